@@ -6,17 +6,147 @@
 // https://flutter.dev/to/pubspec-plugin-platforms.
 
 import 'dns_manager_platform_interface.dart';
+import 'dns_presets.dart';
+import 'local_resolver.dart';
+import 'network_state.dart';
+import 'query_events.dart';
+
+export 'dns_presets.dart';
+export 'local_resolver.dart';
+export 'network_state.dart';
+export 'query_events.dart';
 
 class DnsManager {
   Future<String?> getDNS() async {
     return await DnsManagerPlatform.instance.getDNS();
   }
 
-  Future<String?> setDNS(String dns) async {
-    return await DnsManagerPlatform.instance.setDNS(dns);
+  /// Sets the DNS servers of the active connection.
+  ///
+  /// With [localResolver], the plugin instead runs a local forwarding
+  /// resolver for [dns] and points the connection at it. The resolver can
+  /// also forward over DNS-over-TLS to servers written
+  /// `tls://1.1.1.1#cloudflare-dns.com`, where the part after `#` is the name
+  /// the server's certificate must carry.
+  ///
+  /// If the connection already has these settings nothing is modified and
+  /// the connection is not restarted; the result then starts with
+  /// `DNS unchanged`.
+  ///
+  /// With [global], the servers go into NetworkManager's global DNS
+  /// configuration instead, which applies to every connection, including
+  /// those brought up later, without modifying or restarting any of them.
+  /// [resetDNS] clears it, as does a later call without [global].
+  Future<String?> setDNS(String dns,
+      {LocalResolverOptions? localResolver, bool global = false}) async {
+    return await DnsManagerPlatform.instance
+        .setDNS(dns, localResolver: localResolver, global: global);
   }
 
   Future<String?> resetDNS() async {
     return await DnsManagerPlatform.instance.resetDNS();
   }
+
+  /// NetworkManager's devices, active connections with their DNS settings,
+  /// and connectivity. Kept up to date by the plugin in the background, so
+  /// this does not wait on NetworkManager.
+  Future<NetworkState> getNetworkState() async {
+    return await DnsManagerPlatform.instance.getNetworkState();
+  }
+
+  /// Saves [dns] (comma-separated, as for [setDNS]) as preset [name],
+  /// replacing any preset of that name, so that [applyPreset] can switch to
+  /// it later. The servers are validated and normalised now and kept on disk
+  /// across restarts. With [global], applying the preset sets the global DNS
+  /// configuration, as `setDNS(dns, global: true)` would. An empty [dns]
+  /// removes the preset.
+  Future<String?> definePreset(String name, String dns,
+      {bool global = false}) async {
+    return await DnsManagerPlatform.instance
+        .definePreset(name, dns, global: global);
+  }
+
+  /// Switches to preset [name]. The plugin compares the preset's settings
+  /// with the active connection's as it last saw them and sends only what
+  /// differs, usually in a single call to NetworkManager. Throws if there is
+  /// no such preset or applying it fails.
+  Future<PresetApplyResult> applyPreset(String name) async {
+    return await DnsManagerPlatform.instance.applyPreset(name);
+  }
+
+  /// The presets defined with [definePreset], sorted by name.
+  Future<List<DnsPreset>> listPresets() async {
+    return await DnsManagerPlatform.instance.listPresets();
+  }
+
+  /// The names most often resolved through the local resolver.
+  Future<List<TopDomain>> getTopDomains({int count = 20}) async {
+    return await DnsManagerPlatform.instance.getTopDomains(count: count);
+  }
+
+  /// Cache and refresh-ahead counters of the local resolver.
+  Future<ResolverStats> getResolverStats() async {
+    return await DnsManagerPlatform.instance.getResolverStats();
+  }
+
+  /// Round-trip estimates and timeouts of the upstream servers the local
+  /// resolver has queried, which decide the server each query goes to first.
+  Future<List<UpstreamHealth>> getUpstreamHealth() async {
+    return await DnsManagerPlatform.instance.getUpstreamHealth();
+  }
+
+  /// Queries answered by the local resolver, delivered in batches every
+  /// [interval] or sooner when many queries arrive at once. Recording only
+  /// happens while the stream has a listener.
+  Stream<QueryEventBatch> queryEvents(
+      {Duration interval = const Duration(milliseconds: 100)}) {
+    return DnsManagerPlatform.instance.queryEvents(interval: interval);
+  }
+
+  /// Queries answered between [from] (inclusive) and [to] (exclusive),
+  /// oldest first and at most [limit] of them, from the log kept while the
+  /// local resolver runs with [LocalResolverOptions.queryLog].
+  Future<List<QueryEvent>> queryLog(
+      {required DateTime from, required DateTime to, int limit = 10000}) async {
+    return await DnsManagerPlatform.instance
+        .queryLog(from: from, to: to, limit: limit);
+  }
+
+  /// Compiles hosts files or domain lists at [sources] into the local
+  /// resolver's blocklist. Blocked names are answered according to
+  /// [LocalResolverOptions.blockingMode]. An empty list turns blocking off.
+  Future<String?> loadBlocklist(List<String> sources) async {
+    return await DnsManagerPlatform.instance.loadBlocklist(sources);
+  }
+
+  /// Adds and removes blocklist rules listed in the delta file at [path]
+  /// without recompiling the list: one rule per line in any format
+  /// [loadBlocklist] accepts, prefixed with `+` to add (the default) or `-`
+  /// to remove. Deltas accumulate until the next [loadBlocklist].
+  Future<String?> applyBlocklistDelta(String path) async {
+    return await DnsManagerPlatform.instance.applyBlocklistDelta(path);
+  }
+
+  /// Sends queries for names under each suffix in [routes] to that suffix's
+  /// servers (comma-separated, as for [setDNS]) instead of the default ones,
+  /// e.g. `{'corp.example.com': '10.8.0.1'}`. The longest matching suffix
+  /// wins. Routes are applied by the local resolver (see
+  /// [LocalResolverOptions]) and kept for resolvers started later; an empty
+  /// map removes them.
+  Future<String?> setDnsRoutes(Map<String, String> routes) async {
+    return await DnsManagerPlatform.instance.setDnsRoutes(routes);
+  }
+
+  /// Pins host names to fixed answers served by the local resolver without
+  /// going upstream, e.g. `{'git.corp.example': ['10.1.2.3', 'fd00::5']}`.
+  /// Each value is an IPv4 or IPv6 address, or another name to answer a
+  /// CNAME to. [file] adds the overrides in a hosts-format file (`address
+  /// name...` or `name CNAME target` lines), which is reloaded whenever it
+  /// changes on disk. Overrides take precedence over the blocklist and are
+  /// kept for resolvers started later; no hosts and no file removes them.
+  Future<String?> setHostOverrides(
+      {Map<String, List<String>> hosts = const {}, String? file}) async {
+    return await DnsManagerPlatform.instance
+        .setHostOverrides(hosts: hosts, file: file);
+  }
 }
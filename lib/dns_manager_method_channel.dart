@@ -3,6 +3,10 @@ import 'package:flutter/services.dart';
 import 'dart:async';
 
 import 'dns_manager_platform_interface.dart';
+import 'dns_presets.dart';
+import 'local_resolver.dart';
+import 'network_state.dart';
+import 'query_events.dart';
 
 /// DNS operation status events
 class DnsOperationEvent {
@@ -27,6 +31,10 @@ class MethodChannelDnsManager extends DnsManagerPlatform {
   @visibleForTesting
   final methodChannel = const MethodChannel('dns_manager');
 
+  /// The event channel query batches arrive on.
+  @visibleForTesting
+  final queryEventChannel = const EventChannel('dns_manager/query_events');
+
   /// Stream controller for DNS operation events
   static final StreamController<DnsOperationEvent> _eventController = 
       StreamController<DnsOperationEvent>.broadcast();
@@ -47,14 +55,19 @@ class MethodChannelDnsManager extends DnsManagerPlatform {
   }
 
   @override
-  Future<String?> setDNS(String dns) async {
+  Future<String?> setDNS(String dns,
+      {LocalResolverOptions? localResolver, bool global = false}) async {
     // Return immediately and publish result via stream
     _eventController.add(DnsOperationEvent(
       operation: 'setDNS',
       status: 'started',
     ));
 
-    _executeOperation('setDNS', () => methodChannel.invokeMethod<String>('setDNS', {'dns': dns}));
+    _executeOperation('setDNS', () => methodChannel.invokeMethod<String>('setDNS', {
+          'dns': dns,
+          'global': global,
+          ...?localResolver?.toArguments(),
+        }));
     return null;
   }
 
@@ -70,6 +83,131 @@ class MethodChannelDnsManager extends DnsManagerPlatform {
     return null;
   }
 
+  @override
+  Future<NetworkState> getNetworkState() async {
+    final result = await methodChannel.invokeMethod<Object?>('getNetworkState');
+    return _decodeMap(result, 'getNetworkState', NetworkState.fromMap);
+  }
+
+  @override
+  Future<String?> definePreset(String name, String dns, {bool global = false}) {
+    return methodChannel.invokeMethod<String>(
+        'definePreset', {'name': name, 'dns': dns, 'global': global});
+  }
+
+  @override
+  Future<PresetApplyResult> applyPreset(String name) async {
+    final result = await methodChannel
+        .invokeMethod<Object?>('applyPreset', {'name': name});
+    return _decodeMap(result, 'applyPreset', PresetApplyResult.fromMap);
+  }
+
+  @override
+  Future<List<DnsPreset>> listPresets() async {
+    final result = await methodChannel.invokeMethod<Object?>('listPresets');
+    return _decodeList(result, 'listPresets', DnsPreset.fromMap);
+  }
+
+  @override
+  Future<List<TopDomain>> getTopDomains({int count = 20}) async {
+    final result = await methodChannel.invokeMethod<Object?>(
+        'getTopDomains', {'count': count});
+    return _decodeList(result, 'getTopDomains', TopDomain.fromMap);
+  }
+
+  @override
+  Future<ResolverStats> getResolverStats() async {
+    final result = await methodChannel.invokeMethod<Object?>('getResolverStats');
+    return _decodeMap(result, 'getResolverStats', ResolverStats.fromMap);
+  }
+
+  @override
+  Future<List<UpstreamHealth>> getUpstreamHealth() async {
+    final result = await methodChannel.invokeMethod<Object?>('getUpstreamHealth');
+    return _decodeList(result, 'getUpstreamHealth', UpstreamHealth.fromMap);
+  }
+
+  @override
+  Stream<QueryEventBatch> queryEvents(
+      {Duration interval = const Duration(milliseconds: 100)}) {
+    return queryEventChannel
+        .receiveBroadcastStream({'intervalMs': interval.inMilliseconds})
+        .map((bytes) => QueryEventBatch.decode(bytes as Uint8List));
+  }
+
+  @override
+  Future<List<QueryEvent>> queryLog(
+      {required DateTime from, required DateTime to, int limit = 10000}) async {
+    final result = await methodChannel.invokeMethod<Object?>('queryLog', {
+      'fromUs': from.microsecondsSinceEpoch,
+      'toUs': to.microsecondsSinceEpoch,
+      'limit': limit,
+    });
+    if (result is List) {
+      return [
+        for (final bytes in result.cast<Uint8List>())
+          ...QueryEventBatch.decode(bytes).events,
+      ];
+    }
+    throw PlatformException(
+      code: 'queryLog',
+      message: result?.toString() ?? 'No result',
+    );
+  }
+
+  @override
+  Future<String?> loadBlocklist(List<String> sources) {
+    return methodChannel
+        .invokeMethod<String>('loadBlocklist', {'sources': sources});
+  }
+
+  @override
+  Future<String?> applyBlocklistDelta(String path) {
+    return methodChannel
+        .invokeMethod<String>('applyBlocklistDelta', {'path': path});
+  }
+
+  @override
+  Future<String?> setDnsRoutes(Map<String, String> routes) {
+    return methodChannel
+        .invokeMethod<String>('setDnsRoutes', {'routes': routes});
+  }
+
+  @override
+  Future<String?> setHostOverrides(
+      {Map<String, List<String>> hosts = const {}, String? file}) {
+    return methodChannel.invokeMethod<String>('setHostOverrides', {
+      'hosts': hosts,
+      if (file != null) 'file': file,
+    });
+  }
+
+  /// Decodes a map, or throws if the plugin answered with an error string
+  /// instead.
+  static T _decodeMap<T>(Object? result, String operation,
+      T Function(Map<Object?, Object?>) decode) {
+    if (result is Map) {
+      return decode(result.cast<Object?, Object?>());
+    }
+    throw PlatformException(
+      code: operation,
+      message: result?.toString() ?? 'No result',
+    );
+  }
+
+  /// Decodes a list of maps, or throws if the plugin answered with an error
+  /// string instead.
+  static List<T> _decodeList<T>(Object? result, String operation,
+      T Function(Map<Object?, Object?>) decode) {
+    if (result is List) {
+      return result.cast<Map<Object?, Object?>>().map(decode).toList();
+    }
+    throw PlatformException(
+      code: operation,
+      message: result?.toString() ?? 'No result',
+    );
+  }
+
   /// Execute operation asynchronously and publish results via stream
   static void _executeOperation(String operation, Future<String?> Function() methodCall) async {
     try {
@@ -1,6 +1,10 @@
 import 'package:plugin_platform_interface/plugin_platform_interface.dart';
 
 import 'dns_manager_method_channel.dart';
+import 'dns_presets.dart';
+import 'local_resolver.dart';
+import 'network_state.dart';
+import 'query_events.dart';
 
 abstract class DnsManagerPlatform extends PlatformInterface {
   /// Constructs a DnsManagerPlatform.
@@ -27,11 +31,68 @@ abstract class DnsManagerPlatform extends PlatformInterface {
     throw UnimplementedError('getDNS() has not been implemented.');
   }
 
-  Future<String?> setDNS(String dns) {
+  Future<String?> setDNS(String dns,
+      {LocalResolverOptions? localResolver, bool global = false}) {
     throw UnimplementedError('setDNS() has not been implemented.');
   }
 
   Future<String?> resetDNS() {
     throw UnimplementedError('resetDNS() has not been implemented.');
   }
+
+  Future<NetworkState> getNetworkState() {
+    throw UnimplementedError('getNetworkState() has not been implemented.');
+  }
+
+  Future<String?> definePreset(String name, String dns, {bool global = false}) {
+    throw UnimplementedError('definePreset() has not been implemented.');
+  }
+
+  Future<PresetApplyResult> applyPreset(String name) {
+    throw UnimplementedError('applyPreset() has not been implemented.');
+  }
+
+  Future<List<DnsPreset>> listPresets() {
+    throw UnimplementedError('listPresets() has not been implemented.');
+  }
+
+  Future<List<TopDomain>> getTopDomains({int count = 20}) {
+    throw UnimplementedError('getTopDomains() has not been implemented.');
+  }
+
+  Future<ResolverStats> getResolverStats() {
+    throw UnimplementedError('getResolverStats() has not been implemented.');
+  }
+
+  Future<List<UpstreamHealth>> getUpstreamHealth() {
+    throw UnimplementedError('getUpstreamHealth() has not been implemented.');
+  }
+
+  Stream<QueryEventBatch> queryEvents(
+      {Duration interval = const Duration(milliseconds: 100)}) {
+    throw UnimplementedError('queryEvents() has not been implemented.');
+  }
+
+  Future<List<QueryEvent>> queryLog(
+      {required DateTime from, required DateTime to, int limit = 10000}) {
+    throw UnimplementedError('queryLog() has not been implemented.');
+  }
+
+  Future<String?> loadBlocklist(List<String> sources) {
+    throw UnimplementedError('loadBlocklist() has not been implemented.');
+  }
+
+  Future<String?> applyBlocklistDelta(String path) {
+    throw UnimplementedError(
+        'applyBlocklistDelta() has not been implemented.');
+  }
+
+  Future<String?> setDnsRoutes(Map<String, String> routes) {
+    throw UnimplementedError('setDnsRoutes() has not been implemented.');
+  }
+
+  Future<String?> setHostOverrides(
+      {Map<String, List<String>> hosts = const {}, String? file}) {
+    throw UnimplementedError('setHostOverrides() has not been implemented.');
+  }
 }
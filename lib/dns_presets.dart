@@ -0,0 +1,73 @@
+/// A named set of DNS servers defined with [DnsManager.definePreset].
+class DnsPreset {
+  final String name;
+
+  /// The servers in canonical form, IPv4 before IPv6.
+  final List<String> servers;
+
+  /// Whether applying the preset sets NetworkManager's global DNS
+  /// configuration rather than the active connection's servers.
+  final bool global;
+
+  const DnsPreset({
+    required this.name,
+    required this.servers,
+    required this.global,
+  });
+
+  factory DnsPreset.fromMap(Map<Object?, Object?> map) => DnsPreset(
+        name: map['name'] as String,
+        servers: (map['servers'] as List).cast<String>(),
+        global: map['global'] as bool,
+      );
+}
+
+/// What [DnsManager.applyPreset] did and where the time went.
+class PresetApplyResult {
+  final String preset;
+
+  /// `DNS unchanged - preset already applied`, or what was changed.
+  final String result;
+
+  /// Whether anything had to be changed.
+  final bool changed;
+
+  /// Commands and D-Bus calls made to NetworkManager. One when the plugin
+  /// has the network state, which is the usual case.
+  final int backendCalls;
+
+  /// Finding the preset, the active connection and its current settings.
+  final Duration lookup;
+
+  /// Working out which settings differ.
+  final Duration compare;
+
+  /// Sending the change to NetworkManager. Restarting the connection
+  /// afterwards happens in the background and is not included.
+  final Duration apply;
+
+  final Duration total;
+
+  const PresetApplyResult({
+    required this.preset,
+    required this.result,
+    required this.changed,
+    required this.backendCalls,
+    required this.lookup,
+    required this.compare,
+    required this.apply,
+    required this.total,
+  });
+
+  factory PresetApplyResult.fromMap(Map<Object?, Object?> map) =>
+      PresetApplyResult(
+        preset: map['preset'] as String,
+        result: map['result'] as String,
+        changed: map['changed'] as bool,
+        backendCalls: map['backendCalls'] as int,
+        lookup: Duration(microseconds: map['lookupUs'] as int),
+        compare: Duration(microseconds: map['compareUs'] as int),
+        apply: Duration(microseconds: map['applyUs'] as int),
+        total: Duration(microseconds: map['totalUs'] as int),
+      );
+}
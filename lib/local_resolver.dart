@@ -0,0 +1,312 @@
+/// How the local resolver answers queries for blocked names.
+enum BlockingMode {
+  /// The name does not exist.
+  nxdomain,
+
+  /// 0.0.0.0 or :: for address queries, an empty answer otherwise.
+  nullAddress,
+}
+
+/// How the local resolver answers a UDP query from a client over its rate
+/// limit. Over TCP such queries are always refused.
+enum RateLimitAction {
+  /// REFUSED.
+  refused,
+
+  /// An empty answer marked truncated, so that the client has to retry
+  /// over TCP.
+  truncated,
+}
+
+/// Options for running the plugin-hosted local resolver.
+///
+/// When passed to [DnsManager.setDNS], the plugin starts a forwarding
+/// resolver for the given servers and points the active connection at
+/// [listenAddress] instead of at the servers themselves.
+class LocalResolverOptions {
+  /// Address the resolver listens on.
+  final String listenAddress;
+
+  /// Port the resolver listens on. NetworkManager always queries port 53,
+  /// so [DnsManager.setDNS] rejects any other.
+  final int listenPort;
+
+  /// Maximum number of cached responses.
+  final int cacheSize;
+
+  /// Hard cap on the memory the answer cache takes, in bytes. Fewer than
+  /// [cacheSize] answers are kept if they do not fit.
+  final int cacheMaxBytes;
+
+  /// Entries served at least [prefetchMinHits] times are refreshed in the
+  /// background once no more than this fraction of their TTL remains.
+  /// 0 disables refresh-ahead.
+  final double prefetchFraction;
+
+  /// See [prefetchFraction].
+  final int prefetchMinHits;
+
+  /// How long after expiry a cached answer may still be served when every
+  /// upstream fails or is too slow (RFC 8767). 0 disables serve-stale.
+  final int maxStaleSeconds;
+
+  /// How long a client waits for upstream before a stale answer is sent.
+  final int clientResponseTimeoutMs;
+
+  /// Whether the cache is saved to disk and reused after the app restarts,
+  /// so that previously resolved names are answered without going upstream.
+  final bool persistCache;
+
+  /// Answer for names on the list installed with [DnsManager.loadBlocklist].
+  final BlockingMode blockingMode;
+
+  /// Resolver threads, each with its own socket on [listenPort] and its own
+  /// cache in front of a shared one, so lookups scale across CPU cores.
+  /// 0 starts one per core.
+  final int threads;
+
+  /// Whether each resolver thread is pinned to its own core.
+  final bool pinThreads;
+
+  /// Whether queries are also accepted over TCP on [listenPort], which
+  /// clients use to retry answers too large for UDP.
+  final bool tcp;
+
+  /// PEM file of the CA certificates DNS-over-TLS servers are checked
+  /// against, instead of the system's trust store.
+  final String? tlsCaFile;
+
+  /// Whether answered queries are kept on disk, to be read back with
+  /// [DnsManager.queryLog].
+  final bool queryLog;
+
+  /// Disk space the query log may take, in bytes. The oldest hours are
+  /// deleted to stay under it.
+  final int queryLogMaxBytes;
+
+  /// Queries a second each client address may send on average, across UDP
+  /// and TCP, before its queries are answered with [rateLimitAction]. All
+  /// processes on the machine itself share the loopback address. 0 turns
+  /// rate limiting off.
+  final double rateLimitQps;
+
+  /// Queries a client may send at once after being quiet.
+  final int rateLimitBurst;
+
+  /// Answer for a UDP query over the rate limit.
+  final RateLimitAction rateLimitAction;
+
+  const LocalResolverOptions({
+    this.listenAddress = '127.0.0.1',
+    this.listenPort = 53,
+    this.cacheSize = 10000,
+    this.cacheMaxBytes = 16 << 20,
+    this.prefetchFraction = 0.1,
+    this.prefetchMinHits = 3,
+    this.maxStaleSeconds = 86400,
+    this.clientResponseTimeoutMs = 1800,
+    this.persistCache = true,
+    this.blockingMode = BlockingMode.nxdomain,
+    this.threads = 1,
+    this.pinThreads = false,
+    this.tcp = true,
+    this.tlsCaFile,
+    this.queryLog = false,
+    this.queryLogMaxBytes = 64 << 20,
+    this.rateLimitQps = 0,
+    this.rateLimitBurst = 200,
+    this.rateLimitAction = RateLimitAction.refused,
+  });
+
+  /// The setDNS method channel arguments for these options.
+  Map<String, Object?> toArguments() => {
+        'localResolver': true,
+        'listenAddress': listenAddress,
+        'listenPort': listenPort,
+        'cacheSize': cacheSize,
+        'cacheMaxBytes': cacheMaxBytes,
+        'prefetchFraction': prefetchFraction,
+        'prefetchMinHits': prefetchMinHits,
+        'maxStaleSeconds': maxStaleSeconds,
+        'clientResponseTimeoutMs': clientResponseTimeoutMs,
+        'persistCache': persistCache,
+        'blockingMode': blockingMode.name,
+        'threads': threads,
+        'pinThreads': pinThreads,
+        'tcp': tcp,
+        if (tlsCaFile != null) 'tlsCaFile': tlsCaFile,
+        'queryLog': queryLog,
+        'queryLogMaxBytes': queryLogMaxBytes,
+        'rateLimitQps': rateLimitQps,
+        'rateLimitBurst': rateLimitBurst,
+        'rateLimitAction': rateLimitAction.name,
+      };
+}
+
+/// One entry of the local resolver's most-queried domains.
+class TopDomain {
+  /// Lower-cased query name.
+  final String name;
+
+  /// Exponentially decayed query count. The true count lies between
+  /// `count - error` and `count`.
+  final double count;
+
+  /// Upper bound on how much [count] over-estimates.
+  final double error;
+
+  const TopDomain({
+    required this.name,
+    required this.count,
+    required this.error,
+  });
+
+  factory TopDomain.fromMap(Map<Object?, Object?> map) => TopDomain(
+        name: map['name'] as String,
+        count: (map['count'] as num).toDouble(),
+        error: (map['error'] as num).toDouble(),
+      );
+}
+
+/// Counters of the local resolver since it was started.
+class ResolverStats {
+  final int queries;
+  final int cacheHits;
+  final int cacheMisses;
+
+  /// Background refreshes sent upstream.
+  final int prefetchesIssued;
+
+  /// Refreshed entries that were served at least once afterwards.
+  final int prefetchHits;
+
+  /// Refreshed entries dropped or refreshed again without being served.
+  final int prefetchesWasted;
+
+  /// Cache hits that were NXDOMAIN or NODATA answers.
+  final int negativeCacheHits;
+
+  /// Expired answers served because upstreams failed or were too slow.
+  final int staleAnswersServed;
+
+  /// Cache misses answered from the cache saved by a previous run.
+  final int warmCacheHits;
+
+  /// Misses in one resolver thread's cache answered with what another
+  /// thread received; always 0 with a single thread.
+  final int sharedCacheHits;
+
+  /// Queries answered locally because the name is on the blocklist.
+  final int blockedQueries;
+
+  /// Queries answered from the host overrides.
+  final int hostOverrideQueries;
+
+  /// Client queries that arrived over TCP.
+  final int tcpQueries;
+
+  /// Queries sent upstream over TCP, because they were asked over TCP, the
+  /// UDP answer was truncated or the server is a DNS-over-TLS one.
+  final int upstreamTcpQueries;
+
+  /// Upstream TCP connections opened; queries are pipelined on each one.
+  final int upstreamTcpConnections;
+
+  /// TLS handshakes with DNS-over-TLS servers.
+  final int tlsHandshakes;
+
+  /// Handshakes that resumed an earlier session instead of a full one.
+  final int tlsResumedHandshakes;
+
+  /// Queries turned away because their client was over its rate limit.
+  final int rateLimitedQueries;
+
+  const ResolverStats({
+    required this.queries,
+    required this.cacheHits,
+    required this.cacheMisses,
+    required this.prefetchesIssued,
+    required this.prefetchHits,
+    required this.prefetchesWasted,
+    required this.negativeCacheHits,
+    required this.staleAnswersServed,
+    required this.warmCacheHits,
+    required this.sharedCacheHits,
+    required this.blockedQueries,
+    required this.hostOverrideQueries,
+    required this.tcpQueries,
+    required this.upstreamTcpQueries,
+    required this.upstreamTcpConnections,
+    required this.tlsHandshakes,
+    required this.tlsResumedHandshakes,
+    required this.rateLimitedQueries,
+  });
+
+  factory ResolverStats.fromMap(Map<Object?, Object?> map) => ResolverStats(
+        queries: map['queries'] as int,
+        cacheHits: map['cacheHits'] as int,
+        cacheMisses: map['cacheMisses'] as int,
+        prefetchesIssued: map['prefetchesIssued'] as int,
+        prefetchHits: map['prefetchHits'] as int,
+        prefetchesWasted: map['prefetchesWasted'] as int,
+        negativeCacheHits: map['negativeCacheHits'] as int,
+        staleAnswersServed: map['staleAnswersServed'] as int,
+        warmCacheHits: map['warmCacheHits'] as int,
+        sharedCacheHits: map['sharedCacheHits'] as int,
+        blockedQueries: map['blockedQueries'] as int,
+        hostOverrideQueries: map['hostOverrideQueries'] as int,
+        tcpQueries: map['tcpQueries'] as int,
+        upstreamTcpQueries: map['upstreamTcpQueries'] as int,
+        upstreamTcpConnections: map['upstreamTcpConnections'] as int,
+        tlsHandshakes: map['tlsHandshakes'] as int,
+        tlsResumedHandshakes: map['tlsResumedHandshakes'] as int,
+        rateLimitedQueries: map['rateLimitedQueries'] as int,
+      );
+}
+
+/// What the local resolver has measured of one upstream server.
+class UpstreamHealth {
+  /// Address and port, e.g. `1.1.1.1:53` or `[2606:4700::1111]:853`.
+  final String address;
+
+  /// Smoothed round-trip time and its mean deviation; 0 before the first
+  /// answer.
+  final double srttMs;
+  final double rttVarMs;
+
+  /// How long the next query waits for the server before trying another:
+  /// `srttMs + 4 * rttVarMs`, doubled for every timeout since.
+  final double timeoutMs;
+
+  final int answers;
+  final int timeouts;
+
+  /// Timeouts since the server last answered.
+  final int consecutiveTimeouts;
+
+  /// False while the server is held down after timing out. It is retried
+  /// with a single query once the hold-down ends.
+  final bool available;
+
+  const UpstreamHealth({
+    required this.address,
+    required this.srttMs,
+    required this.rttVarMs,
+    required this.timeoutMs,
+    required this.answers,
+    required this.timeouts,
+    required this.consecutiveTimeouts,
+    required this.available,
+  });
+
+  factory UpstreamHealth.fromMap(Map<Object?, Object?> map) => UpstreamHealth(
+        address: map['address'] as String,
+        srttMs: (map['srttMs'] as num).toDouble(),
+        rttVarMs: (map['rttVarMs'] as num).toDouble(),
+        timeoutMs: (map['timeoutMs'] as num).toDouble(),
+        answers: map['answers'] as int,
+        timeouts: map['timeouts'] as int,
+        consecutiveTimeouts: map['consecutiveTimeouts'] as int,
+        available: map['available'] as bool,
+      );
+}
@@ -0,0 +1,135 @@
+/// NetworkManager's view of the machine, as kept by the plugin.
+class NetworkState {
+  /// Overall state as nmcli prints it, e.g. `connected` or `disconnected`.
+  final String state;
+
+  /// `full`, `limited`, `portal`, `none` or `unknown`.
+  final String connectivity;
+
+  /// Servers of NetworkManager's global DNS configuration, which take
+  /// precedence over every connection's; empty if it has none.
+  final List<String> globalDns;
+
+  final List<NetworkDevice> devices;
+  final List<NetworkConnection> connections;
+
+  /// Increases each time the plugin rebuilds the state after a change.
+  final int generation;
+
+  /// Whether this app's plugin keeps the state up to date for every app on
+  /// the machine embedding the plugin, rather than reading it from the one
+  /// that does.
+  final bool ownsSharedState;
+
+  /// How many `nmcli` commands this app's plugin has run.
+  final int commandsRun;
+
+  const NetworkState({
+    required this.state,
+    required this.connectivity,
+    required this.globalDns,
+    required this.devices,
+    required this.connections,
+    required this.generation,
+    required this.ownsSharedState,
+    required this.commandsRun,
+  });
+
+  factory NetworkState.fromMap(Map<Object?, Object?> map) => NetworkState(
+        state: map['state'] as String,
+        connectivity: map['connectivity'] as String,
+        globalDns: (map['globalDns'] as List).cast<String>(),
+        devices: (map['devices'] as List)
+            .cast<Map<Object?, Object?>>()
+            .map(NetworkDevice.fromMap)
+            .toList(),
+        connections: (map['connections'] as List)
+            .cast<Map<Object?, Object?>>()
+            .map(NetworkConnection.fromMap)
+            .toList(),
+        generation: map['generation'] as int,
+        ownsSharedState: map['ownsSharedState'] as bool,
+        commandsRun: map['commandsRun'] as int,
+      );
+}
+
+/// A network interface NetworkManager knows about.
+class NetworkDevice {
+  final String interface;
+
+  /// e.g. `ethernet`, `wifi` or `wireguard`.
+  final String type;
+
+  /// e.g. `connected`, `disconnected` or `unavailable`.
+  final String state;
+
+  /// UUID of the connection active on the device, empty if none.
+  final String connection;
+
+  const NetworkDevice({
+    required this.interface,
+    required this.type,
+    required this.state,
+    required this.connection,
+  });
+
+  factory NetworkDevice.fromMap(Map<Object?, Object?> map) => NetworkDevice(
+        interface: map['interface'] as String,
+        type: map['type'] as String,
+        state: map['state'] as String,
+        connection: map['connection'] as String,
+      );
+}
+
+/// An active connection and the DNS settings of its profile.
+class NetworkConnection {
+  final String id;
+  final String uuid;
+
+  /// Setting type, e.g. `802-3-ethernet` or `802-11-wireless`.
+  final String type;
+
+  /// `activating`, `activated`, `deactivating` or `deactivated`.
+  final String state;
+
+  /// Whether the connection holds the default route.
+  final bool isDefault;
+
+  /// Interfaces the connection is active on.
+  final List<String> devices;
+
+  /// Static DNS servers of the profile. Empty when DNS is automatic.
+  final List<String> ipv4Dns;
+  final List<String> ipv6Dns;
+
+  /// Whether servers handed out by DHCP or router advertisements are ignored.
+  final bool ipv4IgnoreAutoDns;
+  final bool ipv6IgnoreAutoDns;
+
+  const NetworkConnection({
+    required this.id,
+    required this.uuid,
+    required this.type,
+    required this.state,
+    required this.isDefault,
+    required this.devices,
+    required this.ipv4Dns,
+    required this.ipv6Dns,
+    required this.ipv4IgnoreAutoDns,
+    required this.ipv6IgnoreAutoDns,
+  });
+
+  factory NetworkConnection.fromMap(Map<Object?, Object?> map) =>
+      NetworkConnection(
+        id: map['id'] as String,
+        uuid: map['uuid'] as String,
+        type: map['type'] as String,
+        state: map['state'] as String,
+        isDefault: map['default'] as bool,
+        devices: (map['devices'] as List).cast<String>(),
+        ipv4Dns: (map['ipv4Dns'] as List).cast<String>(),
+        ipv6Dns: (map['ipv6Dns'] as List).cast<String>(),
+        ipv4IgnoreAutoDns: map['ipv4IgnoreAutoDns'] as bool,
+        ipv6IgnoreAutoDns: map['ipv6IgnoreAutoDns'] as bool,
+      );
+}
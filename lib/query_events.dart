@@ -0,0 +1,100 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// Where the local resolver got the answer to a query.
+enum QuerySource {
+  cache,
+
+  /// The cache saved by a previous run of the app.
+  warmCache,
+  upstream,
+
+  /// An expired cache entry, served because upstreams failed or were slow.
+  stale,
+  blocked,
+
+  /// SERVFAIL after every upstream failed.
+  failed,
+
+  /// Answered from the host overrides set with `setHostOverrides`.
+  hostOverride,
+}
+
+/// One query answered by the local resolver.
+class QueryEvent {
+  /// When the answer was sent.
+  final DateTime time;
+
+  /// Lower-cased query name without the trailing dot.
+  final String name;
+
+  /// Query type, e.g. 1 for A or 28 for AAAA.
+  final int type;
+
+  /// Response code, e.g. 0 for NOERROR or 3 for NXDOMAIN.
+  final int rcode;
+
+  /// From receiving the query to sending the answer.
+  final Duration latency;
+  final QuerySource source;
+
+  const QueryEvent({
+    required this.time,
+    required this.name,
+    required this.type,
+    required this.rcode,
+    required this.latency,
+    required this.source,
+  });
+}
+
+/// Queries answered since the previous batch.
+class QueryEventBatch {
+  final List<QueryEvent> events;
+
+  /// Events the plugin had to drop because they arrived faster than the
+  /// batches were sent.
+  final int dropped;
+
+  const QueryEventBatch({required this.events, required this.dropped});
+
+  /// Decodes a batch packed by the plugin. All integers are little-endian.
+  ///
+  /// Header, 20 bytes: u8 version (1), three reserved bytes, u32 event
+  /// count, u32 dropped events, i64 time of the first event in microseconds
+  /// since the epoch. Then per event: u32 microseconds after the first
+  /// event, u32 latency in microseconds, u16 query type, u8 response code,
+  /// u8 [QuerySource] index, u8 name length, and the name.
+  factory QueryEventBatch.decode(Uint8List bytes) {
+    final data = ByteData.sublistView(bytes);
+    final version = data.getUint8(0);
+    if (version != 1) {
+      throw FormatException('Unsupported query event batch version $version');
+    }
+    final count = data.getUint32(4, Endian.little);
+    final dropped = data.getUint32(8, Endian.little);
+    final base = data.getInt64(12, Endian.little);
+    final events = <QueryEvent>[];
+    var offset = 20;
+    for (var i = 0; i < count; i++) {
+      final nameLength = data.getUint8(offset + 12);
+      final source = data.getUint8(offset + 11);
+      events.add(QueryEvent(
+        time: DateTime.fromMicrosecondsSinceEpoch(
+            base + data.getUint32(offset, Endian.little)),
+        latency:
+            Duration(microseconds: data.getUint32(offset + 4, Endian.little)),
+        type: data.getUint16(offset + 8, Endian.little),
+        rcode: data.getUint8(offset + 10),
+        source: source < QuerySource.values.length
+            ? QuerySource.values[source]
+            : QuerySource.upstream,
+        name: ascii.decode(
+            Uint8List.sublistView(bytes, offset + 13, offset + 13 + nameLength),
+            allowInvalid: true),
+      ));
+      offset += 13 + nameLength;
+    }
+    return QueryEventBatch(events: events, dropped: dropped);
+  }
+}
@@ -0,0 +1,339 @@
+#include "answer_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "hash.h"
+
+namespace dns_manager {
+
+uint32_t AnswerCache::Entry::AgeSeconds(Clock::time_point now) const {
+  if (now <= stored_at) {
+    return 0;
+  }
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(now - stored_at)
+          .count());
+}
+
+AnswerCache::AnswerCache(size_t max_entries, size_t max_bytes,
+                         uint32_t max_ttl, uint32_t negative_max_ttl)
+    : max_ttl_(max_ttl), negative_max_ttl_(negative_max_ttl) {
+  // The index has between two and four slots per entry.
+  size_t entry_bytes = sizeof(Entry) + 4 * sizeof(IndexSlot);
+  max_entries_ = std::max<size_t>(
+      std::min<size_t>({max_entries, max_bytes / 2 / entry_bytes, kNoEntry}),
+      1);
+  size_t index_size = 2;
+  while (index_size < max_entries_ * 2) {
+    index_size *= 2;
+  }
+  index_.assign(index_size, IndexSlot{0, kNoEntry});
+  index_mask_ = index_size - 1;
+  entries_.reserve(max_entries_);
+
+  size_t table_bytes =
+      index_size * sizeof(IndexSlot) + max_entries_ * sizeof(Entry);
+  size_t block_bytes = kBlockSize + sizeof(uint32_t);
+  block_count_ = max_bytes > table_bytes
+                     ? std::min<size_t>((max_bytes - table_bytes) / block_bytes,
+                                        kNoEntry)
+                     : 0;
+  blocks_.reset(new uint8_t[block_count_ * kBlockSize]);
+  next_block_.reset(new uint32_t[block_count_]);
+  free_block_count_ = block_count_;
+  memory_bytes_ = table_bytes + block_count_ * block_bytes;
+}
+
+std::string AnswerCache::KeyFor(const DnsQuestion& question) {
+  std::string key;
+  key.reserve(question.name.size() + 4);
+  key.push_back(static_cast<char>(question.qtype >> 8));
+  key.push_back(static_cast<char>(question.qtype));
+  key.push_back(static_cast<char>(question.qclass >> 8));
+  key.push_back(static_cast<char>(question.qclass));
+  key.append(question.name);
+  return key;
+}
+
+bool AnswerCache::QuestionFor(const std::string& key, DnsQuestion* question) {
+  if (key.size() < 4) {
+    return false;
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(key.data());
+  question->qtype = ReadU16(bytes);
+  question->qclass = ReadU16(bytes + 2);
+  question->name.assign(key, 4, std::string::npos);
+  return true;
+}
+
+AnswerCache::Entry* AnswerCache::Find(const std::string& key) {
+  const IndexSlot& slot =
+      index_[Probe(key, HashBytes(key.data(), key.size()))];
+  if (slot.entry == kNoEntry) {
+    return nullptr;
+  }
+  Entry& entry = entries_[slot.entry];
+  entry.referenced_ = true;
+  return &entry;
+}
+
+const AnswerCache::Entry* AnswerCache::Peek(const std::string& key) const {
+  const IndexSlot& slot =
+      index_[Probe(key, HashBytes(key.data(), key.size()))];
+  return slot.entry == kNoEntry ? nullptr : &entries_[slot.entry];
+}
+
+AnswerCache::Entry* AnswerCache::Insert(const std::string& key,
+                                        const uint8_t* response,
+                                        size_t length, Clock::time_point now,
+                                        bool prefetched) {
+  if (length < kDnsHeaderSize || IsTruncated(response)) {
+    return nullptr;
+  }
+  uint8_t rcode = GetRcode(response);
+  bool negative =
+      rcode == kRcodeNxDomain ||
+      (rcode == kRcodeNoError && ReadU16(response + 6) == 0);
+  uint32_t ttl = 0;
+  if (negative) {
+    // Without an SOA there is no negative TTL, so the answer is not cached.
+    if (!FindNegativeTtl(response, length, &ttl)) {
+      return nullptr;
+    }
+    ttl = std::min(ttl, negative_max_ttl_);
+  } else if (rcode != kRcodeNoError ||
+             !FindMinimumTtl(response, length, &ttl)) {
+    return nullptr;
+  }
+  if (ttl == 0) {
+    return nullptr;
+  }
+  // One answer should not flush most of the cache.
+  size_t blocks = (key.size() + length + kBlockSize - 1) / kBlockSize;
+  if (key.size() > UINT16_MAX || blocks > block_count_ / 4) {
+    return nullptr;
+  }
+
+  uint64_t hash = HashBytes(key.data(), key.size());
+  uint32_t existing = index_[Probe(key, hash)].entry;
+  if (existing != kNoEntry) {
+    Drop(existing);
+  }
+  while (size_ >= max_entries_ || free_block_count_ < blocks) {
+    Evict();
+  }
+
+  uint32_t index;
+  if (free_entry_ != kNoEntry) {
+    index = free_entry_;
+    free_entry_ = entries_[index].first_block_;
+  } else {
+    index = static_cast<uint32_t>(entries_.size());
+    entries_.emplace_back();
+  }
+  Entry& entry = entries_[index];
+  entry = Entry();
+  entry.stored_at = now;
+  entry.ttl = std::min(ttl, max_ttl_);
+  entry.prefetched = prefetched;
+  entry.negative = negative;
+  entry.hash_ = hash;
+  entry.first_block_ = AllocateBlocks(blocks);
+  entry.response_length_ = static_cast<uint32_t>(length);
+  entry.key_length_ = static_cast<uint16_t>(key.size());
+  WriteBlocks(entry.first_block_, 0,
+              reinterpret_cast<const uint8_t*>(key.data()), key.size());
+  WriteBlocks(entry.first_block_, key.size(), response, length);
+  // Evictions may have moved the slot the probe ended at.
+  index_[Probe(key, hash)] = {static_cast<uint32_t>(hash >> 32), index};
+  size_++;
+  return &entry;
+}
+
+void AnswerCache::Erase(const std::string& key) {
+  uint32_t index =
+      index_[Probe(key, HashBytes(key.data(), key.size()))].entry;
+  if (index != kNoEntry) {
+    Drop(index);
+  }
+}
+
+size_t AnswerCache::CopyResponse(const Entry& entry, uint8_t* out,
+                                 size_t out_capacity) const {
+  size_t length = entry.response_length_;
+  if (length > out_capacity) {
+    return 0;
+  }
+  ReadBlocks(entry.first_block_, entry.key_length_, out, length);
+  return length;
+}
+
+size_t AnswerCache::Probe(const std::string& key, uint64_t hash) const {
+  uint32_t tag = static_cast<uint32_t>(hash >> 32);
+  size_t slot = hash & index_mask_;
+  while (true) {
+    const IndexSlot& candidate = index_[slot];
+    if (candidate.entry == kNoEntry ||
+        (candidate.tag == tag && entries_[candidate.entry].hash_ == hash &&
+         KeyMatches(entries_[candidate.entry], key))) {
+      return slot;
+    }
+    slot = (slot + 1) & index_mask_;
+  }
+}
+
+bool AnswerCache::KeyMatches(const Entry& entry,
+                             const std::string& key) const {
+  if (entry.key_length_ != key.size()) {
+    return false;
+  }
+  uint32_t block = entry.first_block_;
+  for (size_t offset = 0; offset < key.size(); offset += kBlockSize) {
+    size_t length = std::min(kBlockSize, key.size() - offset);
+    if (memcmp(&blocks_[block * kBlockSize], key.data() + offset, length) !=
+        0) {
+      return false;
+    }
+    block = next_block_[block];
+  }
+  return true;
+}
+
+void AnswerCache::ReadRecord(const Entry& entry, std::string* key,
+                             std::vector<uint8_t>* response) const {
+  key->resize(entry.key_length_);
+  ReadBlocks(entry.first_block_, 0, reinterpret_cast<uint8_t*>(&(*key)[0]),
+             key->size());
+  response->resize(entry.response_length_);
+  ReadBlocks(entry.first_block_, entry.key_length_, response->data(),
+             response->size());
+}
+
+uint32_t AnswerCache::AllocateBlocks(size_t count) {
+  uint32_t first = kNoEntry;
+  uint32_t* link = &first;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t block;
+    if (free_list_ != kNoEntry) {
+      block = free_list_;
+      free_list_ = next_block_[block];
+    } else {
+      block = static_cast<uint32_t>(unused_block_++);
+    }
+    *link = block;
+    link = &next_block_[block];
+  }
+  *link = kNoEntry;
+  free_block_count_ -= count;
+  return first;
+}
+
+void AnswerCache::FreeBlocks(uint32_t first) {
+  uint32_t last = first;
+  size_t count = 1;
+  while (next_block_[last] != kNoEntry) {
+    last = next_block_[last];
+    count++;
+  }
+  next_block_[last] = free_list_;
+  free_list_ = first;
+  free_block_count_ += count;
+}
+
+void AnswerCache::ReadBlocks(uint32_t block, size_t skip, uint8_t* out,
+                             size_t length) const {
+  for (; skip >= kBlockSize; skip -= kBlockSize) {
+    block = next_block_[block];
+  }
+  while (length > 0) {
+    size_t chunk = std::min(kBlockSize - skip, length);
+    memcpy(out, &blocks_[block * kBlockSize + skip], chunk);
+    out += chunk;
+    length -= chunk;
+    skip = 0;
+    block = next_block_[block];
+  }
+}
+
+void AnswerCache::WriteBlocks(uint32_t block, size_t skip,
+                              const uint8_t* data, size_t length) {
+  for (; skip >= kBlockSize; skip -= kBlockSize) {
+    block = next_block_[block];
+  }
+  while (length > 0) {
+    size_t chunk = std::min(kBlockSize - skip, length);
+    memcpy(&blocks_[block * kBlockSize + skip], data, chunk);
+    data += chunk;
+    length -= chunk;
+    skip = 0;
+    block = next_block_[block];
+  }
+}
+
+void AnswerCache::Evict() {
+  // Entries looked up since the hand last passed get another round. Only
+  // called with at least one entry stored, so this ends within two sweeps.
+  while (true) {
+    uint32_t index = static_cast<uint32_t>(clock_hand_);
+    clock_hand_ = (clock_hand_ + 1) % entries_.size();
+    Entry& entry = entries_[index];
+    if (entry.response_length_ == 0) {
+      continue;
+    }
+    if (entry.referenced_) {
+      entry.referenced_ = false;
+      continue;
+    }
+    Drop(index);
+    return;
+  }
+}
+
+void AnswerCache::Drop(uint32_t index) {
+  Entry& entry = entries_[index];
+  if (entry.prefetched && drop_callback_) {
+    drop_callback_(drop_context_);
+  }
+  size_t slot = entry.hash_ & index_mask_;
+  while (index_[slot].entry != index) {
+    slot = (slot + 1) & index_mask_;
+  }
+  // Backward-shift deletion: pull later slots of the probe sequence into the
+  // gap unless that would put them before their home slot, so lookups never
+  // need tombstones.
+  for (size_t next = (slot + 1) & index_mask_; index_[next].entry != kNoEntry;
+       next = (next + 1) & index_mask_) {
+    size_t home = entries_[index_[next].entry].hash_ & index_mask_;
+    if (((next - home) & index_mask_) >= ((next - slot) & index_mask_)) {
+      index_[slot] = index_[next];
+      slot = next;
+    }
+  }
+  index_[slot].entry = kNoEntry;
+
+  FreeBlocks(entry.first_block_);
+  entry.response_length_ = 0;
+  entry.first_block_ = free_entry_;
+  free_entry_ = index;
+  size_--;
+}
+
+size_t BuildCachedAnswer(const AnswerCache& cache,
+                         const AnswerCache::Entry& entry, uint16_t client_id,
+                         AnswerCache::Clock::time_point now, uint8_t* out,
+                         size_t out_capacity, uint32_t stale_ttl) {
+  size_t length = cache.CopyResponse(entry, out, out_capacity);
+  if (length == 0) {
+    return 0;
+  }
+  SetMessageId(out, client_id);
+  if (stale_ttl > 0) {
+    SetTtls(out, length, stale_ttl);
+  } else {
+    AgeTtls(out, length, entry.AgeSeconds(now));
+  }
+  return length;
+}
+
+}  // namespace dns_manager
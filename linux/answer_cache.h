@@ -0,0 +1,212 @@
+#ifndef DNS_MANAGER_ANSWER_CACHE_H_
+#define DNS_MANAGER_ANSWER_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dns_message.h"
+
+namespace dns_manager {
+
+// Cache of upstream responses keyed by (name, type, class), in a fixed
+// amount of memory. Owned by the resolver thread.
+//
+// Everything is allocated up front from |max_bytes|: a table of entries, an
+// open-addressing index over them keyed by the hash of the key, and a pool
+// of fixed-size blocks holding each key and its wire-format response. No
+// memory is allocated per entry, so the cache never grows past the budget
+// and a lookup touches one index slot, one entry and usually one block.
+// When either entries or blocks run out, CLOCK eviction sweeps the entries,
+// sparing those looked up since the last sweep.
+//
+// Positive answers live for their smallest record TTL. NXDOMAIN and NODATA
+// answers are cached for the SOA-derived negative TTL (RFC 2308). Expired
+// entries are kept until evicted or erased so that the resolver can serve
+// them stale (RFC 8767).
+class AnswerCache {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Bytes of key and response per storage block.
+  static constexpr size_t kBlockSize = 64;
+
+  class Entry {
+   public:
+    Clock::time_point stored_at;
+    // Smallest record TTL at the time the response was stored.
+    uint32_t ttl = 0;
+    // Lookups served since the entry was stored.
+    uint32_t hits = 0;
+    // A refresh-ahead query for this entry is in flight.
+    bool prefetching = false;
+    // The entry was stored by a refresh-ahead query and has not been served
+    // since.
+    bool prefetched = false;
+    // NXDOMAIN or NODATA.
+    bool negative = false;
+
+    // Length of the response in wire format; see AnswerCache::CopyResponse().
+    size_t response_length() const { return response_length_; }
+
+    uint32_t AgeSeconds(Clock::time_point now) const;
+    bool Expired(Clock::time_point now) const {
+      return AgeSeconds(now) >= ttl;
+    }
+    // Seconds since the entry expired, 0 while it is fresh.
+    uint32_t StaleSeconds(Clock::time_point now) const {
+      uint32_t age = AgeSeconds(now);
+      return age > ttl ? age - ttl : 0;
+    }
+
+   private:
+    friend class AnswerCache;
+
+    uint64_t hash_ = 0;
+    // First block of the key followed by the response, or the next free
+    // entry. 0 length means the entry is free.
+    uint32_t first_block_ = 0;
+    uint32_t response_length_ = 0;
+    uint16_t key_length_ = 0;
+    // Looked up since the clock hand last passed.
+    bool referenced_ = false;
+  };
+
+  // Called with each entry that is dropped while still marked prefetched,
+  // i.e. a refresh that nobody used.
+  using DropCallback = void (*)(void* context);
+
+  // Holds up to |max_entries| answers in at most |max_bytes|. The entry
+  // table and index take at most half of |max_bytes|, fewer entries being
+  // kept if needed; the rest holds keys and responses.
+  AnswerCache(size_t max_entries, size_t max_bytes, uint32_t max_ttl,
+              uint32_t negative_max_ttl);
+
+  AnswerCache(const AnswerCache&) = delete;
+  AnswerCache& operator=(const AnswerCache&) = delete;
+
+  static std::string KeyFor(const DnsQuestion& question);
+  // The question a key was made from.
+  static bool QuestionFor(const std::string& key, DnsQuestion* question);
+
+  // Returns the entry for |key|, or nullptr, and marks it as used. Expired
+  // entries are returned too; callers decide what to do with them. Entry
+  // pointers stay valid until the next Insert() or Erase().
+  Entry* Find(const std::string& key);
+  // Like Find() but without marking the entry as used.
+  const Entry* Peek(const std::string& key) const;
+  bool Contains(const std::string& key) const { return Peek(key) != nullptr; }
+
+  // Stores |response| if it is cacheable: an untruncated NOERROR answer with
+  // at least one record, or an NXDOMAIN/NODATA answer carrying an SOA record.
+  // Answers larger than a quarter of the block pool are not stored. Returns
+  // the stored entry or nullptr.
+  Entry* Insert(const std::string& key, const uint8_t* response,
+                size_t length, Clock::time_point now, bool prefetched);
+
+  void Erase(const std::string& key);
+
+  // Copies the response of |entry| into |out| and returns its length, or 0
+  // if |out_capacity| is too small.
+  size_t CopyResponse(const Entry& entry, uint8_t* out,
+                      size_t out_capacity) const;
+
+  void set_drop_callback(DropCallback callback, void* context) {
+    drop_callback_ = callback;
+    drop_context_ = context;
+  }
+
+  size_t size() const { return size_; }
+  size_t max_entries() const { return max_entries_; }
+  // Bytes the cache may use, never more than |max_bytes|.
+  size_t memory_bytes() const { return memory_bytes_; }
+
+  // Calls |visit(key, entry, response, length)| for every entry, expired
+  // ones included.
+  template <typename Visitor>
+  void ForEach(Visitor visit) const {
+    std::string key;
+    std::vector<uint8_t> response;
+    for (const Entry& entry : entries_) {
+      if (entry.response_length_ == 0) {
+        continue;
+      }
+      ReadRecord(entry, &key, &response);
+      visit(key, entry, response.data(), response.size());
+    }
+  }
+
+ private:
+  static constexpr uint32_t kNoEntry = UINT32_MAX;
+
+  struct IndexSlot {
+    // High half of the key hash, to skip most mismatches without reading
+    // the entry.
+    uint32_t tag;
+    uint32_t entry;
+  };
+
+  // Index slot holding the entry for |key|, or of the empty slot ending its
+  // probe sequence.
+  size_t Probe(const std::string& key, uint64_t hash) const;
+  bool KeyMatches(const Entry& entry, const std::string& key) const;
+  void ReadRecord(const Entry& entry, std::string* key,
+                  std::vector<uint8_t>* response) const;
+
+  uint32_t AllocateBlocks(size_t count);
+  void FreeBlocks(uint32_t first);
+  // Copy |length| bytes from or to the chain at |block|, starting |skip|
+  // bytes into it.
+  void ReadBlocks(uint32_t block, size_t skip, uint8_t* out,
+                  size_t length) const;
+  void WriteBlocks(uint32_t block, size_t skip, const uint8_t* data,
+                   size_t length);
+
+  void Evict();
+  void Drop(uint32_t index);
+
+  const uint32_t max_ttl_;
+  const uint32_t negative_max_ttl_;
+  size_t max_entries_;
+  size_t memory_bytes_ = 0;
+  size_t size_ = 0;
+
+  // Reserved for |max_entries_| up front so that entries never move.
+  std::vector<Entry> entries_;
+  // Free entries, linked through |first_block_|.
+  uint32_t free_entry_ = kNoEntry;
+  size_t clock_hand_ = 0;
+
+  // Power-of-two sized, at most half full, linearly probed.
+  std::vector<IndexSlot> index_;
+  size_t index_mask_ = 0;
+
+  std::unique_ptr<uint8_t[]> blocks_;
+  // Next block of each chain, or of the free list.
+  std::unique_ptr<uint32_t[]> next_block_;
+  size_t block_count_ = 0;
+  size_t free_block_count_ = 0;
+  uint32_t free_list_ = kNoEntry;
+  // Blocks from here on have never been used and are not on the free list,
+  // so the pool is only touched as it fills.
+  size_t unused_block_ = 0;
+
+  DropCallback drop_callback_ = nullptr;
+  void* drop_context_ = nullptr;
+};
+
+// Copies a cached |entry| of |cache| into |out| as the answer to a client
+// query with |client_id|, lowering the TTLs by the time spent in the cache
+// without touching the stored copy. A non-zero |stale_ttl| instead sets
+// every TTL to that value, for answers served after the entry expired.
+// Returns the answer length, or 0 if |out_capacity| is too small.
+size_t BuildCachedAnswer(const AnswerCache& cache,
+                         const AnswerCache::Entry& entry, uint16_t client_id,
+                         AnswerCache::Clock::time_point now, uint8_t* out,
+                         size_t out_capacity, uint32_t stale_ttl = 0);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_ANSWER_CACHE_H_
@@ -0,0 +1,229 @@
+// Compares the flat AnswerCache with a node-based cache of the kind it
+// replaced: an std::unordered_map from key to a heap-allocated copy of the
+// response, with an std::list for LRU order.
+//
+// Each cache is filled with |entries| A/AAAA answers of one to four records,
+// then every name is looked up in random order and its answer copied out
+// with the TTLs aged, as the resolver does for a cache hit. Reported per
+// cache: inserts and lookups per second, and the resident memory the filled
+// cache added, in total and scaled to a million entries. Each cache runs in
+// its own child process so that one's freed memory does not hide the other's.
+//
+// Usage: answer_cache_benchmark [entries]
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "answer_cache.h"
+
+namespace {
+
+using Clock = dns_manager::AnswerCache::Clock;
+
+struct Answer {
+  std::string key;
+  std::vector<uint8_t> response;
+};
+
+std::vector<Answer> MakeAnswers(size_t count) {
+  std::mt19937 random(42);
+  std::vector<Answer> answers(count);
+  for (size_t i = 0; i < count; i++) {
+    dns_manager::DnsQuestion question;
+    question.name = "host" + std::to_string(i) + ".cdn" +
+                    std::to_string(i % 1000) + ".example.com";
+    question.qtype = i % 4 == 0 ? dns_manager::kTypeAaaa : dns_manager::kTypeA;
+    question.qclass = dns_manager::kClassIn;
+    answers[i].key = dns_manager::AnswerCache::KeyFor(question);
+
+    uint8_t buffer[512];
+    dns_manager::DnsMessageBuilder builder(buffer, sizeof(buffer));
+    builder.SetHeader(0, 0x8180);
+    builder.AddQuestion(question.name.data(), question.name.size(),
+                        question.qtype, question.qclass);
+    uint8_t address[16] = {192, 0, 2, static_cast<uint8_t>(i)};
+    size_t records = 1 + random() % 4;
+    for (size_t r = 0; r < records; r++) {
+      builder.AddRecord(dns_manager::DnsSection::kAnswer,
+                        question.name.data(), question.name.size(),
+                        question.qtype, question.qclass, 300, address,
+                        question.qtype == dns_manager::kTypeA ? 4 : 16);
+    }
+    answers[i].response.assign(buffer, buffer + builder.length());
+  }
+  return answers;
+}
+
+// The node-based cache, reduced to what the benchmark exercises.
+class NodeCache {
+ public:
+  explicit NodeCache(size_t max_entries) : max_entries_(max_entries) {}
+
+  void Insert(const std::string& key, const uint8_t* response,
+              size_t length, Clock::time_point now) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      lru_.erase(it->second.lru);
+      entries_.erase(it);
+    }
+    while (entries_.size() >= max_entries_) {
+      entries_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    lru_.push_front(key);
+    Slot& slot = entries_[key];
+    slot.lru = lru_.begin();
+    slot.response.assign(response, response + length);
+    slot.stored_at = now;
+  }
+
+  size_t BuildAnswer(const std::string& key, uint16_t id,
+                     Clock::time_point now, uint8_t* out) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      return 0;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    const Slot& slot = it->second;
+    size_t length = slot.response.size();
+    memcpy(out, slot.response.data(), length);
+    dns_manager::SetMessageId(out, id);
+    dns_manager::AgeTtls(
+        out, length,
+        static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                  now - slot.stored_at)
+                                  .count()));
+    return length;
+  }
+
+ private:
+  using LruList = std::list<std::string>;
+
+  struct Slot {
+    std::vector<uint8_t> response;
+    Clock::time_point stored_at;
+    LruList::iterator lru;
+  };
+
+  const size_t max_entries_;
+  std::unordered_map<std::string, Slot> entries_;
+  LruList lru_;
+};
+
+size_t ResidentBytes() {
+  FILE* file = fopen("/proc/self/statm", "r");
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  if (file != nullptr) {
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(file);
+  }
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename Insert, typename Lookup>
+void Measure(const char* name, const std::vector<Answer>& answers,
+             const std::vector<size_t>& order, size_t rss_before,
+             Insert insert, Lookup lookup) {
+  Clock::time_point now = Clock::now();
+  auto start = Clock::now();
+  for (const Answer& answer : answers) {
+    insert(answer, now);
+  }
+  double insert_seconds = SecondsSince(start);
+  size_t rss = ResidentBytes() - rss_before;
+
+  uint8_t out[512];
+  size_t found = 0;
+  start = Clock::now();
+  for (size_t i : order) {
+    found += lookup(answers[i], static_cast<uint16_t>(i), now, out) > 0;
+  }
+  double lookup_seconds = SecondsSince(start);
+
+  double per_million = static_cast<double>(rss) * 1e6 / answers.size();
+  printf("%-5s insert=%6.2f M/s  lookup=%6.2f M/s  hits=%zu  "
+         "rss=%7.1f MiB  per 1M entries=%6.1f MiB (%3.0f bytes/entry)\n",
+         name, answers.size() / insert_seconds / 1e6,
+         order.size() / lookup_seconds / 1e6, found, rss / 1048576.0,
+         per_million / 1048576.0, per_million / 1e6);
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t entries = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 1000000;
+  std::vector<Answer> answers = MakeAnswers(entries);
+  std::vector<size_t> order(entries);
+  for (size_t i = 0; i < entries; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(7));
+  size_t wire_bytes = 0;
+  for (const Answer& answer : answers) {
+    wire_bytes += answer.key.size() + answer.response.size();
+  }
+  printf("%zu entries, %.0f bytes of key and answer each on average\n",
+         entries, static_cast<double>(wire_bytes) / entries);
+  fflush(stdout);
+
+  for (int variant = 0; variant < 2; variant++) {
+    pid_t child = fork();
+    if (child != 0) {
+      waitpid(child, nullptr, 0);
+      continue;
+    }
+    size_t rss_before = ResidentBytes();
+    if (variant == 0) {
+      NodeCache cache(entries);
+      Measure(
+          "node", answers, order, rss_before,
+          [&](const Answer& answer, Clock::time_point now) {
+            cache.Insert(answer.key, answer.response.data(),
+                         answer.response.size(), now);
+          },
+          [&](const Answer& answer, uint16_t id, Clock::time_point now,
+              uint8_t* out) {
+            return cache.BuildAnswer(answer.key, id, now, out);
+          });
+    } else {
+      // Room for every answer, so that neither cache evicts.
+      dns_manager::AnswerCache cache(entries, entries * 512, 86400, 3600);
+      Measure(
+          "flat", answers, order, rss_before,
+          [&](const Answer& answer, Clock::time_point now) {
+            cache.Insert(answer.key, answer.response.data(),
+                         answer.response.size(), now, false);
+          },
+          [&](const Answer& answer, uint16_t id, Clock::time_point now,
+              uint8_t* out) {
+            const dns_manager::AnswerCache::Entry* entry =
+                cache.Find(answer.key);
+            return entry == nullptr
+                       ? 0
+                       : dns_manager::BuildCachedAnswer(cache, *entry, id,
+                                                        now, out, 512);
+          });
+    }
+    _exit(0);
+  }
+  return 0;
+}
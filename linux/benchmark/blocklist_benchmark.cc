@@ -0,0 +1,120 @@
+// Compiles a large hosts-style blocklist into a Blocklist index, then
+// measures load time, index size against the text list, and lookup cost for
+// blocked names, names under wildcard rules and names that are not listed.
+//
+// Usage: blocklist_benchmark [rules] [lookups]
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "blocklist.h"
+#include "file_util.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::string BlockedName(size_t i) {
+  return "ad" + std::to_string(i) + ".tracker" + std::to_string(i % 5000) +
+         ".example.com";
+}
+
+// Times |lookups| queries of |names|, returning nanoseconds per lookup and
+// counting how many were blocked.
+double TimeLookups(const dns_manager::Blocklist& blocklist,
+                   const std::vector<std::string>& names, size_t lookups,
+                   size_t* blocked) {
+  *blocked = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < lookups; i++) {
+    const std::string& name = names[i % names.size()];
+    *blocked += blocklist.Contains(name.data(), name.size()) ? 1 : 0;
+  }
+  return SecondsSince(start) * 1e9 / lookups;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t rules = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000000;
+  std::string list_path = "/tmp/dns_manager_blocklist_benchmark.txt";
+  std::string index_path = "/tmp/dns_manager_blocklist_benchmark.idx";
+
+  // A hosts file with |rules| exact names plus 1000 wildcard rules.
+  FILE* list = fopen(list_path.c_str(), "w");
+  for (size_t i = 0; i < rules; i++) {
+    fprintf(list, "0.0.0.0 %s\n", BlockedName(i).c_str());
+  }
+  for (size_t i = 0; i < 1000; i++) {
+    fprintf(list, "*.adnetwork%zu.example\n", i);
+  }
+  long list_size = ftell(list);
+  fclose(list);
+
+  auto start = Clock::now();
+  dns_manager::BlocklistBuilder builder;
+  std::string error;
+  if (!builder.AddFile(list_path, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  std::vector<uint8_t> image = builder.Build();
+  if (!dns_manager::WriteFileAtomically(index_path, image.data(),
+                                        image.size(), &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  double compile_seconds = SecondsSince(start);
+
+  start = Clock::now();
+  std::unique_ptr<dns_manager::Blocklist> blocklist =
+      dns_manager::Blocklist::Open(index_path, &error);
+  double open_seconds = SecondsSince(start);
+  if (!blocklist) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("rules=%zu  list=%ld bytes  index=%zu bytes (%.1f%% of list, "
+         "%.1f bytes/rule)\n",
+         blocklist->size(), list_size, blocklist->file_size(),
+         100.0 * blocklist->file_size() / list_size,
+         static_cast<double>(blocklist->file_size()) / blocklist->size());
+  printf("compile=%.3f s  open=%.1f us\n", compile_seconds,
+         open_seconds * 1e6);
+
+  // Random order so the lookups do not walk the index sequentially.
+  std::mt19937_64 random(1);
+  std::vector<std::string> hits, wildcard, misses;
+  for (size_t i = 0; i < 100000; i++) {
+    hits.push_back(BlockedName(random() % rules));
+    wildcard.push_back("cdn" + std::to_string(i) + ".adnetwork" +
+                       std::to_string(random() % 1000) + ".example");
+    misses.push_back("www" + std::to_string(random()) + ".allowed" +
+                     std::to_string(i % 5000) + ".example.org");
+  }
+  size_t blocked;
+  double ns = TimeLookups(*blocklist, hits, lookups, &blocked);
+  printf("exact hits:    %.1f ns/lookup (%zu of %zu blocked)\n", ns, blocked,
+         lookups);
+  ns = TimeLookups(*blocklist, wildcard, lookups, &blocked);
+  printf("wildcard hits: %.1f ns/lookup (%zu of %zu blocked)\n", ns, blocked,
+         lookups);
+  ns = TimeLookups(*blocklist, misses, lookups, &blocked);
+  printf("misses:        %.1f ns/lookup (%zu of %zu blocked)\n", ns, blocked,
+         lookups);
+
+  unlink(list_path.c_str());
+  unlink(index_path.c_str());
+  return 0;
+}
@@ -0,0 +1,180 @@
+// Measures how a blocklist swap affects queries in flight.
+//
+// Clients keep a resolver busy with queries for blocked names (answered
+// locally, so the numbers are the resolver's own latency) while the main
+// thread first leaves the blocklist alone, then repeatedly maps a freshly
+// compiled index and swaps it in, then applies small deltas on top. Latency
+// percentiles should be the same in all three phases: readers never wait for
+// a swap, and the old index is released as soon as the swap returns.
+//
+// Usage: blocklist_swap_benchmark [rules] [seconds_per_phase] [clients]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blocklist.h"
+#include "dns_message.h"
+#include "file_util.h"
+#include "local_resolver.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::string BlockedName(size_t i) {
+  return "ad" + std::to_string(i) + ".tracker" + std::to_string(i % 5000) +
+         ".example.com";
+}
+
+void CompileIndex(const std::string& path, size_t rules, size_t extra) {
+  dns_manager::BlocklistBuilder builder;
+  for (size_t i = 0; i < rules + extra; i++) {
+    std::string name = BlockedName(i);
+    builder.AddDomain(name.data(), name.size(),
+                      dns_manager::BlocklistBuilder::Match::kExact);
+  }
+  std::vector<uint8_t> image = builder.Build();
+  std::string error;
+  if (!dns_manager::WriteFileAtomically(path, image.data(), image.size(),
+                                        &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(1);
+  }
+}
+
+// Sends queries for blocked names until |stop|, recording each round trip
+// in microseconds.
+void RunClient(const dns_manager::SocketAddress& resolver, size_t rules,
+               unsigned seed, const std::atomic<bool>* stop,
+               std::vector<double>* latencies) {
+  int fd = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  uint8_t query[512];
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  uint16_t id = 0;
+  while (!stop->load()) {
+    dns_manager::DnsQuestion question;
+    question.name = BlockedName((seed * 7919 + id) % rules);
+    question.qtype = dns_manager::kTypeA;
+    question.qclass = dns_manager::kClassIn;
+    size_t length =
+        dns_manager::BuildQuery(question, ++id, query, sizeof(query));
+    auto start = Clock::now();
+    sendto(fd, query, length, 0, resolver.sockaddr_ptr(), resolver.length);
+    pollfd poll_fd = {fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, 1000) == 1 &&
+        recv(fd, response, sizeof(response), 0) > 0) {
+      latencies->push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start)
+              .count());
+    }
+  }
+  close(fd);
+}
+
+void Report(const char* phase, std::vector<double> latencies, size_t swaps,
+            double swap_ms) {
+  if (latencies.empty()) {
+    printf("%-8s no answers\n", phase);
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&latencies](double quantile) {
+    return latencies[static_cast<size_t>(quantile * (latencies.size() - 1))];
+  };
+  printf("%-8s queries=%-8zu p50=%6.1f us  p99=%6.1f us  p99.9=%7.1f us  "
+         "max=%8.1f us",
+         phase, latencies.size(), at(0.5), at(0.99), at(0.999),
+         latencies.back());
+  if (swaps > 0) {
+    printf("  swaps=%zu (%.2f ms each)", swaps, swap_ms / swaps);
+  }
+  printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t rules = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+  int clients = argc > 3 ? atoi(argv[3]) : 2;
+  std::string paths[2] = {"/tmp/dns_manager_swap_benchmark_a.idx",
+                          "/tmp/dns_manager_swap_benchmark_b.idx"};
+
+  // Two indexes that both block every name the clients ask for.
+  CompileIndex(paths[0], rules, 0);
+  CompileIndex(paths[1], rules, 1000);
+
+  dns_manager::ResolverConfig config;
+  config.listen_port = 0;
+  dns_manager::SocketAddress upstream;
+  dns_manager::SocketAddress::Parse("127.0.0.1:9", 53, &upstream);
+  config.upstreams.push_back(upstream);
+  dns_manager::LocalResolver resolver(config);
+  std::string error;
+  std::shared_ptr<const dns_manager::Blocklist> base =
+      dns_manager::Blocklist::Open(paths[0], &error);
+  resolver.SetBlocklist(dns_manager::BlocklistView(base, nullptr));
+  if (!resolver.Start(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  printf("rules=%zu clients=%d seconds_per_phase=%d\n", rules, clients,
+         seconds);
+
+  const char* phases[] = {"steady", "reload", "delta"};
+  for (int phase = 0; phase < 3; phase++) {
+    std::atomic<bool> stop{false};
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+      threads.emplace_back(RunClient, resolver.bound_address(), rules,
+                           static_cast<unsigned>(i), &stop, &latencies[i]);
+    }
+
+    size_t swaps = 0;
+    double swap_ms = 0;
+    auto end = Clock::now() + std::chrono::seconds(seconds);
+    while (Clock::now() < end) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      if (phase == 0) {
+        continue;
+      }
+      auto start = Clock::now();
+      if (phase == 1) {
+        // What loadBlocklist does once the worker thread has compiled.
+        resolver.SetBlocklist(dns_manager::BlocklistView(
+            dns_manager::Blocklist::Open(paths[swaps % 2], &error), nullptr));
+      } else {
+        std::string line = "+extra" + std::to_string(swaps) + ".example\n";
+        resolver.SetBlocklist(dns_manager::BlocklistView(
+            base, dns_manager::BlocklistDelta::Parse(line)));
+      }
+      swap_ms += std::chrono::duration<double, std::milli>(Clock::now() -
+                                                           start)
+                     .count();
+      swaps++;
+    }
+    stop = true;
+    std::vector<double> all;
+    for (int i = 0; i < clients; i++) {
+      threads[i].join();
+      all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+    }
+    Report(phases[phase], std::move(all), swaps, swap_ms);
+  }
+  resolver.Stop();
+  unlink(paths[0].c_str());
+  unlink(paths[1].c_str());
+  return 0;
+}
@@ -0,0 +1,173 @@
+// Measures switching between DNS presets against rebuilding the same change
+// through setDNS each time.
+//
+// setDNS parses the server string, works out the connection properties,
+// then runs `nmcli connection show` and parses its output to see what
+// differs before the modify. applyPreset finds the precomputed properties by
+// name and compares them with the connection as the network monitor last
+// saw it, so the modify is the only nmcli run. Reported: the in-process cost
+// of each way per switch, the nmcli runs each needs with and without the
+// network state (finding the connection takes up to four more), and, for
+// scale, the cost of spawning one process through popen(). The preset file's
+// size and load time are measured for 3 and 1000 presets.
+//
+// Usage: dns_presets_benchmark [switches]
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dns_presets.h"
+#include "dns_settings.h"
+#include "network_snapshot.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Profile {
+  const char* name;
+  const char* servers;
+};
+
+// What an app switching between a few resolver profiles would define.
+const Profile kProfiles[] = {
+    {"corporate", "10.20.0.53,10.20.1.53,fd00:20::53"},
+    {"filtering", "9.9.9.9,149.112.112.112,2620:fe::fe,2620:fe::9"},
+    {"public", "1.1.1.1,1.0.0.1,2606:4700:4700::1111,2606:4700:4700::1001"},
+};
+
+// The connection as it looks once |profile| is applied, both as the network
+// monitor holds it and as `nmcli -t connection show` prints it.
+void ConnectionFor(const Profile& profile,
+                   dns_manager::NetworkConnection* connection,
+                   std::string* nmcli_output) {
+  std::string ipv4;
+  std::string ipv6;
+  dns_manager::CanonicalDnsServers(profile.servers, &ipv4, &ipv6);
+  *connection = dns_manager::NetworkConnection();
+  connection->has_settings = true;
+  connection->ipv4_ignore_auto_dns = true;
+  connection->ipv6_ignore_auto_dns = true;
+  std::string escaped;
+  for (const std::string* list : {&ipv4, &ipv6}) {
+    std::vector<std::string>* servers =
+        list == &ipv4 ? &connection->ipv4_dns : &connection->ipv6_dns;
+    for (size_t start = 0; start < list->size();) {
+      size_t end = std::min(list->find(',', start), list->size());
+      servers->push_back(list->substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  for (char c : ipv6) {
+    if (c == ':') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  *nmcli_output = "ipv4.dns:" + ipv4 +
+                  "\nipv4.ignore-auto-dns:yes\nipv6.dns:" + escaped +
+                  "\nipv6.ignore-auto-dns:yes\n";
+}
+
+double NanosecondsPer(Clock::duration duration, int count) {
+  return std::chrono::duration<double, std::nano>(duration).count() / count;
+}
+
+// Microseconds to run /bin/true through popen(), as the plugin runs nmcli.
+double SpawnMicroseconds() {
+  const int kSpawns = 50;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kSpawns; i++) {
+    FILE* pipe = popen("/bin/true", "r");
+    if (pipe != nullptr) {
+      pclose(pipe);
+    }
+  }
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+             .count() /
+         kSpawns;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int switches = argc > 1 ? atoi(argv[1]) : 100000;
+  const int kProfileCount = sizeof(kProfiles) / sizeof(kProfiles[0]);
+  dns_manager::NetworkConnection connections[kProfileCount];
+  std::string outputs[kProfileCount];
+  for (int i = 0; i < kProfileCount; i++) {
+    ConnectionFor(kProfiles[i], &connections[i], &outputs[i]);
+  }
+
+  // Each switch goes from profile i to profile i + 1, so there is always a
+  // difference to find.
+  size_t changed = 0;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < switches; i++) {
+    const Profile& next = kProfiles[(i + 1) % kProfileCount];
+    std::vector<dns_manager::ConnectionProperty> desired;
+    dns_manager::DnsPropertiesFor(next.servers, &desired);
+    changed += dns_manager::ChangedProperties(
+                   desired, dns_manager::ParseNmcliProperties(
+                                outputs[i % kProfileCount]))
+                   .size();
+  }
+  double set_dns_ns = NanosecondsPer(Clock::now() - start, switches);
+
+  dns_manager::DnsPresets presets;
+  std::string error;
+  for (const Profile& profile : kProfiles) {
+    presets.Define(profile.name, profile.servers, false, &error);
+  }
+  start = Clock::now();
+  for (int i = 0; i < switches; i++) {
+    const dns_manager::DnsPreset* preset =
+        presets.Find(kProfiles[(i + 1) % kProfileCount].name);
+    changed += dns_manager::ChangedProperties(
+                   preset->properties, dns_manager::ConnectionDnsProperties(
+                                           connections[i % kProfileCount]))
+                   .size();
+  }
+  double preset_ns = NanosecondsPer(Clock::now() - start, switches);
+
+  printf("%d switches between %d profiles (%zu properties changed)\n",
+         switches, kProfileCount, changed);
+  printf("%-28s %12s %22s %22s\n", "", "in-process", "nmcli runs (state)",
+         "nmcli runs (no state)");
+  printf("%-28s %9.0f ns %22d %22s\n", "setDNS with a server string",
+         set_dns_ns, 2, "3-6");
+  printf("%-28s %9.0f ns %22d %22s\n", "applyPreset", preset_ns, 1, "3-6");
+  printf("one process spawn through popen(): %.0f us\n", SpawnMicroseconds());
+
+  std::string path = "/tmp/dns_presets_benchmark-" +
+                     std::to_string(getpid()) + ".bin";
+  for (int count : {3, 1000}) {
+    dns_manager::DnsPresets many;
+    for (int i = 0; i < count; i++) {
+      const Profile& profile = kProfiles[i % kProfileCount];
+      many.Define(std::string(profile.name) + "-" + std::to_string(i),
+                  profile.servers, i % 2 == 1, &error);
+    }
+    if (!many.Save(path, &error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    size_t size = many.Serialize().size();
+    const int kLoads = 100;
+    start = Clock::now();
+    for (int i = 0; i < kLoads; i++) {
+      dns_manager::DnsPresets loaded;
+      loaded.Load(path, &error);
+    }
+    printf("%4d presets: %7zu bytes on disk, loaded in %.1f us\n", count, size,
+           NanosecondsPer(Clock::now() - start, kLoads) / 1000);
+  }
+  unlink(path.c_str());
+  return 0;
+}
@@ -0,0 +1,219 @@
+// Measures what it costs to reload a large host overrides file, and what a
+// lookup in the mapped table costs.
+//
+// A hosts file of |names| A, AAAA and CNAME overrides is written, then
+// reloaded |reloads| times. Each reload is broken into the steps the plugin
+// takes: parsing the text, building the table, writing it and mapping it
+// (Open() validates every entry), and swapping it into a running resolver.
+// Then lookups of overridden and other names are timed, and finally the
+// whole path from an edit of the hosts file to the new table being live,
+// through a FileWatcher.
+//
+// Usage: host_overrides_benchmark [names] [lookups] [reloads]
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "file_util.h"
+#include "file_watcher.h"
+#include "host_overrides.h"
+#include "local_resolver.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MicrosecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+std::string NameFor(size_t i) {
+  return "host" + std::to_string(i) + ".site" + std::to_string(i % 100) +
+         ".corp.example";
+}
+
+// One name in ten is an alias of the one before it, the rest have an IPv4
+// address and every fourth an IPv6 one too.
+std::string HostsText(size_t names, unsigned generation) {
+  std::string text;
+  for (size_t i = 0; i < names; i++) {
+    std::string name = NameFor(i);
+    if (i % 10 == 9) {
+      text += name + " CNAME " + NameFor(i - 1) + "\n";
+      continue;
+    }
+    text += "10." + std::to_string(generation % 256) + "." +
+            std::to_string(i / 256 % 256) + "." + std::to_string(i % 256) +
+            " " + name + "\n";
+    if (i % 4 == 0) {
+      text += "fd00::" + std::to_string(i % 65536) + " " + name + "\n";
+    }
+  }
+  return text;
+}
+
+bool WriteText(const std::string& path, const std::string& text) {
+  std::string error;
+  return dns_manager::WriteFileAtomically(
+      path, reinterpret_cast<const uint8_t*>(text.data()), text.size(),
+      &error);
+}
+
+// Compiles |hosts| into |index| and maps it, adding each step's time in
+// microseconds to |steps|.
+std::shared_ptr<const dns_manager::HostOverrides> Compile(
+    const std::string& hosts, const std::string& index, double steps[3]) {
+  std::string error;
+  auto start = Clock::now();
+  dns_manager::HostOverridesBuilder builder;
+  builder.AddFile(hosts, &error);
+  steps[0] += MicrosecondsSince(start);
+  start = Clock::now();
+  std::vector<uint8_t> image = builder.Build();
+  steps[1] += MicrosecondsSince(start);
+  start = Clock::now();
+  dns_manager::WriteFileAtomically(index, image.data(), image.size(), &error);
+  std::shared_ptr<const dns_manager::HostOverrides> overrides =
+      dns_manager::HostOverrides::Open(index, &error);
+  steps[2] += MicrosecondsSince(start);
+  if (!overrides) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(1);
+  }
+  return overrides;
+}
+
+struct Reloader {
+  std::string hosts;
+  std::string index;
+  dns_manager::LocalResolver* resolver;
+  std::atomic<int> reloads{0};
+};
+
+void Reload(void* context) {
+  Reloader* reloader = static_cast<Reloader*>(context);
+  double steps[3] = {0, 0, 0};
+  reloader->resolver->SetHostOverrides(
+      Compile(reloader->hosts, reloader->index, steps));
+  reloader->reloads++;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t names = argc > 1 ? static_cast<size_t>(atol(argv[1])) : 100000;
+  size_t lookups = argc > 2 ? static_cast<size_t>(atol(argv[2])) : 10000000;
+  int reloads = argc > 3 ? atoi(argv[3]) : 20;
+
+  char directory[] = "/tmp/host_overrides_benchmark.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string hosts = std::string(directory) + "/hosts";
+  std::string index = std::string(directory) + "/hosts.idx";
+  std::string text = HostsText(names, 0);
+  WriteText(hosts, text);
+
+  dns_manager::ResolverConfig config;
+  config.listen_port = 0;
+  dns_manager::SocketAddress upstream;
+  dns_manager::SocketAddress::Parse("127.0.0.1:9", 53, &upstream);
+  config.upstreams.push_back(upstream);
+  dns_manager::LocalResolver resolver(config);
+  std::string error;
+  if (!resolver.Start(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  double steps[3] = {0, 0, 0};
+  double swap = 0;
+  double release = 0;
+  std::shared_ptr<const dns_manager::HostOverrides> overrides;
+  for (int i = 0; i < reloads; i++) {
+    std::shared_ptr<const dns_manager::HostOverrides> previous =
+        std::move(overrides);
+    overrides = Compile(hosts, index, steps);
+    auto start = Clock::now();
+    resolver.SetHostOverrides(overrides);
+    swap += MicrosecondsSince(start);
+    // Unmapping the old table, once nothing holds it.
+    start = Clock::now();
+    previous.reset();
+    release += MicrosecondsSince(start);
+  }
+  printf("%zu names, hosts file %.1f MiB, table %.1f MiB\n",
+         overrides->size(), text.size() / 1048576.0,
+         overrides->file_size() / 1048576.0);
+  printf("reload: parse %8.0f us  build %8.0f us  write+map %8.0f us  "
+         "swap %6.1f us  release %6.0f us  total %8.0f us\n",
+         steps[0] / reloads, steps[1] / reloads, steps[2] / reloads,
+         swap / reloads, release / reloads,
+         (steps[0] + steps[1] + steps[2] + swap + release) / reloads);
+
+  std::vector<std::string> hits(std::min<size_t>(names, 65536));
+  std::vector<std::string> misses(hits.size());
+  std::mt19937 random(42);
+  for (size_t i = 0; i < hits.size(); i++) {
+    hits[i] = NameFor(random() % names);
+    misses[i] = "host" + std::to_string(i) + ".elsewhere.example";
+  }
+  dns_manager::HostOverrides::Record
+      records[dns_manager::HostOverrides::kMaxRecordsPerName];
+  for (const std::vector<std::string>* list : {&hits, &misses}) {
+    size_t found = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      const std::string& name = (*list)[i % list->size()];
+      found += overrides->Find(name.data(), name.size(), records) > 0;
+    }
+    printf("lookup %-7s %6.1f ns/op  (%zu of %zu found)\n",
+           list == &hits ? "hits" : "misses",
+           MicrosecondsSince(start) * 1000 / lookups, found, lookups);
+  }
+
+  // From the edit to the new table answering queries.
+  Reloader reloader;
+  reloader.hosts = hosts;
+  reloader.index = index;
+  reloader.resolver = &resolver;
+  dns_manager::FileWatcher watcher(hosts);
+  watcher.set_change_callback(Reload, &reloader);
+  if (!watcher.Start(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  std::vector<double> latencies;
+  for (int i = 1; i <= reloads; i++) {
+    std::string edited = HostsText(names, i);
+    auto start = Clock::now();
+    WriteText(hosts, edited);
+    while (reloader.reloads < i) {
+      usleep(100);
+    }
+    latencies.push_back(MicrosecondsSince(start));
+  }
+  watcher.Stop();
+  std::sort(latencies.begin(), latencies.end());
+  printf("edit to live: p50 %8.0f us  max %8.0f us  (includes the %d ms "
+         "settle delay)\n",
+         latencies[latencies.size() / 2], latencies.back(),
+         dns_manager::FileWatcher::kSettleMs);
+
+  resolver.Stop();
+  unlink(hosts.c_str());
+  unlink(index.c_str());
+  rmdir(directory);
+  return 0;
+}
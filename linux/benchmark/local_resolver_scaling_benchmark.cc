@@ -0,0 +1,179 @@
+// Measures how the sharded resolver scales with its thread count.
+//
+// A stub upstream answers every name once; after that every query is a
+// cache hit, so the resolver itself is the bottleneck. For 1, 2, 4 and 8
+// resolver threads, client threads each keep a window of queries in flight on
+// many sockets, whose distinct source ports let SO_REUSEPORT spread them
+// across the resolver threads, and count answers for a fixed time. The
+// clients run on the same machine and compete with the resolver for cores, so
+// the speedup flattens once threads plus clients exceed the cores available.
+// Reported per thread count: answered queries per second, speedup over one
+// thread, and the share of hits that came from the shared tier.
+//
+// Usage: local_resolver_scaling_benchmark [seconds_per_run] [client_threads]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "local_resolver.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kNames = 1000;
+constexpr size_t kSocketsPerClient = 16;
+constexpr size_t kWindowPerSocket = 4;
+
+std::vector<std::vector<uint8_t>> MakeQueries() {
+  std::vector<std::vector<uint8_t>> queries;
+  for (size_t i = 0; i < kNames; i++) {
+    std::string name = "host" + std::to_string(i) + ".example.com";
+    std::vector<uint8_t> query(512);
+    query.resize(dns_manager::test::MakeQuery(
+        name.c_str(), static_cast<uint16_t>(i), 1, query.data()));
+    queries.push_back(std::move(query));
+  }
+  return queries;
+}
+
+// Sends queries round-robin over its sockets until |running| is cleared and
+// returns how many were answered. A window that stalls on a lost packet is
+// refilled after a short timeout.
+uint64_t RunClient(const dns_manager::SocketAddress& resolver,
+                   const std::vector<std::vector<uint8_t>>& queries,
+                   size_t first, const std::atomic<bool>& running) {
+  std::vector<pollfd> fds;
+  for (size_t i = 0; i < kSocketsPerClient; i++) {
+    int fd = socket(resolver.family(),
+                    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    connect(fd, resolver.sockaddr_ptr(), resolver.length);
+    fds.push_back({fd, POLLIN, 0});
+  }
+  size_t next = first;
+  auto send_one = [&](int fd) {
+    const std::vector<uint8_t>& query = queries[next++ % queries.size()];
+    send(fd, query.data(), query.size(), 0);
+  };
+  auto fill_windows = [&]() {
+    for (const pollfd& fd : fds) {
+      for (size_t i = 0; i < kWindowPerSocket; i++) {
+        send_one(fd.fd);
+      }
+    }
+  };
+
+  uint64_t answered = 0;
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  fill_windows();
+  while (running.load(std::memory_order_relaxed)) {
+    int ready = poll(fds.data(), fds.size(), 50);
+    if (ready == 0) {
+      fill_windows();
+      continue;
+    }
+    for (const pollfd& fd : fds) {
+      if (!(fd.revents & POLLIN)) {
+        continue;
+      }
+      while (recv(fd.fd, response, sizeof(response), 0) > 0) {
+        answered++;
+        send_one(fd.fd);
+      }
+    }
+  }
+  for (const pollfd& fd : fds) {
+    close(fd.fd);
+  }
+  return answered;
+}
+
+// Resolves every name once through |resolver| so later queries are hits.
+void WarmUp(const dns_manager::SocketAddress& resolver,
+            const std::vector<std::vector<uint8_t>>& queries) {
+  int fd = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  connect(fd, resolver.sockaddr_ptr(), resolver.length);
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  for (const std::vector<uint8_t>& query : queries) {
+    send(fd, query.data(), query.size(), 0);
+    pollfd poll_fd = {fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, 2000) == 1) {
+      recv(fd, response, sizeof(response), 0);
+    }
+  }
+  close(fd);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 3;
+  size_t clients = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 8;
+  dns_manager::test::StubUpstream upstream(3600);
+  std::vector<std::vector<uint8_t>> queries = MakeQueries();
+
+  printf("%zu names, %zu client threads x %zu sockets x %zu in flight, "
+         "%.1f s per run, %u cores\n",
+         kNames, clients, kSocketsPerClient, kWindowPerSocket, seconds,
+         std::thread::hardware_concurrency());
+  double baseline = 0;
+  for (size_t threads : {1, 2, 4, 8}) {
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams.push_back(upstream.address());
+    config.threads = threads;
+    config.prefetch_fraction = 0;
+    dns_manager::LocalResolver resolver(config);
+    std::string error;
+    if (!resolver.Start(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    WarmUp(resolver.bound_address(), queries);
+    dns_manager::ResolverStats before = resolver.Stats();
+
+    std::atomic<bool> running{true};
+    std::vector<uint64_t> answered(clients, 0);
+    std::vector<std::thread> client_threads;
+    auto start = Clock::now();
+    for (size_t i = 0; i < clients; i++) {
+      client_threads.emplace_back([&, i]() {
+        answered[i] = RunClient(resolver.bound_address(), queries,
+                                i * kNames / clients, running);
+      });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    running = false;
+    for (std::thread& thread : client_threads) {
+      thread.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t total = 0;
+    for (uint64_t count : answered) {
+      total += count;
+    }
+    double qps = total / elapsed;
+    if (baseline == 0) {
+      baseline = qps;
+    }
+    dns_manager::ResolverStats stats = resolver.Stats();
+    uint64_t hits = stats.cache_hits - before.cache_hits;
+    uint64_t shared = stats.shared_cache_hits - before.shared_cache_hits;
+    printf("threads=%zu  qps=%-9.0f speedup=%.2fx  shared hits=%.2f%%\n",
+           threads, qps, qps / baseline,
+           hits > 0 ? 100.0 * shared / hits : 0.0);
+  }
+  return 0;
+}
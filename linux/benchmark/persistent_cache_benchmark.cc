@@ -0,0 +1,168 @@
+// Measures what the persistent cache buys after a restart.
+//
+// First, how long PersistentCache::Open() takes for snapshots of different
+// sizes: it only checks the header, so the cost should not grow with the
+// number of records. Then, time-to-first-hit: a resolver is restarted and
+// asked for names it resolved before the restart, once with no snapshot
+// (cold) and once with the snapshot opened the way the plugin does at
+// registration (warm). The stub upstream adds a fixed delay to stand in for
+// a real network round trip.
+//
+// Usage: persistent_cache_benchmark [upstream_delay_ms] [names]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "local_resolver.h"
+#include "persistent_cache.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MillisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+bool Exchange(const dns_manager::SocketAddress& resolver,
+              const uint8_t* query, size_t length) {
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  int fd = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sendto(fd, query, length, 0, resolver.sockaddr_ptr(), resolver.length);
+  pollfd poll_fd = {fd, POLLIN, 0};
+  bool answered = poll(&poll_fd, 1, 5000) == 1 &&
+                  recv(fd, response, sizeof(response), 0) > 0;
+  close(fd);
+  return answered;
+}
+
+void BenchmarkOpen(const std::string& path, size_t records) {
+  dns_manager::PersistentCacheWriter writer;
+  std::vector<uint8_t> response(64, 0);
+  int64_t now = time(nullptr);
+  for (size_t i = 0; i < records; i++) {
+    std::string key = std::string("\0\1\0\1", 4) + "host" +
+                      std::to_string(i) + ".example.com";
+    writer.Add(key, response.data(), response.size(), now, 300);
+  }
+  std::string error;
+  if (!dns_manager::PersistentCacheWriter::Commit(path, writer.Build(),
+                                                  &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(1);
+  }
+
+  constexpr int kRounds = 200;
+  size_t file_size = 0;
+  auto start = Clock::now();
+  for (int round = 0; round < kRounds; round++) {
+    std::unique_ptr<dns_manager::PersistentCache> cache =
+        dns_manager::PersistentCache::Open(path, &error);
+    file_size = cache->file_size();
+  }
+  printf("records=%-7zu file=%-9zu bytes  open=%.1f us\n", records,
+         file_size, MillisecondsSince(start) * 1000 / kRounds);
+}
+
+// Starts a resolver, optionally with the snapshot at |path|, and resolves
+// every name once. Returns the time from the restart to the first answer.
+double FirstHitAfterRestart(const dns_manager::SocketAddress& upstream,
+                            const std::string& path, bool warm,
+                            const std::vector<std::string>& names,
+                            double* total_ms, uint64_t* warm_hits) {
+  auto restart = Clock::now();
+  dns_manager::ResolverConfig config;
+  config.listen_port = 0;
+  config.upstreams.push_back(upstream);
+  dns_manager::LocalResolver resolver(config);
+  if (warm) {
+    std::string error;
+    resolver.set_warm_cache(dns_manager::PersistentCache::Open(path, &error));
+  }
+  std::string error;
+  if (!resolver.Start(&error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    exit(1);
+  }
+
+  uint8_t query[512];
+  double first_hit = 0;
+  for (size_t i = 0; i < names.size(); i++) {
+    size_t length = dns_manager::test::MakeQuery(
+        names[i].c_str(), static_cast<uint16_t>(i), 1, query);
+    Exchange(resolver.bound_address(), query, length);
+    if (i == 0) {
+      first_hit = MillisecondsSince(restart);
+    }
+  }
+  *total_ms = MillisecondsSince(restart);
+  *warm_hits = resolver.Stats().warm_cache_hits;
+  return first_hit;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int delay_ms = argc > 1 ? atoi(argv[1]) : 20;
+  size_t name_count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100;
+  std::string path = "/tmp/dns_manager_persistent_cache_benchmark.bin";
+
+  printf("PersistentCache::Open\n");
+  for (size_t records : {1000, 10000, 100000}) {
+    BenchmarkOpen(path, records);
+  }
+
+  dns_manager::test::StubUpstream upstream;
+  upstream.set_delay_ms(delay_ms);
+  std::vector<std::string> names;
+  for (size_t i = 0; i < name_count; i++) {
+    names.push_back("site" + std::to_string(i) + ".example.com");
+  }
+
+  // The run before the restart, which leaves its snapshot behind.
+  unlink(path.c_str());
+  {
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams.push_back(upstream.address());
+    config.cache_file = path;
+    dns_manager::LocalResolver resolver(config);
+    std::string error;
+    if (!resolver.Start(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    uint8_t query[512];
+    for (size_t i = 0; i < names.size(); i++) {
+      size_t length = dns_manager::test::MakeQuery(
+          names[i].c_str(), static_cast<uint16_t>(i), 1, query);
+      Exchange(resolver.bound_address(), query, length);
+    }
+  }
+
+  printf("\nrestart with %zu previously seen names, upstream delay %d ms\n",
+         names.size(), delay_ms);
+  for (bool warm : {false, true}) {
+    double total_ms = 0;
+    uint64_t warm_hits = 0;
+    double first_hit = FirstHitAfterRestart(upstream.address(), path, warm,
+                                            names, &total_ms, &warm_hits);
+    printf("%-5s first answer after %.3f ms, all %zu after %.1f ms "
+           "(warm hits %llu)\n",
+           warm ? "warm" : "cold", first_hit, names.size(), total_ms,
+           static_cast<unsigned long long>(warm_hits));
+  }
+  unlink(path.c_str());
+  return 0;
+}
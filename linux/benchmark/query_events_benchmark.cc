@@ -0,0 +1,139 @@
+// Measures how many query events the packed stream can carry and what each
+// flush costs the main thread.
+//
+// A producer thread records events into a QueryEventRing at a fixed rate, as
+// the resolver thread would under load, while the consumer wakes every flush
+// interval, or as soon as 1024 events are waiting, and drains the ring into
+// batches of at most 1024 events, the work the plugin does on the platform
+// thread before handing the bytes to the event channel. Reported per rate and interval: events delivered per
+// second, events dropped because the ring was full, and main-thread time per
+// batch.
+//
+// Usage: query_events_benchmark [seconds_per_run]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "query_events.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kCapacity = 8192;
+constexpr size_t kBatch = 1024;
+
+// Stands in for the main loop: the ready callback wakes it early.
+struct Wakeup {
+  std::mutex mutex;
+  std::condition_variable ready;
+  bool pending = false;
+};
+
+void OnReady(void* context) {
+  Wakeup* wakeup = static_cast<Wakeup*>(context);
+  std::lock_guard<std::mutex> lock(wakeup->mutex);
+  wakeup->pending = true;
+  wakeup->ready.notify_one();
+}
+
+void Produce(dns_manager::QueryEventRing* ring, double rate,
+             const std::atomic<bool>* stop, uint64_t* produced) {
+  std::vector<std::string> names;
+  for (int i = 0; i < 256; i++) {
+    names.push_back("host" + std::to_string(i) + ".cdn" +
+                    std::to_string(i % 7) + ".example.com");
+  }
+  uint64_t count = 0;
+  auto start = Clock::now();
+  while (!stop->load(std::memory_order_relaxed)) {
+    double elapsed =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    if (count >= elapsed * rate) {
+      continue;
+    }
+    const std::string& name = names[count % names.size()];
+    count++;
+    dns_manager::QueryEvent* event = ring->Reserve();
+    if (event == nullptr) {
+      continue;
+    }
+    event->time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    event->latency_us = 40;
+    event->qtype = 1;
+    event->rcode = 0;
+    event->source = dns_manager::QuerySource::kCache;
+    event->name_length = static_cast<uint8_t>(name.size());
+    memcpy(event->name, name.data(), name.size());
+    ring->Commit();
+  }
+  *produced = count;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 2;
+
+  for (double rate : {10000.0, 100000.0, 1000000.0}) {
+  for (int interval_ms : {10, 50, 100}) {
+    dns_manager::QueryEventRing ring(kCapacity);
+    ring.set_enabled(true);
+    Wakeup wakeup;
+    ring.set_ready_callback(OnReady, &wakeup, kBatch);
+    std::atomic<bool> stop{false};
+    uint64_t produced = 0;
+    std::thread producer(Produce, &ring, rate, &stop, &produced);
+
+    dns_manager::QueryEventBatch batch;
+    uint64_t delivered = 0;
+    uint64_t dropped = 0;
+    uint64_t batches = 0;
+    uint64_t bytes = 0;
+    double flush_us = 0;
+    auto end = Clock::now() + std::chrono::duration<double>(seconds);
+    while (Clock::now() < end) {
+      {
+        std::unique_lock<std::mutex> lock(wakeup.mutex);
+        wakeup.ready.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                              [&] { return wakeup.pending; });
+        wakeup.pending = false;
+      }
+      size_t count;
+      do {
+        auto start = Clock::now();
+        batch.Clear();
+        count = ring.Drain(&batch, kBatch);
+        bytes += batch.bytes().size();
+        flush_us += std::chrono::duration<double, std::micro>(Clock::now() -
+                                                              start)
+                        .count();
+        delivered += count;
+        dropped += batch.dropped();
+        batches++;
+      } while (count == kBatch);
+    }
+    stop = true;
+    producer.join();
+
+    printf("rate=%7.0f/s interval=%3d ms  delivered=%8.0f events/s  "
+           "dropped=%5.1f%%  %6.1f us/batch (%4.0f events, %5.1f KiB)\n",
+           rate, interval_ms, delivered / seconds,
+           100.0 * dropped / std::max<uint64_t>(produced, 1),
+           flush_us / batches, static_cast<double>(delivered) / batches,
+           bytes / 1024.0 / batches);
+  }
+  }
+  return 0;
+}
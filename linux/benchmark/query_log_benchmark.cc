@@ -0,0 +1,167 @@
+// Measures the on-disk query log: how fast events are appended, how many
+// bytes each takes, and how long a time-range scan takes.
+//
+// |hours| of traffic at |qps| queries per second are appended, with names
+// drawn from a Zipf-like distribution over 5000 names, so that a few names
+// make up most queries as they do on a real machine. Ingest is timed
+// including the block writes, and the bytes per event are compared with a
+// text line per query. Then ranges of one minute, three minutes and one hour
+// at random points are scanned |scans| times each (warm page cache), with
+// the blocks the sparse index let the scan skip.
+//
+// Usage: query_log_benchmark [hours] [qps] [scans]
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "query_log.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kNames = 5000;
+// 2026-01-01 00:00:00 UTC.
+constexpr int64_t kStartUs = 1767225600LL * 1000000;
+
+double MicrosecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+void RemoveDirectory(const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+  while (dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      unlink((directory + "/" + entry->d_name).c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(directory.c_str());
+}
+
+double Percentile(std::vector<double> values, double fraction) {
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(fraction * (values.size() - 1))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int hours = argc > 1 ? atoi(argv[1]) : 24;
+  int qps = argc > 2 ? atoi(argv[2]) : 50;
+  int scans = argc > 3 ? atoi(argv[3]) : 50;
+
+  char directory[] = "/tmp/query_log_benchmark.XXXXXX";
+  if (mkdtemp(directory) == nullptr) {
+    perror("mkdtemp");
+    return 1;
+  }
+  std::string error;
+  std::unique_ptr<dns_manager::QueryLog> log =
+      dns_manager::QueryLog::Open(directory, UINT64_MAX, &error);
+  if (!log) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+
+  // Zipf with exponent 1 over the names, drawn by inverting the CDF.
+  std::vector<std::string> names(kNames);
+  std::vector<double> cdf(kNames);
+  double total = 0;
+  for (size_t i = 0; i < kNames; i++) {
+    names[i] = "host" + std::to_string(i) + ".service" +
+               std::to_string(i % 97) + ".example.com";
+    total += 1.0 / (i + 1);
+    cdf[i] = total;
+  }
+  std::mt19937_64 random(42);
+  std::uniform_real_distribution<double> uniform(0, total);
+  std::exponential_distribution<double> gap(qps / 1e6);
+  std::lognormal_distribution<double> latency(std::log(800.0), 1.5);
+
+  std::vector<dns_manager::QueryEvent> events;
+  int64_t end_us = kStartUs + static_cast<int64_t>(hours) * 3600 * 1000000;
+  double text_bytes = 0;
+  for (double time = kStartUs; time < end_us; time += gap(random)) {
+    dns_manager::QueryEvent event;
+    event.time_us = static_cast<int64_t>(time);
+    event.latency_us = static_cast<uint32_t>(latency(random));
+    size_t name = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+                  cdf.begin();
+    name = std::min(name, kNames - 1);
+    event.name_length = static_cast<uint8_t>(names[name].size());
+    memcpy(event.name, names[name].data(), names[name].size());
+    event.qtype = random() % 4 == 0 ? 28 : 1;
+    event.rcode = random() % 50 == 0 ? 3 : 0;
+    event.source = static_cast<dns_manager::QuerySource>(
+        event.latency_us < 100 ? 0 : 2);
+    // "2026-01-01T00:00:00.000000Z host1.example.com A NOERROR upstream
+    // 812us", about what a line-per-query log takes.
+    text_bytes += 28 + event.name_length + 22;
+    events.push_back(event);
+  }
+
+  auto start = Clock::now();
+  for (const dns_manager::QueryEvent& event : events) {
+    log->Append(event);
+  }
+  log->Flush();
+  double ingest_us = MicrosecondsSince(start);
+  printf("%d h at %d qps: %zu events, %.2f M events/s ingest\n", hours, qps,
+         events.size(), events.size() / ingest_us);
+  printf("on disk %.1f MiB: %.2f bytes/event (text log ~%.1f, %.1fx)\n",
+         log->bytes() / 1048576.0,
+         static_cast<double>(log->bytes()) / events.size(),
+         text_bytes / events.size(),
+         text_bytes / static_cast<double>(log->bytes()));
+
+  struct Range {
+    const char* label;
+    int64_t length_us;
+  };
+  const Range kRanges[] = {{"1 min", 60 * 1000000LL},
+                           {"3 min", 3 * 60 * 1000000LL},
+                           {"1 h", 3600 * 1000000LL}};
+  std::vector<dns_manager::QueryEvent> found;
+  for (const Range& range : kRanges) {
+    std::uniform_int_distribution<int64_t> from(
+        kStartUs, std::max(kStartUs, end_us - range.length_us));
+    std::vector<double> latencies;
+    dns_manager::QueryLog::ScanStats stats;
+    size_t events_found = 0;
+    for (int i = 0; i < scans; i++) {
+      found.clear();
+      int64_t at = from(random);
+      start = Clock::now();
+      events_found +=
+          log->Scan(at, at + range.length_us, SIZE_MAX, &found, &stats);
+      latencies.push_back(MicrosecondsSince(start));
+    }
+    printf("scan %-5s p50 %8.0f us  p99 %8.0f us  %7.0f events  "
+           "blocks read %5.1f  skipped %6.1f\n",
+           range.label, Percentile(latencies, 0.5),
+           Percentile(latencies, 0.99),
+           static_cast<double>(events_found) / scans,
+           static_cast<double>(stats.blocks_read) / scans,
+           static_cast<double>(stats.blocks_skipped) / scans);
+  }
+
+  log.reset();
+  RemoveDirectory(directory);
+  return 0;
+}
@@ -0,0 +1,231 @@
+// Measures what per-client rate limiting costs a query, and what it buys
+// when one local client floods the resolver.
+//
+// First RateLimiter::Allow() on its own: nanoseconds per call for one
+// client, for as many clients as the table holds and for ten times that
+// (every call then evicts), on one thread and on four threads either
+// sharing one client or each with their own. Then a resolver in front of a
+// loopback stub upstream, with and without a limit of 1000 queries a second
+// per client: a flooder bound to 127.0.0.2 sends uncached names as fast as
+// it can without waiting for answers, like a retry storm, while a client on
+// 127.0.0.3 resolves a name every millisecond. Reported per mode: the
+// flood's queries and how many reached the upstream, and the well-behaved
+// client's p50 and p99 latency and unanswered queries.
+//
+// Usage: rate_limiter_benchmark [seconds]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns_message.h"
+#include "local_resolver.h"
+#include "rate_limiter.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kCapacity = 4096;
+constexpr size_t kCalls = 4000000;
+
+std::vector<dns_manager::SocketAddress> Clients(size_t count) {
+  std::vector<dns_manager::SocketAddress> clients(count);
+  for (size_t i = 0; i < count; i++) {
+    std::string text = "10." + std::to_string(i >> 16 & 0xff) + "." +
+                       std::to_string(i >> 8 & 0xff) + "." +
+                       std::to_string(i & 0xff);
+    dns_manager::SocketAddress::Parse(text, 53, &clients[i]);
+  }
+  return clients;
+}
+
+// Calls Allow() kCalls times from each of |threads| threads, each cycling
+// through all of |clients| if |shared|, or else through its own slice of
+// them, and returns the nanoseconds per call seen by one thread.
+double NanosecondsPerAllow(size_t threads,
+                           const std::vector<dns_manager::SocketAddress>&
+                               clients,
+                           bool shared) {
+  // A rate high enough that the buckets do not run dry.
+  dns_manager::RateLimiter limiter(1e9, 1000000, kCapacity);
+  std::atomic<size_t> allowed{0};
+  std::vector<std::thread> workers;
+  auto start = Clock::now();
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      size_t count = 0;
+      size_t first = shared ? 0 : t * clients.size() / threads;
+      size_t end =
+          shared ? clients.size() : (t + 1) * clients.size() / threads;
+      size_t next = first;
+      // The resolver reads the clock for each query anyway.
+      Clock::time_point now = Clock::now();
+      for (size_t i = 0; i < kCalls; i++) {
+        if (i % 256 == 0) {
+          now = Clock::now();
+        }
+        count += limiter.Allow(clients[next], now);
+        if (++next == end) {
+          next = first;
+        }
+      }
+      allowed += count;
+    });
+  }
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  double elapsed = std::chrono::duration<double, std::nano>(Clock::now() -
+                                                            start)
+                       .count();
+  return elapsed / kCalls;
+}
+
+int BoundSocket(const char* address) {
+  dns_manager::SocketAddress local;
+  dns_manager::SocketAddress::Parse(address, 0, &local);
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  bind(fd, local.sockaddr_ptr(), local.length);
+  return fd;
+}
+
+// Sends distinct names to |resolver| from 127.0.0.2 until |stop|, reading
+// and discarding whatever comes back.
+void Flood(const dns_manager::SocketAddress& resolver,
+           const std::atomic<bool>& stop, size_t* sent) {
+  int fd = BoundSocket("127.0.0.2");
+  connect(fd, resolver.sockaddr_ptr(), resolver.length);
+  uint8_t query[512];
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  for (uint32_t i = 0; !stop; i++) {
+    std::string name = "flood" + std::to_string(i) + ".example.com";
+    size_t length = dns_manager::test::MakeQuery(
+        name.c_str(), static_cast<uint16_t>(i), 1, query);
+    if (send(fd, query, length, MSG_DONTWAIT) > 0) {
+      (*sent)++;
+    }
+    while (recv(fd, response, sizeof(response), MSG_DONTWAIT) > 0) {
+    }
+  }
+  close(fd);
+}
+
+// Resolves a new name from 127.0.0.3 every millisecond until |stop|.
+void Resolve(const dns_manager::SocketAddress& resolver,
+             const std::atomic<bool>& stop, std::vector<double>* latencies,
+             size_t* failures) {
+  int fd = BoundSocket("127.0.0.3");
+  connect(fd, resolver.sockaddr_ptr(), resolver.length);
+  uint8_t query[512];
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  for (uint16_t i = 0; !stop; i++) {
+    std::string name = "client" + std::to_string(i) + ".example.com";
+    size_t length =
+        dns_manager::test::MakeQuery(name.c_str(), i, 1, query);
+    auto start = Clock::now();
+    send(fd, query, length, 0);
+    pollfd poll_fd = {fd, POLLIN, 0};
+    bool answered = false;
+    while (poll(&poll_fd, 1, 1000) == 1) {
+      ssize_t received = recv(fd, response, sizeof(response), 0);
+      if (received >= static_cast<ssize_t>(dns_manager::kDnsHeaderSize) &&
+          dns_manager::GetMessageId(response) == i) {
+        answered = dns_manager::GetRcode(response) ==
+                   dns_manager::kRcodeNoError;
+        break;
+      }
+    }
+    if (answered) {
+      latencies->push_back(
+          std::chrono::duration<double, std::micro>(Clock::now() - start)
+              .count());
+    } else {
+      (*failures)++;
+    }
+    std::this_thread::sleep_until(start + std::chrono::milliseconds(1));
+  }
+  close(fd);
+}
+
+double Percentile(const std::vector<double>& sorted, double fraction) {
+  return sorted[static_cast<size_t>(fraction * (sorted.size() - 1))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+
+  std::vector<dns_manager::SocketAddress> one = Clients(1);
+  std::vector<dns_manager::SocketAddress> fitting = Clients(kCapacity / 2);
+  std::vector<dns_manager::SocketAddress> many = Clients(kCapacity * 10);
+  printf("Allow(), table of %zu:\n", kCapacity);
+  printf("  1 thread,  1 client           %6.1f ns\n",
+         NanosecondsPerAllow(1, one, true));
+  printf("  1 thread,  %5zu clients      %6.1f ns\n", fitting.size(),
+         NanosecondsPerAllow(1, fitting, true));
+  printf("  1 thread,  %5zu clients      %6.1f ns (evicting)\n", many.size(),
+         NanosecondsPerAllow(1, many, true));
+  printf("  4 threads, 1 shared client    %6.1f ns\n",
+         NanosecondsPerAllow(4, one, true));
+  printf("  4 threads, own clients        %6.1f ns\n",
+         NanosecondsPerAllow(4, fitting, false));
+
+  printf("flood from 127.0.0.2, a query a millisecond from 127.0.0.3, %d s\n",
+         seconds);
+  dns_manager::test::StubUpstream upstream;
+  for (bool limited : {false, true}) {
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams.push_back(upstream.address());
+    config.prefetch_fraction = 0;
+    config.max_stale_seconds = 0;
+    if (limited) {
+      config.rate_limit_qps = 1000;
+      config.rate_limit_burst = 200;
+    }
+    dns_manager::LocalResolver resolver(config);
+    std::string error;
+    if (!resolver.Start(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    size_t upstream_before = upstream.queries();
+    std::atomic<bool> stop{false};
+    size_t flood_sent = 0;
+    size_t failures = 0;
+    std::vector<double> latencies;
+    std::thread flood(Flood, resolver.bound_address(), std::cref(stop),
+                      &flood_sent);
+    std::thread client(Resolve, resolver.bound_address(), std::cref(stop),
+                       &latencies, &failures);
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    flood.join();
+    client.join();
+    dns_manager::ResolverStats stats = resolver.Stats();
+    resolver.Stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-9s flood %8zu sent, %8llu limited, upstream %7zu  client "
+           "p50 %7.0f us  p99 %7.0f us  unanswered %zu of %zu\n",
+           limited ? "limited" : "unlimited", flood_sent,
+           static_cast<unsigned long long>(stats.rate_limited_queries),
+           upstream.queries() - upstream_before,
+           latencies.empty() ? 0 : Percentile(latencies, 0.5),
+           latencies.empty() ? 0 : Percentile(latencies, 0.99), failures,
+           failures + latencies.size());
+  }
+  return 0;
+}
@@ -0,0 +1,260 @@
+// Measures reading the network state that plugin instances share, with
+// several processes standing in for apps that embed the plugin.
+//
+// Each process opens the segment and tries to become its owner. The owner
+// publishes a snapshot the size of a busy machine's (four devices, three
+// connections with their DNS settings) every 10 ms, far more often than
+// NetworkManager changes anything; the others read it every 100 us, as if
+// Flutter called getDNS() that often, and try to take over every 100 ms, as
+// the plugin does every second. Halfway through, the owner is killed.
+// Reported per process: the read latency p50 and p99 when the state was
+// unchanged and when it had to be decoded, copies discarded for overlapping
+// a write, reads that found no state and would have fallen back to nmcli,
+// and the longest time without a new state, which includes the takeover.
+// For scale, the cost of spawning one process through popen() is measured
+// too; finding the active connection and its DNS servers without the shared
+// state takes up to four nmcli runs.
+//
+// Usage: shared_network_state_benchmark [processes] [seconds]
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shared_network_state.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr auto kPublishInterval = std::chrono::milliseconds(10);
+constexpr auto kReadInterval = std::chrono::microseconds(100);
+constexpr auto kTakeOverInterval = std::chrono::milliseconds(100);
+
+// What each process reports back, in memory shared with the parent.
+struct Result {
+  std::atomic<pid_t> pid;
+  std::atomic<bool> owner;
+  std::atomic<bool> done;
+  bool took_over;
+  uint64_t reads;
+  uint64_t decodes;
+  uint64_t fallbacks;
+  uint64_t torn_reads;
+  double unchanged_p50_ns;
+  double unchanged_p99_ns;
+  double changed_p50_ns;
+  double changed_p99_ns;
+  double longest_gap_ms;
+};
+
+dns_manager::NetworkSnapshot BusySnapshot(uint64_t generation) {
+  dns_manager::NetworkSnapshot snapshot;
+  snapshot.state = 70;
+  snapshot.connectivity = 4;
+  snapshot.generation = generation;
+  const char* interfaces[] = {"enp3s0", "wlp2s0", "wg0", "lo"};
+  for (const char* interface : interfaces) {
+    dns_manager::NetworkDevice device;
+    device.interface = interface;
+    device.type = 1;
+    device.state = 100;
+    device.connection_uuid =
+        std::string("3e1a6c0e-5b7a-4d1c-9f0a-") + interface + "000000";
+    snapshot.devices.push_back(device);
+  }
+  for (int i = 0; i < 3; i++) {
+    dns_manager::NetworkConnection connection;
+    connection.id = "Connection " + std::to_string(i);
+    connection.uuid = snapshot.devices[i].connection_uuid;
+    connection.type = i == 0 ? "802-3-ethernet" : "802-11-wireless";
+    connection.devices.push_back(snapshot.devices[i].interface);
+    connection.state = 2;
+    connection.is_default = i == 0;
+    connection.has_settings = true;
+    connection.ipv4_dns = {"1.1.1.1", "1.0.0.1"};
+    connection.ipv6_dns = {"2606:4700:4700::1111", "2606:4700:4700::1001"};
+    snapshot.connections.push_back(connection);
+  }
+  return snapshot;
+}
+
+double Percentile(std::vector<double>* values, double fraction) {
+  if (values->empty()) {
+    return 0;
+  }
+  std::sort(values->begin(), values->end());
+  return (*values)[static_cast<size_t>(fraction * (values->size() - 1))];
+}
+
+double Nanoseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::nano>(duration).count();
+}
+
+// Plays one app embedding the plugin until |end|.
+void RunInstance(const std::string& name, Clock::time_point end,
+                 Result* result) {
+  std::string error;
+  std::unique_ptr<dns_manager::SharedNetworkState> state =
+      dns_manager::SharedNetworkState::Open(name, &error);
+  if (state == nullptr) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return;
+  }
+  result->owner = state->TryBecomeOwner();
+  std::vector<double> unchanged;
+  std::vector<double> changed;
+  uint64_t generation = 0;
+  Clock::time_point last_change = Clock::now();
+  Clock::duration longest_gap{};
+  Clock::time_point next_publish = Clock::now();
+  Clock::time_point next_take_over = Clock::now() + kTakeOverInterval;
+  while (Clock::now() < end) {
+    if (state->owner()) {
+      dns_manager::NetworkSnapshot snapshot = BusySnapshot(++generation);
+      state->Publish(&snapshot, "enp3s0");
+      next_publish += kPublishInterval;
+      std::this_thread::sleep_until(next_publish);
+      continue;
+    }
+    if (Clock::now() >= next_take_over) {
+      next_take_over += kTakeOverInterval;
+      if (state->TryBecomeOwner()) {
+        result->took_over = true;
+        next_publish = Clock::now();
+        continue;
+      }
+    }
+    uint64_t seen = 0;
+    Clock::time_point start = Clock::now();
+    state->Read([&](const dns_manager::NetworkSnapshot* snapshot,
+                    const std::string& default_interface) {
+      const dns_manager::NetworkConnection* connection =
+          snapshot != nullptr ? snapshot->PrimaryConnection(default_interface)
+                              : nullptr;
+      seen = connection != nullptr ? snapshot->generation : 0;
+    });
+    Clock::time_point finish = Clock::now();
+    result->reads++;
+    if (seen == 0) {
+      result->fallbacks++;
+    } else if (seen != generation) {
+      changed.push_back(Nanoseconds(finish - start));
+      longest_gap = std::max(longest_gap, finish - last_change);
+      last_change = finish;
+      generation = seen;
+    } else {
+      unchanged.push_back(Nanoseconds(finish - start));
+    }
+    std::this_thread::sleep_for(kReadInterval);
+  }
+  result->decodes = changed.size();
+  result->torn_reads = state->torn_reads();
+  result->unchanged_p50_ns = Percentile(&unchanged, 0.5);
+  result->unchanged_p99_ns = Percentile(&unchanged, 0.99);
+  result->changed_p50_ns = Percentile(&changed, 0.5);
+  result->changed_p99_ns = Percentile(&changed, 0.99);
+  result->longest_gap_ms =
+      std::chrono::duration<double, std::milli>(longest_gap).count();
+}
+
+// Microseconds to run /bin/true through popen(), as the nmcli fallback
+// runs nmcli.
+double SpawnMicroseconds() {
+  const int kSpawns = 50;
+  Clock::time_point start = Clock::now();
+  for (int i = 0; i < kSpawns; i++) {
+    FILE* pipe = popen("/bin/true", "r");
+    if (pipe != nullptr) {
+      pclose(pipe);
+    }
+  }
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+             .count() /
+         kSpawns;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int processes = argc > 1 ? atoi(argv[1]) : 4;
+  int seconds = argc > 2 ? atoi(argv[2]) : 4;
+  std::string name = "/dns_manager-benchmark-" + std::to_string(getpid());
+  dns_manager::SharedNetworkState::Remove(name);
+
+  void* memory = mmap(nullptr, sizeof(Result) * processes,
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1,
+                      0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  Result* results = new (memory) Result[processes]();
+  Clock::time_point end = Clock::now() + std::chrono::seconds(seconds);
+  for (int i = 0; i < processes; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      RunInstance(name, end, &results[i]);
+      results[i].done = true;
+      _exit(0);
+    }
+    results[i].pid = pid;
+  }
+
+  // Off the takeover schedule, so that the gap shows the wait for the next
+  // attempt.
+  auto kill_after = std::chrono::milliseconds(seconds * 500 + 50);
+  std::this_thread::sleep_until(end - std::chrono::seconds(seconds) +
+                                kill_after);
+  for (int i = 0; i < processes; i++) {
+    if (results[i].owner) {
+      kill(results[i].pid, SIGKILL);
+    }
+  }
+  for (int i = 0; i < processes; i++) {
+    waitpid(results[i].pid, nullptr, 0);
+  }
+  dns_manager::SharedNetworkState::Remove(name);
+
+  printf("%d processes, %d s, owner killed after %lld ms\n", processes,
+         seconds, static_cast<long long>(kill_after.count()));
+  printf("%-22s %8s %8s %18s %18s %6s %9s %8s\n", "process", "reads",
+         "decodes", "unchanged p50/p99", "changed p50/p99", "torn",
+         "fallbacks", "gap");
+  uint64_t fallbacks = 0;
+  for (int i = 0; i < processes; i++) {
+    const Result& result = results[i];
+    std::string role = result.owner ? "owner (killed)"
+                       : result.took_over ? "reader, took over"
+                                          : "reader";
+    if (!result.done && !result.owner) {
+      role += " (failed)";
+    }
+    printf("%-22s %8llu %8llu %7.0f/%7.0f ns %7.0f/%7.0f ns %6llu %9llu "
+           "%5.0f ms\n",
+           role.c_str(), static_cast<unsigned long long>(result.reads),
+           static_cast<unsigned long long>(result.decodes),
+           result.unchanged_p50_ns, result.unchanged_p99_ns,
+           result.changed_p50_ns, result.changed_p99_ns,
+           static_cast<unsigned long long>(result.torn_reads),
+           static_cast<unsigned long long>(result.fallbacks),
+           result.longest_gap_ms);
+    fallbacks += result.fallbacks;
+  }
+  printf("nmcli fallbacks in all processes: %llu\n",
+         static_cast<unsigned long long>(fallbacks));
+  printf("one process spawn through popen(): %.0f us\n", SpawnMicroseconds());
+  return 0;
+}
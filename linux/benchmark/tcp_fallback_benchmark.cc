@@ -0,0 +1,135 @@
+// Measures what a truncated answer costs a client, with and without the
+// resolver's pooled upstream TCP connection.
+//
+// The stub upstream answers every name with enough A records that the UDP
+// answer comes back truncated. For each of a run of distinct names, so that
+// nothing is answered from cache, a client asks over UDP, gets the truncated
+// answer, and asks again over its own TCP connection to the resolver, which
+// goes to the upstream over TCP. Pooled runs keep one upstream connection
+// open for every name; unpooled runs close it as soon as it goes quiet, so
+// each name pays for a TCP handshake to the upstream. Reported per mode: the
+// p50, p99 and mean latency of the whole UDP-then-TCP exchange, and the
+// upstream connections opened.
+//
+// Usage: tcp_fallback_benchmark [names] [answer_records]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "local_resolver.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Reads one length-prefixed message from the blocking TCP socket |fd|.
+bool ReceiveTcp(int fd, uint8_t* response, size_t capacity) {
+  uint8_t prefix[2];
+  if (recv(fd, prefix, sizeof(prefix), MSG_WAITALL) != 2) {
+    return false;
+  }
+  size_t length = static_cast<size_t>(prefix[0]) << 8 | prefix[1];
+  return length <= capacity &&
+         recv(fd, response, length, MSG_WAITALL) ==
+             static_cast<ssize_t>(length);
+}
+
+// Resolves |names| names one after another and returns each exchange's
+// latency in microseconds, or an empty vector if one fails.
+std::vector<double> Run(const dns_manager::SocketAddress& resolver,
+                        size_t names, const std::string& prefix) {
+  int udp = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  connect(udp, resolver.sockaddr_ptr(), resolver.length);
+  int tcp = socket(resolver.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+  timeval timeout = {2, 0};
+  setsockopt(tcp, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  connect(tcp, resolver.sockaddr_ptr(), resolver.length);
+
+  std::vector<double> latencies;
+  std::vector<uint8_t> response(dns_manager::kMaxTcpMessageSize);
+  uint8_t query[512 + 2];
+  for (size_t i = 0; i < names; i++) {
+    std::string name = prefix + std::to_string(i) + ".example.com";
+    size_t length = dns_manager::test::MakeQuery(
+        name.c_str(), static_cast<uint16_t>(i), 1, query + 2);
+    auto start = Clock::now();
+    send(udp, query + 2, length, 0);
+    pollfd poll_fd = {udp, POLLIN, 0};
+    if (poll(&poll_fd, 1, 2000) != 1 ||
+        recv(udp, response.data(), response.size(), 0) <= 0 ||
+        !dns_manager::IsTruncated(response.data())) {
+      latencies.clear();
+      break;
+    }
+    query[0] = static_cast<uint8_t>(length >> 8);
+    query[1] = static_cast<uint8_t>(length);
+    send(tcp, query, length + 2, 0);
+    if (!ReceiveTcp(tcp, response.data(), response.size())) {
+      latencies.clear();
+      break;
+    }
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count());
+  }
+  close(udp);
+  close(tcp);
+  return latencies;
+}
+
+double Percentile(std::vector<double> values, double fraction) {
+  std::sort(values.begin(), values.end());
+  return values[static_cast<size_t>(fraction * (values.size() - 1))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t names = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 2000;
+  size_t records = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 60;
+  dns_manager::test::StubUpstream upstream(3600);
+  upstream.set_answer_count(records);
+
+  printf("%zu names, %zu A records per answer\n", names, records);
+  for (bool pooled : {false, true}) {
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams.push_back(upstream.address());
+    config.prefetch_fraction = 0;
+    if (!pooled) {
+      config.upstream_tcp_idle_timeout_ms = 0;
+    }
+    dns_manager::LocalResolver resolver(config);
+    std::string error;
+    if (!resolver.Start(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    std::vector<double> latencies =
+        Run(resolver.bound_address(), names, pooled ? "pooled" : "unpooled");
+    if (latencies.empty()) {
+      fprintf(stderr, "query failed\n");
+      return 1;
+    }
+    double total = 0;
+    for (double latency : latencies) {
+      total += latency;
+    }
+    printf("%-8s p50=%7.1f us  p99=%7.1f us  mean=%7.1f us  "
+           "upstream connections=%llu\n",
+           pooled ? "pooled" : "unpooled", Percentile(latencies, 0.5),
+           Percentile(latencies, 0.99), total / latencies.size(),
+           static_cast<unsigned long long>(
+               resolver.Stats().upstream_tcp_connections));
+  }
+  return 0;
+}
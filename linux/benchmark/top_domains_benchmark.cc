@@ -0,0 +1,92 @@
+// Measures TopDomainsSketch update cost and shows that its memory does not
+// grow with the number of queries. Query names follow a Zipf(1.0)
+// distribution over one million distinct names, which roughly matches DNS
+// popularity curves.
+//
+// Usage: top_domains_benchmark [capacity] [updates]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "top_domains.h"
+
+namespace {
+
+constexpr size_t kDistinctNames = 1000000;
+
+// Inverse-CDF sampler over ranks 1..n with P(rank) proportional to 1/rank.
+class ZipfSampler {
+ public:
+  explicit ZipfSampler(size_t n) : cdf_(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += 1.0 / static_cast<double>(i + 1);
+      cdf_[i] = sum;
+    }
+    for (double& value : cdf_) {
+      value /= sum;
+    }
+  }
+
+  size_t Sample(std::mt19937_64& random) {
+    double u = std::uniform_real_distribution<double>(0, 1)(random);
+    return std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin();
+  }
+
+ private:
+  std::vector<double> cdf_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  size_t capacity = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1024;
+  size_t updates = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000000;
+
+  std::vector<std::string> names(kDistinctNames);
+  for (size_t i = 0; i < kDistinctNames; i++) {
+    names[i] = "host" + std::to_string(i) + ".example.com";
+  }
+  // Pre-sample the stream so the timed loop only measures the sketch.
+  std::mt19937_64 random(42);
+  ZipfSampler zipf(kDistinctNames);
+  std::vector<uint32_t> stream(updates);
+  for (uint32_t& rank : stream) {
+    rank = static_cast<uint32_t>(zipf.Sample(random));
+  }
+
+  dns_manager::TopDomainsSketch sketch(capacity, 600);
+  printf("capacity=%zu memory=%zu bytes\n", capacity, sketch.memory_bytes());
+
+  // Ten simulated seconds per million updates so decay is exercised.
+  auto start = std::chrono::steady_clock::now();
+  size_t report = updates / 4;
+  for (size_t i = 0; i < updates; i++) {
+    const std::string& name = names[stream[i]];
+    sketch.Add(name.data(), name.size(), i / 100000.0);
+    if (report > 0 && (i + 1) % report == 0) {
+      printf("after %zu updates: memory=%zu bytes\n", i + 1,
+             sketch.memory_bytes());
+    }
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  printf("updates=%zu time=%.3f s  %.1f ns/update  %.2f M updates/s\n",
+         updates, seconds, seconds * 1e9 / updates, updates / seconds / 1e6);
+
+  std::vector<dns_manager::DomainCount> top =
+      sketch.Top(10, updates / 100000.0);
+  printf("top 10 (expected host0..host9 in order):\n");
+  for (const dns_manager::DomainCount& domain : top) {
+    printf("  %-24s count=%.1f error=%.1f\n", domain.name.c_str(),
+           domain.count, domain.error);
+  }
+  return 0;
+}
@@ -0,0 +1,262 @@
+// Measures what adaptive upstream selection saves clients when the first
+// configured upstream is fast but unreliable.
+//
+// Two in-process UDP upstreams answer after a latency drawn per query: the
+// first usually in 2 ms, the second in 8 ms. The first also spikes to
+// 250 ms on 2% of queries, drops 3% of them, and is down entirely for one
+// second in every five. Client threads resolve distinct names, so that
+// nothing comes from cache, once with the servers tried in list order and
+// a fixed timeout, and once with adaptive selection. Reported per mode: the
+// p50, p99 and maximum latency a client saw, failed queries, and the share
+// of queries each upstream received.
+//
+// Usage: upstream_selection_benchmark [seconds] [clients]
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns_message.h"
+#include "local_resolver.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Behaviour {
+  int latency_ms;
+  int spike_ms;
+  double spike_fraction;
+  double drop_fraction;
+  // Down for the first |outage_ms| of every |outage_period_ms|; 0 for never.
+  int outage_ms;
+  int outage_period_ms;
+};
+
+// A loopback UDP upstream whose answers are delayed, or dropped, according
+// to a Behaviour. Unlike StubUpstream, delayed answers do not hold up the
+// ones behind them.
+class FlakyUpstream {
+ public:
+  FlakyUpstream(const Behaviour& behaviour, unsigned seed)
+      : behaviour_(behaviour), random_(seed) {
+    dns_manager::SocketAddress::Parse("127.0.0.1", 0, &address_);
+    fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    bind(fd_, address_.sockaddr_ptr(), address_.length);
+    address_.length = sizeof(address_.storage);
+    getsockname(fd_, address_.sockaddr_ptr(), &address_.length);
+    start_ = Clock::now();
+    thread_ = std::thread(&FlakyUpstream::Run, this);
+  }
+
+  ~FlakyUpstream() {
+    running_ = false;
+    thread_.join();
+    close(fd_);
+  }
+
+  const dns_manager::SocketAddress& address() const { return address_; }
+  size_t queries() const { return queries_; }
+  void ResetQueries() { queries_ = 0; }
+
+ private:
+  struct Answer {
+    Clock::time_point due;
+    dns_manager::SocketAddress client;
+    std::vector<uint8_t> message;
+    bool operator>(const Answer& other) const { return due > other.due; }
+  };
+
+  void Run() {
+    std::priority_queue<Answer, std::vector<Answer>, std::greater<Answer>>
+        answers;
+    uint8_t buffer[dns_manager::kMaxUdpMessageSize];
+    while (running_) {
+      int timeout_ms = 20;
+      if (!answers.empty()) {
+        timeout_ms = static_cast<int>(std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                   answers.top().due - Clock::now())
+                   .count()));
+        timeout_ms = std::min(timeout_ms, 20);
+      }
+      pollfd poll_fd = {fd_, POLLIN, 0};
+      if (poll(&poll_fd, 1, timeout_ms) == 1) {
+        Answer answer;
+        answer.client.length = sizeof(answer.client.storage);
+        ssize_t received = recvfrom(fd_, buffer, sizeof(buffer), 0,
+                                    answer.client.sockaddr_ptr(),
+                                    &answer.client.length);
+        if (received >= static_cast<ssize_t>(dns_manager::kDnsHeaderSize)) {
+          queries_++;
+          int delay_ms = Delay();
+          if (delay_ms >= 0) {
+            answer.message = AnswerTo(buffer, static_cast<size_t>(received));
+            answer.due = Clock::now() + std::chrono::milliseconds(delay_ms);
+            answers.push(std::move(answer));
+          }
+        }
+      }
+      Clock::time_point now = Clock::now();
+      while (!answers.empty() && answers.top().due <= now) {
+        const Answer& answer = answers.top();
+        sendto(fd_, answer.message.data(), answer.message.size(), 0,
+               answer.client.sockaddr_ptr(), answer.client.length);
+        answers.pop();
+      }
+    }
+  }
+
+  // How long to hold the next answer back, or -1 to drop it.
+  int Delay() {
+    if (behaviour_.outage_period_ms > 0) {
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         Clock::now() - start_)
+                         .count();
+      if (elapsed % behaviour_.outage_period_ms < behaviour_.outage_ms) {
+        return -1;
+      }
+    }
+    double draw = std::uniform_real_distribution<double>(0, 1)(random_);
+    if (draw < behaviour_.drop_fraction) {
+      return -1;
+    }
+    if (draw < behaviour_.drop_fraction + behaviour_.spike_fraction) {
+      return behaviour_.spike_ms;
+    }
+    return behaviour_.latency_ms;
+  }
+
+  // One A record, 192.0.2.1, TTL 300.
+  static std::vector<uint8_t> AnswerTo(const uint8_t* query, size_t length) {
+    static const uint8_t kRecord[] = {0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01,
+                                      0x00, 0x00, 0x01, 0x2c, 0x00, 0x04,
+                                      192,  0,    2,    1};
+    std::vector<uint8_t> answer(query, query + length);
+    answer.insert(answer.end(), kRecord, kRecord + sizeof(kRecord));
+    answer[2] |= 0x80;
+    answer[3] = 0x80;
+    dns_manager::WriteU16(answer.data() + 6, 1);
+    return answer;
+  }
+
+  const Behaviour behaviour_;
+  std::mt19937 random_;
+  dns_manager::SocketAddress address_;
+  int fd_ = -1;
+  Clock::time_point start_;
+  std::atomic<bool> running_{true};
+  std::atomic<size_t> queries_{0};
+  std::thread thread_;
+};
+
+// Resolves distinct names one after another until |stop|, adding each
+// latency in microseconds to |latencies| and each unanswered or failed query
+// to |failures|.
+void Resolve(const dns_manager::SocketAddress& resolver, int client,
+             const std::string& prefix, const std::atomic<bool>& stop,
+             std::vector<double>* latencies, std::atomic<size_t>* failures) {
+  int fd = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  connect(fd, resolver.sockaddr_ptr(), resolver.length);
+  uint8_t query[512];
+  uint8_t response[dns_manager::kMaxUdpMessageSize];
+  for (uint16_t i = 0; !stop; i++) {
+    std::string name = prefix + std::to_string(client) + "-" +
+                       std::to_string(i) + ".example.com";
+    size_t length = dns_manager::test::MakeQuery(name.c_str(), i, 1, query);
+    auto start = Clock::now();
+    send(fd, query, length, 0);
+    pollfd poll_fd = {fd, POLLIN, 0};
+    if (poll(&poll_fd, 1, 5000) != 1 ||
+        recv(fd, response, sizeof(response), 0) <
+            static_cast<ssize_t>(dns_manager::kDnsHeaderSize) ||
+        dns_manager::GetRcode(response) != dns_manager::kRcodeNoError) {
+      (*failures)++;
+      continue;
+    }
+    latencies->push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count());
+  }
+  close(fd);
+}
+
+double Percentile(const std::vector<double>& sorted, double fraction) {
+  return sorted[static_cast<size_t>(fraction * (sorted.size() - 1))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 10;
+  int clients = argc > 2 ? atoi(argv[2]) : 8;
+
+  FlakyUpstream flaky({2, 250, 0.02, 0.03, 1000, 5000}, 1);
+  FlakyUpstream steady({8, 0, 0, 0, 0, 0}, 2);
+  printf("%d s, %d clients; first upstream 2 ms, 2%% spikes to 250 ms, "
+         "3%% drops, down 1 s in 5; second 8 ms\n",
+         seconds, clients);
+  for (bool adaptive : {false, true}) {
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams = {flaky.address(), steady.address()};
+    config.upstream_timeout_ms = 500;
+    config.adaptive_upstreams = adaptive;
+    config.prefetch_fraction = 0;
+    dns_manager::LocalResolver resolver(config);
+    std::string error;
+    if (!resolver.Start(&error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    flaky.ResetQueries();
+    steady.ResetQueries();
+
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> failures{0};
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+      threads.emplace_back(Resolve, resolver.bound_address(), i,
+                           adaptive ? "adaptive" : "fixed", std::cref(stop),
+                           &latencies[i], &failures);
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    resolver.Stop();
+
+    std::vector<double> all;
+    for (const std::vector<double>& client : latencies) {
+      all.insert(all.end(), client.begin(), client.end());
+    }
+    if (all.empty()) {
+      fprintf(stderr, "no query was answered\n");
+      return 1;
+    }
+    std::sort(all.begin(), all.end());
+    double sent = static_cast<double>(flaky.queries() + steady.queries());
+    printf("%-8s queries=%6zu  p50=%7.1f ms  p99=%7.1f ms  max=%7.1f ms  "
+           "failed=%zu  to first/second=%.0f%%/%.0f%%\n",
+           adaptive ? "adaptive" : "fixed", all.size(),
+           Percentile(all, 0.5) / 1000, Percentile(all, 0.99) / 1000,
+           all.back() / 1000, failures.load(),
+           100 * flaky.queries() / sent, 100 * steady.queries() / sent);
+  }
+  return 0;
+}
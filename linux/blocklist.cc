@@ -0,0 +1,495 @@
+#include "blocklist.h"
+
+#include <strings.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+#include "checksum.h"
+#include "file_util.h"
+#include "hash.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr char kFileMagic[8] = {'D', 'N', 'S', 'M', 'B', 'L', 'K', '\0'};
+constexpr size_t kBloomBlockBytes = 64;
+constexpr size_t kBloomBitsPerRule = 12;
+constexpr int kBloomProbes = 6;
+// Aim for this many rules per bucket.
+constexpr size_t kRulesPerBucket = 4;
+constexpr unsigned kMaxBucketBits = 28;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bucket_bits;
+  uint64_t entry_count;
+  uint64_t bloom_blocks;
+  // CRC-32C of this header with |crc| zeroed.
+  uint32_t crc;
+  uint32_t reserved;
+  // Keeps the Bloom filter that follows cache-line aligned.
+  uint8_t padding[24];
+};
+
+static_assert(sizeof(FileHeader) == 64, "unexpected FileHeader padding");
+
+// Names a hosts file maps for the machine itself rather than to block.
+const char* const kLocalNames[] = {
+    "localhost",     "localhost.localdomain", "local",
+    "broadcasthost", "ip6-localhost",         "ip6-loopback",
+    "ip6-localnet",  "ip6-mcastprefix",       "ip6-allnodes",
+    "ip6-allrouters", "ip6-allhosts",         "0.0.0.0",
+};
+
+uint64_t RuleValue(const char* name, size_t length,
+                   BlocklistBuilder::Match match) {
+  return (HashBytes(name, length) & ~static_cast<uint64_t>(1)) |
+         (match == BlocklistBuilder::Match::kSubdomains ? 1 : 0);
+}
+
+size_t BucketFor(uint64_t value, unsigned bucket_bits) {
+  return bucket_bits == 0 ? 0 : static_cast<size_t>(value >> (64 - bucket_bits));
+}
+
+// The filter block and the bit positions inside it for |value|.
+size_t BloomBlock(uint64_t value, size_t mask, uint64_t* positions) {
+  uint64_t hash = MixHash(value);
+  *positions = MixHash(hash ^ 0x9e3779b97f4a7c15ULL);
+  return static_cast<size_t>(hash) & mask;
+}
+
+size_t BucketTableBytes(unsigned bucket_bits) {
+  size_t bytes = ((static_cast<size_t>(1) << bucket_bits) + 1) * sizeof(uint32_t);
+  return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t HeaderCrc(FileHeader header) {
+  header.crc = 0;
+  return Crc32c(&header, sizeof(header));
+}
+
+bool IsAddress(const char* token, size_t length) {
+  bool digits_and_dots = true;
+  for (size_t i = 0; i < length; i++) {
+    if (token[i] == ':') {
+      return true;
+    }
+    if (token[i] != '.' && (token[i] < '0' || token[i] > '9')) {
+      digits_and_dots = false;
+    }
+  }
+  return digits_and_dots;
+}
+
+bool IsLocalName(const char* name, size_t length) {
+  for (const char* local : kLocalNames) {
+    if (strlen(local) == length && strncasecmp(local, name, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Advances |*position| past the next whitespace-separated token of |line|.
+bool NextToken(const char* line, size_t length, size_t* position,
+               const char** token, size_t* token_length) {
+  size_t start = *position;
+  while (start < length && (line[start] == ' ' || line[start] == '\t' ||
+                            line[start] == '\r' || line[start] == '\n')) {
+    start++;
+  }
+  size_t end = start;
+  while (end < length && line[end] != ' ' && line[end] != '\t' &&
+         line[end] != '\r' && line[end] != '\n') {
+    end++;
+  }
+  *position = end;
+  *token = line + start;
+  *token_length = end - start;
+  return end > start;
+}
+
+// Whether |has| accepts a rule that covers |name|.
+template <typename HasRule>
+bool MatchName(const char* name, size_t length, HasRule has) {
+  // The full name can match an exact rule or one covering its subdomains...
+  if (has(RuleValue(name, length, BlocklistBuilder::Match::kExact))) {
+    return true;
+  }
+  // ...and each parent only a rule covering its subdomains.
+  for (size_t start = 0; start < length; start++) {
+    if (name[start] == '.' && start + 1 < length &&
+        has(RuleValue(name + start + 1, length - start - 1,
+                      BlocklistBuilder::Match::kSubdomains))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SortedContains(const std::vector<uint64_t>& values, uint64_t value) {
+  return !values.empty() &&
+         std::binary_search(values.begin(), values.end(), value);
+}
+
+// |values| without the sorted |drop|.
+std::vector<uint64_t> SortedDifference(const std::vector<uint64_t>& values,
+                                       const std::vector<uint64_t>& drop) {
+  std::vector<uint64_t> result;
+  std::set_difference(values.begin(), values.end(), drop.begin(), drop.end(),
+                      std::back_inserter(result));
+  return result;
+}
+
+std::vector<uint64_t> SortedUnion(const std::vector<uint64_t>& a,
+                                  const std::vector<uint64_t>& b) {
+  std::vector<uint64_t> result;
+  std::set_union(a.begin(), a.end(), b.begin(), b.end(),
+                 std::back_inserter(result));
+  return result;
+}
+
+// Adds a "+rule" or "-rule" delta line to the matching builder.
+void AddDeltaLine(const char* line, size_t length, BlocklistBuilder* added,
+                  BlocklistBuilder* removed) {
+  if (length > 0 && line[0] == '-') {
+    removed->AddLine(line + 1, length - 1);
+  } else if (length > 0 && line[0] == '+') {
+    added->AddLine(line + 1, length - 1);
+  } else {
+    added->AddLine(line, length);
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<Blocklist> Blocklist::Open(const std::string& path,
+                                           std::string* error) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path, error);
+  if (!file) {
+    return nullptr;
+  }
+
+  FileHeader header;
+  const char* problem = nullptr;
+  if (file->size() < sizeof(header)) {
+    problem = "truncated header";
+  } else {
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+      problem = "not a blocklist index";
+    } else if (header.version != kVersion) {
+      problem = "unsupported blocklist version";
+    } else if (HeaderCrc(header) != header.crc) {
+      problem = "header checksum mismatch";
+    } else if (header.bucket_bits > kMaxBucketBits ||
+               header.bloom_blocks == 0 ||
+               (header.bloom_blocks & (header.bloom_blocks - 1)) != 0 ||
+               header.bloom_blocks > (file->size() >> 6) ||
+               header.entry_count > (file->size() >> 3) ||
+               file->size() != sizeof(header) +
+                                   header.bloom_blocks * kBloomBlockBytes +
+                                   BucketTableBytes(header.bucket_bits) +
+                                   header.entry_count * sizeof(uint64_t)) {
+      problem = "size does not match header";
+    }
+  }
+  if (problem != nullptr) {
+    *error = path + ": " + problem;
+    return nullptr;
+  }
+  return std::unique_ptr<Blocklist>(
+      new Blocklist(std::move(file), header.entry_count, header.bucket_bits,
+                    header.bloom_blocks));
+}
+
+Blocklist::Blocklist(std::unique_ptr<MappedFile> file, size_t entry_count,
+                     unsigned bucket_bits, size_t bloom_blocks)
+    : file_(std::move(file)),
+      entry_count_(entry_count),
+      bucket_bits_(bucket_bits),
+      bloom_mask_(bloom_blocks - 1) {
+  const uint8_t* data = file_->data() + sizeof(FileHeader);
+  bloom_ = reinterpret_cast<const uint64_t*>(data);
+  data += bloom_blocks * kBloomBlockBytes;
+  buckets_ = reinterpret_cast<const uint32_t*>(data);
+  data += BucketTableBytes(bucket_bits);
+  entries_ = reinterpret_cast<const uint64_t*>(data);
+}
+
+Blocklist::~Blocklist() = default;
+
+size_t Blocklist::file_size() const { return file_->size(); }
+
+bool Blocklist::Has(uint64_t value) const {
+  uint64_t positions;
+  const uint64_t* block =
+      bloom_ + BloomBlock(value, bloom_mask_, &positions) * 8;
+  for (int probe = 0; probe < kBloomProbes; probe++) {
+    unsigned bit = static_cast<unsigned>(positions >> (probe * 9)) & 511;
+    if ((block[bit >> 6] & (static_cast<uint64_t>(1) << (bit & 63))) == 0) {
+      return false;
+    }
+  }
+  size_t bucket = BucketFor(value, bucket_bits_);
+  size_t begin = std::min<size_t>(buckets_[bucket], entry_count_);
+  size_t end = std::min<size_t>(buckets_[bucket + 1], entry_count_);
+  return begin < end &&
+         std::binary_search(entries_ + begin, entries_ + end, value);
+}
+
+bool Blocklist::Contains(const char* name, size_t length) const {
+  return MatchName(name, length,
+                   [this](uint64_t value) { return Has(value); });
+}
+
+bool BlocklistBuilder::AddDomain(const char* name, size_t length,
+                                 Match match) {
+  if (length > 0 && name[length - 1] == '.') {
+    length--;
+  }
+  if (length == 0 || length > 253) {
+    return false;
+  }
+  char normalised[253];
+  size_t label_length = 0;
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c + 32);
+    }
+    if (c == '.') {
+      if (label_length == 0) {
+        return false;
+      }
+      label_length = 0;
+    } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '_') {
+      if (++label_length > 63) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    normalised[i] = c;
+  }
+  if (label_length == 0) {
+    return false;
+  }
+  values_.push_back(RuleValue(normalised, length, match));
+  return true;
+}
+
+size_t BlocklistBuilder::AddLine(const char* line, size_t length) {
+  const char* comment = static_cast<const char*>(memchr(line, '#', length));
+  if (comment != nullptr) {
+    length = comment - line;
+  }
+  size_t position = 0;
+  const char* token;
+  size_t token_length;
+  if (!NextToken(line, length, &position, &token, &token_length) ||
+      token[0] == '!' || token[0] == '[') {
+    return 0;
+  }
+
+  if (token_length > 2 && token[0] == '|' && token[1] == '|') {
+    // Adblock-style "||example.com^"; rules with options or paths are not
+    // domain rules and are skipped.
+    const char* name = token + 2;
+    size_t name_length = token_length - 2;
+    if (name[name_length - 1] == '^') {
+      name_length--;
+    }
+    if (!AddDomain(name, name_length, Match::kExact)) {
+      return 0;
+    }
+    AddDomain(name, name_length, Match::kSubdomains);
+    return 2;
+  }
+
+  if (IsAddress(token, token_length)) {
+    size_t added = 0;
+    while (NextToken(line, length, &position, &token, &token_length)) {
+      if (!IsLocalName(token, token_length) &&
+          AddDomain(token, token_length, Match::kExact)) {
+        added++;
+      }
+    }
+    return added;
+  }
+
+  // A domain list has one name per line.
+  const char* extra;
+  size_t extra_length;
+  if (NextToken(line, length, &position, &extra, &extra_length)) {
+    return 0;
+  }
+  if (token_length > 2 && token[0] == '*' && token[1] == '.') {
+    return AddDomain(token + 2, token_length - 2, Match::kSubdomains) ? 1 : 0;
+  }
+  return AddDomain(token, token_length, Match::kExact) ? 1 : 0;
+}
+
+bool BlocklistBuilder::AddFile(const std::string& path, std::string* error) {
+  FILE* file = fopen(path.c_str(), "re");
+  if (file == nullptr) {
+    *error = "open " + path + ": " + strerror(errno);
+    return false;
+  }
+  char* line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) >= 0) {
+    AddLine(line, static_cast<size_t>(length));
+  }
+  free(line);
+  fclose(file);
+  return true;
+}
+
+std::vector<uint64_t> BlocklistBuilder::TakeRules() {
+  std::sort(values_.begin(), values_.end());
+  values_.erase(std::unique(values_.begin(), values_.end()), values_.end());
+  return std::move(values_);
+}
+
+std::vector<uint8_t> BlocklistBuilder::Build() {
+  std::sort(values_.begin(), values_.end());
+  values_.erase(std::unique(values_.begin(), values_.end()), values_.end());
+  size_t count = values_.size();
+
+  unsigned bucket_bits = 0;
+  while (bucket_bits < kMaxBucketBits &&
+         (static_cast<size_t>(kRulesPerBucket) << (bucket_bits + 1)) <= count) {
+    bucket_bits++;
+  }
+  size_t bloom_blocks = 1;
+  while (bloom_blocks * kBloomBlockBytes * 8 < count * kBloomBitsPerRule) {
+    bloom_blocks *= 2;
+  }
+
+  size_t bloom_offset = sizeof(FileHeader);
+  size_t buckets_offset = bloom_offset + bloom_blocks * kBloomBlockBytes;
+  size_t entries_offset = buckets_offset + BucketTableBytes(bucket_bits);
+  std::vector<uint8_t> image(entries_offset + count * sizeof(uint64_t));
+
+  uint64_t* bloom = reinterpret_cast<uint64_t*>(image.data() + bloom_offset);
+  uint32_t* buckets = reinterpret_cast<uint32_t*>(image.data() + buckets_offset);
+  size_t bucket = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint64_t value = values_[i];
+    uint64_t positions;
+    uint64_t* block = bloom + BloomBlock(value, bloom_blocks - 1, &positions) * 8;
+    for (int probe = 0; probe < kBloomProbes; probe++) {
+      unsigned bit = static_cast<unsigned>(positions >> (probe * 9)) & 511;
+      block[bit >> 6] |= static_cast<uint64_t>(1) << (bit & 63);
+    }
+    // Buckets up to this value's start where it does.
+    size_t value_bucket = BucketFor(value, bucket_bits);
+    while (bucket <= value_bucket) {
+      buckets[bucket++] = static_cast<uint32_t>(i);
+    }
+  }
+  while (bucket <= (static_cast<size_t>(1) << bucket_bits)) {
+    buckets[bucket++] = static_cast<uint32_t>(count);
+  }
+  memcpy(image.data() + entries_offset, values_.data(),
+         count * sizeof(uint64_t));
+
+  FileHeader header = {};
+  memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = Blocklist::kVersion;
+  header.bucket_bits = bucket_bits;
+  header.entry_count = count;
+  header.bloom_blocks = bloom_blocks;
+  header.crc = HeaderCrc(header);
+  memcpy(image.data(), &header, sizeof(header));
+  return image;
+}
+
+std::unique_ptr<BlocklistDelta> BlocklistDelta::Load(const std::string& path,
+                                                     std::string* error) {
+  FILE* file = fopen(path.c_str(), "re");
+  if (file == nullptr) {
+    *error = "open " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  BlocklistBuilder added;
+  BlocklistBuilder removed;
+  char* line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) >= 0) {
+    AddDeltaLine(line, static_cast<size_t>(length), &added, &removed);
+  }
+  free(line);
+  fclose(file);
+  return FromBuilders(&added, &removed);
+}
+
+std::unique_ptr<BlocklistDelta> BlocklistDelta::Parse(const std::string& text) {
+  BlocklistBuilder added;
+  BlocklistBuilder removed;
+  std::istringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    AddDeltaLine(line.data(), line.size(), &added, &removed);
+  }
+  return FromBuilders(&added, &removed);
+}
+
+std::unique_ptr<BlocklistDelta> BlocklistDelta::FromBuilders(
+    BlocklistBuilder* added, BlocklistBuilder* removed) {
+  std::unique_ptr<BlocklistDelta> delta(new BlocklistDelta());
+  delta->removed_ = removed->TakeRules();
+  // A rule both added and removed in one file counts as removed.
+  delta->added_ = SortedDifference(added->TakeRules(), delta->removed_);
+  return delta;
+}
+
+std::unique_ptr<BlocklistDelta> BlocklistDelta::Apply(
+    const BlocklistDelta& newer) const {
+  std::unique_ptr<BlocklistDelta> merged(new BlocklistDelta());
+  merged->added_ = SortedUnion(SortedDifference(added_, newer.removed_),
+                               newer.added_);
+  merged->removed_ = SortedUnion(SortedDifference(removed_, newer.added_),
+                                 newer.removed_);
+  return merged;
+}
+
+bool BlocklistView::Has(uint64_t value) const {
+  if (delta_) {
+    if (SortedContains(delta_->added_, value)) {
+      return true;
+    }
+    if (SortedContains(delta_->removed_, value)) {
+      return false;
+    }
+  }
+  return base_ && base_->Has(value);
+}
+
+bool BlocklistView::Contains(const char* name, size_t length) const {
+  return MatchName(name, length,
+                   [this](uint64_t value) { return Has(value); });
+}
+
+size_t BlocklistView::size() const {
+  size_t base = base_ ? base_->size() : 0;
+  if (!delta_) {
+    return base;
+  }
+  size_t removed = std::min(base, delta_->removed());
+  return base - removed + delta_->added();
+}
+
+}  // namespace dns_manager
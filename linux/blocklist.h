@@ -0,0 +1,168 @@
+#ifndef DNS_MANAGER_BLOCKLIST_H_
+#define DNS_MANAGER_BLOCKLIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dns_manager {
+
+class BlocklistView;
+class MappedFile;
+
+// A compiled domain blocklist, read through mmap.
+//
+// Each rule is stored as the 64-bit hash of the domain name, with the lowest
+// bit saying whether it matches the name itself or only names below it. The
+// file holds a blocked Bloom filter (one 64-byte block per lookup), a bucket
+// table indexed by the top bits of the hash, and the sorted hashes, so a
+// lookup probes the filter for each suffix of the query name and binary
+// searches a handful of entries only when the filter says yes. At about ten
+// bytes per rule the index is a fraction of the text list it came from.
+// Different names sharing a 64-bit hash is possible but vanishingly rare
+// (about n / 2^64 per lookup).
+class Blocklist {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  // Maps a file written by BlocklistBuilder. Returns nullptr and sets
+  // |error| if it is missing, from another version or damaged.
+  static std::unique_ptr<Blocklist> Open(const std::string& path,
+                                         std::string* error);
+
+  ~Blocklist();
+
+  Blocklist(const Blocklist&) = delete;
+  Blocklist& operator=(const Blocklist&) = delete;
+
+  // Whether the lower-case |name| (no trailing dot) is blocked, either by an
+  // exact rule or by a rule covering one of its parent domains. Thread-safe.
+  bool Contains(const char* name, size_t length) const;
+
+  size_t size() const { return entry_count_; }
+  size_t file_size() const;
+
+ private:
+  friend class BlocklistView;
+
+  Blocklist(std::unique_ptr<MappedFile> file, size_t entry_count,
+            unsigned bucket_bits, size_t bloom_blocks);
+
+  bool Has(uint64_t value) const;
+
+  std::unique_ptr<MappedFile> file_;
+  size_t entry_count_;
+  unsigned bucket_bits_;
+  size_t bloom_mask_;
+  const uint64_t* bloom_;
+  const uint32_t* buckets_;
+  const uint64_t* entries_;
+};
+
+// Collects rules from hosts files and domain lists and writes the index that
+// Blocklist reads.
+//
+// Accepted lines:
+//   0.0.0.0 ads.example.com tracker.example.com   hosts file: exact names
+//   ads.example.com                               domain list: exact name
+//   *.example.com                                 names below example.com
+//   ||example.com^                                example.com and below
+// Text after '#' and lines starting with '!' are comments. localhost and
+// similar entries that hosts files carry for the machine itself are skipped.
+class BlocklistBuilder {
+ public:
+  enum class Match : uint8_t { kExact, kSubdomains };
+
+  // Adds one rule. Returns false if |name| is not a valid domain name.
+  bool AddDomain(const char* name, size_t length, Match match);
+  // Adds the rules on one line. Returns the number of rules added.
+  size_t AddLine(const char* line, size_t length);
+  // Adds every line of |path|. Returns false and sets |error| if it cannot
+  // be read.
+  bool AddFile(const std::string& path, std::string* error);
+
+  // Rules added so far, counting duplicates.
+  size_t size() const { return values_.size(); }
+
+  // Sorts and deduplicates the rules and serialises the index.
+  std::vector<uint8_t> Build();
+  // Sorts and deduplicates the rules and hands them over as stored in the
+  // index, for BlocklistDelta.
+  std::vector<uint64_t> TakeRules();
+
+ private:
+  std::vector<uint64_t> values_;
+};
+
+// Rules added to and removed from a compiled Blocklist, so that small
+// updates take effect without rebuilding the index. Immutable once built;
+// Apply() returns a new delta.
+//
+// Delta files use the BlocklistBuilder formats with a leading '+' (add, the
+// default) or '-' (remove):
+//   +ads.example.com
+//   -||cdn.example.com^
+// Removing a rule only drops that rule; a name stays blocked if another
+// rule covers it.
+class BlocklistDelta {
+ public:
+  // Reads a delta file. Returns nullptr and sets |error| if it cannot be
+  // read.
+  static std::unique_ptr<BlocklistDelta> Load(const std::string& path,
+                                              std::string* error);
+  // Parses delta lines.
+  static std::unique_ptr<BlocklistDelta> Parse(const std::string& text);
+
+  // This delta followed by |newer|; a rule in both ends up where |newer|
+  // put it.
+  std::unique_ptr<BlocklistDelta> Apply(const BlocklistDelta& newer) const;
+
+  size_t added() const { return added_.size(); }
+  size_t removed() const { return removed_.size(); }
+  bool empty() const { return added_.empty() && removed_.empty(); }
+
+ private:
+  friend class BlocklistView;
+
+  static std::unique_ptr<BlocklistDelta> FromBuilders(
+      BlocklistBuilder* added, BlocklistBuilder* removed);
+
+  // Sorted, disjoint rule values.
+  std::vector<uint64_t> added_;
+  std::vector<uint64_t> removed_;
+};
+
+// A compiled Blocklist with the delta applied since, which is what queries
+// are checked against. Either part may be null.
+class BlocklistView {
+ public:
+  BlocklistView() = default;
+  BlocklistView(std::shared_ptr<const Blocklist> base,
+                std::shared_ptr<const BlocklistDelta> delta)
+      : base_(std::move(base)), delta_(std::move(delta)) {}
+
+  // See Blocklist::Contains().
+  bool Contains(const char* name, size_t length) const;
+
+  bool empty() const {
+    return (!base_ || base_->size() == 0) && (!delta_ || delta_->added() == 0);
+  }
+  // Rules in effect, approximately: removals are assumed to hit.
+  size_t size() const;
+
+  const std::shared_ptr<const Blocklist>& base() const { return base_; }
+  const std::shared_ptr<const BlocklistDelta>& delta() const { return delta_; }
+
+ private:
+  bool Has(uint64_t value) const;
+
+  std::shared_ptr<const Blocklist> base_;
+  std::shared_ptr<const BlocklistDelta> delta_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_BLOCKLIST_H_
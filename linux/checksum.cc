@@ -0,0 +1,33 @@
+#include "checksum.h"
+
+namespace dns_manager {
+
+namespace {
+
+struct Crc32cTable {
+  uint32_t entries[256];
+
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+      }
+      entries[i] = crc;
+    }
+  }
+};
+
+}  // namespace
+
+uint32_t Crc32c(const void* data, size_t length, uint32_t crc) {
+  static const Crc32cTable table;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,15 @@
+#ifndef DNS_MANAGER_CHECKSUM_H_
+#define DNS_MANAGER_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dns_manager {
+
+// CRC-32C (Castagnoli) of |length| bytes, continuing from |crc| so that large
+// buffers can be checksummed in pieces.
+uint32_t Crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_CHECKSUM_H_
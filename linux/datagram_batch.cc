@@ -0,0 +1,135 @@
+#include "datagram_batch.h"
+
+#include <sys/uio.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace dns_manager {
+
+DatagramReader::DatagramReader(bool batched)
+    : batched_(batched), buffers_(kBatch * kMaxUdpMessageSize) {}
+
+size_t DatagramReader::Receive(int fd) {
+  if (fd < 0) {
+    return 0;
+  }
+  if (batched_) {
+    mmsghdr messages[kBatch];
+    iovec vectors[kBatch];
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < kBatch; i++) {
+      vectors[i] = {data(i), kMaxUdpMessageSize};
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = sources_[i].sockaddr_ptr();
+      messages[i].msg_hdr.msg_namelen = sizeof(sources_[i].storage);
+    }
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+    int received = recvmmsg(fd, messages, kBatch, MSG_DONTWAIT, nullptr);
+    if (received > 0) {
+      for (int i = 0; i < received; i++) {
+        lengths_[i] = messages[i].msg_len;
+        sources_[i].length = messages[i].msg_hdr.msg_namelen;
+      }
+      return static_cast<size_t>(received);
+    }
+    if (errno != ENOSYS) {
+      return 0;
+    }
+    batched_ = false;
+  }
+  sources_[0].length = sizeof(sources_[0].storage);
+  syscalls_.fetch_add(1, std::memory_order_relaxed);
+  ssize_t received = recvfrom(fd, data(0), kMaxUdpMessageSize, MSG_DONTWAIT,
+                              sources_[0].sockaddr_ptr(),
+                              &sources_[0].length);
+  if (received < 0) {
+    return 0;
+  }
+  lengths_[0] = static_cast<size_t>(received);
+  return 1;
+}
+
+DatagramWriter::DatagramWriter(bool batched)
+    : batched_(batched), buffer_(batched ? kBatch * kMaxUdpMessageSize : 0) {}
+
+void DatagramWriter::Send(const SocketAddress& to, const uint8_t* message,
+                          size_t length, uint32_t tag) {
+  if (length > kMaxUdpMessageSize) {
+    failed_.push_back(tag);
+    return;
+  }
+  if (!batched_) {
+    if (!SendOne(to, message, length)) {
+      failed_.push_back(tag);
+    }
+    return;
+  }
+  if (queued_ == kBatch || buffered_ + length > buffer_.size()) {
+    Flush();
+  }
+  memcpy(&buffer_[buffered_], message, length);
+  offsets_[queued_] = buffered_;
+  lengths_[queued_] = length;
+  buffered_ += length;
+  destinations_[queued_] = to;
+  tags_[queued_] = tag;
+  queued_++;
+}
+
+void DatagramWriter::Flush() {
+  size_t next = 0;
+  while (next < queued_ && batched_) {
+    mmsghdr messages[kBatch];
+    iovec vectors[kBatch];
+    memset(messages, 0, sizeof(messages));
+    size_t count = queued_ - next;
+    for (size_t i = 0; i < count; i++) {
+      vectors[i] = {&buffer_[offsets_[next + i]], lengths_[next + i]};
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = destinations_[next + i].sockaddr_ptr();
+      messages[i].msg_hdr.msg_namelen = destinations_[next + i].length;
+    }
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+    int sent = fd_ < 0 ? -1
+                       : sendmmsg(fd_, messages,
+                                  static_cast<unsigned int>(count),
+                                  MSG_DONTWAIT);
+    if (sent > 0) {
+      next += static_cast<size_t>(sent);
+    } else if (fd_ >= 0 && errno == ENOSYS) {
+      batched_ = false;
+    } else {
+      // The first datagram was refused; the call stops there.
+      failed_.push_back(tags_[next]);
+      next++;
+    }
+  }
+  for (; next < queued_; next++) {
+    if (!SendOne(destinations_[next], &buffer_[offsets_[next]],
+                 lengths_[next])) {
+      failed_.push_back(tags_[next]);
+    }
+  }
+  queued_ = 0;
+  buffered_ = 0;
+}
+
+void DatagramWriter::TakeFailed(std::vector<uint32_t>* tags) {
+  tags->insert(tags->end(), failed_.begin(), failed_.end());
+  failed_.clear();
+}
+
+bool DatagramWriter::SendOne(const SocketAddress& to, const uint8_t* message,
+                             size_t length) {
+  if (fd_ < 0) {
+    return false;
+  }
+  syscalls_.fetch_add(1, std::memory_order_relaxed);
+  return sendto(fd_, message, length, MSG_DONTWAIT, to.sockaddr_ptr(),
+                to.length) >= 0;
+}
+
+}  // namespace dns_manager
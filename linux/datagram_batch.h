@@ -0,0 +1,107 @@
+#ifndef DNS_MANAGER_DATAGRAM_BATCH_H_
+#define DNS_MANAGER_DATAGRAM_BATCH_H_
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dns_message.h"
+#include "socket_address.h"
+
+namespace dns_manager {
+
+// Receives datagrams from non-blocking UDP sockets up to kBatch at a time,
+// with one recvmmsg() call per batch. Unbatched, or on a kernel without
+// recvmmsg(), it reads one datagram per recvfrom() call instead. The
+// datagrams stay valid, and writable, until the next Receive(). Owned by
+// one thread; syscalls() may be read from any.
+class DatagramReader {
+ public:
+  static constexpr size_t kBatch = 32;
+
+  explicit DatagramReader(bool batched);
+
+  DatagramReader(const DatagramReader&) = delete;
+  DatagramReader& operator=(const DatagramReader&) = delete;
+
+  // Reads what |fd| has waiting, up to capacity() datagrams. Returns how
+  // many, 0 once it has none. Datagrams longer than kMaxUdpMessageSize are
+  // cut short.
+  size_t Receive(int fd);
+  // How many datagrams one Receive() can return: fewer means the socket
+  // was drained.
+  size_t capacity() const { return batched_ ? kBatch : 1; }
+
+  uint8_t* data(size_t i) { return &buffers_[i * kMaxUdpMessageSize]; }
+  size_t length(size_t i) const { return lengths_[i]; }
+  const SocketAddress& source(size_t i) const { return sources_[i]; }
+
+  uint64_t syscalls() const {
+    return syscalls_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  bool batched_;
+  std::vector<uint8_t> buffers_;
+  size_t lengths_[kBatch];
+  SocketAddress sources_[kBatch];
+  std::atomic<uint64_t> syscalls_{0};
+};
+
+// Queues datagrams for one UDP socket and sends them up to kBatch at a time
+// with one sendmmsg() call per batch, on Flush() or once the queue is full.
+// Queued datagrams are packed back to back, so that a batch of small answers
+// takes a few cache lines. Unbatched, or on a kernel without sendmmsg(), each
+// is sent at once with sendto(). A datagram the socket refuses is reported
+// through its tag rather than retried. Owned by one thread; syscalls() may be
+// read from any.
+class DatagramWriter {
+ public:
+  static constexpr size_t kBatch = DatagramReader::kBatch;
+
+  explicit DatagramWriter(bool batched);
+
+  DatagramWriter(const DatagramWriter&) = delete;
+  DatagramWriter& operator=(const DatagramWriter&) = delete;
+
+  // The socket to send on; -1 drops everything.
+  void set_fd(int fd) { fd_ = fd; }
+
+  // Copies |message| to be sent to |to|. Messages longer than
+  // kMaxUdpMessageSize fail.
+  void Send(const SocketAddress& to, const uint8_t* message, size_t length,
+            uint32_t tag = 0);
+  // Sends everything queued.
+  void Flush();
+  // Moves the tags of the datagrams that could not be sent since the last
+  // call into |tags|.
+  void TakeFailed(std::vector<uint32_t>* tags);
+
+  size_t queued() const { return queued_; }
+  uint64_t syscalls() const {
+    return syscalls_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  bool SendOne(const SocketAddress& to, const uint8_t* message,
+               size_t length);
+
+  bool batched_;
+  int fd_ = -1;
+  std::vector<uint8_t> buffer_;
+  size_t buffered_ = 0;
+  size_t offsets_[kBatch];
+  size_t lengths_[kBatch];
+  SocketAddress destinations_[kBatch];
+  uint32_t tags_[kBatch];
+  size_t queued_ = 0;
+  std::vector<uint32_t> failed_;
+  std::atomic<uint64_t> syscalls_{0};
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DATAGRAM_BATCH_H_
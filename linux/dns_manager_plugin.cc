@@ -8,9 +8,26 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "dns_manager_plugin_private.h"
+#include "dns_presets.h"
+#include "dns_settings.h"
+#include "file_util.h"
+#include "file_watcher.h"
+#include "host_overrides.h"
+#include "local_resolver.h"
+#include "network_monitor.h"
+#include "query_log.h"
+#include "route_monitor.h"
+#include "shared_network_state.h"
 
 #define DNS_MANAGER_PLUGIN(obj) \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), dns_manager_plugin_get_type(), \
@@ -22,6 +39,97 @@ struct _DnsManagerPlugin {
 
 G_DEFINE_TYPE(DnsManagerPlugin, dns_manager_plugin, g_object_get_type())
 
+// The plugin-hosted resolver, running while setDNS is in local resolver mode.
+static std::unique_ptr<dns_manager::LocalResolver> local_resolver;
+
+// The resolver cache left by the previous run, mapped at registration so the
+// first queries after a restart are answered without going upstream.
+static std::unique_ptr<dns_manager::PersistentCache> warm_cache;
+
+// The blocklist installed by loadBlocklist and applyBlocklistDelta, kept for
+// resolvers started later.
+static dns_manager::BlocklistView blocklist;
+
+// Where setHostOverrides gets its overrides from: names with their
+// addresses or alias targets, and a hosts-format file.
+struct HostOverrideSources {
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::string file;
+};
+
+// The host overrides installed by setHostOverrides, kept for resolvers
+// started later, with what they were compiled from. While a file is among
+// the sources, a watcher recompiles them when it changes; the generation
+// tells reloads that finish after the sources changed again to stand down.
+static std::shared_ptr<const dns_manager::HostOverrides> host_overrides;
+static HostOverrideSources host_override_sources;
+static std::unique_ptr<dns_manager::FileWatcher> host_overrides_watcher;
+static guint host_overrides_generation = 0;
+
+// Split-DNS routes installed by setDnsRoutes, kept for resolvers started
+// later.
+static std::vector<dns_manager::DnsRoute> dns_routes;
+
+// Presets defined with definePreset, read from the user config directory on
+// first use.
+static std::unique_ptr<dns_manager::DnsPresets> dns_presets;
+
+// NetworkManager state kept current in the background from registration
+// on, so the read-only methods answer without running nmcli.
+static std::unique_ptr<dns_manager::NetworkMonitor> network_monitor;
+
+// Which interface holds the default route, followed through rtnetlink. The
+// DNS methods act on the connection active on it.
+static std::unique_ptr<dns_manager::RouteMonitor> route_monitor;
+
+// The network state shared with the plugin in other apps on the machine
+// (see SharedNetworkState). Only the instance that owns it runs the two
+// monitors above, publishing what they see; the others read it instead and
+// try to take over every second in case the owner exits.
+static std::unique_ptr<dns_manager::SharedNetworkState> shared_network_state;
+static guint network_state_takeover_timer = 0;
+static gint network_state_publish_pending = 0;
+static constexpr guint kNetworkStateTakeoverSeconds = 1;
+
+// Commands such as nmcli run by execute_command, for getNetworkState.
+static int64_t commands_run = 0;
+// D-Bus calls the plugin itself made to NetworkManager, for applyPreset.
+static int64_t dbus_calls_made = 0;
+
+// When the plugin last changed DNS settings. The network monitor picks a
+// change up a refresh after NetworkManager made it, so for this long its
+// copy of the settings may predate the change.
+static gint64 last_settings_change_us = 0;
+static constexpr gint64 kNetworkStateLagUs = 2 * G_USEC_PER_SEC;
+
+static bool network_state_settled() {
+  return g_get_monotonic_time() - last_settings_change_us >= kNetworkStateLagUs;
+}
+
+// Streams the local resolver's answered queries to Dart in packed batches
+// (see QueryEventBatch) while Dart listens.
+static FlEventChannel* query_event_channel = nullptr;
+static gboolean query_events_listening = FALSE;
+static guint query_event_timer = 0;
+
+// Events the resolver can hold between flushes, and the most sent in one
+// batch; reaching that many also triggers a flush before the timer fires.
+static constexpr size_t kQueryEventCapacity = 8192;
+static constexpr size_t kQueryEventBatch = 1024;
+static constexpr int64_t kQueryEventFlushMs = 100;
+static int64_t query_event_interval_ms = kQueryEventFlushMs;
+
+// The on-disk query log under the user cache directory. Drained events are
+// appended to it while a resolver started with queryLog runs; it stays
+// open for queryLog calls after that.
+static std::unique_ptr<dns_manager::QueryLog> query_log;
+static gboolean query_log_enabled = FALSE;
+static uint64_t query_log_max_bytes = 0;
+static constexpr uint64_t kQueryLogMaxBytes = 64 << 20;
+static constexpr int64_t kQueryLogDefaultLimit = 10000;
+
+static gboolean load_blocklist_in_background(FlMethodCall* method_call);
+
 // Called when a method call is received from Flutter.
 static void dns_manager_plugin_handle_method_call(
     DnsManagerPlugin* self,
@@ -32,22 +140,54 @@ static void dns_manager_plugin_handle_method_call(
   FlValue* arguments = fl_method_call_get_args(method_call);
 
   if (strcmp(method, "getDNS") == 0) {
-    response = get_dns();
+    response = get_dns(method_call);
   } else if (strcmp(method, "setDNS") == 0) {
-    response = set_dns(arguments);
+    response = set_dns(arguments, method_call);
   } else if (strcmp(method, "resetDNS") == 0) {
-    response = reset_dns();
+    response = reset_dns(method_call);
   } else if (strcmp(method, "getConnectionStatus") == 0) {
     response = get_connection_status();
+  } else if (strcmp(method, "getTopDomains") == 0) {
+    response = get_top_domains(arguments);
+  } else if (strcmp(method, "getResolverStats") == 0) {
+    response = get_resolver_stats();
+  } else if (strcmp(method, "getUpstreamHealth") == 0) {
+    response = get_upstream_health();
+  } else if (strcmp(method, "queryLog") == 0) {
+    response = query_log_range(arguments);
+  } else if (strcmp(method, "loadBlocklist") == 0) {
+    if (load_blocklist_in_background(method_call)) {
+      return;
+    }
+    response = load_blocklist(arguments);
+  } else if (strcmp(method, "applyBlocklistDelta") == 0) {
+    response = apply_blocklist_delta(arguments);
+  } else if (strcmp(method, "setDnsRoutes") == 0) {
+    response = set_dns_routes(arguments);
+  } else if (strcmp(method, "setHostOverrides") == 0) {
+    response = set_host_overrides(arguments);
+  } else if (strcmp(method, "getNetworkState") == 0) {
+    response = get_network_state();
+  } else if (strcmp(method, "definePreset") == 0) {
+    response = define_preset(arguments);
+  } else if (strcmp(method, "applyPreset") == 0) {
+    response = apply_preset(arguments, method_call);
+  } else if (strcmp(method, "listPresets") == 0) {
+    response = list_presets();
   } else {
     response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
   }
 
+  // Calls waiting on NetworkManager are answered when it replies.
+  if (response == nullptr) {
+    return;
+  }
   fl_method_call_respond(method_call, response, nullptr);
 }
 
 // Helper function to execute shell commands
 static gchar* execute_command(const gchar* command) {
+  commands_run++;
   FILE* pipe = popen(command, "r");
   if (!pipe) {
     return g_strdup("Error: Could not execute command");
@@ -66,8 +206,125 @@ static gchar* execute_command(const gchar* command) {
   return result;
 }
 
+// Calls |visit(snapshot, default_interface)| with the network state this
+// instance follows itself, or else with the one another instance shares.
+// The snapshot is nullptr while there is none, and the interface holding
+// the default route "" if unknown.
+template <typename Visitor>
+static void read_network_state(Visitor visit) {
+  if (network_monitor) {
+    std::string interface = route_monitor ? route_monitor->DefaultInterface() : std::string();
+    network_monitor->Read([&](const dns_manager::NetworkSnapshot* snapshot) {
+      visit(snapshot, interface);
+    });
+  } else if (shared_network_state) {
+    shared_network_state->Read(visit);
+  } else {
+    visit(nullptr, std::string());
+  }
+}
+
+// The interface holding the default route, or "" if unknown.
+static std::string default_interface() {
+  if (route_monitor) {
+    return route_monitor->DefaultInterface();
+  }
+  std::string interface;
+  read_network_state([&](const dns_manager::NetworkSnapshot*, const std::string& shared) {
+    interface = shared;
+  });
+  return interface;
+}
+
+// Calls |visit| with the connection the DNS methods act on according to the
+// network state. Returns false, without calling it, if there is no snapshot
+// yet.
+template <typename Visitor>
+static bool read_primary_connection(Visitor visit) {
+  bool have_snapshot = false;
+  read_network_state([&](const dns_manager::NetworkSnapshot* snapshot, const std::string& interface) {
+    if (snapshot != nullptr) {
+      have_snapshot = true;
+      visit(snapshot->PrimaryConnection(interface));
+    }
+  });
+  return have_snapshot;
+}
+
+// Shares what the monitors see with the other plugin instances.
+static void publish_network_state() {
+  if (!shared_network_state || !shared_network_state->owner() || !network_monitor) {
+    return;
+  }
+  std::string interface = route_monitor ? route_monitor->DefaultInterface() : std::string();
+  network_monitor->Read([&](const dns_manager::NetworkSnapshot* snapshot) {
+    shared_network_state->Publish(snapshot, interface);
+  });
+}
+
+static gboolean network_state_changed_idle(gpointer user_data) {
+  g_atomic_int_set(&network_state_publish_pending, 0);
+  publish_network_state();
+  return G_SOURCE_REMOVE;
+}
+
+// Called on the monitor threads after a change; publishes once per burst.
+static void network_state_changed(void* context) {
+  if (g_atomic_int_compare_and_exchange(&network_state_publish_pending, 0, 1)) {
+    g_idle_add(network_state_changed_idle, nullptr);
+  }
+}
+
+// Starts following the routing table and NetworkManager in this process.
+static void start_network_monitors() {
+  // Reads the routing table once here; changes are then applied as the
+  // kernel reports them. Without it the DNS methods fall back to the first
+  // ethernet or Wi-Fi connection.
+  route_monitor = std::make_unique<dns_manager::RouteMonitor>();
+  route_monitor->set_change_callback(network_state_changed, nullptr);
+  std::string route_error;
+  if (!route_monitor->Start(&route_error)) {
+    route_monitor.reset();
+  }
+
+  // Takes the first snapshot in the background, so it is usually ready by
+  // the time Flutter asks for anything.
+  network_monitor = std::make_unique<dns_manager::NetworkMonitor>();
+  network_monitor->set_change_callback(network_state_changed, nullptr);
+  network_monitor->Start();
+}
+
+static gboolean take_over_network_state(gpointer user_data) {
+  if (!shared_network_state->TryBecomeOwner()) {
+    return G_SOURCE_CONTINUE;
+  }
+  network_state_takeover_timer = 0;
+  start_network_monitors();
+  return G_SOURCE_REMOVE;
+}
+
 // Helper function to get the active connection
 static gchar* get_active_connection() {
+  gchar* uuid = nullptr;
+  if (read_primary_connection(
+          [&](const dns_manager::NetworkConnection* connection) {
+            uuid = g_strdup(connection ? connection->uuid.c_str() : "");
+          })) {
+    return uuid;
+  }
+
+  // Prefer the connection on the default route's interface
+  std::string interface = default_interface();
+  if (!interface.empty()) {
+    g_autofree gchar* command = g_strdup_printf("nmcli -t -f UUID,DEVICE connection show --active | grep ':%s$' | head -1 | cut -d: -f1", interface.c_str());
+    gchar* result = execute_command(command);
+    g_strchomp(result);
+    if (strlen(result) > 0) {
+      return result;
+    }
+    g_free(result);
+  }
+
   // Try to get ethernet connection first
   gchar* result = execute_command("nmcli -t -f UUID,TYPE,DEVICE connection show --active | grep ethernet | head -1 | cut -d: -f1");
   if (result && strlen(result) > 0) {
@@ -93,7 +350,545 @@ static gchar* get_active_connection() {
   return g_strdup("");
 }
 
-FlMethodResponse* set_dns(FlValue* arguments) {
+// Helper function to read an optional integer argument
+static int64_t lookup_int_argument(FlValue* arguments, const gchar* key,
+                                   int64_t default_value) {
+  if (arguments == nullptr || fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return default_value;
+  }
+  FlValue* value = fl_value_lookup_string(arguments, key);
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_INT) {
+    return default_value;
+  }
+  return fl_value_get_int(value);
+}
+
+// Helper function to read an optional floating point argument
+static double lookup_double_argument(FlValue* arguments, const gchar* key,
+                                     double default_value) {
+  if (arguments == nullptr || fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return default_value;
+  }
+  FlValue* value = fl_value_lookup_string(arguments, key);
+  if (value == nullptr) {
+    return default_value;
+  }
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_FLOAT) {
+    return fl_value_get_float(value);
+  }
+  if (fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+    return static_cast<double>(fl_value_get_int(value));
+  }
+  return default_value;
+}
+
+// Helper function to read an optional boolean argument
+static gboolean lookup_bool_argument(FlValue* arguments, const gchar* key) {
+  if (arguments == nullptr || fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return FALSE;
+  }
+  FlValue* value = fl_value_lookup_string(arguments, key);
+  return value != nullptr && fl_value_get_type(value) == FL_VALUE_TYPE_BOOL &&
+         fl_value_get_bool(value);
+}
+
+// Path of the resolver cache snapshot, under the user's cache directory.
+static std::string resolver_cache_path() {
+  g_autofree gchar* path = g_build_filename(g_get_user_cache_dir(), "dns_manager",
+                                            "resolver-cache.bin", nullptr);
+  return path;
+}
+
+// Opens the query log with a budget of |max_bytes|, reopening it if it is
+// open with another. Returns false and sets |error| if it cannot be opened.
+static bool open_query_log(uint64_t max_bytes, std::string* error) {
+  if (query_log && query_log_max_bytes == max_bytes) {
+    return true;
+  }
+  query_log.reset();
+  g_autofree gchar* directory = g_build_filename(g_get_user_cache_dir(), "dns_manager", nullptr);
+  g_mkdir_with_parents(directory, 0700);
+  g_autofree gchar* path = g_build_filename(directory, "query-log", nullptr);
+  query_log = dns_manager::QueryLog::Open(path, max_bytes, error);
+  query_log_max_bytes = max_bytes;
+  return query_log != nullptr;
+}
+
+static void open_warm_cache() {
+  std::string error;
+  warm_cache = dns_manager::PersistentCache::Open(resolver_cache_path(), &error);
+}
+
+// Sends what the resolver has recorded since the last flush to Dart and
+// to the query log.
+static void flush_query_events() {
+  if (!local_resolver || !(query_events_listening || query_log_enabled)) {
+    return;
+  }
+  dns_manager::QueryEventBatch batch;
+  size_t count;
+  do {
+    batch.Clear();
+    count = local_resolver->DrainQueryEvents(&batch, kQueryEventBatch);
+    if (count == 0 && batch.dropped() == 0) {
+      break;
+    }
+    const std::vector<uint8_t>& bytes = batch.bytes();
+    if (query_log_enabled && query_log) {
+      query_log->Append(bytes.data(), bytes.size());
+    }
+    if (query_events_listening) {
+      g_autoptr(FlValue) value = fl_value_new_uint8_list(bytes.data(), bytes.size());
+      fl_event_channel_send(query_event_channel, value, nullptr, nullptr);
+    }
+  } while (count == kQueryEventBatch);
+}
+
+static gboolean query_event_timer_fired(gpointer user_data) {
+  flush_query_events();
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean query_events_ready_idle(gpointer user_data) {
+  flush_query_events();
+  return G_SOURCE_REMOVE;
+}
+
+// Called on the resolver thread when a full batch is waiting.
+static void query_events_ready(void* context) {
+  g_idle_add(query_events_ready_idle, nullptr);
+}
+
+// Records and drains query events while Dart listens or the query log is
+// on, and stops otherwise.
+static void update_query_event_recording() {
+  gboolean recording = query_events_listening || query_log_enabled;
+  if (local_resolver) {
+    local_resolver->SetQueryEventsEnabled(recording);
+  }
+  if (query_event_timer != 0) {
+    g_source_remove(query_event_timer);
+    query_event_timer = 0;
+  }
+  if (recording) {
+    query_event_timer = g_timeout_add(static_cast<guint>(MAX(query_event_interval_ms, 1)), query_event_timer_fired, nullptr);
+  }
+}
+
+static FlMethodErrorResponse* query_events_listen(FlEventChannel* channel,
+                                                  FlValue* arguments,
+                                                  gpointer user_data) {
+  query_event_interval_ms = lookup_int_argument(arguments, "intervalMs", kQueryEventFlushMs);
+  query_events_listening = TRUE;
+  update_query_event_recording();
+  return nullptr;
+}
+
+static FlMethodErrorResponse* query_events_cancel(FlEventChannel* channel,
+                                                  FlValue* arguments,
+                                                  gpointer user_data) {
+  query_events_listening = FALSE;
+  query_event_interval_ms = kQueryEventFlushMs;
+  update_query_event_recording();
+  return nullptr;
+}
+
+static void stop_local_resolver() {
+  flush_query_events();
+  local_resolver.reset();
+  if (query_log) {
+    query_log->Flush();
+  }
+}
+
+// Starts the plugin-hosted resolver forwarding to |dns|. Returns an error
+// message, or nullptr on success.
+static gchar* start_local_resolver(const gchar* dns, FlValue* arguments) {
+  dns_manager::ResolverConfig config;
+  if (!dns_manager::ParseUpstreams(dns, &config)) {
+    return g_strdup_printf("Invalid DNS server list '%s'", dns);
+  }
+  FlValue* listen_value = fl_value_lookup_string(arguments, "listenAddress");
+  if (listen_value != nullptr &&
+      fl_value_get_type(listen_value) == FL_VALUE_TYPE_STRING) {
+    config.listen_address = fl_value_get_string(listen_value);
+  }
+  // The connection can only name the resolver's address, and NetworkManager
+  // sends its queries to port 53 of it.
+  int64_t listen_port = lookup_int_argument(arguments, "listenPort", config.listen_port);
+  if (listen_port != 53) {
+    return g_strdup_printf("listenPort %" G_GINT64_FORMAT " not supported, NetworkManager only queries port 53", listen_port);
+  }
+  config.cache_max_entries = static_cast<size_t>(
+      lookup_int_argument(arguments, "cacheSize", config.cache_max_entries));
+  config.cache_max_bytes = static_cast<size_t>(lookup_int_argument(
+      arguments, "cacheMaxBytes", config.cache_max_bytes));
+  config.prefetch_fraction =
+      lookup_double_argument(arguments, "prefetchFraction", config.prefetch_fraction);
+  config.prefetch_min_hits = static_cast<uint32_t>(
+      lookup_int_argument(arguments, "prefetchMinHits", config.prefetch_min_hits));
+  config.max_stale_seconds = static_cast<uint32_t>(
+      lookup_int_argument(arguments, "maxStaleSeconds", config.max_stale_seconds));
+  config.client_response_timeout_ms = static_cast<int>(lookup_int_argument(
+      arguments, "clientResponseTimeoutMs", config.client_response_timeout_ms));
+  config.threads = static_cast<size_t>(
+      lookup_int_argument(arguments, "threads", config.threads));
+  config.pin_threads = lookup_bool_argument(arguments, "pinThreads");
+  config.tcp = lookup_bool_argument(arguments, "tcp");
+  FlValue* ca_value = fl_value_lookup_string(arguments, "tlsCaFile");
+  if (ca_value != nullptr &&
+      fl_value_get_type(ca_value) == FL_VALUE_TYPE_STRING) {
+    config.tls_ca_file = fl_value_get_string(ca_value);
+  }
+  config.routes = dns_routes;
+  config.query_event_capacity = kQueryEventCapacity;
+  FlValue* blocking_value = fl_value_lookup_string(arguments, "blockingMode");
+  if (blocking_value != nullptr &&
+      fl_value_get_type(blocking_value) == FL_VALUE_TYPE_STRING &&
+      strcmp(fl_value_get_string(blocking_value), "nullAddress") == 0) {
+    config.blocking_mode = dns_manager::BlockingMode::kNullAddress;
+  }
+  config.rate_limit_qps =
+      lookup_double_argument(arguments, "rateLimitQps", config.rate_limit_qps);
+  config.rate_limit_burst = static_cast<uint32_t>(
+      lookup_int_argument(arguments, "rateLimitBurst", config.rate_limit_burst));
+  FlValue* rate_limit_value = fl_value_lookup_string(arguments, "rateLimitAction");
+  if (rate_limit_value != nullptr &&
+      fl_value_get_type(rate_limit_value) == FL_VALUE_TYPE_STRING &&
+      strcmp(fl_value_get_string(rate_limit_value), "truncated") == 0) {
+    config.rate_limit_action = dns_manager::RateLimitAction::kTruncated;
+  }
+  gboolean log_queries = lookup_bool_argument(arguments, "queryLog");
+  if (log_queries) {
+    uint64_t max_bytes = static_cast<uint64_t>(lookup_int_argument(
+        arguments, "queryLogMaxBytes", static_cast<int64_t>(kQueryLogMaxBytes)));
+    std::string error;
+    if (!open_query_log(max_bytes, &error)) {
+      return g_strdup_printf("Could not open query log: %s", error.c_str());
+    }
+  }
+  bool persist_cache = lookup_bool_argument(arguments, "persistCache");
+  if (persist_cache) {
+    config.cache_file = resolver_cache_path();
+    g_autofree gchar* directory = g_path_get_dirname(config.cache_file.c_str());
+    g_mkdir_with_parents(directory, 0700);
+  }
+
+  // Stopping the old resolver writes its snapshot, which the new one starts
+  // from.
+  stop_local_resolver();
+  query_log_enabled = log_queries;
+  auto resolver = std::make_unique<dns_manager::LocalResolver>(config);
+  if (persist_cache) {
+    if (!warm_cache) {
+      open_warm_cache();
+    }
+    resolver->set_warm_cache(std::move(warm_cache));
+  }
+  resolver->SetBlocklist(blocklist);
+  resolver->SetHostOverrides(host_overrides);
+  resolver->set_query_events_ready(query_events_ready, nullptr, kQueryEventBatch);
+  std::string error;
+  if (!resolver->Start(&error)) {
+    return g_strdup(error.c_str());
+  }
+  local_resolver = std::move(resolver);
+  update_query_event_recording();
+  return nullptr;
+}
+
+// Where the duration of the last applied DNS change is kept, so that a
+// skipped no-op can report what it saved even right after an app restart.
+static std::string apply_duration_path() {
+  g_autofree gchar* path = g_build_filename(g_get_user_cache_dir(), "dns_manager", "last-apply-ms", nullptr);
+  return path;
+}
+
+// Milliseconds the last applied change took from modify until the
+// connection was back up, or -1 if none has been timed.
+static gint64 last_apply_duration_ms() {
+  g_autofree gchar* contents = nullptr;
+  if (!g_file_get_contents(apply_duration_path().c_str(), &contents, nullptr, nullptr)) {
+    return -1;
+  }
+  return g_ascii_strtoll(contents, nullptr, 10);
+}
+
+static void reconnect_finished(GPid pid, gint status, gpointer user_data) {
+  gint64* started = static_cast<gint64*>(user_data);
+  gint64 elapsed_ms = (g_get_monotonic_time() - *started) / 1000;
+  g_autofree gchar* contents = g_strdup_printf("%" G_GINT64_FORMAT "\n", elapsed_ms);
+  std::string path = apply_duration_path();
+  g_autofree gchar* directory = g_path_get_dirname(path.c_str());
+  g_mkdir_with_parents(directory, 0700);
+  g_file_set_contents(path.c_str(), contents, -1, nullptr);
+  g_spawn_close_pid(pid);
+  delete started;
+}
+
+// Restarts |connection| in the background so the change takes effect, timing
+// it from |started| (when the modify began) until the connection is up.
+static void reconnect(const gchar* connection, gint64 started) {
+  g_autofree gchar* restart_cmd = g_strdup_printf("nmcli connection down '%s' && nmcli connection up '%s'", connection, connection);
+  gchar* argv[] = {const_cast<gchar*>("sh"), const_cast<gchar*>("-c"), restart_cmd, nullptr};
+  GPid pid;
+  if (!g_spawn_async(nullptr, argv, nullptr,
+                     static_cast<GSpawnFlags>(G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD),
+                     nullptr, nullptr, &pid, nullptr)) {
+    g_autofree gchar* background_cmd = g_strdup_printf("%s &", restart_cmd);
+    system(background_cmd);
+    return;
+  }
+  g_child_watch_add(pid, reconnect_finished, new gint64(started));
+}
+
+// Sets |properties| on |connection| in a single nmcli call and restarts it in
+// the background. Returns nullptr on success, otherwise the nmcli output.
+static gchar* modify_dns_properties(const gchar* connection,
+                                    const std::vector<dns_manager::ConnectionProperty>& properties) {
+  gint64 started = g_get_monotonic_time();
+  GString* modify_cmd = g_string_new(nullptr);
+  g_string_append_printf(modify_cmd, "nmcli connection modify '%s'", connection);
+  for (const dns_manager::ConnectionProperty& property : properties) {
+    g_string_append_printf(modify_cmd, " %s '%s'", property.name.c_str(), property.value.c_str());
+  }
+  g_autofree gchar* command = g_string_free(modify_cmd, FALSE);
+  gchar* output = execute_command(command);
+  if (strstr(output, "Error") != NULL) {
+    return output;
+  }
+  g_free(output);
+  last_settings_change_us = g_get_monotonic_time();
+  reconnect(connection, started);
+  return nullptr;
+}
+
+// Brings |connection|'s DNS properties to |desired|, modifying only those that
+// differ and reconnecting only if anything did. Returns nullptr on success
+// and sets |unchanged| when there was nothing to do; otherwise returns the
+// nmcli output.
+static gchar* apply_dns_properties(const gchar* connection,
+                                   const std::vector<dns_manager::ConnectionProperty>& desired,
+                                   gboolean* unchanged) {
+  g_autofree gchar* show_cmd = g_strdup_printf("nmcli -t -f %s connection show '%s'", dns_manager::kDnsPropertyFields, connection);
+  g_autofree gchar* current = execute_command(show_cmd);
+  std::vector<dns_manager::ConnectionProperty> changed =
+      dns_manager::ChangedProperties(desired, dns_manager::ParseNmcliProperties(current));
+  *unchanged = changed.empty();
+  if (changed.empty()) {
+    return nullptr;
+  }
+  return modify_dns_properties(connection, changed);
+}
+
+// The answer for a setDNS or resetDNS that found nothing to change.
+static FlMethodResponse* unchanged_response() {
+  gint64 saved_ms = last_apply_duration_ms();
+  g_autofree gchar* message = saved_ms >= 0
+      ? g_strdup_printf("DNS unchanged - skipped modify and reconnect (saved ~%" G_GINT64_FORMAT " ms)", saved_ms)
+      : g_strdup("DNS unchanged - skipped modify and reconnect");
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Global DNS servers the plugin itself set, and when, so that the network
+// state need not have caught up before they are relied on.
+static std::vector<std::string> last_global_dns;
+static gint64 last_global_dns_us = -kNetworkStateLagUs;
+
+// Talks to NetworkManager about its global DNS configuration; the plugin
+// tests put their own in its place.
+static GlobalDnsBackend global_dns_backend = {dns_manager::GetGlobalDns, dns_manager::SetGlobalDns};
+
+void set_global_dns_backend(const GlobalDnsBackend& backend) {
+  global_dns_backend = backend;
+}
+
+// The servers of NetworkManager's global DNS configuration as last set by
+// the plugin or, after that, according to the network state. Returns false
+// before the first snapshot.
+static bool known_global_dns(std::vector<std::string>* servers) {
+  if (g_get_monotonic_time() - last_global_dns_us < kNetworkStateLagUs) {
+    *servers = last_global_dns;
+    return true;
+  }
+  bool have_snapshot = false;
+  read_network_state([&](const dns_manager::NetworkSnapshot* snapshot, const std::string&) {
+    if (snapshot != nullptr) {
+      have_snapshot = true;
+      *servers = snapshot->global_dns;
+    }
+  });
+  return have_snapshot;
+}
+
+// The next step of a method call that had to ask NetworkManager about global
+// DNS: given the servers read, or the error of the read or change, it returns
+// the answer, or nullptr if it has handed the call on to another request.
+typedef std::function<FlMethodResponse*(const std::vector<std::string>& servers, const std::string& error)> GlobalDnsStep;
+
+struct GlobalDnsRequest {
+  FlMethodCall* method_call;
+  GlobalDnsStep next;
+  // A backend may answer before the request is even sent; the answer then
+  // goes back to the sender rather than to |method_call|.
+  bool sending;
+  bool answered;
+  FlMethodResponse* response;
+};
+
+static void global_dns_request_answered(GlobalDnsRequest* request,
+                                        const std::vector<std::string>& servers,
+                                        const std::string& error) {
+  FlMethodResponse* response = request->next(servers, error);
+  if (request->sending) {
+    request->answered = true;
+    request->response = response;
+    return;
+  }
+  if (response != nullptr) {
+    if (request->method_call != nullptr) {
+      fl_method_call_respond(request->method_call, response, nullptr);
+    }
+    g_object_unref(response);
+  }
+  g_clear_object(&request->method_call);
+  delete request;
+}
+
+static void global_dns_read(const std::vector<std::string>& servers,
+                            const std::string& error, void* context) {
+  global_dns_request_answered(static_cast<GlobalDnsRequest*>(context), servers, error);
+}
+
+static void global_dns_written(const std::string& error, void* context) {
+  global_dns_request_answered(static_cast<GlobalDnsRequest*>(context), {}, error);
+}
+
+static GlobalDnsRequest* new_global_dns_request(FlMethodCall* method_call, GlobalDnsStep next) {
+  dbus_calls_made++;
+  return new GlobalDnsRequest{
+      method_call != nullptr ? FL_METHOD_CALL(g_object_ref(method_call)) : nullptr,
+      std::move(next), true, false, nullptr};
+}
+
+// Returns the answer if the backend already gave it, otherwise nullptr, to
+// be returned in place of the response; |method_call| is then answered
+// once NetworkManager has replied.
+static FlMethodResponse* global_dns_request_sent(GlobalDnsRequest* request) {
+  request->sending = false;
+  if (!request->answered) {
+    return nullptr;
+  }
+  FlMethodResponse* response = request->response;
+  g_clear_object(&request->method_call);
+  delete request;
+  return response;
+}
+
+// Hands the global DNS servers to |next|: at once when they are known, else
+// once NetworkManager has told, without waiting for it on this thread.
+static FlMethodResponse* with_global_dns(FlMethodCall* method_call, GlobalDnsStep next) {
+  std::vector<std::string> servers;
+  if (known_global_dns(&servers)) {
+    return next(servers, "");
+  }
+  GlobalDnsRequest* request = new_global_dns_request(method_call, std::move(next));
+  global_dns_backend.get(global_dns_read, request);
+  return global_dns_request_sent(request);
+}
+
+// Sends |servers| to NetworkManager's global DNS configuration without
+// waiting for it, which can take a polkit prompt; |finish| builds the answer
+// from the error, empty on success, once it has replied.
+static FlMethodResponse* request_global_dns(const std::vector<std::string>& servers,
+                                            FlMethodCall* method_call,
+                                            std::function<FlMethodResponse*(const std::string& error)> finish) {
+  GlobalDnsRequest* request = new_global_dns_request(
+      method_call, [servers, finish](const std::vector<std::string>&, const std::string& error) {
+        if (error.empty()) {
+          last_settings_change_us = g_get_monotonic_time();
+          last_global_dns = servers;
+          last_global_dns_us = last_settings_change_us;
+        }
+        return finish(error);
+      });
+  global_dns_backend.set(servers, global_dns_written, request);
+  return global_dns_request_sent(request);
+}
+
+// Points every connection, present and future, at |dns| through
+// NetworkManager's global DNS configuration, without modifying or restarting
+// any of them. Returns nullptr if |method_call| is answered once
+// NetworkManager has replied.
+static FlMethodResponse* set_global_dns(const gchar* dns, FlMethodCall* method_call) {
+  std::string ipv4;
+  std::string ipv6;
+  if (!dns_manager::CanonicalDnsServers(dns, &ipv4, &ipv6) || (ipv4.empty() && ipv6.empty())) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Invalid DNS server list");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  std::vector<std::string> servers;
+  for (const std::string& list : {ipv4, ipv6}) {
+    for (size_t start = 0; start < list.size();) {
+      size_t end = std::min(list.find(',', start), list.size());
+      servers.push_back(list.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+
+  return with_global_dns(method_call, [servers, method_call](const std::vector<std::string>& current, const std::string& error) {
+    if (error.empty() && current == servers) {
+      g_autoptr(FlValue) result = fl_value_new_string("DNS unchanged - global DNS already set");
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+    gint64 started = g_get_monotonic_time();
+    return request_global_dns(servers, method_call, [started](const std::string& error) {
+      if (!error.empty()) {
+        g_autofree gchar* message = g_strdup_printf("Error setting global DNS: %s", error.c_str());
+        g_autoptr(FlValue) result = fl_value_new_string(message);
+        return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      }
+      gint64 elapsed_ms = (g_get_monotonic_time() - started) / 1000;
+      // Compared with the last per-connection change, which had to restart
+      // the connection.
+      gint64 connection_ms = last_apply_duration_ms();
+      g_autofree gchar* message = connection_ms >= 0
+          ? g_strdup_printf("Global DNS set successfully in %" G_GINT64_FORMAT " ms - applies to all connections (last per-connection change took %" G_GINT64_FORMAT " ms)", elapsed_ms, connection_ms)
+          : g_strdup_printf("Global DNS set successfully in %" G_GINT64_FORMAT " ms - applies to all connections", elapsed_ms);
+      g_autoptr(FlValue) result = fl_value_new_string(message);
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    });
+  });
+}
+
+// Points |connection| at |desired|, skipping the modify and reconnect if it
+// already is. |global_cleared| says whether a global DNS configuration was
+// just cleared to let the connection's servers apply.
+static FlMethodResponse* apply_connection_dns(const gchar* connection,
+                                              const std::vector<dns_manager::ConnectionProperty>& desired,
+                                              gboolean global_cleared) {
+  // Compare with what the connection already has; the common case of
+  // setting the same servers again skips nmcli and the reconnect.
+  gboolean unchanged = FALSE;
+  g_autofree gchar* error = apply_dns_properties(connection, desired, &unchanged);
+  if (error != nullptr) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error setting DNS");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (unchanged && global_cleared) {
+    g_autoptr(FlValue) result = fl_value_new_string("Global DNS cleared - connection DNS already set");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (unchanged) {
+    return unchanged_response();
+  }
+  
+  g_autoptr(FlValue) result = fl_value_new_string("DNS set successfully - Network reconnecting...");
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* set_dns(FlValue* arguments, FlMethodCall* method_call) {
   if (fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
     g_autoptr(FlValue) result = fl_value_new_string("Error: Invalid arguments");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
@@ -106,59 +901,147 @@ FlMethodResponse* set_dns(FlValue* arguments) {
   }
   
   const gchar* dns = fl_value_get_string(dns_value);
-  g_autofree gchar* connection = get_active_connection();
+  // In global mode no connection is looked up, modified or restarted.
+  gboolean global = lookup_bool_argument(arguments, "global");
+  g_autofree gchar* connection = global ? nullptr : get_active_connection();
   
-  if (strlen(connection) == 0) {
+  if (!global && strlen(connection) == 0) {
     g_autoptr(FlValue) result = fl_value_new_string("Error: No active connection found");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
   
-  // Clear existing DNS first, then set new DNS servers
-  g_autofree gchar* command1 = g_strdup_printf("nmcli connection modify '%s' ipv4.ignore-auto-dns yes", connection);
-  g_autofree gchar* output1 = execute_command(command1);
-  
-  g_autofree gchar* command2 = g_strdup_printf("nmcli connection modify '%s' ipv4.dns '%s'", connection, dns);
-  g_autofree gchar* output2 = execute_command(command2);
-  
-  if (strstr(output1, "Error") != NULL || strstr(output2, "Error") != NULL) {
-    g_autoptr(FlValue) result = fl_value_new_string("Error setting DNS");
+  // In local resolver mode the plugin forwards to the given servers itself
+  // and the connection is pointed at the resolver instead.
+  gboolean use_local_resolver = lookup_bool_argument(arguments, "localResolver");
+  g_autofree gchar* applied_dns = nullptr;
+  if (use_local_resolver) {
+    g_autofree gchar* error = start_local_resolver(dns, arguments);
+    if (error != nullptr) {
+      g_autofree gchar* message = g_strdup_printf("Error: Could not start local resolver: %s", error);
+      g_autoptr(FlValue) result = fl_value_new_string(message);
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+    applied_dns = g_strdup(local_resolver->bound_address().HostString().c_str());
+  } else if (strstr(dns, "tls://") != nullptr) {
+    // NetworkManager cannot forward to DNS-over-TLS servers itself.
+    g_autoptr(FlValue) result = fl_value_new_string("Error: DNS-over-TLS servers require the local resolver");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  } else {
+    applied_dns = g_strdup(dns);
   }
-  
-  // Restart the connection to apply changes (run in background)
-  g_autofree gchar* restart_cmd = g_strdup_printf("nmcli connection down '%s' && nmcli connection up '%s' &", connection, connection);
-  system(restart_cmd);
-  
-  g_autoptr(FlValue) result = fl_value_new_string("DNS set successfully - Network reconnecting...");
-  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+
+  // A rejected list leaves a running local resolver, and the connection
+  // pointed at it, as they were.
+  std::vector<dns_manager::ConnectionProperty> desired;
+  if (!dns_manager::DnsPropertiesFor(applied_dns, &desired)) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Invalid DNS server list");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (!use_local_resolver) {
+    stop_local_resolver();
+  }
+
+  if (global) {
+    return set_global_dns(applied_dns, method_call);
+  }
+
+  // Global DNS would override the connection's servers, so it is cleared
+  // first and the connection changed once NetworkManager has done that.
+  std::string target = connection;
+  return with_global_dns(method_call, [target, desired, method_call](const std::vector<std::string>& global_dns, const std::string&) {
+    if (global_dns.empty()) {
+      return apply_connection_dns(target.c_str(), desired, FALSE);
+    }
+    return request_global_dns({}, method_call, [target, desired](const std::string& error) {
+      if (!error.empty()) {
+        g_autofree gchar* message = g_strdup_printf("Error clearing global DNS: %s", error.c_str());
+        g_autoptr(FlValue) result = fl_value_new_string(message);
+        return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      }
+      return apply_connection_dns(target.c_str(), desired, TRUE);
+    });
+  });
 }
 
-FlMethodResponse* reset_dns() {
+// Returns the active connection to automatic DNS. |global_cleared| says
+// whether a global DNS configuration was just cleared.
+static FlMethodResponse* reset_connection_dns(gboolean global_cleared) {
   g_autofree gchar* connection = get_active_connection();
   
   if (strlen(connection) == 0) {
-    g_autoptr(FlValue) result = fl_value_new_string("Error: No active connection found");
+    g_autoptr(FlValue) result = fl_value_new_string(global_cleared ? "Global DNS cleared - no active connection found" : "Error: No active connection found");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
   
   // Reset DNS to automatic by clearing DNS servers
-  g_autofree gchar* command = g_strdup_printf("nmcli connection modify '%s' ipv4.ignore-auto-dns no && nmcli connection modify '%s' ipv4.dns ''", connection, connection);
-  g_autofree gchar* output = execute_command(command);
-  
-  if (strstr(output, "Error") != NULL) {
+  gboolean unchanged = FALSE;
+  g_autofree gchar* error = apply_dns_properties(connection, dns_manager::AutomaticDnsProperties(), &unchanged);
+  if (error != nullptr) {
     g_autoptr(FlValue) result = fl_value_new_string("Error resetting DNS");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
-  
-  // Restart the connection to apply changes (run in background)
-  g_autofree gchar* restart_cmd = g_strdup_printf("nmcli connection down '%s' && nmcli connection up '%s' &", connection, connection);
-  system(restart_cmd);
+  if (unchanged && global_cleared) {
+    g_autoptr(FlValue) result = fl_value_new_string("Global DNS cleared - connection DNS already automatic");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (unchanged) {
+    return unchanged_response();
+  }
   
   g_autoptr(FlValue) result = fl_value_new_string("DNS reset successfully - Network reconnecting...");
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
+FlMethodResponse* reset_dns(FlMethodCall* method_call) {
+  stop_local_resolver();
+
+  return with_global_dns(method_call, [method_call](const std::vector<std::string>& global_dns, const std::string&) {
+    if (global_dns.empty()) {
+      return reset_connection_dns(FALSE);
+    }
+    return request_global_dns({}, method_call, [](const std::string& error) {
+      if (!error.empty()) {
+        g_autofree gchar* message = g_strdup_printf("Error resetting global DNS: %s", error.c_str());
+        g_autoptr(FlValue) result = fl_value_new_string(message);
+        return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      }
+      return reset_connection_dns(TRUE);
+    });
+  });
+}
+
 FlMethodResponse* get_connection_status() {
+  // Same lines as `nmcli -t -f GENERAL connection show`, for the fields the
+  // snapshot holds.
+  g_autoptr(GString) status = nullptr;
+  if (read_primary_connection(
+          [&](const dns_manager::NetworkConnection* connection) {
+            if (connection == nullptr) {
+              return;
+            }
+            std::string devices;
+            for (const std::string& device : connection->devices) {
+              devices += devices.empty() ? device : "," + device;
+            }
+            std::string name;
+            for (char c : connection->id) {
+              if (c == ':' || c == '\\') {
+                name.push_back('\\');
+              }
+              name.push_back(c);
+            }
+            status = g_string_new(nullptr);
+            g_string_append_printf(status, "GENERAL.NAME:%s\n", name.c_str());
+            g_string_append_printf(status, "GENERAL.UUID:%s\n", connection->uuid.c_str());
+            g_string_append_printf(status, "GENERAL.TYPE:%s\n", connection->type.c_str());
+            g_string_append_printf(status, "GENERAL.DEVICES:%s\n", devices.c_str());
+            g_string_append_printf(status, "GENERAL.STATE:%s\n", dns_manager::ConnectionStateName(connection->state));
+            g_string_append_printf(status, "GENERAL.DEFAULT:%s", connection->is_default ? "yes" : "no");
+          })) {
+    g_autoptr(FlValue) result = fl_value_new_string(status ? status->str : "No active connection");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
   g_autofree gchar* connection = get_active_connection();
   
   if (strlen(connection) == 0) {
@@ -182,36 +1065,892 @@ FlMethodResponse* get_connection_status() {
   return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
 }
 
-FlMethodResponse* get_dns() {
-  g_autofree gchar* connection = get_active_connection();
+// Formats a connection's static servers, IPv4 first, as getDNS reports them.
+static FlMethodResponse* dns_servers_response(const std::string& ipv4,
+                                              const std::string& ipv6) {
+  std::string servers = ipv4;
+  if (!ipv6.empty()) {
+    servers += servers.empty() ? ipv6 : "," + ipv6;
+  }
+  if (servers.empty()) {
+    g_autoptr(FlValue) result = fl_value_new_string("Automatic DNS (DHCP)");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  g_autoptr(FlValue) result = fl_value_new_string(servers.c_str());
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Reports a global DNS configuration, which takes precedence over the
+// connection's servers.
+static FlMethodResponse* global_dns_response(const std::vector<std::string>& global_dns) {
+  std::string servers;
+  for (const std::string& server : global_dns) {
+    servers += servers.empty() ? server : "," + server;
+  }
+  g_autofree gchar* message = g_strdup_printf("Global DNS: %s", servers.c_str());
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// The active connection's own servers, as nmcli shows them. |no_connection|
+// says whether the network state already found there is none.
+static FlMethodResponse* connection_dns_response(bool no_connection) {
+  g_autofree gchar* connection = no_connection ? g_strdup("") : get_active_connection();
   
   if (strlen(connection) == 0) {
     g_autoptr(FlValue) result = fl_value_new_string("Error: No active connection found");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
   
-  // Get current DNS settings more efficiently
-  g_autofree gchar* command = g_strdup_printf("nmcli -g ipv4.dns connection show '%s'", connection);
+  g_autofree gchar* command = g_strdup_printf("nmcli -t -f %s connection show '%s'", dns_manager::kDnsPropertyFields, connection);
   g_autofree gchar* output = execute_command(command);
   
   if (strstr(output, "Error") != NULL) {
+    g_strchomp(output);
     g_autoptr(FlValue) result = fl_value_new_string(output);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
   
-  // Remove trailing newline and whitespace
-  g_strchomp(output);
+  std::map<std::string, std::string> properties = dns_manager::ParseNmcliProperties(output);
+  std::string ipv4;
+  std::string ipv6;
+  std::string unused;
+  dns_manager::CanonicalDnsServers(properties["ipv4.dns"], &ipv4, &unused);
+  dns_manager::CanonicalDnsServers(properties["ipv6.dns"], &unused, &ipv6);
+  return dns_servers_response(ipv4, ipv6);
+}
+
+FlMethodResponse* get_dns(FlMethodCall* method_call) {
+  // Answered from the network state when it has the profile's settings;
+  // nmcli is only run before the first snapshot or if NetworkManager would
+  // not hand them out over D-Bus. A global DNS configuration takes precedence
+  // over the connection's servers and is reported as such.
+  FlMethodResponse* response = nullptr;
+  bool have_snapshot = false;
+  bool no_connection = false;
+  read_network_state([&](const dns_manager::NetworkSnapshot* snapshot, const std::string& interface) {
+    if (snapshot == nullptr) {
+      return;
+    }
+    have_snapshot = true;
+    if (!snapshot->global_dns.empty()) {
+      response = global_dns_response(snapshot->global_dns);
+      return;
+    }
+    const dns_manager::NetworkConnection* connection = snapshot->PrimaryConnection(interface);
+    if (connection == nullptr) {
+      no_connection = true;
+    } else if (connection->has_settings) {
+      std::string ipv4;
+      std::string ipv6;
+      for (const std::string& server : connection->ipv4_dns) {
+        ipv4 += ipv4.empty() ? server : "," + server;
+      }
+      for (const std::string& server : connection->ipv6_dns) {
+        ipv6 += ipv6.empty() ? server : "," + server;
+      }
+      response = dns_servers_response(ipv4, ipv6);
+    }
+  });
+  if (response != nullptr) {
+    return response;
+  }
+  if (have_snapshot) {
+    return connection_dns_response(no_connection);
+  }
+  // Before the first snapshot, NetworkManager is asked directly, as nmcli
+  // only shows the connection's own servers.
+  return with_global_dns(method_call, [](const std::vector<std::string>& global_dns, const std::string&) {
+    if (!global_dns.empty()) {
+      return global_dns_response(global_dns);
+    }
+    return connection_dns_response(false);
+  });
+}
+
+FlMethodResponse* get_network_state() {
+  g_autoptr(FlValue) result = nullptr;
+  read_network_state([&](const dns_manager::NetworkSnapshot* snapshot, const std::string&) {
+    if (snapshot == nullptr) {
+      return;
+    }
+    result = fl_value_new_map();
+    fl_value_set_string_take(result, "state", fl_value_new_string(dns_manager::NetworkStateName(snapshot->state)));
+    fl_value_set_string_take(result, "connectivity", fl_value_new_string(dns_manager::ConnectivityName(snapshot->connectivity)));
+    fl_value_set_string_take(result, "generation", fl_value_new_int(snapshot->generation));
+    FlValue* global_dns = fl_value_new_list();
+    for (const std::string& server : snapshot->global_dns) {
+      fl_value_append_take(global_dns, fl_value_new_string(server.c_str()));
+    }
+    fl_value_set_string_take(result, "globalDns", global_dns);
+    FlValue* devices = fl_value_new_list();
+    for (const dns_manager::NetworkDevice& device : snapshot->devices) {
+      FlValue* entry = fl_value_new_map();
+      fl_value_set_string_take(entry, "interface", fl_value_new_string(device.interface.c_str()));
+      fl_value_set_string_take(entry, "type", fl_value_new_string(dns_manager::DeviceTypeName(device.type)));
+      fl_value_set_string_take(entry, "state", fl_value_new_string(dns_manager::DeviceStateName(device.state)));
+      fl_value_set_string_take(entry, "connection", fl_value_new_string(device.connection_uuid.c_str()));
+      fl_value_append_take(devices, entry);
+    }
+    fl_value_set_string_take(result, "devices", devices);
+    FlValue* connections = fl_value_new_list();
+    for (const dns_manager::NetworkConnection& connection : snapshot->connections) {
+      FlValue* entry = fl_value_new_map();
+      fl_value_set_string_take(entry, "id", fl_value_new_string(connection.id.c_str()));
+      fl_value_set_string_take(entry, "uuid", fl_value_new_string(connection.uuid.c_str()));
+      fl_value_set_string_take(entry, "type", fl_value_new_string(connection.type.c_str()));
+      fl_value_set_string_take(entry, "state", fl_value_new_string(dns_manager::ConnectionStateName(connection.state)));
+      fl_value_set_string_take(entry, "default", fl_value_new_bool(connection.is_default));
+      FlValue* interfaces = fl_value_new_list();
+      for (const std::string& device : connection.devices) {
+        fl_value_append_take(interfaces, fl_value_new_string(device.c_str()));
+      }
+      fl_value_set_string_take(entry, "devices", interfaces);
+      FlValue* ipv4_dns = fl_value_new_list();
+      for (const std::string& server : connection.ipv4_dns) {
+        fl_value_append_take(ipv4_dns, fl_value_new_string(server.c_str()));
+      }
+      fl_value_set_string_take(entry, "ipv4Dns", ipv4_dns);
+      FlValue* ipv6_dns = fl_value_new_list();
+      for (const std::string& server : connection.ipv6_dns) {
+        fl_value_append_take(ipv6_dns, fl_value_new_string(server.c_str()));
+      }
+      fl_value_set_string_take(entry, "ipv6Dns", ipv6_dns);
+      fl_value_set_string_take(entry, "ipv4IgnoreAutoDns", fl_value_new_bool(connection.ipv4_ignore_auto_dns));
+      fl_value_set_string_take(entry, "ipv6IgnoreAutoDns", fl_value_new_bool(connection.ipv6_ignore_auto_dns));
+      fl_value_append_take(connections, entry);
+    }
+    fl_value_set_string_take(result, "connections", connections);
+    fl_value_set_string_take(result, "ownsSharedState", fl_value_new_bool(!shared_network_state || shared_network_state->owner()));
+    fl_value_set_string_take(result, "commandsRun", fl_value_new_int(commands_run));
+  });
+  if (result == nullptr) {
+    g_autoptr(FlValue) error = fl_value_new_string("Error: Network state is not available");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(error));
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* get_top_domains(FlValue* arguments) {
+  if (!local_resolver) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Local resolver is not running");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
   
-  if (strlen(output) == 0) {
-    g_autoptr(FlValue) result = fl_value_new_string("Automatic DNS (DHCP)");
+  int64_t count = lookup_int_argument(arguments, "count", 20);
+  if (count < 0) {
+    count = 0;
+  }
+  
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const dns_manager::DomainCount& domain : local_resolver->TopDomains(count)) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "name", fl_value_new_string(domain.name.c_str()));
+    fl_value_set_string_take(entry, "count", fl_value_new_float(domain.count));
+    fl_value_set_string_take(entry, "error", fl_value_new_float(domain.error));
+    fl_value_append_take(result, entry);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* get_resolver_stats() {
+  if (!local_resolver) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Local resolver is not running");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  
+  dns_manager::ResolverStats stats = local_resolver->Stats();
+  g_autoptr(FlValue) result = fl_value_new_map();
+  fl_value_set_string_take(result, "queries", fl_value_new_int(stats.queries));
+  fl_value_set_string_take(result, "cacheHits", fl_value_new_int(stats.cache_hits));
+  fl_value_set_string_take(result, "cacheMisses", fl_value_new_int(stats.cache_misses));
+  fl_value_set_string_take(result, "prefetchesIssued", fl_value_new_int(stats.prefetches_issued));
+  fl_value_set_string_take(result, "prefetchHits", fl_value_new_int(stats.prefetch_hits));
+  fl_value_set_string_take(result, "prefetchesWasted", fl_value_new_int(stats.prefetches_wasted));
+  fl_value_set_string_take(result, "negativeCacheHits", fl_value_new_int(stats.negative_cache_hits));
+  fl_value_set_string_take(result, "staleAnswersServed", fl_value_new_int(stats.stale_answers_served));
+  fl_value_set_string_take(result, "warmCacheHits", fl_value_new_int(stats.warm_cache_hits));
+  fl_value_set_string_take(result, "sharedCacheHits", fl_value_new_int(stats.shared_cache_hits));
+  fl_value_set_string_take(result, "blockedQueries", fl_value_new_int(stats.blocked_queries));
+  fl_value_set_string_take(result, "hostOverrideQueries", fl_value_new_int(stats.host_override_queries));
+  fl_value_set_string_take(result, "tcpQueries", fl_value_new_int(stats.tcp_queries));
+  fl_value_set_string_take(result, "upstreamTcpQueries", fl_value_new_int(stats.upstream_tcp_queries));
+  fl_value_set_string_take(result, "upstreamTcpConnections", fl_value_new_int(stats.upstream_tcp_connections));
+  fl_value_set_string_take(result, "tlsHandshakes", fl_value_new_int(stats.tls_handshakes));
+  fl_value_set_string_take(result, "tlsResumedHandshakes", fl_value_new_int(stats.tls_resumed_handshakes));
+  fl_value_set_string_take(result, "rateLimitedQueries", fl_value_new_int(stats.rate_limited_queries));
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* get_upstream_health() {
+  if (!local_resolver) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Local resolver is not running");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const dns_manager::UpstreamScore& score : local_resolver->UpstreamScores()) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "address", fl_value_new_string(score.address.ToString().c_str()));
+    fl_value_set_string_take(entry, "srttMs", fl_value_new_float(score.srtt_ms));
+    fl_value_set_string_take(entry, "rttVarMs", fl_value_new_float(score.rttvar_ms));
+    fl_value_set_string_take(entry, "timeoutMs", fl_value_new_float(score.timeout_ms));
+    fl_value_set_string_take(entry, "answers", fl_value_new_int(score.answers));
+    fl_value_set_string_take(entry, "timeouts", fl_value_new_int(score.timeouts));
+    fl_value_set_string_take(entry, "consecutiveTimeouts", fl_value_new_int(score.consecutive_timeouts));
+    fl_value_set_string_take(entry, "available", fl_value_new_bool(score.available));
+    fl_value_append_take(result, entry);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Moves |batch| onto |list| as a packed byte list and empties it.
+static void append_query_event_batch(FlValue* list,
+                                     dns_manager::QueryEventBatch* batch) {
+  const std::vector<uint8_t>& bytes = batch->bytes();
+  fl_value_append_take(list, fl_value_new_uint8_list(bytes.data(), bytes.size()));
+  batch->Clear();
+}
+
+FlMethodResponse* query_log_range(FlValue* arguments) {
+  std::string error;
+  if (!query_log && !open_query_log(UINT64_MAX, &error)) {
+    g_autofree gchar* message = g_strdup_printf("Error: Could not open query log: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  
+  // Include what the resolver recorded since the last flush.
+  flush_query_events();
+  int64_t from_us = lookup_int_argument(arguments, "fromUs", 0);
+  int64_t to_us = lookup_int_argument(arguments, "toUs", INT64_MAX);
+  int64_t limit = lookup_int_argument(arguments, "limit", kQueryLogDefaultLimit);
+  std::vector<dns_manager::QueryEvent> events;
+  query_log->Scan(from_us, to_us, static_cast<size_t>(MAX(limit, 0)), &events);
+
+  // The events in the same packed batches queryEvents delivers. Offsets in
+  // a batch are 32-bit microseconds, so a range longer than about an hour
+  // takes several.
+  g_autoptr(FlValue) result = fl_value_new_list();
+  dns_manager::QueryEventBatch batch;
+  int64_t batch_start_us = 0;
+  for (const dns_manager::QueryEvent& event : events) {
+    if (batch.count() > 0 && event.time_us - batch_start_us > UINT32_MAX) {
+      append_query_event_batch(result, &batch);
+    }
+    if (batch.count() == 0) {
+      batch_start_us = event.time_us;
+    }
+    batch.Add(event);
+  }
+  if (batch.count() > 0) {
+    append_query_event_batch(result, &batch);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Reads the "sources" list of a loadBlocklist call. Returns false if it is
+// missing or holds anything but strings.
+static bool blocklist_sources(FlValue* arguments,
+                              std::vector<std::string>* sources) {
+  FlValue* list = nullptr;
+  if (arguments != nullptr && fl_value_get_type(arguments) == FL_VALUE_TYPE_MAP) {
+    list = fl_value_lookup_string(arguments, "sources");
+  }
+  if (list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return false;
+  }
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* source = fl_value_get_list_value(list, i);
+    if (fl_value_get_type(source) != FL_VALUE_TYPE_STRING) {
+      return false;
+    }
+    sources->push_back(fl_value_get_string(source));
+  }
+  return true;
+}
+
+// Compiles |sources| into the index under the user cache directory and maps
+// it. Touches no plugin state, so it can run on a worker thread.
+static std::shared_ptr<const dns_manager::Blocklist> compile_blocklist(
+    const std::vector<std::string>& sources, std::string* error) {
+  dns_manager::BlocklistBuilder builder;
+  for (const std::string& source : sources) {
+    if (!builder.AddFile(source, error)) {
+      *error = "Could not read blocklist: " + *error;
+      return nullptr;
+    }
+  }
+
+  // The compiled index is mapped rather than kept on the heap. Replacing the
+  // file leaves the index in use mapped until the resolver releases it.
+  static std::mutex write_mutex;
+  std::vector<uint8_t> image = builder.Build();
+  std::lock_guard<std::mutex> lock(write_mutex);
+  g_autofree gchar* directory = g_build_filename(g_get_user_cache_dir(), "dns_manager", nullptr);
+  g_mkdir_with_parents(directory, 0700);
+  g_autofree gchar* path = g_build_filename(directory, "blocklist.idx", nullptr);
+  std::shared_ptr<const dns_manager::Blocklist> loaded;
+  if (dns_manager::WriteFileAtomically(path, image.data(), image.size(), error)) {
+    loaded = dns_manager::Blocklist::Open(path, error);
+  }
+  if (!loaded) {
+    *error = "Could not load blocklist: " + *error;
+  }
+  return loaded;
+}
+
+// Makes |view| the blocklist of the running resolver and of resolvers
+// started later.
+static void install_blocklist(dns_manager::BlocklistView view) {
+  blocklist = std::move(view);
+  if (local_resolver) {
+    local_resolver->SetBlocklist(blocklist);
+  }
+}
+
+static FlMethodResponse* blocklist_loaded(
+    std::shared_ptr<const dns_manager::Blocklist> loaded,
+    const std::string& error) {
+  if (!loaded) {
+    g_autofree gchar* message = g_strdup_printf("Error: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  // A full reload supersedes earlier deltas.
+  install_blocklist(dns_manager::BlocklistView(std::move(loaded), nullptr));
+  g_autofree gchar* message = g_strdup_printf("Blocklist loaded: %zu rules", blocklist.size());
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* load_blocklist(FlValue* arguments) {
+  std::vector<std::string> sources;
+  if (!blocklist_sources(arguments, &sources)) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Blocklist sources must be a list of file paths");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  // An empty list turns blocking off.
+  if (sources.empty()) {
+    install_blocklist(dns_manager::BlocklistView());
+    g_autoptr(FlValue) result = fl_value_new_string("Blocklist cleared");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  std::string error;
+  std::shared_ptr<const dns_manager::Blocklist> loaded = compile_blocklist(sources, &error);
+  return blocklist_loaded(std::move(loaded), error);
+}
+
+// A loadBlocklist call compiling on a worker thread.
+struct BlocklistJob {
+  std::vector<std::string> sources;
+  std::shared_ptr<const dns_manager::Blocklist> loaded;
+  std::string error;
+};
+
+static void compile_blocklist_in_thread(GTask* task, gpointer source_object,
+                                        gpointer task_data,
+                                        GCancellable* cancellable) {
+  BlocklistJob* job = static_cast<BlocklistJob*>(task_data);
+  job->loaded = compile_blocklist(job->sources, &job->error);
+  g_task_return_boolean(task, TRUE);
+}
+
+static void blocklist_compiled(GObject* source_object, GAsyncResult* result,
+                               gpointer user_data) {
+  g_autoptr(FlMethodCall) method_call = FL_METHOD_CALL(user_data);
+  BlocklistJob* job = static_cast<BlocklistJob*>(g_task_get_task_data(G_TASK(result)));
+  g_autoptr(FlMethodResponse) response = blocklist_loaded(std::move(job->loaded), job->error);
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+// Compiles large lists without holding up the platform thread; the new
+// index is installed and the call answered back on the main loop. Returns
+// false if the call can be answered right away by load_blocklist().
+static gboolean load_blocklist_in_background(FlMethodCall* method_call) {
+  std::vector<std::string> sources;
+  if (!blocklist_sources(fl_method_call_get_args(method_call), &sources) ||
+      sources.empty()) {
+    return FALSE;
+  }
+  BlocklistJob* job = new BlocklistJob();
+  job->sources = std::move(sources);
+  GTask* task = g_task_new(nullptr, nullptr, blocklist_compiled,
+                           g_object_ref(method_call));
+  g_task_set_task_data(task, job, [](gpointer data) {
+    delete static_cast<BlocklistJob*>(data);
+  });
+  g_task_run_in_thread(task, compile_blocklist_in_thread);
+  g_object_unref(task);
+  return TRUE;
+}
+
+FlMethodResponse* apply_blocklist_delta(FlValue* arguments) {
+  FlValue* path_value = nullptr;
+  if (arguments != nullptr && fl_value_get_type(arguments) == FL_VALUE_TYPE_MAP) {
+    path_value = fl_value_lookup_string(arguments, "path");
+  }
+  if (path_value == nullptr || fl_value_get_type(path_value) != FL_VALUE_TYPE_STRING) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Blocklist delta path required");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  std::string error;
+  std::shared_ptr<const dns_manager::BlocklistDelta> delta =
+      dns_manager::BlocklistDelta::Load(fl_value_get_string(path_value), &error);
+  if (!delta) {
+    g_autofree gchar* message = g_strdup_printf("Error: Could not read blocklist delta: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (blocklist.delta()) {
+    delta = blocklist.delta()->Apply(*delta);
+  }
+  install_blocklist(dns_manager::BlocklistView(blocklist.base(), std::move(delta)));
+  g_autofree gchar* message = g_strdup_printf("Blocklist updated: %zu rules", blocklist.size());
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* set_dns_routes(FlValue* arguments) {
+  FlValue* routes_value = nullptr;
+  if (arguments != nullptr && fl_value_get_type(arguments) == FL_VALUE_TYPE_MAP) {
+    routes_value = fl_value_lookup_string(arguments, "routes");
+  }
+  if (routes_value == nullptr || fl_value_get_type(routes_value) != FL_VALUE_TYPE_MAP) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Routes must map domain suffixes to DNS servers");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  std::vector<dns_manager::DnsRoute> routes;
+  dns_manager::DomainTrie suffixes;
+  for (size_t i = 0; i < fl_value_get_length(routes_value); i++) {
+    FlValue* suffix = fl_value_get_map_key(routes_value, i);
+    FlValue* servers = fl_value_get_map_value(routes_value, i);
+    dns_manager::DnsRoute route;
+    if (fl_value_get_type(suffix) != FL_VALUE_TYPE_STRING ||
+        fl_value_get_type(servers) != FL_VALUE_TYPE_STRING ||
+        !suffixes.Insert(fl_value_get_string(suffix), 0) ||
+        !dns_manager::SocketAddress::ParseList(fl_value_get_string(servers), 53,
+                                               &route.upstreams) ||
+        route.upstreams.empty()) {
+      g_autoptr(FlValue) result = fl_value_new_string("Error: Invalid DNS route");
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+    route.suffix = fl_value_get_string(suffix);
+    routes.push_back(std::move(route));
+  }
+
+  std::string error;
+  if (local_resolver && !local_resolver->SetRoutes(routes, &error)) {
+    g_autofree gchar* message = g_strdup_printf("Error: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  dns_routes = std::move(routes);
+  g_autofree gchar* message = g_strdup_printf("DNS routes set: %zu", dns_routes.size());
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Compiles |sources| into the table under the user cache directory and maps
+// it. Touches no plugin state, so it can run on the watcher thread.
+static std::shared_ptr<const dns_manager::HostOverrides> compile_host_overrides(
+    const HostOverrideSources& sources, std::string* error) {
+  dns_manager::HostOverridesBuilder builder;
+  for (const auto& entry : sources.entries) {
+    if (!builder.AddAddress(entry.first, entry.second) &&
+        !builder.AddCname(entry.first, entry.second)) {
+      *error = "Invalid host override " + entry.first + " -> " + entry.second;
+      return nullptr;
+    }
+  }
+  if (!sources.file.empty() && !builder.AddFile(sources.file, error)) {
+    *error = "Could not read host overrides: " + *error;
+    return nullptr;
+  }
+
+  static std::mutex write_mutex;
+  std::vector<uint8_t> image = builder.Build();
+  std::lock_guard<std::mutex> lock(write_mutex);
+  g_autofree gchar* directory = g_build_filename(g_get_user_cache_dir(), "dns_manager", nullptr);
+  g_mkdir_with_parents(directory, 0700);
+  g_autofree gchar* path = g_build_filename(directory, "hosts.idx", nullptr);
+  std::shared_ptr<const dns_manager::HostOverrides> loaded;
+  if (dns_manager::WriteFileAtomically(path, image.data(), image.size(), error)) {
+    loaded = dns_manager::HostOverrides::Open(path, error);
+  }
+  if (!loaded) {
+    *error = "Could not load host overrides: " + *error;
+  }
+  return loaded;
+}
+
+// Makes |overrides| those of the running resolver and of resolvers started
+// later.
+static void install_host_overrides(
+    std::shared_ptr<const dns_manager::HostOverrides> overrides) {
+  host_overrides = std::move(overrides);
+  if (local_resolver) {
+    local_resolver->SetHostOverrides(host_overrides);
+  }
+}
+
+// A table recompiled after the hosts file changed.
+struct HostOverridesReload {
+  std::shared_ptr<const dns_manager::HostOverrides> loaded;
+  guint generation;
+};
+
+static gboolean host_overrides_reloaded(gpointer user_data) {
+  std::unique_ptr<HostOverridesReload> reload(static_cast<HostOverridesReload*>(user_data));
+  if (reload->generation == host_overrides_generation) {
+    install_host_overrides(std::move(reload->loaded));
+  }
+  return G_SOURCE_REMOVE;
+}
+
+// Runs on the watcher thread, which setHostOverrides stops before touching
+// the sources. A file that cannot be read, say because it is being
+// replaced, leaves the overrides in use alone.
+static void host_overrides_file_changed(void* context) {
+  std::string error;
+  std::shared_ptr<const dns_manager::HostOverrides> loaded =
+      compile_host_overrides(host_override_sources, &error);
+  if (!loaded) {
+    return;
+  }
+  g_idle_add(host_overrides_reloaded,
+             new HostOverridesReload{std::move(loaded), host_overrides_generation});
+}
+
+FlMethodResponse* set_host_overrides(FlValue* arguments) {
+  HostOverrideSources sources;
+  FlValue* hosts = nullptr;
+  FlValue* file = nullptr;
+  if (arguments != nullptr && fl_value_get_type(arguments) == FL_VALUE_TYPE_MAP) {
+    hosts = fl_value_lookup_string(arguments, "hosts");
+    file = fl_value_lookup_string(arguments, "file");
+  }
+  bool valid = (hosts == nullptr || fl_value_get_type(hosts) == FL_VALUE_TYPE_MAP) &&
+               (file == nullptr || fl_value_get_type(file) == FL_VALUE_TYPE_STRING);
+  for (size_t i = 0; valid && hosts != nullptr && i < fl_value_get_length(hosts); i++) {
+    FlValue* name = fl_value_get_map_key(hosts, i);
+    FlValue* values = fl_value_get_map_value(hosts, i);
+    valid = fl_value_get_type(name) == FL_VALUE_TYPE_STRING &&
+            fl_value_get_type(values) == FL_VALUE_TYPE_LIST;
+    for (size_t j = 0; valid && j < fl_value_get_length(values); j++) {
+      FlValue* value = fl_value_get_list_value(values, j);
+      valid = fl_value_get_type(value) == FL_VALUE_TYPE_STRING;
+      if (valid) {
+        sources.entries.emplace_back(fl_value_get_string(name), fl_value_get_string(value));
+      }
+    }
+  }
+  if (!valid) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Host overrides must map names to lists of addresses or names");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  if (file != nullptr) {
+    sources.file = fl_value_get_string(file);
+  }
+
+  std::string error;
+  std::shared_ptr<const dns_manager::HostOverrides> loaded;
+  if (!sources.entries.empty() || !sources.file.empty()) {
+    loaded = compile_host_overrides(sources, &error);
+    if (!loaded) {
+      g_autofree gchar* message = g_strdup_printf("Error: %s", error.c_str());
+      g_autoptr(FlValue) result = fl_value_new_string(message);
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+  }
+
+  // The old watcher is stopped before its sources change, and reloads it
+  // already queued are discarded.
+  host_overrides_watcher.reset();
+  host_overrides_generation++;
+  host_override_sources = std::move(sources);
+  install_host_overrides(loaded);
+  if (!loaded) {
+    g_autoptr(FlValue) result = fl_value_new_string("Host overrides cleared");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  // Without inotify the file is only read again on the next call.
+  if (!host_override_sources.file.empty()) {
+    host_overrides_watcher = std::make_unique<dns_manager::FileWatcher>(host_override_sources.file);
+    host_overrides_watcher->set_change_callback(host_overrides_file_changed, nullptr);
+    if (!host_overrides_watcher->Start(&error)) {
+      host_overrides_watcher.reset();
+    }
+  }
+  g_autofree gchar* message = g_strdup_printf("Host overrides set: %zu names", host_overrides->size());
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Where definePreset keeps the presets, under the user's config directory.
+static std::string presets_path() {
+  g_autofree gchar* path = g_build_filename(g_get_user_config_dir(), "dns_manager", "presets.bin", nullptr);
+  return path;
+}
+
+// The defined presets, read from disk the first time. Returns nullptr and
+// sets |error| if the file cannot be read.
+static dns_manager::DnsPresets* loaded_presets(std::string* error) {
+  if (!dns_presets) {
+    auto presets = std::make_unique<dns_manager::DnsPresets>();
+    if (!presets->Load(presets_path(), error)) {
+      return nullptr;
+    }
+    dns_presets = std::move(presets);
+  }
+  return dns_presets.get();
+}
+
+// The "name" argument of the preset methods, or nullptr if it is missing.
+static const gchar* preset_name_argument(FlValue* arguments) {
+  if (arguments == nullptr || fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(arguments, "name");
+  if (value == nullptr || fl_value_get_type(value) != FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  return fl_value_get_string(value);
+}
+
+FlMethodResponse* define_preset(FlValue* arguments) {
+  const gchar* name = preset_name_argument(arguments);
+  FlValue* dns_value = name != nullptr ? fl_value_lookup_string(arguments, "dns") : nullptr;
+  if (dns_value == nullptr || fl_value_get_type(dns_value) != FL_VALUE_TYPE_STRING) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Preset name and DNS parameter required");
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  const gchar* dns = fl_value_get_string(dns_value);
+
+  std::string error;
+  dns_manager::DnsPresets* presets = loaded_presets(&error);
+  if (presets == nullptr) {
+    g_autofree gchar* message = g_strdup_printf("Error: Could not read presets: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  // Validate on a copy, so that a failed save leaves memory matching disk.
+  dns_manager::DnsPresets updated = *presets;
+  bool removed = strlen(dns) == 0;
+  if (removed) {
+    updated.Remove(name);
+  } else if (!updated.Define(name, dns, lookup_bool_argument(arguments, "global"), &error)) {
+    g_autofree gchar* message = g_strdup_printf("Error: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  std::string path = presets_path();
+  g_autofree gchar* directory = g_path_get_dirname(path.c_str());
+  g_mkdir_with_parents(directory, 0700);
+  if (!updated.Save(path, &error)) {
+    g_autofree gchar* message = g_strdup_printf("Error: Could not save presets: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  *presets = std::move(updated);
+
+  g_autofree gchar* message = nullptr;
+  if (removed) {
+    message = g_strdup_printf("Preset removed: %s", name);
   } else {
-    g_autoptr(FlValue) result = fl_value_new_string(output);
+    std::string servers;
+    for (const std::string& server : presets->Find(name)->servers) {
+      servers += (servers.empty() ? "" : ",") + server;
+    }
+    message = g_strdup_printf("Preset defined: %s (%s)", name, servers.c_str());
+  }
+  g_autoptr(FlValue) result = fl_value_new_string(message);
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+FlMethodResponse* list_presets() {
+  std::string error;
+  dns_manager::DnsPresets* presets = loaded_presets(&error);
+  if (presets == nullptr) {
+    g_autofree gchar* message = g_strdup_printf("Error: Could not read presets: %s", error.c_str());
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+  g_autoptr(FlValue) result = fl_value_new_list();
+  for (const dns_manager::DnsPreset& preset : presets->presets()) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "name", fl_value_new_string(preset.name.c_str()));
+    FlValue* servers = fl_value_new_list();
+    for (const std::string& server : preset.servers) {
+      fl_value_append_take(servers, fl_value_new_string(server.c_str()));
+    }
+    fl_value_set_string_take(entry, "servers", servers);
+    fl_value_set_string_take(entry, "global", fl_value_new_bool(preset.global));
+    fl_value_append_take(result, entry);
+  }
+  return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+}
+
+// Applies a preset with as few round trips to NetworkManager as possible:
+// the connection and its current settings come from the network state, the
+// preset's settings were worked out when it was defined, and whatever
+// differs goes out in one nmcli modify (or one D-Bus call for a global
+// preset). Answers with the time spent in each step, through |method_call|
+// once NetworkManager has replied if it had to take a global DNS change.
+FlMethodResponse* apply_preset(FlValue* arguments, FlMethodCall* method_call) {
+  gint64 started = g_get_monotonic_time();
+  const gchar* name = preset_name_argument(arguments);
+  if (name == nullptr) {
+    g_autoptr(FlValue) result = fl_value_new_string("Error: Preset name required");
     return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
   }
+  std::string error;
+  dns_manager::DnsPresets* presets = loaded_presets(&error);
+  const dns_manager::DnsPreset* preset = presets != nullptr ? presets->Find(name) : nullptr;
+  if (preset == nullptr) {
+    g_autofree gchar* message = presets == nullptr
+        ? g_strdup_printf("Error: Could not read presets: %s", error.c_str())
+        : g_strdup_printf("Error: Unknown preset: %s", name);
+    g_autoptr(FlValue) result = fl_value_new_string(message);
+    return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+  }
+
+  int64_t commands_before = commands_run;
+  int64_t dbus_calls_before = dbus_calls_made;
+  g_autofree gchar* connection = nullptr;
+  std::map<std::string, std::string> current;
+  read_network_state([&](const dns_manager::NetworkSnapshot* snapshot, const std::string& interface) {
+    if (snapshot == nullptr) {
+      return;
+    }
+    const dns_manager::NetworkConnection* primary = snapshot->PrimaryConnection(interface);
+    if (!preset->global && primary != nullptr) {
+      connection = g_strdup(primary->uuid.c_str());
+      // Right after a change the profile is read back instead: comparing
+      // with the settings from before it could skip a switch back.
+      if (network_state_settled()) {
+        current = dns_manager::ConnectionDnsProperties(*primary);
+      }
+    }
+  });
+  if (!preset->global) {
+    // Without the network state, or its copy of the profile, ask nmcli.
+    if (connection == nullptr) {
+      connection = get_active_connection();
+    }
+    if (strlen(connection) == 0) {
+      g_autoptr(FlValue) result = fl_value_new_string("Error: No active connection found");
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    }
+    if (current.empty()) {
+      g_autofree gchar* show_cmd = g_strdup_printf("nmcli -t -f %s connection show '%s'", dns_manager::kDnsPropertyFields, connection);
+      g_autofree gchar* output = execute_command(show_cmd);
+      current = dns_manager::ParseNmcliProperties(output);
+    }
+  }
+
+  // The global configuration comes from the network state, or from
+  // NetworkManager when there is none yet, so that an active one is always
+  // found.
+  dns_manager::DnsPreset chosen = *preset;
+  std::string target = connection != nullptr ? connection : "";
+  return with_global_dns(method_call, [=](const std::vector<std::string>& global_dns, const std::string& read_error) {
+    gint64 looked_up = g_get_monotonic_time();
+
+    std::vector<dns_manager::ConnectionProperty> changed;
+    bool unchanged;
+    if (chosen.global) {
+      unchanged = read_error.empty() && global_dns == chosen.servers;
+    } else {
+      changed = dns_manager::ChangedProperties(chosen.properties, current);
+      unchanged = changed.empty() && global_dns.empty();
+    }
+    gint64 compared = g_get_monotonic_time();
+
+    // Answers once whatever differed has been applied. The reconnect that
+    // follows a modify runs in the background and is not part of the
+    // timings.
+    auto respond = [=](const gchar* message, bool applied) {
+      gint64 finished = g_get_monotonic_time();
+      // Presets name servers directly, so a running local resolver is not
+      // needed any more; until now it still served the old settings.
+      stop_local_resolver();
+      g_autoptr(FlValue) result = fl_value_new_map();
+      fl_value_set_string_take(result, "preset", fl_value_new_string(chosen.name.c_str()));
+      fl_value_set_string_take(result, "result", fl_value_new_string(message));
+      fl_value_set_string_take(result, "changed", fl_value_new_bool(applied));
+      fl_value_set_string_take(result, "backendCalls", fl_value_new_int(commands_run - commands_before + dbus_calls_made - dbus_calls_before));
+      fl_value_set_string_take(result, "lookupUs", fl_value_new_int(looked_up - started));
+      fl_value_set_string_take(result, "compareUs", fl_value_new_int(compared - looked_up));
+      fl_value_set_string_take(result, "applyUs", fl_value_new_int(finished - compared));
+      fl_value_set_string_take(result, "totalUs", fl_value_new_int(finished - started));
+      return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+    };
+    if (unchanged) {
+      return respond("DNS unchanged - preset already applied", false);
+    }
+    if (chosen.global) {
+      return request_global_dns(chosen.servers, method_call, [respond](const std::string& error) {
+        if (!error.empty()) {
+          g_autofree gchar* message = g_strdup_printf("Error setting global DNS: %s", error.c_str());
+          g_autoptr(FlValue) result = fl_value_new_string(message);
+          return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+        }
+        return respond("Preset applied - global DNS set", true);
+      });
+    }
+
+    // Sets the connection's servers, if they differ, once global DNS is out
+    // of the way.
+    auto modify = [respond, target, changed]() {
+      if (changed.empty()) {
+        return respond("Preset applied - global DNS cleared", true);
+      }
+      g_autofree gchar* output = modify_dns_properties(target.c_str(), changed);
+      if (output != nullptr) {
+        g_autoptr(FlValue) result = fl_value_new_string("Error applying preset");
+        return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+      }
+      return respond("Preset applied - Network reconnecting...", true);
+    };
+    // Global DNS would override the connection's servers.
+    if (!global_dns.empty()) {
+      return request_global_dns({}, method_call, [modify](const std::string& error) {
+        if (!error.empty()) {
+          g_autofree gchar* message = g_strdup_printf("Error clearing global DNS: %s", error.c_str());
+          g_autoptr(FlValue) result = fl_value_new_string(message);
+          return FL_METHOD_RESPONSE(fl_method_success_response_new(result));
+        }
+        return modify();
+      });
+    }
+    return modify();
+  });
 }
 
 static void dns_manager_plugin_dispose(GObject* object) {
+  if (network_state_takeover_timer != 0) {
+    g_source_remove(network_state_takeover_timer);
+    network_state_takeover_timer = 0;
+  }
+  route_monitor.reset();
+  host_overrides_watcher.reset();
+  if (query_event_timer != 0) {
+    g_source_remove(query_event_timer);
+    query_event_timer = 0;
+  }
+  query_events_listening = FALSE;
+  g_clear_object(&query_event_channel);
+  stop_local_resolver();
+  query_log_enabled = FALSE;
+  query_log.reset();
+  network_monitor.reset();
+  shared_network_state.reset();
   G_OBJECT_CLASS(dns_manager_plugin_parent_class)->dispose(object);
 }
 
@@ -240,5 +1979,26 @@ void dns_manager_plugin_register_with_registrar(FlPluginRegistrar* registrar) {
                                             g_object_ref(plugin),
                                             g_object_unref);
 
+  query_event_channel = fl_event_channel_new(fl_plugin_registrar_get_messenger(registrar),
+                                             "dns_manager/query_events",
+                                             FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(query_event_channel, query_events_listen,
+                                       query_events_cancel, nullptr, nullptr);
+
+  // Only maps the file and checks its header; records are validated when
+  // first looked up.
+  open_warm_cache();
+
+  // Of all the apps embedding the plugin, only the first follows the
+  // routing table and NetworkManager; the others read what it shares.
+  // Without shared memory each follows them itself.
+  std::string shared_error;
+  shared_network_state = dns_manager::SharedNetworkState::Open(dns_manager::SharedNetworkState::DefaultName(), &shared_error);
+  if (!shared_network_state || shared_network_state->TryBecomeOwner()) {
+    start_network_monitors();
+  } else {
+    network_state_takeover_timer = g_timeout_add_seconds(kNetworkStateTakeoverSeconds, take_over_network_state, nullptr);
+  }
+
   g_object_unref(plugin);
 }
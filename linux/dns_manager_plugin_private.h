@@ -1,13 +1,46 @@
 #include <flutter_linux/flutter_linux.h>
 
+#include <string>
+#include <vector>
+
 #include "include/dns_manager/dns_manager_plugin.h"
+#include "network_monitor.h"
 
 // This file exposes some plugin internals for unit testing. See
 // https://github.com/flutter/flutter/issues/88724 for current limitations
 // in the unit-testable API.
 
+// How the plugin reads and changes NetworkManager's global DNS
+// configuration; dns_manager::GetGlobalDns and SetGlobalDns unless a test
+// puts its own in place. Either may call back before returning.
+struct GlobalDnsBackend {
+  void (*get)(dns_manager::GlobalDnsReadCallback done, void* context);
+  void (*set)(const std::vector<std::string>& servers,
+              dns_manager::GlobalDnsCallback done, void* context);
+};
+void set_global_dns_backend(const GlobalDnsBackend& backend);
+
 // DNS management functions
-FlMethodResponse* get_dns();
-FlMethodResponse* set_dns(FlValue* arguments);
-FlMethodResponse* reset_dns();
+// These three, and apply_preset, return nullptr when they have to wait for
+// NetworkManager's global DNS configuration; |method_call| is answered once
+// it replies, and may be nullptr to drop the answer.
+FlMethodResponse* get_dns(FlMethodCall* method_call);
+FlMethodResponse* set_dns(FlValue* arguments, FlMethodCall* method_call);
+FlMethodResponse* reset_dns(FlMethodCall* method_call);
 FlMethodResponse* get_connection_status();
+FlMethodResponse* get_network_state();
+
+// DNS preset functions
+FlMethodResponse* define_preset(FlValue* arguments);
+FlMethodResponse* apply_preset(FlValue* arguments, FlMethodCall* method_call);
+FlMethodResponse* list_presets();
+
+// Local resolver functions
+FlMethodResponse* get_top_domains(FlValue* arguments);
+FlMethodResponse* get_resolver_stats();
+FlMethodResponse* get_upstream_health();
+FlMethodResponse* query_log_range(FlValue* arguments);
+FlMethodResponse* load_blocklist(FlValue* arguments);
+FlMethodResponse* apply_blocklist_delta(FlValue* arguments);
+FlMethodResponse* set_dns_routes(FlValue* arguments);
+FlMethodResponse* set_host_overrides(FlValue* arguments);
@@ -0,0 +1,507 @@
+#include "dns_message.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dns_manager {
+
+namespace {
+
+char ToLower(uint8_t c) {
+  return static_cast<char>(c >= 'A' && c <= 'Z' ? c + 32 : c);
+}
+
+// Calls |visit(label, label_length)| for each label of the checked name at
+// |offset|, following compression pointers. Returns false if the name runs
+// off the end of the message or |visit| returns false.
+template <typename Visitor>
+bool ForEachLabel(const uint8_t* message, size_t length, size_t offset,
+                  Visitor visit) {
+  // A checked name cannot need more steps than it has bytes.
+  for (size_t steps = 0; steps <= kMaxDnsNameLength && offset < length;
+       steps++) {
+    uint8_t label_length = message[offset];
+    if ((label_length & 0xc0) == 0xc0) {
+      if (offset + 1 >= length) {
+        return false;
+      }
+      offset = ((label_length & 0x3f) << 8) | message[offset + 1];
+      continue;
+    }
+    if (label_length == 0) {
+      return true;
+    }
+    if ((label_length & 0xc0) || offset + 1 + label_length > length ||
+        !visit(message + offset + 1, label_length)) {
+      return false;
+    }
+    offset += label_length + 1;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool SkipDnsName(const uint8_t* message, size_t length, size_t offset,
+                 size_t* end) {
+  size_t position = offset;
+  // Length of the name in uncompressed wire format, including the root.
+  size_t wire_length = 0;
+  bool jumped = false;
+  while (true) {
+    if (position >= length) {
+      return false;
+    }
+    uint8_t label_length = message[position];
+    if ((label_length & 0xc0) == 0xc0) {
+      if (position + 1 >= length) {
+        return false;
+      }
+      size_t target = ((label_length & 0x3f) << 8) | message[position + 1];
+      // Backward pointers plus the length limit below mean every walk ends.
+      if (target < kDnsHeaderSize || target >= position) {
+        return false;
+      }
+      if (!jumped) {
+        *end = position + 2;
+        jumped = true;
+      }
+      position = target;
+      continue;
+    }
+    if (label_length & 0xc0) {
+      return false;
+    }
+    wire_length += label_length + 1;
+    if (wire_length > kMaxDnsNameLength) {
+      return false;
+    }
+    if (label_length == 0) {
+      break;
+    }
+    position += label_length + 1;
+  }
+  if (!jumped) {
+    *end = position + 1;
+  }
+  return true;
+}
+
+bool DnsNameView::Decode(char* out, size_t out_capacity,
+                         size_t* decoded_length) const {
+  size_t written = 0;
+  bool ok = ForEachLabel(message_, length_, offset_,
+                         [&](const uint8_t* label, size_t label_length) {
+                           size_t dot = written > 0 ? 1 : 0;
+                           if (written + dot + label_length > out_capacity) {
+                             return false;
+                           }
+                           if (dot) {
+                             out[written++] = '.';
+                           }
+                           for (size_t i = 0; i < label_length; i++) {
+                             out[written++] = ToLower(label[i]);
+                           }
+                           return true;
+                         });
+  *decoded_length = written;
+  return ok;
+}
+
+std::string DnsNameView::ToString() const {
+  char buffer[kMaxDnsNameLength];
+  size_t decoded_length = 0;
+  if (!Decode(buffer, sizeof(buffer), &decoded_length)) {
+    return std::string();
+  }
+  return std::string(buffer, decoded_length);
+}
+
+bool DnsNameView::Equals(const char* name, size_t name_length) const {
+  char buffer[kMaxDnsNameLength];
+  size_t decoded_length = 0;
+  if (!Decode(buffer, sizeof(buffer), &decoded_length) ||
+      decoded_length != name_length) {
+    return false;
+  }
+  for (size_t i = 0; i < name_length; i++) {
+    if (buffer[i] != ToLower(static_cast<uint8_t>(name[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DnsNameView::Equals(const DnsNameView& other) const {
+  char buffer[kMaxDnsNameLength];
+  size_t decoded_length = 0;
+  return other.Decode(buffer, sizeof(buffer), &decoded_length) &&
+         Equals(buffer, decoded_length);
+}
+
+DnsMessageReader::DnsMessageReader(const uint8_t* message, size_t length)
+    : message_(message), length_(length) {
+  if (length < kDnsHeaderSize) {
+    valid_ = false;
+    return;
+  }
+  header_.id = ReadU16(message);
+  header_.flags = ReadU16(message + 2);
+  header_.question_count = ReadU16(message + 4);
+  header_.answer_count = ReadU16(message + 6);
+  header_.authority_count = ReadU16(message + 8);
+  header_.additional_count = ReadU16(message + 10);
+  questions_left_ = header_.question_count;
+  records_left_[0] = header_.answer_count;
+  records_left_[1] = header_.authority_count;
+  records_left_[2] = header_.additional_count;
+}
+
+bool DnsMessageReader::NextQuestion(DnsQuestionView* question) {
+  if (!valid_ || questions_left_ == 0) {
+    return false;
+  }
+  size_t end = 0;
+  if (!SkipDnsName(message_, length_, offset_, &end) || end + 4 > length_) {
+    return Fail();
+  }
+  question->name = DnsNameView(message_, length_, offset_);
+  question->qtype = ReadU16(message_ + end);
+  question->qclass = ReadU16(message_ + end + 2);
+  question->end = end + 4;
+  offset_ = end + 4;
+  questions_left_--;
+  return true;
+}
+
+bool DnsMessageReader::NextRecord(DnsRecordView* record) {
+  DnsQuestionView question;
+  while (questions_left_ > 0) {
+    if (!NextQuestion(&question)) {
+      return false;
+    }
+  }
+  if (!valid_) {
+    return false;
+  }
+  size_t section = 0;
+  while (section < 3 && records_left_[section] == 0) {
+    section++;
+  }
+  if (section == 3) {
+    return false;
+  }
+
+  size_t end = 0;
+  if (!SkipDnsName(message_, length_, offset_, &end) || end + 10 > length_) {
+    return Fail();
+  }
+  uint16_t rdata_length = ReadU16(message_ + end + 8);
+  if (end + 10 + rdata_length > length_) {
+    return Fail();
+  }
+  record->name = DnsNameView(message_, length_, offset_);
+  record->section = static_cast<DnsSection>(section + 1);
+  record->type = ReadU16(message_ + end);
+  record->rclass = ReadU16(message_ + end + 2);
+  record->ttl = ReadU32(message_ + end + 4);
+  record->ttl_offset = end + 4;
+  record->rdata = message_ + end + 10;
+  record->rdata_length = rdata_length;
+  record->rdata_offset = end + 10;
+  offset_ = end + 10 + rdata_length;
+  records_left_[section]--;
+  return true;
+}
+
+DnsMessageBuilder::DnsMessageBuilder(uint8_t* buffer, size_t capacity)
+    : buffer_(buffer), capacity_(capacity) {
+  if (capacity >= kDnsHeaderSize) {
+    memset(buffer, 0, kDnsHeaderSize);
+    length_ = kDnsHeaderSize;
+  }
+}
+
+void DnsMessageBuilder::SetHeader(uint16_t id, uint16_t flags) {
+  if (length_ > 0) {
+    WriteU16(buffer_, id);
+    WriteU16(buffer_ + 2, flags);
+  }
+}
+
+bool DnsMessageBuilder::AddQuestion(const char* name, size_t name_length,
+                                    uint16_t qtype, uint16_t qclass) {
+  size_t saved_length = length_;
+  size_t saved_targets = target_count_;
+  if (!BeginSection(DnsSection::kQuestion) || !WriteName(name, name_length) ||
+      capacity_ - length_ < 4) {
+    length_ = saved_length;
+    target_count_ = saved_targets;
+    return false;
+  }
+  WriteU16(buffer_ + length_, qtype);
+  WriteU16(buffer_ + length_ + 2, qclass);
+  length_ += 4;
+  CountRecord(DnsSection::kQuestion);
+  return true;
+}
+
+bool DnsMessageBuilder::AddRecord(DnsSection section, const char* name,
+                                  size_t name_length, uint16_t type,
+                                  uint16_t rclass, uint32_t ttl,
+                                  const uint8_t* rdata,
+                                  uint16_t rdata_length) {
+  size_t saved_length = length_;
+  size_t saved_targets = target_count_;
+  if (section == DnsSection::kQuestion || !BeginSection(section) ||
+      !WriteName(name, name_length) ||
+      capacity_ - length_ < 10 + static_cast<size_t>(rdata_length)) {
+    length_ = saved_length;
+    target_count_ = saved_targets;
+    return false;
+  }
+  uint8_t* out = buffer_ + length_;
+  WriteU16(out, type);
+  WriteU16(out + 2, rclass);
+  WriteU32(out + 4, ttl);
+  WriteU16(out + 8, rdata_length);
+  if (rdata_length > 0) {
+    memcpy(out + 10, rdata, rdata_length);
+  }
+  length_ += 10 + rdata_length;
+  CountRecord(section);
+  return true;
+}
+
+bool DnsMessageBuilder::BeginSection(DnsSection section) {
+  if (length_ == 0 || section < section_) {
+    return false;
+  }
+  section_ = section;
+  return true;
+}
+
+void DnsMessageBuilder::CountRecord(DnsSection section) {
+  uint8_t* count = buffer_ + 4 + 2 * static_cast<size_t>(section);
+  WriteU16(count, static_cast<uint16_t>(ReadU16(count) + 1));
+}
+
+bool DnsMessageBuilder::WriteName(const char* name, size_t name_length) {
+  if (name_length > 0 && name[name_length - 1] == '.') {
+    name_length--;
+  }
+  size_t wire_length = name_length == 0 ? 1 : name_length + 2;
+  if (wire_length > kMaxDnsNameLength) {
+    return false;
+  }
+  // Start of each label in |name|.
+  size_t starts[kMaxDnsNameLength / 2 + 1];
+  size_t label_count = 0;
+  for (size_t start = 0; start < name_length;) {
+    const char* dot = static_cast<const char*>(
+        memchr(name + start, '.', name_length - start));
+    size_t end = dot != nullptr ? dot - name : name_length;
+    if (end == start || end - start > kMaxDnsLabelLength) {
+      return false;
+    }
+    starts[label_count++] = start;
+    start = end + 1;
+  }
+
+  // Find the longest suffix already in the message.
+  size_t labels_to_write = label_count;
+  size_t pointer = 0;
+  for (size_t i = 0; i < label_count && pointer == 0; i++) {
+    for (size_t t = 0; t < target_count_; t++) {
+      if (SuffixMatches(targets_[t], name + starts[i],
+                        name_length - starts[i])) {
+        labels_to_write = i;
+        pointer = targets_[t];
+        break;
+      }
+    }
+  }
+
+  size_t needed = pointer != 0 ? starts[labels_to_write] + 2 : wire_length;
+  if (capacity_ - length_ < needed) {
+    return false;
+  }
+  for (size_t i = 0; i < labels_to_write; i++) {
+    size_t end = i + 1 < label_count ? starts[i + 1] - 1 : name_length;
+    size_t label_length = end - starts[i];
+    if (length_ < 0x4000 && target_count_ < kMaxCompressionTargets) {
+      targets_[target_count_++] = static_cast<uint16_t>(length_);
+    }
+    buffer_[length_++] = static_cast<uint8_t>(label_length);
+    memcpy(buffer_ + length_, name + starts[i], label_length);
+    length_ += label_length;
+  }
+  if (pointer != 0) {
+    WriteU16(buffer_ + length_, static_cast<uint16_t>(0xc000 | pointer));
+    length_ += 2;
+  } else {
+    buffer_[length_++] = 0;
+  }
+  return true;
+}
+
+bool DnsMessageBuilder::SuffixMatches(size_t offset, const char* suffix,
+                                      size_t length) const {
+  size_t position = 0;
+  bool matched = ForEachLabel(
+      buffer_, length_, offset, [&](const uint8_t* label, size_t label_length) {
+        if (position > 0) {
+          if (position >= length || suffix[position] != '.') {
+            return false;
+          }
+          position++;
+        }
+        if (length - position < label_length) {
+          return false;
+        }
+        for (size_t i = 0; i < label_length; i++) {
+          if (ToLower(label[i]) !=
+              ToLower(static_cast<uint8_t>(suffix[position + i]))) {
+            return false;
+          }
+        }
+        position += label_length;
+        return true;
+      });
+  return matched && position == length;
+}
+
+size_t BuildQuery(const DnsQuestion& question, uint16_t id, uint8_t* out,
+                  size_t out_capacity) {
+  DnsMessageBuilder builder(out, out_capacity);
+  builder.SetHeader(id, 0x0100);  // RD
+  if (!builder.AddQuestion(question.name.data(), question.name.size(),
+                           question.qtype, question.qclass)) {
+    return 0;
+  }
+  return builder.length();
+}
+
+bool FindMinimumTtl(const uint8_t* message, size_t length, uint32_t* ttl) {
+  bool found = false;
+  uint32_t minimum = UINT32_MAX;
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    if (record.section != DnsSection::kAdditional && record.type != kTypeOpt) {
+      minimum = std::min(minimum, record.ttl);
+      found = true;
+    }
+  }
+  if (!reader.valid() || !found) {
+    return false;
+  }
+  *ttl = minimum;
+  return true;
+}
+
+bool FindNegativeTtl(const uint8_t* message, size_t length, uint32_t* ttl) {
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    if (record.section != DnsSection::kAuthority || record.type != kTypeSoa) {
+      continue;
+    }
+    // RDATA: MNAME, RNAME, then SERIAL REFRESH RETRY EXPIRE MINIMUM.
+    size_t rdata_end = record.rdata_offset + record.rdata_length;
+    size_t fields = 0;
+    if (!SkipDnsName(message, rdata_end, record.rdata_offset, &fields) ||
+        !SkipDnsName(message, rdata_end, fields, &fields) ||
+        fields + 20 > rdata_end) {
+      continue;
+    }
+    *ttl = std::min(record.ttl, ReadU32(message + fields + 16));
+    return true;
+  }
+  return false;
+}
+
+bool AgeTtls(uint8_t* message, size_t length, uint32_t elapsed) {
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    if (record.type != kTypeOpt) {
+      WriteU32(message + record.ttl_offset,
+               record.ttl > elapsed ? record.ttl - elapsed : 0);
+    }
+  }
+  return reader.valid();
+}
+
+bool SetTtls(uint8_t* message, size_t length, uint32_t ttl) {
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    if (record.type != kTypeOpt) {
+      WriteU32(message + record.ttl_offset, ttl);
+    }
+  }
+  return reader.valid();
+}
+
+bool ParseFirstQuestion(const uint8_t* message, size_t length,
+                        DnsQuestion* question) {
+  DnsMessageReader reader(message, length);
+  DnsQuestionView view;
+  if (!reader.NextQuestion(&view)) {
+    return false;
+  }
+  question->name = view.name.ToString();
+  question->qtype = view.qtype;
+  question->qclass = view.qclass;
+  return true;
+}
+
+size_t BuildErrorResponse(const uint8_t* query, size_t query_length,
+                          uint8_t rcode, uint8_t* out, size_t out_capacity) {
+  DnsMessageReader reader(query, query_length);
+  DnsQuestionView question;
+  if (!reader.NextQuestion(&question) || question.end > out_capacity) {
+    return 0;
+  }
+  // Everything up to the end of the first question is copied verbatim; any
+  // compression pointers in it point backwards into that range.
+  memcpy(out, query, question.end);
+  // QR=1, keep opcode and RD; RA=1 and the requested rcode.
+  out[2] = static_cast<uint8_t>(0x80 | (query[2] & 0x79));
+  out[3] = static_cast<uint8_t>(0x80 | (rcode & 0x0f));
+  WriteU16(out + 4, 1);
+  WriteU16(out + 6, 0);
+  WriteU16(out + 8, 0);
+  WriteU16(out + 10, 0);
+  return question.end;
+}
+
+size_t MaxUdpResponseSize(const uint8_t* query, size_t length) {
+  DnsMessageReader reader(query, length);
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    if (record.section == DnsSection::kAdditional && record.type == kTypeOpt) {
+      // The OPT record's class holds the requester's UDP payload size.
+      return std::min(std::max<size_t>(record.rclass, kMinUdpPayloadSize),
+                      kMaxUdpMessageSize);
+    }
+  }
+  return kMinUdpPayloadSize;
+}
+
+size_t BuildTruncatedResponse(const uint8_t* response, size_t length,
+                              uint8_t* out, size_t out_capacity) {
+  if (length < kDnsHeaderSize) {
+    return 0;
+  }
+  size_t truncated_length = BuildErrorResponse(
+      response, length, GetRcode(response), out, out_capacity);
+  if (truncated_length > 0) {
+    // Keep AA as well, then set TC.
+    out[2] = static_cast<uint8_t>(out[2] | (response[2] & 0x04) | 0x02);
+  }
+  return truncated_length;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,274 @@
+#ifndef DNS_MANAGER_DNS_MESSAGE_H_
+#define DNS_MANAGER_DNS_MESSAGE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dns_manager {
+
+// The DNS wire format (RFC 1035 section 4).
+//
+// DnsMessageReader walks a received message in place: questions and records
+// come back as views into the caller's buffer, and names are decoded only
+// when asked for, so parsing allocates nothing. DnsMessageBuilder writes a
+// message into a caller-provided buffer, compressing names against the ones
+// already written. The free functions below build on these for the local
+// resolver's needs.
+
+constexpr size_t kDnsHeaderSize = 12;
+constexpr size_t kMaxDnsNameLength = 255;
+constexpr size_t kMaxDnsLabelLength = 63;
+constexpr size_t kMaxUdpMessageSize = 4096;
+// Answers a client sent no EDNS buffer size for must fit this (RFC 1035).
+constexpr size_t kMinUdpPayloadSize = 512;
+// Over TCP a message carries a two-byte length prefix (RFC 1035 4.2.2).
+constexpr size_t kMaxTcpMessageSize = 65535;
+
+constexpr uint16_t kTypeA = 1;
+constexpr uint16_t kTypeNs = 2;
+constexpr uint16_t kTypeCname = 5;
+constexpr uint16_t kTypeSoa = 6;
+constexpr uint16_t kTypeAaaa = 28;
+constexpr uint16_t kTypeOpt = 41;
+
+constexpr uint16_t kClassIn = 1;
+
+constexpr uint8_t kRcodeNoError = 0;
+constexpr uint8_t kRcodeServFail = 2;
+constexpr uint8_t kRcodeNxDomain = 3;
+constexpr uint8_t kRcodeRefused = 5;
+
+struct DnsQuestion {
+  // Lower-cased presentation form without the trailing dot ("" for the root).
+  std::string name;
+  uint16_t qtype = 0;
+  uint16_t qclass = 0;
+};
+
+inline uint16_t ReadU16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline void WriteU16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+inline uint16_t GetMessageId(const uint8_t* message) {
+  return ReadU16(message);
+}
+
+inline void SetMessageId(uint8_t* message, uint16_t id) {
+  WriteU16(message, id);
+}
+
+inline bool IsResponse(const uint8_t* message) {
+  return (message[2] & 0x80) != 0;
+}
+
+inline uint8_t GetRcode(const uint8_t* message) {
+  return message[3] & 0x0f;
+}
+
+inline bool IsTruncated(const uint8_t* message) {
+  return (message[2] & 0x02) != 0;
+}
+
+inline uint32_t ReadU32(const uint8_t* p) {
+  return (static_cast<uint32_t>(ReadU16(p)) << 16) | ReadU16(p + 2);
+}
+
+inline void WriteU32(uint8_t* p, uint32_t value) {
+  WriteU16(p, static_cast<uint16_t>(value >> 16));
+  WriteU16(p + 2, static_cast<uint16_t>(value));
+}
+
+enum class DnsSection : uint8_t { kQuestion, kAnswer, kAuthority, kAdditional };
+
+struct DnsHeader {
+  uint16_t id = 0;
+  // QR, opcode, AA, TC, RD, RA, Z and rcode as on the wire.
+  uint16_t flags = 0;
+  uint16_t question_count = 0;
+  uint16_t answer_count = 0;
+  uint16_t authority_count = 0;
+  uint16_t additional_count = 0;
+};
+
+// A domain name inside a message, possibly compressed. Only valid while the
+// message buffer is, and only created for names the reader has checked.
+class DnsNameView {
+ public:
+  DnsNameView() = default;
+  DnsNameView(const uint8_t* message, size_t length, size_t offset)
+      : message_(message), length_(length), offset_(offset) {}
+
+  // Offset of the name's first byte in the message.
+  size_t offset() const { return offset_; }
+
+  // Writes the lower-cased presentation form without the trailing dot ("" for
+  // the root) into |out| and sets |*decoded_length|. Returns false if |out|
+  // is too small.
+  bool Decode(char* out, size_t out_capacity, size_t* decoded_length) const;
+  std::string ToString() const;
+
+  // Case-insensitive comparison with a presentation-form |name| (no trailing
+  // dot, no escapes).
+  bool Equals(const char* name, size_t name_length) const;
+  bool Equals(const DnsNameView& other) const;
+
+ private:
+  const uint8_t* message_ = nullptr;
+  size_t length_ = 0;
+  size_t offset_ = 0;
+};
+
+struct DnsQuestionView {
+  DnsNameView name;
+  uint16_t qtype = 0;
+  uint16_t qclass = 0;
+  // Offset just past the question.
+  size_t end = 0;
+};
+
+struct DnsRecordView {
+  DnsNameView name;
+  DnsSection section = DnsSection::kAnswer;
+  uint16_t type = 0;
+  uint16_t rclass = 0;
+  uint32_t ttl = 0;
+  // Offset of the TTL field, for rewriting TTLs in place.
+  size_t ttl_offset = 0;
+  const uint8_t* rdata = nullptr;
+  uint16_t rdata_length = 0;
+  size_t rdata_offset = 0;
+};
+
+// Checks the (possibly compressed) name at |offset| and sets |*end| to the
+// offset just past it in place. Compression pointers must point backwards,
+// which rules out loops; the decoded name must fit kMaxDnsNameLength.
+bool SkipDnsName(const uint8_t* message, size_t length, size_t offset,
+                 size_t* end);
+
+// Walks a message section by section. Every question and record it returns
+// has been bounds-checked, names included. Once anything malformed is found
+// the reader stops and valid() turns false.
+class DnsMessageReader {
+ public:
+  DnsMessageReader(const uint8_t* message, size_t length);
+
+  bool valid() const { return valid_; }
+  const DnsHeader& header() const { return header_; }
+
+  // Returns the next question, or false once there are none left (or the
+  // message is malformed).
+  bool NextQuestion(DnsQuestionView* question);
+  // Returns the next record of the answer, authority and additional sections
+  // in order, skipping any questions not read yet.
+  bool NextRecord(DnsRecordView* record);
+
+ private:
+  bool Fail() {
+    valid_ = false;
+    return false;
+  }
+
+  const uint8_t* message_;
+  size_t length_;
+  size_t offset_ = kDnsHeaderSize;
+  bool valid_ = true;
+  DnsHeader header_;
+  uint16_t questions_left_ = 0;
+  // Records left in the answer, authority and additional sections.
+  uint16_t records_left_[3] = {0, 0, 0};
+};
+
+// Writes a message into a caller-provided buffer. Sections must be filled in
+// order; each name is compressed against the names already written. A call
+// that does not fit leaves the message as it was and returns false.
+class DnsMessageBuilder {
+ public:
+  DnsMessageBuilder(uint8_t* buffer, size_t capacity);
+
+  // Sets the ID and flags; the section counts are kept up to date by the
+  // Add methods.
+  void SetHeader(uint16_t id, uint16_t flags);
+
+  bool AddQuestion(const char* name, size_t name_length, uint16_t qtype,
+                   uint16_t qclass);
+  bool AddRecord(DnsSection section, const char* name, size_t name_length,
+                 uint16_t type, uint16_t rclass, uint32_t ttl,
+                 const uint8_t* rdata, uint16_t rdata_length);
+
+  // Length of the message written so far, 0 if the buffer cannot even hold
+  // a header.
+  size_t length() const { return length_; }
+
+ private:
+  // Suffix offsets remembered for compression. Names past this many labels
+  // are still written, just not offered as compression targets.
+  static constexpr size_t kMaxCompressionTargets = 64;
+
+  bool BeginSection(DnsSection section);
+  bool WriteName(const char* name, size_t name_length);
+  bool SuffixMatches(size_t offset, const char* suffix, size_t length) const;
+  void CountRecord(DnsSection section);
+
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t length_ = 0;
+  DnsSection section_ = DnsSection::kQuestion;
+  uint16_t targets_[kMaxCompressionTargets];
+  size_t target_count_ = 0;
+};
+
+// Parses the first entry of the question section. Returns false for anything
+// that is not a well-formed query with at least one question.
+bool ParseFirstQuestion(const uint8_t* message, size_t length,
+                        DnsQuestion* question);
+
+// Writes a recursive query for |question| with message ID |id| into |out|.
+// Returns the query length, or 0 if the name is invalid or |out_capacity| is
+// too small.
+size_t BuildQuery(const DnsQuestion& question, uint16_t id, uint8_t* out,
+                  size_t out_capacity);
+
+// Finds the smallest TTL among the answer and authority records of
+// |message|. Returns false if the message is malformed or has no such
+// records.
+bool FindMinimumTtl(const uint8_t* message, size_t length, uint32_t* ttl);
+
+// Computes the negative-caching TTL of an NXDOMAIN or NODATA response: the
+// smaller of the authority SOA record's TTL and its MINIMUM field
+// (RFC 2308 section 5). Returns false if there is no SOA record.
+bool FindNegativeTtl(const uint8_t* message, size_t length, uint32_t* ttl);
+
+// Lowers every record TTL in |message| by |elapsed| seconds, stopping at
+// zero. OPT pseudo-records are left alone. Returns false if malformed.
+bool AgeTtls(uint8_t* message, size_t length, uint32_t elapsed);
+
+// Sets every record TTL in |message| to |ttl|, leaving OPT pseudo-records
+// alone. Returns false if malformed.
+bool SetTtls(uint8_t* message, size_t length, uint32_t ttl);
+
+// Writes a response to |query| carrying only its question section and the
+// given |rcode| into |out|. Returns the response length, or 0 if |query| is
+// malformed or |out_capacity| is too small.
+size_t BuildErrorResponse(const uint8_t* query, size_t query_length,
+                          uint8_t rcode, uint8_t* out, size_t out_capacity);
+
+// The largest response |query| may be answered with over UDP: the payload
+// size of its EDNS OPT record, clamped to [kMinUdpPayloadSize,
+// kMaxUdpMessageSize], or kMinUdpPayloadSize without one (RFC 6891 6.2.5).
+size_t MaxUdpResponseSize(const uint8_t* query, size_t length);
+
+// Writes |response| cut down to its header and question, with the TC bit
+// set, into |out|, telling a UDP client to retry over TCP. Returns the
+// length, or 0 if |response| is malformed or |out_capacity| is too small.
+size_t BuildTruncatedResponse(const uint8_t* response, size_t length,
+                              uint8_t* out, size_t out_capacity);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DNS_MESSAGE_H_
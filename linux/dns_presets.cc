@@ -0,0 +1,207 @@
+#include "dns_presets.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "checksum.h"
+#include "file_util.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr uint32_t kFileMagic = 0x52504d44;  // "DMPR"
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;
+  uint32_t crc;
+};
+
+struct EntryHeader {
+  uint8_t flags;
+  uint8_t name_length;
+  uint16_t ipv4_length;
+  uint16_t ipv6_length;
+};
+
+static_assert(sizeof(EntryHeader) == 6, "unexpected EntryHeader padding");
+
+enum PresetFlags : uint8_t {
+  kGlobal = 1 << 0,
+};
+
+void Append(std::vector<uint8_t>* out, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  out->insert(out->end(), bytes, bytes + size);
+}
+
+// Splits the canonical lists back into servers. They were validated when
+// the preset was defined.
+DnsPreset Compile(const std::string& name, bool global,
+                  const std::string& ipv4, const std::string& ipv6) {
+  DnsPreset preset;
+  preset.name = name;
+  preset.global = global;
+  for (const std::string* list : {&ipv4, &ipv6}) {
+    for (size_t start = 0; start < list->size();) {
+      size_t end = std::min(list->find(',', start), list->size());
+      preset.servers.push_back(list->substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  preset.properties = CanonicalDnsProperties(ipv4, ipv6);
+  return preset;
+}
+
+// The canonical list of one family, as stored in the file.
+const std::string& ListOf(const DnsPreset& preset, const char* name) {
+  static const std::string kEmpty;
+  for (const ConnectionProperty& property : preset.properties) {
+    if (property.name == name) {
+      return property.value;
+    }
+  }
+  return kEmpty;
+}
+
+}  // namespace
+
+bool DnsPresets::Define(const std::string& name, const std::string& servers,
+                        bool global, std::string* error) {
+  if (name.empty() || name.size() > kMaxNameLength) {
+    *error = "Preset names must be 1 to 255 bytes long";
+    return false;
+  }
+  std::string ipv4;
+  std::string ipv6;
+  if (!CanonicalDnsServers(servers, &ipv4, &ipv6) ||
+      (ipv4.empty() && ipv6.empty())) {
+    *error = "Invalid DNS server list";
+    return false;
+  }
+  if (ipv4.size() > UINT16_MAX || ipv6.size() > UINT16_MAX) {
+    *error = "Too many DNS servers";
+    return false;
+  }
+  DnsPreset preset = Compile(name, global, ipv4, ipv6);
+  auto it = std::lower_bound(
+      presets_.begin(), presets_.end(), name,
+      [](const DnsPreset& a, const std::string& b) { return a.name < b; });
+  if (it != presets_.end() && it->name == name) {
+    *it = std::move(preset);
+  } else {
+    presets_.insert(it, std::move(preset));
+  }
+  return true;
+}
+
+bool DnsPresets::Remove(const std::string& name) {
+  auto it = std::find_if(presets_.begin(), presets_.end(),
+                         [&](const DnsPreset& p) { return p.name == name; });
+  if (it == presets_.end()) {
+    return false;
+  }
+  presets_.erase(it);
+  return true;
+}
+
+const DnsPreset* DnsPresets::Find(const std::string& name) const {
+  auto it = std::lower_bound(
+      presets_.begin(), presets_.end(), name,
+      [](const DnsPreset& a, const std::string& b) { return a.name < b; });
+  return it != presets_.end() && it->name == name ? &*it : nullptr;
+}
+
+std::vector<uint8_t> DnsPresets::Serialize() const {
+  std::vector<uint8_t> entries;
+  for (const DnsPreset& preset : presets_) {
+    const std::string& ipv4 = ListOf(preset, "ipv4.dns");
+    const std::string& ipv6 = ListOf(preset, "ipv6.dns");
+    EntryHeader header = {static_cast<uint8_t>(preset.global ? kGlobal : 0),
+                          static_cast<uint8_t>(preset.name.size()),
+                          static_cast<uint16_t>(ipv4.size()),
+                          static_cast<uint16_t>(ipv6.size())};
+    Append(&entries, &header, sizeof(header));
+    Append(&entries, preset.name.data(), preset.name.size());
+    Append(&entries, ipv4.data(), ipv4.size());
+    Append(&entries, ipv6.data(), ipv6.size());
+  }
+  FileHeader header = {kFileMagic, kVersion,
+                       static_cast<uint32_t>(presets_.size()),
+                       Crc32c(entries.data(), entries.size())};
+  std::vector<uint8_t> image;
+  image.reserve(sizeof(header) + entries.size());
+  Append(&image, &header, sizeof(header));
+  image.insert(image.end(), entries.begin(), entries.end());
+  return image;
+}
+
+bool DnsPresets::Parse(const uint8_t* data, size_t size, std::string* error) {
+  FileHeader header;
+  if (size < sizeof(header)) {
+    *error = "Preset file is truncated";
+    return false;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != kFileMagic || header.version != kVersion) {
+    *error = "Preset file has an unknown format";
+    return false;
+  }
+  const uint8_t* next = data + sizeof(header);
+  const uint8_t* end = data + size;
+  if (Crc32c(next, end - next) != header.crc) {
+    *error = "Preset file is corrupt";
+    return false;
+  }
+  std::vector<DnsPreset> presets;
+  for (uint32_t i = 0; i < header.count; i++) {
+    EntryHeader entry;
+    if (static_cast<size_t>(end - next) < sizeof(entry)) {
+      *error = "Preset file is truncated";
+      return false;
+    }
+    memcpy(&entry, next, sizeof(entry));
+    next += sizeof(entry);
+    size_t length = size_t{entry.name_length} + entry.ipv4_length +
+                    entry.ipv6_length;
+    if (static_cast<size_t>(end - next) < length) {
+      *error = "Preset file is truncated";
+      return false;
+    }
+    const char* text = reinterpret_cast<const char*>(next);
+    std::string name(text, entry.name_length);
+    std::string ipv4(text + entry.name_length, entry.ipv4_length);
+    std::string ipv6(text + entry.name_length + entry.ipv4_length,
+                     entry.ipv6_length);
+    next += length;
+    presets.push_back(Compile(name, entry.flags & kGlobal, ipv4, ipv6));
+  }
+  if (next != end) {
+    *error = "Preset file has trailing data";
+    return false;
+  }
+  presets_ = std::move(presets);
+  return true;
+}
+
+bool DnsPresets::Load(const std::string& path, std::string* error) {
+  if (access(path.c_str(), F_OK) != 0 && errno == ENOENT) {
+    presets_.clear();
+    return true;
+  }
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path, error);
+  return file != nullptr && Parse(file->data(), file->size(), error);
+}
+
+bool DnsPresets::Save(const std::string& path, std::string* error) const {
+  std::vector<uint8_t> image = Serialize();
+  return WriteFileAtomically(path, image.data(), image.size(), error);
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,72 @@
+#ifndef DNS_MANAGER_DNS_PRESETS_H_
+#define DNS_MANAGER_DNS_PRESETS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dns_settings.h"
+
+namespace dns_manager {
+
+// A named set of DNS servers, validated and normalised when it is defined so
+// that applying it involves no parsing.
+struct DnsPreset {
+  std::string name;
+  // Whether it goes into NetworkManager's global DNS configuration rather
+  // than the active connection's settings.
+  bool global = false;
+  // Canonical servers (see CanonicalDnsServers), IPv4 before IPv6.
+  std::vector<std::string> servers;
+  // What the connection has to hold, as DnsPropertiesFor() would return.
+  std::vector<ConnectionProperty> properties;
+};
+
+// The presets the app has defined, kept sorted by name and stored in a
+// small file that survives restarts.
+//
+// File layout (version 1; integers in host byte order):
+//
+//   FileHeader      magic, version, preset count, CRC-32C of the entries
+//   entries         per preset: uint8_t flags, uint8_t name length,
+//                   uint16_t IPv4 list length, uint16_t IPv6 list length,
+//                   then the name and the comma-separated canonical lists
+//
+// The lists are stored already canonical, so loading only splits them.
+class DnsPresets {
+ public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kMaxNameLength = 255;
+
+  // Adds preset |name| for the comma-separated |servers|, replacing any
+  // preset of that name. Returns false and sets |error| if the name is empty
+  // or too long, or the servers are invalid or none.
+  bool Define(const std::string& name, const std::string& servers, bool global,
+              std::string* error);
+  // Returns false if there is no preset |name|.
+  bool Remove(const std::string& name);
+  // nullptr if there is no preset |name|.
+  const DnsPreset* Find(const std::string& name) const;
+
+  const std::vector<DnsPreset>& presets() const { return presets_; }
+
+  // The file image of the current presets.
+  std::vector<uint8_t> Serialize() const;
+  // Replaces the presets with those in a file image. Returns false and sets
+  // |error| if it is truncated, corrupt or of another version, in which
+  // case the presets are left as they were.
+  bool Parse(const uint8_t* data, size_t size, std::string* error);
+
+  // Reads the presets from |path|; a missing file means no presets.
+  bool Load(const std::string& path, std::string* error);
+  // Writes them to |path| through a temporary file and rename().
+  bool Save(const std::string& path, std::string* error) const;
+
+ private:
+  std::vector<DnsPreset> presets_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DNS_PRESETS_H_
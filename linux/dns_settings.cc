@@ -0,0 +1,184 @@
+#include "dns_settings.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "network_snapshot.h"
+#include "socket_address.h"
+
+namespace dns_manager {
+
+const char kDnsPropertyFields[] =
+    "ipv4.dns,ipv4.ignore-auto-dns,ipv6.dns,ipv6.ignore-auto-dns";
+
+namespace {
+
+bool EndsWith(const std::string& text, const char* suffix) {
+  size_t length = strlen(suffix);
+  return text.size() >= length &&
+         text.compare(text.size() - length, length, suffix) == 0;
+}
+
+// Normalises a property value for comparison. Returns false if it cannot be
+// understood, in which case the property is treated as changed.
+bool NormaliseValue(const std::string& name, const std::string& value,
+                    std::string* normalised) {
+  if (EndsWith(name, ".dns")) {
+    std::string ipv4;
+    std::string ipv6;
+    if (!CanonicalDnsServers(value, &ipv4, &ipv6)) {
+      return false;
+    }
+    *normalised = ipv4 + "," + ipv6;
+    return true;
+  }
+  if (EndsWith(name, ".ignore-auto-dns")) {
+    std::string lower = value;
+    for (char& c : lower) {
+      c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    }
+    if (lower == "yes" || lower == "true") {
+      *normalised = "yes";
+    } else if (lower == "no" || lower == "false") {
+      *normalised = "no";
+    } else {
+      return false;
+    }
+    return true;
+  }
+  *normalised = value;
+  return true;
+}
+
+}  // namespace
+
+std::map<std::string, std::string> ParseNmcliProperties(
+    const std::string& output) {
+  std::map<std::string, std::string> properties;
+  size_t start = 0;
+  while (start < output.size()) {
+    size_t end = output.find('\n', start);
+    if (end == std::string::npos) {
+      end = output.size();
+    }
+    size_t colon = output.find(':', start);
+    if (colon != std::string::npos && colon < end) {
+      std::string value;
+      for (size_t i = colon + 1; i < end; i++) {
+        if (output[i] == '\\' && i + 1 < end) {
+          i++;
+        }
+        value.push_back(output[i]);
+      }
+      properties[output.substr(start, colon - start)] = value;
+    }
+    start = end + 1;
+  }
+  return properties;
+}
+
+bool CanonicalDnsServers(const std::string& servers, std::string* ipv4,
+                         std::string* ipv6) {
+  ipv4->clear();
+  ipv6->clear();
+  if (servers.find_first_not_of(" \t\r\n") == std::string::npos ||
+      servers == "--") {
+    return true;
+  }
+  std::vector<SocketAddress> addresses;
+  if (!SocketAddress::ParseList(servers, 53, &addresses)) {
+    return false;
+  }
+  std::vector<std::string> seen;
+  for (const SocketAddress& address : addresses) {
+    std::string host = address.HostString();
+    if (std::find(seen.begin(), seen.end(), host) != seen.end()) {
+      continue;
+    }
+    seen.push_back(host);
+    std::string* list = address.family() == AF_INET6 ? ipv6 : ipv4;
+    if (!list->empty()) {
+      list->push_back(',');
+    }
+    list->append(host);
+  }
+  return true;
+}
+
+bool DnsPropertiesFor(const std::string& servers,
+                      std::vector<ConnectionProperty>* properties) {
+  std::string ipv4;
+  std::string ipv6;
+  if (!CanonicalDnsServers(servers, &ipv4, &ipv6) ||
+      (ipv4.empty() && ipv6.empty())) {
+    return false;
+  }
+  *properties = CanonicalDnsProperties(ipv4, ipv6);
+  return true;
+}
+
+std::vector<ConnectionProperty> CanonicalDnsProperties(
+    const std::string& ipv4, const std::string& ipv6) {
+  std::vector<ConnectionProperty> properties;
+  properties.push_back({"ipv4.dns", ipv4});
+  properties.push_back({"ipv4.ignore-auto-dns", "yes"});
+  properties.push_back({"ipv6.dns", ipv6});
+  if (!ipv6.empty()) {
+    properties.push_back({"ipv6.ignore-auto-dns", "yes"});
+  }
+  return properties;
+}
+
+std::vector<ConnectionProperty> AutomaticDnsProperties() {
+  return {{"ipv4.dns", ""},
+          {"ipv4.ignore-auto-dns", "no"},
+          {"ipv6.dns", ""},
+          {"ipv6.ignore-auto-dns", "no"}};
+}
+
+std::vector<ConnectionProperty> ChangedProperties(
+    const std::vector<ConnectionProperty>& desired,
+    const std::map<std::string, std::string>& current) {
+  std::vector<ConnectionProperty> changed;
+  for (const ConnectionProperty& property : desired) {
+    auto it = current.find(property.name);
+    std::string wanted;
+    std::string have;
+    if (it == current.end() ||
+        !NormaliseValue(property.name, property.value, &wanted) ||
+        !NormaliseValue(property.name, it->second, &have) || wanted != have) {
+      changed.push_back(property);
+    }
+  }
+  return changed;
+}
+
+std::map<std::string, std::string> ConnectionDnsProperties(
+    const NetworkConnection& connection) {
+  std::map<std::string, std::string> properties;
+  if (!connection.has_settings) {
+    return properties;
+  }
+  auto join = [](const std::vector<std::string>& servers) {
+    std::string list;
+    for (const std::string& server : servers) {
+      if (!list.empty()) {
+        list.push_back(',');
+      }
+      list.append(server);
+    }
+    return list;
+  };
+  properties["ipv4.dns"] = join(connection.ipv4_dns);
+  properties["ipv4.ignore-auto-dns"] =
+      connection.ipv4_ignore_auto_dns ? "yes" : "no";
+  properties["ipv6.dns"] = join(connection.ipv6_dns);
+  properties["ipv6.ignore-auto-dns"] =
+      connection.ipv6_ignore_auto_dns ? "yes" : "no";
+  return properties;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,62 @@
+#ifndef DNS_MANAGER_DNS_SETTINGS_H_
+#define DNS_MANAGER_DNS_SETTINGS_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+
+struct NetworkConnection;
+
+// A NetworkManager connection property as nmcli names it ("ipv4.dns") and its
+// value in the form nmcli accepts.
+struct ConnectionProperty {
+  std::string name;
+  std::string value;
+};
+
+// The properties setDNS and resetDNS manage, in the order nmcli is asked for
+// them.
+extern const char kDnsPropertyFields[];
+
+// Parses the output of `nmcli -t -f <fields> connection show <id>`: one
+// "name:value" line per property, with ':' and '\' inside values escaped by
+// a backslash.
+std::map<std::string, std::string> ParseNmcliProperties(
+    const std::string& output);
+
+// Splits a comma-separated server list into canonical IPv4 and IPv6 lists
+// (inet_ntop forms, duplicates and ports dropped, order kept). Returns false
+// if an entry is not an IP address.
+bool CanonicalDnsServers(const std::string& servers, std::string* ipv4,
+                         std::string* ipv6);
+
+// What setDNS wants the connection to hold for |servers|: each family's
+// servers, with automatic DNS turned off for IPv4 and, when IPv6 servers are
+// given, for IPv6. Returns false if |servers| is invalid.
+bool DnsPropertiesFor(const std::string& servers,
+                      std::vector<ConnectionProperty>* properties);
+// The same for servers already split by CanonicalDnsServers().
+std::vector<ConnectionProperty> CanonicalDnsProperties(
+    const std::string& ipv4, const std::string& ipv6);
+// What resetDNS wants: no static servers and automatic DNS for both families.
+std::vector<ConnectionProperty> AutomaticDnsProperties();
+
+// The entries of |desired| whose value differs from |current| once both are
+// normalised (canonical addresses, yes/no booleans). Properties nmcli did not
+// report count as changed.
+std::vector<ConnectionProperty> ChangedProperties(
+    const std::vector<ConnectionProperty>& desired,
+    const std::map<std::string, std::string>& current);
+
+// The DNS properties of an active |connection| as the network monitor read
+// them, in the form ParseNmcliProperties() returns, so that they can be
+// compared without asking nmcli. Empty if the monitor could not read the
+// connection's settings.
+std::map<std::string, std::string> ConnectionDnsProperties(
+    const NetworkConnection& connection);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DNS_SETTINGS_H_
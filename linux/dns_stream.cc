@@ -0,0 +1,188 @@
+#include "dns_stream.h"
+
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "dns_message.h"
+
+namespace dns_manager {
+
+namespace {
+
+// Enough for several answers per read without growing the buffer.
+constexpr size_t kReadChunk = 16384;
+// One read never buffers more than a maximum-size message plus a chunk, so a
+// peer that sends faster than messages are handled cannot grow it further.
+constexpr size_t kMaxBufferedRead = 2 + kMaxTcpMessageSize + kReadChunk;
+
+}  // namespace
+
+DnsStream::DnsStream(int fd, SSL* ssl)
+    : fd_(fd), ssl_(ssl), last_active_(Clock::now()) {
+  // Queries and answers are small and latency-bound.
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+DnsStream::~DnsStream() {
+  // A session freed without close_notify is marked as not resumable.
+  if (ssl_ != nullptr && !handshaking()) {
+    SSL_shutdown(ssl_);
+  }
+  SSL_free(ssl_);
+  close(fd_);
+}
+
+std::unique_ptr<DnsStream> DnsStream::Connect(const SocketAddress& address,
+                                              TlsContext* tls,
+                                              const std::string& server_name) {
+  int fd = socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  0);
+  if (fd < 0) {
+    return nullptr;
+  }
+  SSL* ssl = nullptr;
+  if (tls != nullptr) {
+    ssl = tls->NewConnection(fd, address, server_name);
+    if (ssl == nullptr) {
+      close(fd);
+      return nullptr;
+    }
+  }
+  std::unique_ptr<DnsStream> stream(new DnsStream(fd, ssl));
+  stream->tls_ = tls;
+  if (connect(fd, address.sockaddr_ptr(), address.length) != 0) {
+    if (errno != EINPROGRESS) {
+      return nullptr;
+    }
+    stream->connecting_ = true;
+  }
+  return stream;
+}
+
+bool DnsStream::Send(const uint8_t* message, size_t length) {
+  if (length > kMaxTcpMessageSize ||
+      write_buffer_.size() - write_offset_ + length > kMaxPendingWrite) {
+    return false;
+  }
+  if (write_offset_ == write_buffer_.size()) {
+    write_buffer_.clear();
+    write_offset_ = 0;
+  }
+  write_buffer_.push_back(static_cast<uint8_t>(length >> 8));
+  write_buffer_.push_back(static_cast<uint8_t>(length));
+  write_buffer_.insert(write_buffer_.end(), message, message + length);
+  last_active_ = Clock::now();
+  return connecting_ || Flush();
+}
+
+bool DnsStream::Flush() {
+  if (connecting_) {
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 ||
+        error != 0) {
+      return false;
+    }
+    connecting_ = false;
+  }
+  if (handshaking()) {
+    return Handshake();
+  }
+  tls_wants_write_ = false;
+  while (write_offset_ < write_buffer_.size()) {
+    size_t remaining = write_buffer_.size() - write_offset_;
+    if (ssl_ != nullptr) {
+      int written = SSL_write(ssl_, write_buffer_.data() + write_offset_,
+                              static_cast<int>(remaining));
+      if (written <= 0) {
+        int error = SSL_get_error(ssl_, written);
+        tls_wants_write_ = error == SSL_ERROR_WANT_WRITE;
+        return error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ;
+      }
+      write_offset_ += static_cast<size_t>(written);
+      continue;
+    }
+    ssize_t written = send(fd_, write_buffer_.data() + write_offset_,
+                           remaining, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    write_offset_ += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+bool DnsStream::Handshake() {
+  int result = SSL_do_handshake(ssl_);
+  tls_wants_write_ = false;
+  if (result != 1) {
+    int error = SSL_get_error(ssl_, result);
+    tls_wants_write_ = error == SSL_ERROR_WANT_WRITE;
+    return error == SSL_ERROR_WANT_WRITE || error == SSL_ERROR_WANT_READ;
+  }
+  if (tls_ != nullptr) {
+    tls_->RecordHandshake(ssl_);
+  }
+  last_active_ = Clock::now();
+  // Send what was queued while the handshake ran.
+  return Flush();
+}
+
+bool DnsStream::TlsPending() const {
+  return ssl_ != nullptr && SSL_pending(ssl_) > 0;
+}
+
+bool DnsStream::Fill() {
+  if (connecting_ || handshaking()) {
+    if (!Flush()) {
+      return false;
+    }
+    if (connecting_ || handshaking()) {
+      return true;
+    }
+  }
+  while (read_buffer_.size() < kMaxBufferedRead) {
+    size_t size = read_buffer_.size();
+    read_buffer_.resize(size + kReadChunk);
+    if (ssl_ != nullptr) {
+      int received = SSL_read(ssl_, read_buffer_.data() + size,
+                              static_cast<int>(kReadChunk));
+      read_buffer_.resize(size + (received > 0 ? received : 0));
+      if (received > 0) {
+        last_active_ = Clock::now();
+        continue;
+      }
+      int error = SSL_get_error(ssl_, received);
+      if (error == SSL_ERROR_ZERO_RETURN) {
+        closed_ = true;
+        return true;
+      }
+      tls_wants_write_ = error == SSL_ERROR_WANT_WRITE;
+      return error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE;
+    }
+    ssize_t received = recv(fd_, read_buffer_.data() + size, kReadChunk, 0);
+    read_buffer_.resize(size + (received > 0 ? received : 0));
+    if (received > 0) {
+      last_active_ = Clock::now();
+      continue;
+    }
+    if (received == 0) {
+      closed_ = true;
+      return true;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  return true;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,118 @@
+#ifndef DNS_MANAGER_DNS_STREAM_H_
+#define DNS_MANAGER_DNS_STREAM_H_
+
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "socket_address.h"
+#include "tls_context.h"
+
+namespace dns_manager {
+
+// A non-blocking TCP connection carrying DNS messages, each preceded by its
+// two-byte length (RFC 1035 4.2.2), optionally inside TLS (RFC 7858). Any
+// number of messages may be in flight in either direction (RFC 7766
+// 6.2.1.1); matching answers to queries by ID is up to the caller. Owned by
+// one thread.
+class DnsStream {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Bytes queued for writing beyond which Send() gives up on the peer.
+  static constexpr size_t kMaxPendingWrite = 256 * 1024;
+
+  // Takes ownership of the connected socket |fd| and, if not null, of the
+  // TLS connection |ssl| set up on it. The handshake runs as the socket
+  // becomes ready; messages sent before it completes are queued.
+  explicit DnsStream(int fd, SSL* ssl = nullptr);
+  ~DnsStream();
+
+  DnsStream(const DnsStream&) = delete;
+  DnsStream& operator=(const DnsStream&) = delete;
+
+  // Starts connecting to |address|, over TLS when |tls| is not null (see
+  // TlsContext::NewConnection for |server_name|). Messages sent before the
+  // connection is up are queued. Returns nullptr if the connect fails at
+  // once.
+  static std::unique_ptr<DnsStream> Connect(const SocketAddress& address,
+                                            TlsContext* tls = nullptr,
+                                            const std::string& server_name =
+                                                std::string());
+
+  int fd() const { return fd_; }
+  // Whether Flush() has bytes to write, or the connect or TLS is waiting for
+  // the socket to become writable; poll for POLLOUT while true.
+  bool wants_write() const {
+    return connecting_ || tls_wants_write_ ||
+           (!handshaking() && write_offset_ < write_buffer_.size());
+  }
+  // When a message was last sent or received.
+  Clock::time_point last_active() const { return last_active_; }
+
+  // Reads what the socket holds and calls |visit(message, length)| for each
+  // complete message; |message| is only valid during the call. Returns
+  // false once the peer has closed the connection or it failed.
+  template <typename Visitor>
+  bool Read(Visitor visit) {
+    // TLS may hold decrypted bytes the socket no longer signals.
+    do {
+      if (!Fill()) {
+        return false;
+      }
+      size_t offset = 0;
+      while (read_buffer_.size() - offset >= 2) {
+        size_t length = static_cast<size_t>(read_buffer_[offset]) << 8 |
+                        read_buffer_[offset + 1];
+        if (read_buffer_.size() - offset - 2 < length) {
+          break;
+        }
+        visit(read_buffer_.data() + offset + 2, length);
+        offset += 2 + length;
+      }
+      read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + offset);
+    } while (!closed_ && TlsPending());
+    return !closed_;
+  }
+
+  // Queues |message| and writes as much as the socket takes. Returns false
+  // if the connection failed or the peer is not keeping up.
+  bool Send(const uint8_t* message, size_t length);
+  // Writes queued bytes; call when the socket is writable. Returns false if
+  // the connection failed.
+  bool Flush();
+
+ private:
+  bool handshaking() const {
+    return ssl_ != nullptr && !SSL_is_init_finished(ssl_);
+  }
+  // Appends what the socket holds to |read_buffer_|.
+  bool Fill();
+  // Advances the TLS handshake; returns false if it failed.
+  bool Handshake();
+  bool TlsPending() const;
+
+  int fd_;
+  SSL* ssl_;
+  // Counts the handshake; null for plain TCP and for server connections.
+  TlsContext* tls_ = nullptr;
+  bool connecting_ = false;
+  // The last TLS call needs the socket to become writable.
+  bool tls_wants_write_ = false;
+  // The peer closed its side; complete messages read before are still
+  // delivered.
+  bool closed_ = false;
+  Clock::time_point last_active_;
+  std::vector<uint8_t> read_buffer_;
+  std::vector<uint8_t> write_buffer_;
+  size_t write_offset_ = 0;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DNS_STREAM_H_
@@ -0,0 +1,164 @@
+#include "domain_trie.h"
+
+#include <cstring>
+
+#include "hash.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr size_t kInitialEdgeSlots = 16;
+
+// Lower-cases |suffix| into |out|, dropping a leading "*." or "." and a
+// trailing dot. Returns false if a label is empty, too long or holds
+// characters that cannot appear in a host name.
+bool NormaliseSuffix(const std::string& suffix, std::string* out) {
+  size_t begin = 0;
+  size_t end = suffix.size();
+  if (suffix.compare(0, 2, "*.") == 0) {
+    begin = 2;
+  } else if (end > 0 && suffix[0] == '.') {
+    begin = 1;
+  }
+  if (end > begin && suffix[end - 1] == '.') {
+    end--;
+  }
+  if (end - begin > 253) {
+    return false;
+  }
+  out->clear();
+  size_t label_length = 0;
+  for (size_t i = begin; i < end; i++) {
+    char c = suffix[i];
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c + 32);
+    }
+    if (c == '.') {
+      if (label_length == 0) {
+        return false;
+      }
+      label_length = 0;
+    } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '_') {
+      if (++label_length > 63) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    out->push_back(c);
+  }
+  return out->empty() || label_length > 0;
+}
+
+}  // namespace
+
+DomainTrie::DomainTrie() : values_(1, kNoMatch), edges_(kInitialEdgeSlots) {}
+
+uint64_t DomainTrie::EdgeHash(uint32_t parent, const char* label,
+                              size_t length) {
+  return HashBytes(label, length, MixHash(parent + 1));
+}
+
+uint32_t DomainTrie::Child(uint32_t parent, const char* label,
+                           size_t length) const {
+  uint64_t hash = EdgeHash(parent, label, length);
+  uint16_t tag = static_cast<uint16_t>(hash);
+  size_t mask = edges_.size() - 1;
+  for (size_t slot = static_cast<size_t>(hash >> 16) & mask;;
+       slot = (slot + 1) & mask) {
+    const Edge& edge = edges_[slot];
+    if (edge.child == 0) {
+      return kNoMatch;
+    }
+    if (edge.tag == tag && edge.parent == parent &&
+        edge.label_length == length &&
+        memcmp(labels_.data() + edge.label_offset, label, length) == 0) {
+      return edge.child;
+    }
+  }
+}
+
+uint32_t DomainTrie::AddChild(uint32_t parent, const char* label,
+                              size_t length) {
+  if ((edge_count_ + 1) * 2 > edges_.size()) {
+    Grow();
+  }
+  uint64_t hash = EdgeHash(parent, label, length);
+  size_t mask = edges_.size() - 1;
+  size_t slot = static_cast<size_t>(hash >> 16) & mask;
+  while (edges_[slot].child != 0) {
+    slot = (slot + 1) & mask;
+  }
+  uint32_t child = static_cast<uint32_t>(values_.size());
+  values_.push_back(kNoMatch);
+  edges_[slot] = {parent, child, static_cast<uint32_t>(labels_.size()),
+                  static_cast<uint16_t>(length), static_cast<uint16_t>(hash)};
+  labels_.append(label, length);
+  edge_count_++;
+  return child;
+}
+
+void DomainTrie::Grow() {
+  std::vector<Edge> old(edges_.size() * 2);
+  old.swap(edges_);
+  size_t mask = edges_.size() - 1;
+  for (const Edge& edge : old) {
+    if (edge.child == 0) {
+      continue;
+    }
+    uint64_t hash = EdgeHash(edge.parent, labels_.data() + edge.label_offset,
+                             edge.label_length);
+    size_t slot = static_cast<size_t>(hash >> 16) & mask;
+    while (edges_[slot].child != 0) {
+      slot = (slot + 1) & mask;
+    }
+    edges_[slot] = edge;
+  }
+}
+
+bool DomainTrie::Insert(const std::string& suffix, uint32_t value) {
+  std::string name;
+  if (!NormaliseSuffix(suffix, &name)) {
+    return false;
+  }
+  uint32_t node = 0;
+  size_t end = name.size();
+  while (end > 0) {
+    size_t start = name.rfind('.', end - 1);
+    start = start == std::string::npos ? 0 : start + 1;
+    uint32_t child = Child(node, name.data() + start, end - start);
+    node = child != kNoMatch ? child
+                             : AddChild(node, name.data() + start, end - start);
+    end = start > 0 ? start - 1 : 0;
+  }
+  if (values_[node] == kNoMatch) {
+    rules_++;
+  }
+  values_[node] = value;
+  return true;
+}
+
+uint32_t DomainTrie::Match(const char* name, size_t length) const {
+  uint32_t node = 0;
+  uint32_t match = values_[0];
+  size_t end = length;
+  while (end > 0) {
+    size_t start = end;
+    while (start > 0 && name[start - 1] != '.') {
+      start--;
+    }
+    node = Child(node, name + start, end - start);
+    if (node == kNoMatch) {
+      break;
+    }
+    if (values_[node] != kNoMatch) {
+      match = values_[node];
+    }
+    end = start > 0 ? start - 1 : 0;
+  }
+  return match;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,66 @@
+#ifndef DNS_MANAGER_DOMAIN_TRIE_H_
+#define DNS_MANAGER_DOMAIN_TRIE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+
+// Maps domain suffixes to values and finds the longest suffix rule covering
+// a name, as split-DNS routing needs ("corp.example.com" covers
+// "git.corp.example.com" and "corp.example.com" itself).
+//
+// Names are walked from the last label to the first; each node's children
+// are found through one shared open-addressing table keyed by (node, label),
+// so every edge is a whole label and a lookup costs one probe per label of
+// the query name no matter how many rules there are.
+class DomainTrie {
+ public:
+  static constexpr uint32_t kNoMatch = UINT32_MAX;
+
+  DomainTrie();
+
+  // Adds a rule for |suffix| ("corp.example.com", ".corp.example.com" and
+  // "*.corp.example.com" are the same rule; "" and "." match every name),
+  // replacing any earlier value for it. Returns false if |suffix| is not a
+  // valid domain name.
+  bool Insert(const std::string& suffix, uint32_t value);
+
+  // The value of the longest rule that is the lower-case |name| (no
+  // trailing dot) or one of its parents, or kNoMatch.
+  uint32_t Match(const char* name, size_t length) const;
+
+  // Number of rules.
+  size_t size() const { return rules_; }
+
+ private:
+  struct Edge {
+    uint32_t parent;
+    // 0 marks an empty slot; the root is never a child.
+    uint32_t child;
+    uint32_t label_offset;
+    uint16_t label_length;
+    // Low bits of the edge hash, checked before comparing labels.
+    uint16_t tag;
+  };
+
+  static uint64_t EdgeHash(uint32_t parent, const char* label, size_t length);
+  uint32_t Child(uint32_t parent, const char* label, size_t length) const;
+  uint32_t AddChild(uint32_t parent, const char* label, size_t length);
+  void Grow();
+
+  // Value of each node, indexed by node id; node 0 is the root.
+  std::vector<uint32_t> values_;
+  // Power-of-two sized, at most half full.
+  std::vector<Edge> edges_;
+  size_t edge_count_ = 0;
+  // Edge labels, back to back.
+  std::string labels_;
+  size_t rules_ = 0;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_DOMAIN_TRIE_H_
@@ -0,0 +1,40 @@
+#include "epoch.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace dns_manager {
+
+EpochDomain::Reader::Reader(EpochDomain* domain) : domain_(domain) {
+  for (slot_ = 0; slot_ < kMaxReaders; slot_++) {
+    bool expected = false;
+    if (domain_->slots_[slot_].used.compare_exchange_strong(expected, true)) {
+      return;
+    }
+  }
+  fprintf(stderr, "dns_manager: more than %zu epoch readers\n", kMaxReaders);
+  abort();
+}
+
+EpochDomain::Reader::~Reader() {
+  domain_->slots_[slot_].epoch.store(0, std::memory_order_release);
+  domain_->slots_[slot_].used.store(false, std::memory_order_release);
+}
+
+EpochDomain::EpochDomain() = default;
+
+uint64_t EpochDomain::Advance() {
+  return epoch_.fetch_add(1, std::memory_order_seq_cst) + 1;
+}
+
+bool EpochDomain::ReadersPast(uint64_t epoch) const {
+  for (const Slot& slot : slots_) {
+    uint64_t entered = slot.epoch.load(std::memory_order_seq_cst);
+    if (entered != 0 && entered < epoch) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace dns_manager
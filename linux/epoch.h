@@ -0,0 +1,156 @@
+#ifndef DNS_MANAGER_EPOCH_H_
+#define DNS_MANAGER_EPOCH_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace dns_manager {
+
+// Epoch-based reclamation for data that query threads read on every packet
+// and that is replaced now and then from another thread.
+//
+// Each reader thread owns a Reader slot and brackets its reads with a
+// ReadSection, which records the global epoch it started in. A writer swaps
+// in a new object, advances the epoch and keeps the old object until every
+// slot is either idle or in the new epoch; no reader ever takes a lock or
+// touches a reference count.
+class EpochDomain {
+ public:
+  // Upper bound on readers registered at the same time.
+  static constexpr size_t kMaxReaders = 64;
+
+  // A reader thread's slot. Aborts if all kMaxReaders are taken.
+  class Reader {
+   public:
+    explicit Reader(EpochDomain* domain);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+   private:
+    friend class EpochDomain;
+    EpochDomain* domain_;
+    size_t slot_;
+  };
+
+  // Objects loaded from an RcuPointer stay alive until the section ends.
+  // Sections must be short and must not nest.
+  class ReadSection {
+   public:
+    explicit ReadSection(Reader* reader) : reader_(reader) {
+      reader_->domain_->Enter(reader_->slot_);
+    }
+    ~ReadSection() { reader_->domain_->Exit(reader_->slot_); }
+
+    ReadSection(const ReadSection&) = delete;
+    ReadSection& operator=(const ReadSection&) = delete;
+
+   private:
+    Reader* reader_;
+  };
+
+  EpochDomain();
+
+  EpochDomain(const EpochDomain&) = delete;
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  // Starts a new epoch and returns it. Objects unpublished before the call
+  // may be freed once ReadersPast() holds for the returned epoch.
+  uint64_t Advance();
+  // Whether no reader is still inside a section that began before |epoch|.
+  bool ReadersPast(uint64_t epoch) const;
+
+ private:
+  // One cache line per slot so readers do not contend.
+  struct alignas(64) Slot {
+    // Epoch the current section began in, 0 outside sections.
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> used{false};
+  };
+
+  void Enter(size_t slot) {
+    // Sequentially consistent so that a writer which finds the slot idle
+    // after advancing knows the reader will load the new pointer.
+    slots_[slot].epoch.store(epoch_.load(std::memory_order_seq_cst),
+                             std::memory_order_seq_cst);
+  }
+  void Exit(size_t slot) {
+    slots_[slot].epoch.store(0, std::memory_order_release);
+  }
+
+  std::atomic<uint64_t> epoch_{1};
+  Slot slots_[kMaxReaders];
+};
+
+// A pointer that readers load inside an EpochDomain::ReadSection and a
+// writer replaces with Publish(). Replaced objects are freed by the writer
+// once no reader can still hold them.
+template <typename T>
+class RcuPointer {
+ public:
+  explicit RcuPointer(EpochDomain* domain) : domain_(domain) {}
+  // Readers must be gone by now.
+  ~RcuPointer() {
+    delete current_.load(std::memory_order_relaxed);
+    for (auto& retired : retired_) {
+      delete retired.second;
+    }
+  }
+
+  RcuPointer(const RcuPointer&) = delete;
+  RcuPointer& operator=(const RcuPointer&) = delete;
+
+  // The current object, or nullptr. Only valid until the reader's section
+  // ends.
+  const T* Load() const { return current_.load(std::memory_order_seq_cst); }
+
+  // Makes |value| the current object and retires the previous one, freeing
+  // whatever retired objects readers have already left behind. Thread-safe
+  // with respect to other writers and to readers.
+  void Publish(std::unique_ptr<T> value) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    const T* previous =
+        current_.exchange(value.release(), std::memory_order_seq_cst);
+    if (previous != nullptr) {
+      retired_.emplace_back(domain_->Advance(), previous);
+    }
+    ReclaimLocked();
+  }
+
+  // Frees retired objects no reader can still hold. Returns how many are
+  // still waiting.
+  size_t Reclaim() {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    return ReclaimLocked();
+  }
+
+ private:
+  size_t ReclaimLocked() {
+    size_t kept = 0;
+    for (auto& retired : retired_) {
+      if (domain_->ReadersPast(retired.first)) {
+        delete retired.second;
+      } else {
+        retired_[kept++] = retired;
+      }
+    }
+    retired_.resize(kept);
+    return kept;
+  }
+
+  EpochDomain* const domain_;
+  std::atomic<const T*> current_{nullptr};
+  std::mutex writer_mutex_;
+  // Replaced objects and the epoch readers must reach before they go.
+  std::vector<std::pair<uint64_t, const T*>> retired_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_EPOCH_H_
@@ -0,0 +1,79 @@
+#include "file_util.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace dns_manager {
+
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string& path,
+                                             std::string* error) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    *error = "open " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    *error = path + ": empty file";
+    close(fd);
+    return nullptr;
+  }
+  size_t size = static_cast<size_t>(info.st_size);
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    *error = "mmap " + path + ": " + strerror(errno);
+    return nullptr;
+  }
+  return std::unique_ptr<MappedFile>(
+      new MappedFile(static_cast<const uint8_t*>(mapping), size));
+}
+
+MappedFile::~MappedFile() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+bool WriteFileAtomically(const std::string& path, const uint8_t* data,
+                         size_t size, std::string* error) {
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  if (fd < 0) {
+    *error = "open " + temporary + ": " + strerror(errno);
+    return false;
+  }
+  size_t written = 0;
+  while (written < size) {
+    ssize_t result = write(fd, data + written, size - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      *error = "write " + temporary + ": " + strerror(errno);
+      close(fd);
+      unlink(temporary.c_str());
+      return false;
+    }
+    written += static_cast<size_t>(result);
+  }
+  // The data must be on disk before the rename makes it visible.
+  if (fsync(fd) != 0) {
+    *error = "fsync " + temporary + ": " + strerror(errno);
+    close(fd);
+    unlink(temporary.c_str());
+    return false;
+  }
+  close(fd);
+  if (rename(temporary.c_str(), path.c_str()) != 0) {
+    *error = "rename " + temporary + ": " + strerror(errno);
+    unlink(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,41 @@
+#ifndef DNS_MANAGER_FILE_UTIL_H_
+#define DNS_MANAGER_FILE_UTIL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace dns_manager {
+
+// A read-only private mapping of a whole file. The mapping stays valid after
+// the file is replaced or removed.
+class MappedFile {
+ public:
+  // Returns nullptr and sets |error| if the file cannot be opened or is
+  // empty.
+  static std::unique_ptr<MappedFile> Open(const std::string& path,
+                                          std::string* error);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  const uint8_t* data_;
+  size_t size_;
+};
+
+// Writes |size| bytes to |path| through a temporary file that is fsynced and
+// renamed over |path|, so readers see either the old or the new contents.
+bool WriteFileAtomically(const std::string& path, const uint8_t* data,
+                         size_t size, std::string* error);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_FILE_UTIL_H_
@@ -0,0 +1,124 @@
+#include "file_watcher.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace dns_manager {
+
+namespace {
+
+void CloseFd(int* fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+}  // namespace
+
+FileWatcher::FileWatcher(const std::string& path) : path_(path) {
+  size_t slash = path.rfind('/');
+  if (slash == std::string::npos) {
+    directory_ = ".";
+    name_ = path;
+  } else {
+    directory_ = slash == 0 ? "/" : path.substr(0, slash);
+    name_ = path.substr(slash + 1);
+  }
+}
+
+FileWatcher::~FileWatcher() { Stop(); }
+
+bool FileWatcher::Start(std::string* error) {
+  if (running_) {
+    return true;
+  }
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    *error = std::string("inotify_init1: ") + strerror(errno);
+    return false;
+  }
+  if (inotify_add_watch(inotify_fd_, directory_.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    *error = "inotify_add_watch " + directory_ + ": " + strerror(errno);
+    CloseFd(&inotify_fd_);
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    *error = std::string("eventfd: ") + strerror(errno);
+    CloseFd(&inotify_fd_);
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread(&FileWatcher::Run, this);
+  return true;
+}
+
+void FileWatcher::Stop() {
+  bool was_running = running_.exchange(false);
+  if (was_running) {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  CloseFd(&inotify_fd_);
+  CloseFd(&wake_fd_);
+}
+
+void FileWatcher::Run() {
+  pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {inotify_fd_, POLLIN, 0}};
+  bool changed = false;
+  while (running_) {
+    // While a change is pending, wait only until the file settles.
+    int ready = poll(fds, 2, changed ? kSettleMs : -1);
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (!running_) {
+      break;
+    }
+    if (ready == 0) {
+      changed = false;
+      if (change_callback_) {
+        change_callback_(change_context_);
+      }
+      continue;
+    }
+    if (fds[1].revents & POLLIN) {
+      changed = ReadEvents() || changed;
+    }
+  }
+}
+
+bool FileWatcher::ReadEvents() {
+  alignas(inotify_event) char buffer[4096];
+  bool matched = false;
+  while (true) {
+    ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+    if (length <= 0) {
+      return matched;
+    }
+    for (ssize_t offset = 0; offset < length;) {
+      const inotify_event* event =
+          reinterpret_cast<const inotify_event*>(buffer + offset);
+      // Lost events may have included ours.
+      if ((event->mask & IN_Q_OVERFLOW) ||
+          (event->len > 0 && name_ == event->name)) {
+        matched = true;
+      }
+      offset += sizeof(inotify_event) + event->len;
+    }
+  }
+}
+
+}  // namespace dns_manager
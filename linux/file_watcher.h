@@ -0,0 +1,61 @@
+#ifndef DNS_MANAGER_FILE_WATCHER_H_
+#define DNS_MANAGER_FILE_WATCHER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace dns_manager {
+
+// Reports changes to one file, from inotify events on its directory.
+//
+// Watching the directory rather than the file catches both ways a file gets
+// updated: written in place, and written elsewhere and renamed over it,
+// which is how editors and configuration tools replace files atomically
+// (the new file is a new inode, so a watch on the old one would go quiet).
+// Events are coalesced: the callback runs once the file has been quiet for
+// |kSettleMs|, so a burst of writes causes one reload.
+class FileWatcher {
+ public:
+  using ChangeCallback = void (*)(void* context);
+
+  static constexpr int kSettleMs = 20;
+
+  explicit FileWatcher(const std::string& path);
+  ~FileWatcher();
+
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // Called on the watcher thread after the file changed. Set before
+  // Start().
+  void set_change_callback(ChangeCallback callback, void* context) {
+    change_callback_ = callback;
+    change_context_ = context;
+  }
+
+  // Starts watching. On failure returns false and sets |error|.
+  bool Start(std::string* error);
+  void Stop();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  void Run();
+  // Reads the waiting events. Returns true if one was about the file.
+  bool ReadEvents();
+
+  const std::string path_;
+  std::string directory_;
+  std::string name_;
+  int inotify_fd_ = -1;
+  int wake_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  ChangeCallback change_callback_ = nullptr;
+  void* change_context_ = nullptr;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_FILE_WATCHER_H_
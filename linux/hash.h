@@ -0,0 +1,40 @@
+#ifndef DNS_MANAGER_HASH_H_
+#define DNS_MANAGER_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace dns_manager {
+
+inline uint64_t MixHash(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdULL;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ULL;
+  value ^= value >> 33;
+  return value;
+}
+
+// Fast non-cryptographic 64-bit hash for domain names and cache keys. It reads
+// eight bytes at a time and finishes with the MurmurHash3 finaliser.
+inline uint64_t HashBytes(const void* data, size_t length,
+                          uint64_t seed = 0x9e3779b97f4a7c15ULL) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = seed ^ (length * 0x87c37b91114253d5ULL);
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    hash = (hash ^ MixHash(word)) * 0x4cf5ad432745937fULL;
+    bytes += 8;
+    length -= 8;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, bytes, length);
+  hash ^= MixHash(tail ^ length);
+  return MixHash(hash);
+}
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_HASH_H_
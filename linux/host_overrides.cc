@@ -0,0 +1,443 @@
+#include "host_overrides.h"
+
+#include <arpa/inet.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "checksum.h"
+#include "dns_message.h"
+#include "file_util.h"
+#include "hash.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr char kFileMagic[8] = {'D', 'N', 'S', 'M', 'H', 'O', 'S', 'T'};
+// Aim for this many names per bucket.
+constexpr size_t kNamesPerBucket = 4;
+constexpr unsigned kMaxBucketBits = 28;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t bucket_bits;
+  uint64_t name_count;
+  uint64_t record_count;
+  uint64_t data_size;
+  // CRC-32C of this header with |crc| zeroed.
+  uint32_t crc;
+  uint32_t reserved;
+  uint8_t padding[16];
+};
+
+static_assert(sizeof(FileHeader) == 64, "unexpected FileHeader padding");
+
+size_t BucketFor(uint64_t hash, unsigned bucket_bits) {
+  return bucket_bits == 0 ? 0 : static_cast<size_t>(hash >> (64 - bucket_bits));
+}
+
+size_t BucketTableBytes(unsigned bucket_bits) {
+  size_t bytes = ((static_cast<size_t>(1) << bucket_bits) + 1) * sizeof(uint32_t);
+  return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+uint32_t HeaderCrc(FileHeader header) {
+  header.crc = 0;
+  return Crc32c(&header, sizeof(header));
+}
+
+// Lower-cases |name| and drops a trailing dot. Returns false if it is not a
+// valid host name.
+bool NormaliseName(const char* name, size_t length, std::string* normalised) {
+  if (length > 0 && name[length - 1] == '.') {
+    length--;
+  }
+  if (length == 0 || length > 253) {
+    return false;
+  }
+  normalised->assign(name, length);
+  size_t label_length = 0;
+  for (char& c : *normalised) {
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c + 32);
+    }
+    if (c == '.') {
+      if (label_length == 0) {
+        return false;
+      }
+      label_length = 0;
+    } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '_') {
+      if (++label_length > 63) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return label_length > 0;
+}
+
+// |name|, already normalised, in uncompressed wire format.
+std::string WireName(const std::string& name) {
+  std::string wire;
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    wire.push_back(static_cast<char>(end - start));
+    wire.append(name, start, end - start);
+    start = end + 1;
+  }
+  wire.push_back('\0');
+  return wire;
+}
+
+// Advances |*position| past the next whitespace-separated token of |line|.
+bool NextToken(const char* line, size_t length, size_t* position,
+               std::string* token) {
+  size_t start = *position;
+  while (start < length && (line[start] == ' ' || line[start] == '\t' ||
+                            line[start] == '\r' || line[start] == '\n')) {
+    start++;
+  }
+  size_t end = start;
+  while (end < length && line[end] != ' ' && line[end] != '\t' &&
+         line[end] != '\r' && line[end] != '\n') {
+    end++;
+  }
+  *position = end;
+  token->assign(line + start, end - start);
+  return end > start;
+}
+
+bool IsAddress(const std::string& text) {
+  uint8_t address[16];
+  return inet_pton(AF_INET, text.c_str(), address) == 1 ||
+         inet_pton(AF_INET6, text.c_str(), address) == 1;
+}
+
+}  // namespace
+
+struct HostOverrides::NameEntry {
+  uint64_t hash;
+  uint32_t name_offset;
+  uint32_t first_record;
+  uint16_t record_count;
+  uint8_t name_length;
+  uint8_t reserved[5];
+};
+
+struct HostOverrides::RecordEntry {
+  uint16_t type;
+  uint16_t rdata_length;
+  uint32_t rdata_offset;
+};
+
+std::unique_ptr<HostOverrides> HostOverrides::Open(const std::string& path,
+                                                   std::string* error) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path, error);
+  if (!file) {
+    return nullptr;
+  }
+
+  FileHeader header;
+  const char* problem = nullptr;
+  if (file->size() < sizeof(header)) {
+    problem = "truncated header";
+  } else {
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+      problem = "not a host overrides file";
+    } else if (header.version != kVersion) {
+      problem = "unsupported host overrides version";
+    } else if (HeaderCrc(header) != header.crc) {
+      problem = "header checksum mismatch";
+    } else if (header.bucket_bits > kMaxBucketBits ||
+               header.name_count > file->size() / sizeof(NameEntry) ||
+               header.record_count > file->size() / sizeof(RecordEntry) ||
+               header.data_size > file->size() ||
+               file->size() != sizeof(header) +
+                                   BucketTableBytes(header.bucket_bits) +
+                                   header.name_count * sizeof(NameEntry) +
+                                   header.record_count * sizeof(RecordEntry) +
+                                   header.data_size) {
+      problem = "size does not match header";
+    }
+  }
+  if (problem != nullptr) {
+    *error = path + ": " + problem;
+    return nullptr;
+  }
+
+  std::unique_ptr<HostOverrides> overrides(
+      new HostOverrides(std::move(file), header.name_count,
+                        header.bucket_bits, header.record_count));
+  // Check every offset now so that lookups need not.
+  size_t buckets = static_cast<size_t>(1) << header.bucket_bits;
+  for (size_t i = 0; i < buckets && problem == nullptr; i++) {
+    if (overrides->buckets_[i] > overrides->buckets_[i + 1]) {
+      problem = "bucket table out of order";
+    }
+  }
+  if (overrides->buckets_[buckets] != header.name_count) {
+    problem = "bucket table does not cover every name";
+  }
+  for (size_t i = 0; i < header.name_count && problem == nullptr; i++) {
+    const NameEntry& name = overrides->names_[i];
+    if (name.name_offset + static_cast<uint64_t>(name.name_length) >
+            header.data_size ||
+        name.record_count == 0 || name.record_count > kMaxRecordsPerName ||
+        name.first_record + static_cast<uint64_t>(name.record_count) >
+            header.record_count ||
+        (i > 0 && overrides->names_[i - 1].hash > name.hash)) {
+      problem = "bad name entry";
+    }
+  }
+  for (size_t i = 0; i < header.record_count && problem == nullptr; i++) {
+    const RecordEntry& record = overrides->records_[i];
+    if (record.rdata_offset + static_cast<uint64_t>(record.rdata_length) >
+        header.data_size) {
+      problem = "bad record entry";
+    }
+  }
+  if (problem != nullptr) {
+    *error = path + ": " + problem;
+    return nullptr;
+  }
+  return overrides;
+}
+
+HostOverrides::HostOverrides(std::unique_ptr<MappedFile> file,
+                             size_t name_count, unsigned bucket_bits,
+                             size_t record_count)
+    : file_(std::move(file)),
+      name_count_(name_count),
+      bucket_bits_(bucket_bits) {
+  static_assert(sizeof(NameEntry) == 24, "unexpected NameEntry padding");
+  static_assert(sizeof(RecordEntry) == 8, "unexpected RecordEntry padding");
+  const uint8_t* data = file_->data() + sizeof(FileHeader);
+  buckets_ = reinterpret_cast<const uint32_t*>(data);
+  data += BucketTableBytes(bucket_bits);
+  names_ = reinterpret_cast<const NameEntry*>(data);
+  data += name_count * sizeof(NameEntry);
+  records_ = reinterpret_cast<const RecordEntry*>(data);
+  data += record_count * sizeof(RecordEntry);
+  data_ = data;
+}
+
+HostOverrides::~HostOverrides() = default;
+
+size_t HostOverrides::file_size() const { return file_->size(); }
+
+size_t HostOverrides::Find(const char* name, size_t length,
+                           Record* records) const {
+  uint64_t hash = HashBytes(name, length);
+  size_t bucket = BucketFor(hash, bucket_bits_);
+  const NameEntry* end = names_ + buckets_[bucket + 1];
+  const NameEntry* entry = std::lower_bound(
+      names_ + buckets_[bucket], end, hash,
+      [](const NameEntry& entry, uint64_t hash) { return entry.hash < hash; });
+  for (; entry != end && entry->hash == hash; entry++) {
+    if (entry->name_length != length ||
+        memcmp(data_ + entry->name_offset, name, length) != 0) {
+      continue;
+    }
+    for (size_t i = 0; i < entry->record_count; i++) {
+      const RecordEntry& record = records_[entry->first_record + i];
+      records[i].type = record.type;
+      records[i].rdata_length = record.rdata_length;
+      records[i].rdata = data_ + record.rdata_offset;
+    }
+    return entry->record_count;
+  }
+  return 0;
+}
+
+bool HostOverridesBuilder::AddAddress(const std::string& name,
+                                      const std::string& address) {
+  uint8_t bytes[16];
+  if (inet_pton(AF_INET, address.c_str(), bytes) == 1) {
+    return AddRecord(name, kTypeA,
+                     std::string(reinterpret_cast<char*>(bytes), 4));
+  }
+  if (inet_pton(AF_INET6, address.c_str(), bytes) == 1) {
+    return AddRecord(name, kTypeAaaa,
+                     std::string(reinterpret_cast<char*>(bytes), 16));
+  }
+  return false;
+}
+
+bool HostOverridesBuilder::AddCname(const std::string& name,
+                                    const std::string& target) {
+  std::string normalised;
+  if (!NormaliseName(target.data(), target.size(), &normalised)) {
+    return false;
+  }
+  return AddRecord(name, kTypeCname, WireName(normalised));
+}
+
+bool HostOverridesBuilder::AddRecord(const std::string& name, uint16_t type,
+                                     std::string rdata) {
+  std::string normalised;
+  if (!NormaliseName(name.data(), name.size(), &normalised)) {
+    return false;
+  }
+  std::vector<Record>& records = names_[normalised];
+  bool alias = !records.empty() && records[0].type == kTypeCname;
+  if (alias || (type == kTypeCname && !records.empty()) ||
+      records.size() >= HostOverrides::kMaxRecordsPerName) {
+    return false;
+  }
+  for (const Record& record : records) {
+    if (record.type == type && record.rdata == rdata) {
+      return false;
+    }
+  }
+  records.push_back(Record{type, std::move(rdata)});
+  return true;
+}
+
+size_t HostOverridesBuilder::AddLine(const char* line, size_t length) {
+  const char* comment = static_cast<const char*>(memchr(line, '#', length));
+  if (comment != nullptr) {
+    length = comment - line;
+  }
+  size_t position = 0;
+  std::string first;
+  std::string token;
+  if (!NextToken(line, length, &position, &first)) {
+    return 0;
+  }
+  if (IsAddress(first)) {
+    size_t added = 0;
+    while (NextToken(line, length, &position, &token)) {
+      if (AddAddress(token, first)) {
+        added++;
+      }
+    }
+    return added;
+  }
+  std::string target;
+  if (NextToken(line, length, &position, &token) &&
+      strcasecmp(token.c_str(), "CNAME") == 0 &&
+      NextToken(line, length, &position, &target) &&
+      !NextToken(line, length, &position, &token)) {
+    return AddCname(first, target) ? 1 : 0;
+  }
+  return 0;
+}
+
+bool HostOverridesBuilder::AddFile(const std::string& path,
+                                   std::string* error) {
+  FILE* file = fopen(path.c_str(), "re");
+  if (file == nullptr) {
+    *error = "open " + path + ": " + strerror(errno);
+    return false;
+  }
+  char* line = nullptr;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) >= 0) {
+    AddLine(line, static_cast<size_t>(length));
+  }
+  free(line);
+  fclose(file);
+  return true;
+}
+
+std::vector<uint8_t> HostOverridesBuilder::Build() const {
+  struct Sorted {
+    uint64_t hash;
+    const std::string* name;
+    const std::vector<Record>* records;
+  };
+  std::vector<Sorted> sorted;
+  sorted.reserve(names_.size());
+  size_t record_count = 0;
+  size_t data_size = 0;
+  for (const auto& item : names_) {
+    sorted.push_back(Sorted{HashBytes(item.first.data(), item.first.size()),
+                            &item.first, &item.second});
+    record_count += item.second.size();
+    data_size += item.first.size();
+    for (const Record& record : item.second) {
+      data_size += record.rdata.size();
+    }
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const Sorted& a, const Sorted& b) {
+              return a.hash != b.hash ? a.hash < b.hash : *a.name < *b.name;
+            });
+  size_t count = sorted.size();
+
+  unsigned bucket_bits = 0;
+  while (bucket_bits < kMaxBucketBits &&
+         (kNamesPerBucket << (bucket_bits + 1)) <= count) {
+    bucket_bits++;
+  }
+  size_t buckets_offset = sizeof(FileHeader);
+  size_t names_offset = buckets_offset + BucketTableBytes(bucket_bits);
+  size_t records_offset = names_offset + count * sizeof(HostOverrides::NameEntry);
+  size_t data_offset =
+      records_offset + record_count * sizeof(HostOverrides::RecordEntry);
+  std::vector<uint8_t> image(data_offset + data_size);
+
+  uint32_t* buckets = reinterpret_cast<uint32_t*>(image.data() + buckets_offset);
+  auto* names = reinterpret_cast<HostOverrides::NameEntry*>(image.data() +
+                                                            names_offset);
+  auto* records = reinterpret_cast<HostOverrides::RecordEntry*>(
+      image.data() + records_offset);
+  uint8_t* data = image.data() + data_offset;
+  size_t bucket = 0;
+  size_t record = 0;
+  size_t data_used = 0;
+  for (size_t i = 0; i < count; i++) {
+    const Sorted& item = sorted[i];
+    // Buckets up to this name's start where it does.
+    size_t name_bucket = BucketFor(item.hash, bucket_bits);
+    while (bucket <= name_bucket) {
+      buckets[bucket++] = static_cast<uint32_t>(i);
+    }
+    HostOverrides::NameEntry& name = names[i];
+    name.hash = item.hash;
+    name.name_offset = static_cast<uint32_t>(data_used);
+    name.name_length = static_cast<uint8_t>(item.name->size());
+    name.first_record = static_cast<uint32_t>(record);
+    name.record_count = static_cast<uint16_t>(item.records->size());
+    memcpy(data + data_used, item.name->data(), item.name->size());
+    data_used += item.name->size();
+    for (const Record& source : *item.records) {
+      HostOverrides::RecordEntry& entry = records[record++];
+      entry.type = source.type;
+      entry.rdata_length = static_cast<uint16_t>(source.rdata.size());
+      entry.rdata_offset = static_cast<uint32_t>(data_used);
+      memcpy(data + data_used, source.rdata.data(), source.rdata.size());
+      data_used += source.rdata.size();
+    }
+  }
+  while (bucket <= (static_cast<size_t>(1) << bucket_bits)) {
+    buckets[bucket++] = static_cast<uint32_t>(count);
+  }
+
+  FileHeader header = {};
+  memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = HostOverrides::kVersion;
+  header.bucket_bits = bucket_bits;
+  header.name_count = count;
+  header.record_count = record_count;
+  header.data_size = data_size;
+  header.crc = HeaderCrc(header);
+  memcpy(image.data(), &header, sizeof(header));
+  return image;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,120 @@
+#ifndef DNS_MANAGER_HOST_OVERRIDES_H_
+#define DNS_MANAGER_HOST_OVERRIDES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dns_manager {
+
+class MappedFile;
+
+// A compiled table of pinned host names, read through mmap, that the local
+// resolver answers A, AAAA and CNAME queries from without going upstream.
+//
+// File layout (version 1; integers in host byte order):
+//
+//   FileHeader               magic, version, counts, header CRC
+//   uint32_t[buckets + 1]    first name of each bucket, padded to 8 bytes
+//   NameEntry[names]         sorted by the 64-bit hash of the name
+//   RecordEntry[records]     each name's records, in a row
+//   data                     names, then record data in wire format
+//
+// A name is found by its hash: the top bits pick a bucket and a binary
+// search over the handful of names in it finds the entry, whose name is
+// then compared, so a lookup touches a few cache lines. Open() checks every
+// offset once, so lookups can trust the file.
+class HostOverrides {
+ public:
+  static constexpr uint32_t kVersion = 1;
+  // More records for one name are dropped.
+  static constexpr size_t kMaxRecordsPerName = 32;
+
+  // One record of an overridden name, pointing into the mapped file.
+  struct Record {
+    uint16_t type = 0;
+    uint16_t rdata_length = 0;
+    const uint8_t* rdata = nullptr;
+  };
+
+  // Maps a file written by HostOverridesBuilder. Returns nullptr and sets
+  // |error| if it is missing, from another version or damaged.
+  static std::unique_ptr<HostOverrides> Open(const std::string& path,
+                                             std::string* error);
+
+  ~HostOverrides();
+
+  HostOverrides(const HostOverrides&) = delete;
+  HostOverrides& operator=(const HostOverrides&) = delete;
+
+  // Copies the records of the lower-case |name| (no trailing dot) into
+  // |records|, which must hold kMaxRecordsPerName, and returns how many
+  // there are; 0 if the name is not overridden. Thread-safe.
+  size_t Find(const char* name, size_t length, Record* records) const;
+
+  size_t size() const { return name_count_; }
+  size_t file_size() const;
+
+ private:
+  friend class HostOverridesBuilder;
+
+  struct NameEntry;
+  struct RecordEntry;
+
+  HostOverrides(std::unique_ptr<MappedFile> file, size_t name_count,
+                unsigned bucket_bits, size_t record_count);
+
+  std::unique_ptr<MappedFile> file_;
+  size_t name_count_;
+  unsigned bucket_bits_;
+  const uint32_t* buckets_;
+  const NameEntry* names_;
+  const RecordEntry* records_;
+  const uint8_t* data_;
+};
+
+// Collects overrides and writes the file HostOverrides reads.
+//
+// Accepted lines:
+//   10.1.2.3 git.corp.example gitlab.corp.example   hosts file: A records
+//   fd00::5 git.corp.example                        AAAA records
+//   wiki.corp.example CNAME docs.corp.example       an alias
+// Text after '#' is a comment. A name has either addresses or one CNAME;
+// whichever was added first wins.
+class HostOverridesBuilder {
+ public:
+  // Adds an A or AAAA record for |name| from the textual |address|.
+  // Returns false if either is invalid or |name| is an alias.
+  bool AddAddress(const std::string& name, const std::string& address);
+  // Makes |name| an alias of |target|. Returns false if either is invalid
+  // or |name| already has records.
+  bool AddCname(const std::string& name, const std::string& target);
+  // Adds the overrides on one line. Returns the number of records added.
+  size_t AddLine(const char* line, size_t length);
+  // Adds every line of |path|. Returns false and sets |error| if it cannot
+  // be read.
+  bool AddFile(const std::string& path, std::string* error);
+
+  // Names with at least one record.
+  size_t size() const { return names_.size(); }
+
+  // Serialises the table.
+  std::vector<uint8_t> Build() const;
+
+ private:
+  struct Record {
+    uint16_t type;
+    std::string rdata;
+  };
+
+  bool AddRecord(const std::string& name, uint16_t type, std::string rdata);
+
+  std::unordered_map<std::string, std::vector<Record>> names_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_HOST_OVERRIDES_H_
@@ -0,0 +1,1875 @@
+#include "local_resolver.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <unordered_map>
+
+#include "datagram_batch.h"
+#include "dns_message.h"
+#include "dns_stream.h"
+
+namespace dns_manager {
+
+namespace {
+
+// Upper bound on queries in flight; beyond this new queries get SERVFAIL.
+constexpr size_t kMaxPendingQueries = 16384;
+// Tries at finding an ephemeral port free for both UDP and TCP.
+constexpr int kMaxBindAttempts = 8;
+// Queries waiting on every open connection to an upstream before another
+// one is opened.
+constexpr size_t kPipelineDepth = 16;
+// Default DNS-over-TLS port (RFC 7858).
+constexpr uint16_t kTlsPort = 853;
+
+// An upstream connection with queries outstanding that has answered none
+// for this many upstream timeouts is given up on.
+constexpr int kStalledStreamTimeouts = 2;
+
+// UDP sockets each thread sends upstream queries from, per address family,
+// and the queries sent from one before it is swapped for a socket on a new
+// random port. Each query goes out on one picked at random, so an off-path
+// attacker has to guess the port as well as the ID.
+constexpr size_t kUpstreamSocketsPerFamily = 4;
+constexpr uint32_t kQueriesPerUpstreamSocket = 32;
+
+// Whether the question of |response| is the one |key| (see
+// AnswerCache::KeyFor) was made from. An answer with the right ID that asks
+// something else is forged or confused, and must not be cached.
+bool AnswersQuestion(const uint8_t* response, size_t length,
+                     const std::string& key) {
+  DnsMessageReader reader(response, length);
+  DnsQuestionView question;
+  if (key.size() < 4 || reader.header().question_count != 1 ||
+      !reader.NextQuestion(&question)) {
+    return false;
+  }
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(key.data());
+  return question.qtype == ReadU16(bytes) &&
+         question.qclass == ReadU16(bytes + 2) &&
+         question.name.Equals(key.data() + 4, key.size() - 4);
+}
+
+int OpenUdpSocket(int family, std::string* error) {
+  int fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0 && error) {
+    *error = std::string("socket: ") + strerror(errno);
+  }
+  return fd;
+}
+
+void CloseFd(int* fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+// The CPUs this process may run on, in ascending order.
+std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+void AddStats(const ResolverStats& from, ResolverStats* to) {
+  to->queries += from.queries;
+  to->cache_hits += from.cache_hits;
+  to->cache_misses += from.cache_misses;
+  to->prefetches_issued += from.prefetches_issued;
+  to->prefetch_hits += from.prefetch_hits;
+  to->prefetches_wasted += from.prefetches_wasted;
+  to->negative_cache_hits += from.negative_cache_hits;
+  to->stale_answers_served += from.stale_answers_served;
+  to->warm_cache_hits += from.warm_cache_hits;
+  to->shared_cache_hits += from.shared_cache_hits;
+  to->blocked_queries += from.blocked_queries;
+  to->host_override_queries += from.host_override_queries;
+  to->tcp_queries += from.tcp_queries;
+  to->upstream_tcp_queries += from.upstream_tcp_queries;
+  to->upstream_tcp_connections += from.upstream_tcp_connections;
+  to->rate_limited_queries += from.rate_limited_queries;
+}
+
+std::string TrimSpaces(const std::string& text) {
+  size_t start = text.find_first_not_of(" \t");
+  if (start == std::string::npos) {
+    return std::string();
+  }
+  return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+}  // namespace
+
+// A resolver thread. Nothing it does per query touches another thread's
+// memory: it has its own listening sockets, client connections, upstream
+// sockets and connections, pending queries, cache, counters and query event
+// ring, and reads the host overrides, blocklist and routes
+// through its own epoch slot. Only cache misses reach shared state, the
+// SharedAnswerCache and the warm cache.
+class LocalResolver::Shard {
+ public:
+  Shard(LocalResolver* resolver, size_t cache_entries, size_t cache_bytes);
+  ~Shard() { Close(); }
+
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+ private:
+  friend class LocalResolver;
+
+  // Where an answer goes.
+  struct Client {
+    SocketAddress address;
+    // The TCP connection the query came on, 0 for UDP.
+    uint64_t stream = 0;
+    // Larger answers are sent truncated, so that the client retries over
+    // TCP.
+    size_t max_response_size = kMinUdpPayloadSize;
+  };
+
+  // The pooled TCP connection to one upstream. Every query sent to the
+  // upstream over TCP is pipelined on it.
+  struct UpstreamStream {
+    SocketAddress address;
+    std::unique_ptr<DnsStream> stream;
+    // Queries sent and not yet answered on it.
+    size_t in_flight = 0;
+    // When it last answered, or started waiting for an answer.
+    Clock::time_point last_answer;
+  };
+
+  // A UDP socket upstream queries are sent from. Once it has sent
+  // kQueriesPerUpstreamSocket queries it is swapped for a new one, which
+  // the kernel binds to another random port.
+  struct UpstreamSocket {
+    int family = AF_INET;
+    int fd = -1;
+    // Told apart from the sockets it replaced and will replace by an ID
+    // from the same sequence as the connections'.
+    uint64_t id = 0;
+    std::unique_ptr<DatagramWriter> writer;
+    uint32_t queries = 0;
+  };
+
+  // A swapped-out socket, kept open until the answers to the queries sent
+  // from it are due.
+  struct RetiredSocket {
+    int fd = -1;
+    uint64_t id = 0;
+    Clock::time_point close_at;
+  };
+
+  struct PendingQuery {
+    Client client;
+    uint16_t client_id = 0;
+    // The servers this query is routed to, the one tried last and, by
+    // index, every one tried.
+    std::shared_ptr<const UpstreamList> upstreams;
+    size_t upstream = 0;
+    uint64_t tried = 0;
+    // When the client's query arrived.
+    Clock::time_point received;
+    // When it was last sent, and how long to wait for the answer.
+    Clock::time_point sent;
+    int timeout_ms = 0;
+    Clock::time_point deadline;
+    // The server tried before the current one and when, so that a late
+    // answer from it over UDP is still taken; SIZE_MAX if none.
+    size_t previous_upstream = SIZE_MAX;
+    Clock::time_point previous_sent;
+    // When to fall back to a stale answer if upstream has not replied.
+    Clock::time_point client_deadline = Clock::time_point::max();
+    std::vector<uint8_t> query;
+    std::string cache_key;
+    // A refresh-ahead query with no client waiting for it.
+    bool prefetch = false;
+    // The client already got a stale answer; the upstream reply only
+    // refreshes the cache.
+    bool answered = false;
+    // Sent over TCP, because the client asked over TCP or the UDP answer
+    // came back truncated.
+    bool tcp = false;
+    // The upstream connection it was last sent on.
+    uint64_t stream = 0;
+    // The UDP socket it was last sent from and, for a late answer from
+    // |previous_upstream|, the one before; 0 for none.
+    uint64_t socket = 0;
+    uint64_t previous_socket = 0;
+    // Already sent again once after its connection broke.
+    bool resent = false;
+  };
+
+  // Binds the listening sockets, with SO_REUSEPORT when |reuse_port|, and
+  // opens the upstream sockets.
+  bool Open(const SocketAddress& listen, bool reuse_port, std::string* error);
+  void Close();
+
+  void Run();
+  void ReadClientQueries();
+  void AcceptClients();
+  void ReadClientStream(uint64_t id);
+  void HandleClientQuery(const uint8_t* query, size_t length,
+                         const Client& client);
+  // Reads the answers waiting on the upstream UDP socket |socket|.
+  void ReadUpstreamResponses(int fd, uint64_t socket);
+  void ReadUpstreamStream(uint64_t id);
+  // |stream| is the upstream connection the answer came on and |socket| the
+  // UDP socket; the other is 0.
+  void HandleUpstreamResponse(uint8_t* response, size_t length,
+                              const SocketAddress& source, uint64_t stream,
+                              uint64_t socket);
+  void SendToClient(const Client& client, const uint8_t* response,
+                    size_t length);
+  // Answers a query from a client over its rate limit.
+  void AnswerRateLimited(const uint8_t* query, size_t length,
+                         const Client& client);
+  void AnswerBlocked(const uint8_t* query, size_t length,
+                     const DnsQuestion& question, const Client& client,
+                     Clock::time_point received);
+  // Answers from the host overrides. Returns false if they do not cover
+  // the question.
+  bool AnswerFromHostOverrides(const uint8_t* query,
+                               const DnsQuestion& question,
+                               const Client& client,
+                               Clock::time_point received);
+  bool AnswerFromCache(const std::string& key, const Client& client,
+                       uint16_t client_id, Clock::time_point now);
+  void MaybePrefetch(const std::string& key, AnswerCache::Entry* entry,
+                     Clock::time_point now);
+  // Stores an answer in this thread's cache and shares it with the others.
+  AnswerCache::Entry* Store(const std::string& key, const uint8_t* response,
+                            size_t length, Clock::time_point stored_at,
+                            bool prefetched);
+  AnswerCache::Entry* LoadFromSharedCache(const std::string& key,
+                                          Clock::time_point now);
+  AnswerCache::Entry* LoadFromWarmCache(const std::string& key,
+                                        Clock::time_point now);
+  bool AnswerWithStale(const PendingQuery& pending, Clock::time_point now);
+  void FailPendingQuery(const PendingQuery& pending);
+  std::shared_ptr<const UpstreamList> UpstreamsFor(const std::string& name);
+  bool SendToUpstream(uint16_t id, PendingQuery* pending);
+  // The TLS settings of |upstream|, or nullptr if it is not a TLS upstream.
+  const TlsUpstream* TlsFor(const SocketAddress& upstream) const;
+  // Pipelines the query on the pooled connection to its current upstream,
+  // opening one if needed.
+  bool SendOverTcp(uint16_t id, PendingQuery* pending);
+  // Closes a client or upstream connection. Queries waiting on an upstream
+  // connection are sent again on a new one, once.
+  void CloseStream(uint64_t id);
+  void CloseIdleStreams(Clock::time_point now);
+  Clock::time_point UpstreamStreamDeadline(const UpstreamStream& upstream)
+      const;
+  void ExpirePendingQueries(Clock::time_point now);
+  int NextTimeoutMs(Clock::time_point now) const;
+  void SendServFail(const PendingQuery& pending);
+  // Records an answered client query if query events are enabled.
+  void RecordQuery(const char* name, size_t length, uint16_t qtype,
+                   uint8_t rcode, QuerySource source,
+                   Clock::time_point received);
+  // The same for a query identified by its AnswerCache key.
+  void RecordQuery(const std::string& key, uint8_t rcode, QuerySource source,
+                   Clock::time_point received);
+  static void CountWastedPrefetch(void* shard);
+  bool AllocateId(uint16_t* id);
+  // A socket of |upstream|'s family picked at random, swapped for a new one
+  // first if it has sent its share of queries.
+  UpstreamSocket* UpstreamSocketFor(const SocketAddress& upstream);
+  void CloseRetiredSockets(Clock::time_point now);
+  // Sends the queued datagrams, moving queries the upstream socket refused
+  // on to their next server.
+  void FlushDatagrams();
+
+  LocalResolver* const resolver_;
+  const ResolverConfig& config_;
+  int listen_fd_ = -1;
+  int tcp_listen_fd_ = -1;
+  std::thread thread_;
+
+  // Owned by the shard's thread.
+  std::unordered_map<uint16_t, PendingQuery> pending_;
+  AnswerCache cache_;
+  std::mt19937 random_;
+  // Only the first thread writes the periodic cache snapshot.
+  Clock::time_point next_persist_ = Clock::time_point::max();
+  EpochDomain::Reader epoch_reader_;
+  // Client and upstream TCP connections, by IDs that are never reused, so a
+  // late answer cannot reach a newer connection that got the same fd.
+  std::unordered_map<uint64_t, std::unique_ptr<DnsStream>> client_streams_;
+  std::unordered_map<uint64_t, UpstreamStream> upstream_streams_;
+  uint64_t next_stream_id_ = 1;
+  // Connections to close once the current poll round is handled, as they
+  // may be in the middle of a read.
+  std::vector<uint64_t> closing_streams_;
+  // Answers built from the cache can be as large as a TCP message.
+  std::vector<uint8_t> response_buffer_;
+  // UDP datagrams in and out, batched unless |config_.batch_udp_io| is
+  // false. Answers and queries are queued while a batch of datagrams is
+  // handled and flushed before the thread waits again.
+  DatagramReader reader_;
+  DatagramWriter client_writer_;
+  // kUpstreamSocketsPerFamily IPv4 sockets, then as many IPv6 ones. Sized
+  // once, as Stats() reads the writers' counters from another thread.
+  std::vector<UpstreamSocket> upstream_sockets_;
+  std::vector<RetiredSocket> retired_sockets_;
+  // IDs of the queries whose upstream send failed.
+  std::vector<uint32_t> failed_sends_;
+
+  // Answered client queries, drained by the plugin; nullptr without a query
+  // event capacity.
+  std::unique_ptr<QueryEventRing> query_events_;
+
+  // Guards the sketch and the counters, which are read from the main thread.
+  mutable std::mutex stats_mutex_;
+  TopDomainsSketch top_domains_;
+  ResolverStats stats_;
+};
+
+LocalResolver::Shard::Shard(LocalResolver* resolver, size_t cache_entries,
+                            size_t cache_bytes)
+    : resolver_(resolver),
+      config_(resolver->config_),
+      cache_(cache_entries, cache_bytes, config_.cache_max_ttl,
+             config_.negative_max_ttl),
+      random_(std::random_device()()),
+      epoch_reader_(&resolver->epochs_),
+      response_buffer_(kMaxTcpMessageSize),
+      reader_(config_.batch_udp_io),
+      client_writer_(config_.batch_udp_io),
+      upstream_sockets_(2 * kUpstreamSocketsPerFamily),
+      top_domains_(config_.top_domains_capacity,
+                   config_.top_domains_half_life_seconds) {
+  for (size_t i = 0; i < upstream_sockets_.size(); i++) {
+    upstream_sockets_[i].family =
+        i < kUpstreamSocketsPerFamily ? AF_INET : AF_INET6;
+    upstream_sockets_[i].writer.reset(
+        new DatagramWriter(config_.batch_udp_io));
+  }
+  cache_.set_drop_callback(&Shard::CountWastedPrefetch, this);
+  if (config_.query_event_capacity > 0) {
+    query_events_.reset(new QueryEventRing(config_.query_event_capacity));
+  }
+}
+
+bool LocalResolver::Shard::Open(const SocketAddress& listen, bool reuse_port,
+                                std::string* error) {
+  listen_fd_ = OpenUdpSocket(listen.family(), error);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  int one = 1;
+  if (reuse_port && setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &one,
+                               sizeof(one)) != 0) {
+    *error = std::string("SO_REUSEPORT: ") + strerror(errno);
+    return false;
+  }
+  if (bind(listen_fd_, listen.sockaddr_ptr(), listen.length) != 0) {
+    *error = "bind " + listen.ToString() + ": " + strerror(errno);
+    return false;
+  }
+  if (config_.tcp) {
+    // The same port as UDP, which differs from |listen| when it asked for
+    // port 0.
+    SocketAddress bound;
+    bound.length = sizeof(bound.storage);
+    getsockname(listen_fd_, bound.sockaddr_ptr(), &bound.length);
+    tcp_listen_fd_ = socket(listen.family(),
+                            SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (tcp_listen_fd_ < 0) {
+      *error = std::string("socket: ") + strerror(errno);
+      return false;
+    }
+    // Lets a restarted resolver bind while old connections linger.
+    setsockopt(tcp_listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuse_port && setsockopt(tcp_listen_fd_, SOL_SOCKET, SO_REUSEPORT,
+                                 &one, sizeof(one)) != 0) {
+      *error = std::string("SO_REUSEPORT: ") + strerror(errno);
+      return false;
+    }
+    if (bind(tcp_listen_fd_, bound.sockaddr_ptr(), bound.length) != 0 ||
+        ::listen(tcp_listen_fd_, SOMAXCONN) != 0) {
+      *error = "bind TCP " + bound.ToString() + ": " + strerror(errno);
+      return false;
+    }
+  }
+
+  // Routes can be changed while running, so have both families ready; a
+  // host without IPv6 simply cannot use IPv6 route servers.
+  for (UpstreamSocket& socket : upstream_sockets_) {
+    bool required = false;
+    for (const SocketAddress& upstream : config_.upstreams) {
+      required = required || upstream.family() == socket.family;
+    }
+    socket.fd = OpenUdpSocket(socket.family, required ? error : nullptr);
+    if (socket.fd < 0 && required) {
+      return false;
+    }
+    socket.id = next_stream_id_++;
+    socket.writer->set_fd(socket.fd);
+  }
+  client_writer_.set_fd(listen_fd_);
+  return true;
+}
+
+void LocalResolver::Shard::Close() {
+  pending_.clear();
+  client_streams_.clear();
+  upstream_streams_.clear();
+  closing_streams_.clear();
+  client_writer_.set_fd(-1);
+  CloseFd(&listen_fd_);
+  CloseFd(&tcp_listen_fd_);
+  for (UpstreamSocket& socket : upstream_sockets_) {
+    socket.writer->set_fd(-1);
+    CloseFd(&socket.fd);
+    socket.queries = 0;
+  }
+  for (RetiredSocket& socket : retired_sockets_) {
+    CloseFd(&socket.fd);
+  }
+  retired_sockets_.clear();
+}
+
+LocalResolver::LocalResolver(const ResolverConfig& config)
+    : config_(config),
+      start_time_(Clock::now()),
+      default_upstreams_(std::make_shared<UpstreamList>(config.upstreams)),
+      upstream_health_(config.upstream_timeout_ms,
+                       config.upstream_min_timeout_ms,
+                       config.upstream_timeout_ms,
+                       config.adaptive_upstreams) {
+  if (config.rate_limit_qps > 0) {
+    rate_limiter_.reset(new RateLimiter(config.rate_limit_qps,
+                                        config.rate_limit_burst,
+                                        config.rate_limit_clients));
+  }
+  size_t threads =
+      config.threads > 0 ? config.threads : AllowedCpus().size();
+  threads = std::min(std::max<size_t>(threads, 1), kMaxThreads);
+  // With several threads, half of the cache memory goes to the shared tier
+  // and the threads split the other half.
+  size_t cache_bytes = config.cache_max_bytes;
+  if (threads > 1) {
+    cache_bytes /= 2;
+    shared_cache_.reset(new SharedAnswerCache(
+        config.cache_max_entries, cache_bytes, config.cache_max_ttl,
+        config.negative_max_ttl));
+  }
+  for (size_t i = 0; i < threads; i++) {
+    shards_.emplace_back(new Shard(this, config.cache_max_entries / threads,
+                                   cache_bytes / threads));
+  }
+}
+
+LocalResolver::~LocalResolver() { Stop(); }
+
+bool LocalResolver::Start(std::string* error) {
+  if (running_) {
+    return true;
+  }
+  if (config_.upstreams.empty()) {
+    *error = "no upstream servers configured";
+    return false;
+  }
+  if (!config_.routes.empty() && !SetRoutes(config_.routes, error)) {
+    return false;
+  }
+
+  SocketAddress listen;
+  if (!SocketAddress::Parse(config_.listen_address, config_.listen_port,
+                            &listen)) {
+    *error = "invalid listen address " + config_.listen_address;
+    return false;
+  }
+  if (!config_.tls_upstreams.empty() && !tls_) {
+    tls_ = TlsContext::Create(config_.tls_ca_file, error);
+    if (!tls_) {
+      return false;
+    }
+  }
+
+  // An ephemeral UDP port may be taken for TCP; then try another one.
+  for (int attempt = 0;; attempt++) {
+    bool opened = true;
+    for (size_t i = 0; opened && i < shards_.size(); i++) {
+      // The other threads join the first one's sockets on the port it got,
+      // so that the kernel spreads clients across them.
+      opened = shards_[i]->Open(i == 0 ? listen : bound_address_,
+                                shards_.size() > 1, error);
+      if (opened && i == 0) {
+        bound_address_.length = sizeof(bound_address_.storage);
+        getsockname(shards_[0]->listen_fd_, bound_address_.sockaddr_ptr(),
+                    &bound_address_.length);
+      }
+    }
+    if (opened) {
+      break;
+    }
+    bool retry = errno == EADDRINUSE && config_.listen_port == 0 &&
+                 attempt < kMaxBindAttempts;
+    Stop();
+    if (!retry) {
+      return false;
+    }
+  }
+
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    *error = std::string("eventfd: ") + strerror(errno);
+    Stop();
+    return false;
+  }
+
+  if (!config_.cache_file.empty()) {
+    shards_[0]->next_persist_ =
+        Clock::now() +
+        std::chrono::seconds(config_.cache_persist_interval_seconds);
+  }
+  std::vector<int> cpus;
+  if (config_.pin_threads) {
+    cpus = AllowedCpus();
+  }
+  running_ = true;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    Shard* shard = shards_[i].get();
+    shard->thread_ = std::thread(&Shard::Run, shard);
+    if (!cpus.empty()) {
+      // Pinning is best effort; an unpinned thread still works.
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus[i % cpus.size()], &set);
+      pthread_setaffinity_np(shard->thread_.native_handle(), sizeof(set),
+                             &set);
+    }
+  }
+  return true;
+}
+
+void LocalResolver::Stop() {
+  bool was_running = running_.exchange(false);
+  if (was_running && wake_fd_ >= 0) {
+    // Never read, so it stays readable and wakes every thread.
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+  for (const auto& shard : shards_) {
+    if (shard->thread_.joinable()) {
+      shard->thread_.join();
+    }
+  }
+  if (was_running && !config_.cache_file.empty()) {
+    PersistCache(shards_[0]->cache_, Clock::now(), true);
+  }
+  if (persist_thread_.joinable()) {
+    persist_thread_.join();
+  }
+  for (const auto& shard : shards_) {
+    shard->Close();
+  }
+  CloseFd(&wake_fd_);
+}
+
+std::vector<DomainCount> LocalResolver::TopDomains(size_t count) const {
+  double now = NowSeconds();
+  if (shards_.size() == 1) {
+    std::lock_guard<std::mutex> lock(shards_[0]->stats_mutex_);
+    return shards_[0]->top_domains_.Top(count, now);
+  }
+  // Each thread counts the names its own clients asked for, so a name's
+  // count is the sum over threads.
+  std::unordered_map<std::string, DomainCount> merged;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->stats_mutex_);
+    for (const DomainCount& domain :
+         shard->top_domains_.Top(config_.top_domains_capacity, now)) {
+      DomainCount& total = merged[domain.name];
+      total.name = domain.name;
+      total.count += domain.count;
+      total.error += domain.error;
+    }
+  }
+  std::vector<DomainCount> top;
+  top.reserve(merged.size());
+  for (auto& item : merged) {
+    top.push_back(std::move(item.second));
+  }
+  std::sort(top.begin(), top.end(),
+            [](const DomainCount& a, const DomainCount& b) {
+              return a.count > b.count;
+            });
+  if (top.size() > count) {
+    top.resize(count);
+  }
+  return top;
+}
+
+void LocalResolver::SetBlocklist(BlocklistView blocklist) {
+  std::unique_ptr<BlocklistView> published;
+  if (!blocklist.empty()) {
+    published.reset(new BlocklistView(std::move(blocklist)));
+  }
+  blocklist_.Publish(std::move(published));
+  // A reader holds the old rules for one lookup at most, so this wait is
+  // short and the old index is never kept alongside the new one for long.
+  while (blocklist_.Reclaim() > 0) {
+    std::this_thread::yield();
+  }
+}
+
+void LocalResolver::SetHostOverrides(
+    std::shared_ptr<const HostOverrides> overrides) {
+  std::unique_ptr<std::shared_ptr<const HostOverrides>> published;
+  if (overrides) {
+    published.reset(
+        new std::shared_ptr<const HostOverrides>(std::move(overrides)));
+  }
+  host_overrides_.Publish(std::move(published));
+  while (host_overrides_.Reclaim() > 0) {
+    std::this_thread::yield();
+  }
+}
+
+std::vector<UpstreamScore> LocalResolver::UpstreamScores() const {
+  return upstream_health_.Scores(Clock::now());
+}
+
+void LocalResolver::SetQueryEventsEnabled(bool enabled) {
+  for (const auto& shard : shards_) {
+    if (shard->query_events_) {
+      shard->query_events_->set_enabled(enabled);
+    }
+  }
+}
+
+void LocalResolver::set_query_events_ready(
+    QueryEventRing::ReadyCallback callback, void* context, size_t threshold) {
+  for (const auto& shard : shards_) {
+    if (shard->query_events_) {
+      shard->query_events_->set_ready_callback(callback, context, threshold);
+    }
+  }
+}
+
+size_t LocalResolver::DrainQueryEvents(QueryEventBatch* batch,
+                                       size_t max_events) {
+  if (shards_.size() == 1) {
+    QueryEventRing* ring = shards_[0]->query_events_.get();
+    return ring ? ring->Drain(batch, max_events) : 0;
+  }
+  // Each ring is in order; merge them so batch offsets stay ascending.
+  size_t count = 0;
+  while (count < max_events) {
+    QueryEventRing* earliest = nullptr;
+    const QueryEvent* first = nullptr;
+    for (const auto& shard : shards_) {
+      QueryEventRing* ring = shard->query_events_.get();
+      const QueryEvent* event = ring ? ring->Front() : nullptr;
+      if (event != nullptr &&
+          (first == nullptr || event->time_us < first->time_us)) {
+        earliest = ring;
+        first = event;
+      }
+    }
+    if (earliest == nullptr) {
+      break;
+    }
+    batch->Add(*first);
+    earliest->Pop();
+    count++;
+  }
+  for (const auto& shard : shards_) {
+    if (shard->query_events_) {
+      batch->AddDropped(shard->query_events_->TakeDropped());
+    }
+  }
+  return count;
+}
+
+bool LocalResolver::SetRoutes(const std::vector<DnsRoute>& routes,
+                              std::string* error) {
+  std::unique_ptr<RouteTable> table;
+  if (!routes.empty()) {
+    table.reset(new RouteTable());
+    for (const DnsRoute& route : routes) {
+      if (route.upstreams.empty()) {
+        *error = "no servers for " + route.suffix;
+        return false;
+      }
+      if (!table->trie.Insert(route.suffix,
+                              static_cast<uint32_t>(table->upstreams.size()))) {
+        *error = "invalid domain suffix " + route.suffix;
+        return false;
+      }
+      table->upstreams.push_back(
+          std::make_shared<UpstreamList>(route.upstreams));
+    }
+  }
+  routes_.Publish(std::move(table));
+  while (routes_.Reclaim() > 0) {
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+ResolverStats LocalResolver::Stats() const {
+  ResolverStats total;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->stats_mutex_);
+    AddStats(shard->stats_, &total);
+  }
+  for (const auto& shard : shards_) {
+    total.udp_syscalls +=
+        shard->reader_.syscalls() + shard->client_writer_.syscalls();
+    for (const Shard::UpstreamSocket& socket : shard->upstream_sockets_) {
+      total.udp_syscalls += socket.writer->syscalls();
+    }
+  }
+  if (tls_) {
+    total.tls_handshakes = tls_->handshakes();
+    total.tls_resumed_handshakes = tls_->resumed_handshakes();
+  }
+  return total;
+}
+
+void LocalResolver::Shard::Run() {
+  std::vector<pollfd> fds;
+  // The upstream socket or connection behind each pollfd past the fixed
+  // ones; sockets first.
+  std::vector<uint64_t> stream_ids;
+  while (resolver_->running_) {
+    // poll() skips the negative fds of sockets that are not open.
+    fds.assign({{resolver_->wake_fd_, POLLIN, 0},
+                {listen_fd_, POLLIN, 0},
+                {tcp_listen_fd_, POLLIN, 0}});
+    constexpr size_t kFixedFds = 3;
+    stream_ids.clear();
+    for (const UpstreamSocket& socket : upstream_sockets_) {
+      fds.push_back({socket.fd, POLLIN, 0});
+      stream_ids.push_back(socket.id);
+    }
+    for (const RetiredSocket& socket : retired_sockets_) {
+      fds.push_back({socket.fd, POLLIN, 0});
+      stream_ids.push_back(socket.id);
+    }
+    const size_t first_stream = fds.size();
+    for (const auto& item : client_streams_) {
+      const DnsStream& stream = *item.second;
+      fds.push_back({stream.fd(),
+                     static_cast<short>(POLLIN |
+                                        (stream.wants_write() ? POLLOUT : 0)),
+                     0});
+      stream_ids.push_back(item.first);
+    }
+    for (const auto& item : upstream_streams_) {
+      const DnsStream& stream = *item.second.stream;
+      fds.push_back({stream.fd(),
+                     static_cast<short>(POLLIN |
+                                        (stream.wants_write() ? POLLOUT : 0)),
+                     0});
+      stream_ids.push_back(item.first);
+    }
+
+    int ready = poll(fds.data(), fds.size(), NextTimeoutMs(Clock::now()));
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (ready > 0) {
+      if (fds[1].revents & POLLIN) {
+        ReadClientQueries();
+      }
+      // A socket swapped out meanwhile stays open until the loop ends.
+      for (size_t i = kFixedFds; i < first_stream; i++) {
+        if (fds[i].revents & POLLIN) {
+          ReadUpstreamResponses(fds[i].fd, stream_ids[i - kFixedFds]);
+        }
+      }
+      for (size_t i = first_stream; i < fds.size(); i++) {
+        uint64_t id = stream_ids[i - kFixedFds];
+        short events = fds[i].revents;
+        if (events & POLLOUT) {
+          auto client = client_streams_.find(id);
+          auto upstream = upstream_streams_.find(id);
+          bool flushed =
+              client != client_streams_.end()
+                  ? client->second->Flush()
+                  : upstream == upstream_streams_.end() ||
+                        upstream->second.stream->Flush();
+          if (!flushed) {
+            closing_streams_.push_back(id);
+          }
+        }
+        if (events & (POLLIN | POLLHUP | POLLERR)) {
+          if (client_streams_.count(id) != 0) {
+            ReadClientStream(id);
+          } else {
+            ReadUpstreamStream(id);
+          }
+        }
+      }
+      if (fds[2].revents & POLLIN) {
+        AcceptClients();
+      }
+    }
+    for (uint64_t id : closing_streams_) {
+      CloseStream(id);
+    }
+    closing_streams_.clear();
+    Clock::time_point now = Clock::now();
+    ExpirePendingQueries(now);
+    CloseIdleStreams(now);
+    FlushDatagrams();
+    CloseRetiredSockets(now);
+    if (next_persist_ <= now) {
+      resolver_->PersistCache(cache_, now, false);
+      next_persist_ =
+          now + std::chrono::seconds(config_.cache_persist_interval_seconds);
+    }
+  }
+}
+
+void LocalResolver::Shard::ReadClientQueries() {
+  size_t received;
+  do {
+    received = reader_.Receive(listen_fd_);
+    for (size_t i = 0; i < received; i++) {
+      Client client;
+      client.address = reader_.source(i);
+      client.max_response_size =
+          MaxUdpResponseSize(reader_.data(i), reader_.length(i));
+      HandleClientQuery(reader_.data(i), reader_.length(i), client);
+    }
+    // Answers go out with each batch rather than once the socket is empty.
+    FlushDatagrams();
+  } while (received == reader_.capacity());
+}
+
+void LocalResolver::Shard::AcceptClients() {
+  while (true) {
+    int fd = accept4(tcp_listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    if (client_streams_.size() >= config_.max_tcp_clients) {
+      close(fd);
+      continue;
+    }
+    client_streams_[next_stream_id_++].reset(new DnsStream(fd));
+  }
+}
+
+void LocalResolver::Shard::ReadClientStream(uint64_t id) {
+  Client client;
+  client.stream = id;
+  client.max_response_size = kMaxTcpMessageSize;
+  // Only the rate limit needs to know who is asking over TCP.
+  if (resolver_->rate_limiter_) {
+    client.address.length = sizeof(client.address.storage);
+    getpeername(client_streams_[id]->fd(), client.address.sockaddr_ptr(),
+                &client.address.length);
+  }
+  // Queries are answered as they complete, in whatever order (RFC 7766
+  // 6.2.1.1).
+  bool open = client_streams_[id]->Read(
+      [&](const uint8_t* query, size_t length) {
+        HandleClientQuery(query, length, client);
+      });
+  if (!open) {
+    closing_streams_.push_back(id);
+  }
+}
+
+void LocalResolver::Shard::HandleClientQuery(const uint8_t* query,
+                                             size_t length,
+                                             const Client& client) {
+  DnsQuestion question;
+  if (length < kDnsHeaderSize || IsResponse(query) ||
+      !ParseFirstQuestion(query, length, &question)) {
+    return;
+  }
+  Clock::time_point now = Clock::now();
+  if (resolver_->rate_limiter_ &&
+      !resolver_->rate_limiter_->Allow(client.address, now)) {
+    AnswerRateLimited(query, length, client);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.queries++;
+    if (client.stream != 0) {
+      stats_.tcp_queries++;
+    }
+    top_domains_.Add(question.name.data(), question.name.size(),
+                     resolver_->NowSeconds());
+  }
+  if ((question.qtype == kTypeA || question.qtype == kTypeAaaa ||
+       question.qtype == kTypeCname) &&
+      AnswerFromHostOverrides(query, question, client, now)) {
+    return;
+  }
+  bool blocked;
+  {
+    EpochDomain::ReadSection read(&epoch_reader_);
+    const BlocklistView* blocklist = resolver_->blocklist_.Load();
+    blocked = blocklist != nullptr &&
+              blocklist->Contains(question.name.data(), question.name.size());
+  }
+  if (blocked) {
+    AnswerBlocked(query, length, question, client, now);
+    return;
+  }
+
+  std::string key = AnswerCache::KeyFor(question);
+  if (AnswerFromCache(key, client, GetMessageId(query), now)) {
+    return;
+  }
+
+  PendingQuery pending;
+  pending.client = client;
+  pending.client_id = GetMessageId(query);
+  pending.received = now;
+  pending.query.assign(query, query + length);
+  pending.cache_key = std::move(key);
+  pending.upstreams = UpstreamsFor(question.name);
+  // A client asking over TCP has most likely just had a truncated answer,
+  // so skip straight to TCP upstream too.
+  pending.tcp = client.stream != 0;
+  if (config_.max_stale_seconds > 0) {
+    pending.client_deadline =
+        now + std::chrono::milliseconds(config_.client_response_timeout_ms);
+  }
+
+  uint16_t id;
+  if (pending_.size() >= kMaxPendingQueries || !AllocateId(&id)) {
+    FailPendingQuery(pending);
+    return;
+  }
+  auto inserted = pending_.emplace(id, std::move(pending));
+  if (!SendToUpstream(id, &inserted.first->second)) {
+    FailPendingQuery(inserted.first->second);
+    pending_.erase(inserted.first);
+  }
+}
+
+void LocalResolver::Shard::ReadUpstreamResponses(int fd, uint64_t socket) {
+  size_t received;
+  do {
+    received = reader_.Receive(fd);
+    for (size_t i = 0; i < received; i++) {
+      HandleUpstreamResponse(reader_.data(i), reader_.length(i),
+                             reader_.source(i), 0, socket);
+    }
+    FlushDatagrams();
+  } while (received == reader_.capacity());
+}
+
+void LocalResolver::Shard::ReadUpstreamStream(uint64_t id) {
+  auto it = upstream_streams_.find(id);
+  if (it == upstream_streams_.end()) {
+    return;
+  }
+  UpstreamStream& upstream = it->second;
+  // Copied: handling an answer may open or close other connections.
+  SocketAddress source = upstream.address;
+  bool open = upstream.stream->Read([&](uint8_t* response, size_t length) {
+    if (upstream.in_flight > 0) {
+      upstream.in_flight--;
+    }
+    upstream.last_answer = Clock::now();
+    HandleUpstreamResponse(response, length, source, id, 0);
+  });
+  if (!open) {
+    closing_streams_.push_back(id);
+  }
+}
+
+void LocalResolver::Shard::HandleUpstreamResponse(uint8_t* buffer,
+                                                  size_t length,
+                                                  const SocketAddress& source,
+                                                  uint64_t stream,
+                                                  uint64_t socket) {
+  if (length < kDnsHeaderSize || !IsResponse(buffer)) {
+    return;
+  }
+  auto it = pending_.find(GetMessageId(buffer));
+  if (it == pending_.end()) {
+    return;
+  }
+  // Only accept the answer from the server, and over the connection or on
+  // the socket, the query was last sent to, or over UDP from the server
+  // tried before it. Either way it has to answer the question asked.
+  PendingQuery& pending = it->second;
+  const UpstreamList& upstreams = *pending.upstreams;
+  Clock::time_point sent;
+  if (source == upstreams[pending.upstream] && pending.stream == stream &&
+      pending.socket == socket) {
+    sent = pending.sent;
+  } else if (stream == 0 && pending.previous_upstream != SIZE_MAX &&
+             source == upstreams[pending.previous_upstream] &&
+             pending.previous_socket == socket) {
+    sent = pending.previous_sent;
+  } else {
+    return;
+  }
+  if (!AnswersQuestion(buffer, length, pending.cache_key)) {
+    return;
+  }
+  Clock::time_point now = Clock::now();
+  uint8_t rcode = GetRcode(buffer);
+  if (rcode == kRcodeServFail || rcode == kRcodeRefused) {
+    // Treat a failing upstream like one that timed out.
+    resolver_->upstream_health_.RecordTimeout(source, now);
+    if (!SendToUpstream(it->first, &pending)) {
+      FailPendingQuery(pending);
+      pending_.erase(it);
+    }
+    return;
+  }
+  resolver_->upstream_health_.RecordAnswer(source, now - sent);
+  // A UDP client gets the truncated answer at once and will ask again over
+  // TCP. Nobody else can use it: fetch the whole answer over TCP.
+  if (IsTruncated(buffer) && stream == 0 &&
+      (pending.prefetch || pending.answered)) {
+    pending.tcp = true;
+    if (!SendOverTcp(it->first, &pending)) {
+      FailPendingQuery(pending);
+      pending_.erase(it);
+    }
+    return;
+  }
+
+  if (pending.prefetch) {
+    if (!Store(pending.cache_key, buffer, length, Clock::now(), true)) {
+      FailPendingQuery(pending);
+    }
+  } else {
+    // Stored first, so that the client's next query finds the answer on
+    // whichever thread it lands.
+    Store(pending.cache_key, buffer, length, Clock::now(), false);
+    if (!pending.answered) {
+      SetMessageId(buffer, pending.client_id);
+      SendToClient(pending.client, buffer, length);
+      RecordQuery(pending.cache_key, rcode, QuerySource::kUpstream,
+                  pending.received);
+    }
+  }
+  pending_.erase(it);
+}
+
+void LocalResolver::Shard::SendToClient(const Client& client,
+                                        const uint8_t* response,
+                                        size_t length) {
+  if (client.stream != 0) {
+    auto it = client_streams_.find(client.stream);
+    // The client may have hung up in the meantime.
+    if (it != client_streams_.end() && !it->second->Send(response, length)) {
+      closing_streams_.push_back(client.stream);
+    }
+    return;
+  }
+  uint8_t truncated[kMaxUdpMessageSize];
+  if (length > client.max_response_size) {
+    length = BuildTruncatedResponse(response, length, truncated,
+                                    sizeof(truncated));
+    if (length == 0) {
+      return;
+    }
+    response = truncated;
+  }
+  client_writer_.Send(client.address, response, length);
+}
+
+void LocalResolver::Shard::AnswerRateLimited(const uint8_t* query,
+                                             size_t length,
+                                             const Client& client) {
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.queries++;
+    stats_.rate_limited_queries++;
+  }
+  uint8_t response[kMaxUdpMessageSize];
+  bool truncate = client.stream == 0 &&
+                  config_.rate_limit_action == RateLimitAction::kTruncated;
+  size_t response_length =
+      BuildErrorResponse(query, length,
+                         truncate ? kRcodeNoError : kRcodeRefused, response,
+                         sizeof(response));
+  if (response_length == 0) {
+    return;
+  }
+  if (truncate) {
+    response[2] |= 0x02;
+  }
+  SendToClient(client, response, response_length);
+}
+
+void LocalResolver::Shard::AnswerBlocked(const uint8_t* query, size_t length,
+                                         const DnsQuestion& question,
+                                         const Client& client,
+                                         Clock::time_point received) {
+  uint8_t response[kMaxUdpMessageSize];
+  size_t response_length = 0;
+  if (config_.blocking_mode == BlockingMode::kNxDomain) {
+    response_length = BuildErrorResponse(query, length, kRcodeNxDomain,
+                                         response, sizeof(response));
+  } else {
+    static const uint8_t kUnspecified[16] = {0};
+    DnsMessageBuilder builder(response, sizeof(response));
+    // QR and RA, plus the query's opcode and RD.
+    uint16_t flags =
+        static_cast<uint16_t>(0x8080 | (ReadU16(query + 2) & 0x7900));
+    builder.SetHeader(GetMessageId(query), flags);
+    bool ok = builder.AddQuestion(question.name.data(), question.name.size(),
+                                  question.qtype, question.qclass);
+    if (ok && (question.qtype == kTypeA || question.qtype == kTypeAaaa)) {
+      ok = builder.AddRecord(DnsSection::kAnswer, question.name.data(),
+                             question.name.size(), question.qtype,
+                             question.qclass, config_.blocked_answer_ttl,
+                             kUnspecified, question.qtype == kTypeA ? 4 : 16);
+    }
+    response_length = ok ? builder.length() : 0;
+  }
+  if (response_length == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.blocked_queries++;
+  }
+  SendToClient(client, response, response_length);
+  RecordQuery(question.name.data(), question.name.size(), question.qtype,
+              GetRcode(response), QuerySource::kBlocked, received);
+}
+
+bool LocalResolver::Shard::AnswerFromHostOverrides(
+    const uint8_t* query, const DnsQuestion& question, const Client& client,
+    Clock::time_point received) {
+  // Longest CNAME chain followed within the overrides.
+  constexpr int kMaxAliases = 8;
+  uint8_t response[kMaxUdpMessageSize];
+  DnsMessageBuilder builder(response, sizeof(response));
+  // QR, AA and RA, plus the query's opcode and RD.
+  builder.SetHeader(
+      GetMessageId(query),
+      static_cast<uint16_t>(0x8480 | (ReadU16(query + 2) & 0x7900)));
+  bool ok = builder.AddQuestion(question.name.data(), question.name.size(),
+                                question.qtype, question.qclass);
+  {
+    EpochDomain::ReadSection read(&epoch_reader_);
+    const std::shared_ptr<const HostOverrides>* overrides =
+        resolver_->host_overrides_.Load();
+    if (overrides == nullptr) {
+      return false;
+    }
+    HostOverrides::Record records[HostOverrides::kMaxRecordsPerName];
+    char name[kMaxDnsNameLength];
+    size_t name_length = question.name.size();
+    memcpy(name, question.name.data(), name_length);
+    size_t count = (*overrides)->Find(name, name_length, records);
+    if (count == 0) {
+      return false;
+    }
+    for (int aliases = 0; ok && count > 0; aliases++) {
+      char target[kMaxDnsNameLength];
+      size_t target_length = 0;
+      for (size_t i = 0; ok && i < count; i++) {
+        const HostOverrides::Record& record = records[i];
+        if (record.type != question.qtype && record.type != kTypeCname) {
+          continue;
+        }
+        ok = builder.AddRecord(DnsSection::kAnswer, name, name_length,
+                               record.type, question.qclass,
+                               config_.host_override_ttl, record.rdata,
+                               record.rdata_length);
+        if (record.type == kTypeCname) {
+          ok = ok && DnsNameView(record.rdata, record.rdata_length, 0)
+                         .Decode(target, sizeof(target), &target_length);
+        }
+      }
+      // Follow an alias to an overridden name; one that is not overridden
+      // is left for the client to resolve.
+      if (target_length == 0 || question.qtype == kTypeCname ||
+          aliases == kMaxAliases) {
+        break;
+      }
+      memcpy(name, target, target_length);
+      name_length = target_length;
+      count = (*overrides)->Find(name, name_length, records);
+    }
+  }
+  if (!ok) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.host_override_queries++;
+  }
+  SendToClient(client, response, builder.length());
+  RecordQuery(question.name.data(), question.name.size(), question.qtype,
+              kRcodeNoError, QuerySource::kHostOverride, received);
+  return true;
+}
+
+bool LocalResolver::Shard::AnswerFromCache(const std::string& key,
+                                           const Client& client,
+                                           uint16_t client_id,
+                                           Clock::time_point now) {
+  AnswerCache::Entry* entry = cache_.Find(key);
+  bool shared = false;
+  bool warm = false;
+  if (entry == nullptr) {
+    entry = LoadFromSharedCache(key, now);
+    shared = entry != nullptr;
+  }
+  if (entry == nullptr) {
+    entry = LoadFromWarmCache(key, now);
+    warm = entry != nullptr;
+  }
+  if (entry != nullptr && entry->Expired(now)) {
+    // Keep expired entries around while they can still be served stale.
+    if (entry->StaleSeconds(now) > config_.max_stale_seconds) {
+      cache_.Erase(key);
+    }
+    entry = nullptr;
+  }
+  if (entry == nullptr) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.cache_misses++;
+    return false;
+  }
+
+  uint8_t* response = response_buffer_.data();
+  size_t length = BuildCachedAnswer(cache_, *entry, client_id, now, response,
+                                    response_buffer_.size());
+  if (length == 0) {
+    return false;
+  }
+
+  entry->hits++;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.cache_hits++;
+    if (entry->negative) {
+      stats_.negative_cache_hits++;
+    }
+    if (entry->prefetched) {
+      stats_.prefetch_hits++;
+    }
+    if (shared) {
+      stats_.shared_cache_hits++;
+    }
+    if (warm) {
+      stats_.warm_cache_hits++;
+    }
+  }
+  entry->prefetched = false;
+  SendToClient(client, response, length);
+  RecordQuery(key, GetRcode(response),
+              warm ? QuerySource::kWarmCache : QuerySource::kCache, now);
+  MaybePrefetch(key, entry, now);
+  return true;
+}
+
+void LocalResolver::Shard::MaybePrefetch(const std::string& key,
+                                         AnswerCache::Entry* entry,
+                                         Clock::time_point now) {
+  if (config_.prefetch_fraction <= 0 || entry->prefetching ||
+      entry->hits < config_.prefetch_min_hits) {
+    return;
+  }
+  uint32_t remaining = entry->ttl - entry->AgeSeconds(now);
+  if (remaining > entry->ttl * config_.prefetch_fraction) {
+    return;
+  }
+
+  DnsQuestion question;
+  uint8_t query[kMaxUdpMessageSize];
+  uint16_t id;
+  if (pending_.size() >= kMaxPendingQueries ||
+      !AnswerCache::QuestionFor(key, &question) || !AllocateId(&id)) {
+    return;
+  }
+  size_t length = BuildQuery(question, id, query, sizeof(query));
+  if (length == 0) {
+    return;
+  }
+
+  PendingQuery pending;
+  pending.query.assign(query, query + length);
+  pending.cache_key = key;
+  pending.upstreams = UpstreamsFor(question.name);
+  pending.prefetch = true;
+  auto inserted = pending_.emplace(id, std::move(pending));
+  if (!SendToUpstream(id, &inserted.first->second)) {
+    pending_.erase(inserted.first);
+    return;
+  }
+  entry->prefetching = true;
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.prefetches_issued++;
+}
+
+AnswerCache::Entry* LocalResolver::Shard::Store(const std::string& key,
+                                                const uint8_t* response,
+                                                size_t length,
+                                                Clock::time_point stored_at,
+                                                bool prefetched) {
+  AnswerCache::Entry* entry =
+      cache_.Insert(key, response, length, stored_at, prefetched);
+  if (entry != nullptr && resolver_->shared_cache_) {
+    resolver_->shared_cache_->Insert(key, response, length, stored_at);
+  }
+  return entry;
+}
+
+AnswerCache::Entry* LocalResolver::Shard::LoadFromSharedCache(
+    const std::string& key, Clock::time_point now) {
+  std::vector<uint8_t> response;
+  Clock::time_point stored_at;
+  if (!resolver_->shared_cache_ ||
+      !resolver_->shared_cache_->Find(key, now, config_.max_stale_seconds,
+                                      &response, &stored_at)) {
+    return nullptr;
+  }
+  // Keeps the time the answer was received, so it expires on schedule.
+  return cache_.Insert(key, response.data(), response.size(), stored_at,
+                       false);
+}
+
+AnswerCache::Entry* LocalResolver::Shard::LoadFromWarmCache(
+    const std::string& key, Clock::time_point now) {
+  if (!resolver_->warm_cache_) {
+    return nullptr;
+  }
+  PersistentCache::Record record;
+  int64_t wall_now = time(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(resolver_->warm_cache_mutex_);
+    if (!resolver_->warm_cache_->Find(key, wall_now, config_.max_stale_seconds,
+                                      &record)) {
+      return nullptr;
+    }
+  }
+  // Back-date the entry so it expires when it would have without the
+  // restart.
+  int64_t age = std::max<int64_t>(wall_now - record.stored_wall_seconds, 0);
+  return Store(key, record.response, record.length,
+               now - std::chrono::seconds(age), false);
+}
+
+bool LocalResolver::Shard::AnswerWithStale(const PendingQuery& pending,
+                                           Clock::time_point now) {
+  AnswerCache::Entry* entry = cache_.Find(pending.cache_key);
+  if (entry == nullptr ||
+      entry->StaleSeconds(now) > config_.max_stale_seconds) {
+    return false;
+  }
+  // Another query may have refreshed the entry in the meantime.
+  bool stale = entry->Expired(now);
+  uint8_t* response = response_buffer_.data();
+  size_t length = BuildCachedAnswer(cache_, *entry, pending.client_id, now,
+                                    response, response_buffer_.size(),
+                                    stale ? config_.stale_answer_ttl : 0);
+  if (length == 0) {
+    return false;
+  }
+  if (stale) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.stale_answers_served++;
+  }
+  SendToClient(pending.client, response, length);
+  RecordQuery(pending.cache_key, GetRcode(response),
+              stale ? QuerySource::kStale : QuerySource::kCache,
+              pending.received);
+  return true;
+}
+
+void LocalResolver::Shard::FailPendingQuery(const PendingQuery& pending) {
+  if (!pending.prefetch) {
+    if (!pending.answered && (config_.max_stale_seconds == 0 ||
+                              !AnswerWithStale(pending, Clock::now()))) {
+      SendServFail(pending);
+    }
+    return;
+  }
+  // Let a later hit try the refresh again.
+  AnswerCache::Entry* entry = cache_.Find(pending.cache_key);
+  if (entry != nullptr) {
+    entry->prefetching = false;
+  }
+}
+
+std::shared_ptr<const LocalResolver::UpstreamList>
+LocalResolver::Shard::UpstreamsFor(const std::string& name) {
+  EpochDomain::ReadSection read(&epoch_reader_);
+  const RouteTable* routes = resolver_->routes_.Load();
+  if (routes != nullptr) {
+    uint32_t route = routes->trie.Match(name.data(), name.size());
+    if (route != DomainTrie::kNoMatch) {
+      return routes->upstreams[route];
+    }
+  }
+  return resolver_->default_upstreams_;
+}
+
+bool LocalResolver::Shard::SendToUpstream(uint16_t id, PendingQuery* pending) {
+  // Try the servers not tried yet, best first, until a send succeeds.
+  const UpstreamList& upstreams = *pending->upstreams;
+  while (true) {
+    Clock::time_point now = Clock::now();
+    size_t next = resolver_->upstream_health_.Choose(
+        upstreams, pending->tried, now, &pending->timeout_ms);
+    if (next == upstreams.size()) {
+      return false;
+    }
+    if (pending->tried != 0) {
+      pending->previous_upstream = pending->upstream;
+      pending->previous_sent = pending->sent;
+      pending->previous_socket = pending->socket;
+    }
+    pending->tried |= static_cast<uint64_t>(1) << next;
+    pending->upstream = next;
+    const SocketAddress& upstream = upstreams[next];
+    if (pending->tcp || TlsFor(upstream) != nullptr) {
+      if (SendOverTcp(id, pending)) {
+        return true;
+      }
+    } else {
+      // Should the socket refuse it, FlushDatagrams() moves on to the next
+      // server.
+      UpstreamSocket* socket = UpstreamSocketFor(upstream);
+      pending->stream = 0;
+      pending->socket = socket->id;
+      SetMessageId(pending->query.data(), id);
+      socket->writer->Send(upstream, pending->query.data(),
+                           pending->query.size(), id);
+      pending->sent = now;
+      pending->deadline = now + std::chrono::milliseconds(pending->timeout_ms);
+      return true;
+    }
+  }
+}
+
+bool LocalResolver::Shard::SendOverTcp(uint16_t id, PendingQuery* pending) {
+  const SocketAddress& address = (*pending->upstreams)[pending->upstream];
+  Clock::time_point now = Clock::now();
+  // The least busy connection to the upstream.
+  uint64_t stream_id = 0;
+  size_t connections = 0;
+  size_t least_in_flight = 0;
+  for (const auto& item : upstream_streams_) {
+    if (item.second.address != address) {
+      continue;
+    }
+    if (connections++ == 0 || item.second.in_flight < least_in_flight) {
+      stream_id = item.first;
+      least_in_flight = item.second.in_flight;
+    }
+  }
+  if (stream_id == 0 || (least_in_flight >= kPipelineDepth &&
+                         connections < config_.upstream_connections)) {
+    const TlsUpstream* tls = TlsFor(address);
+    std::unique_ptr<DnsStream> stream =
+        tls == nullptr ? DnsStream::Connect(address)
+                       : DnsStream::Connect(address, resolver_->tls_.get(),
+                                            tls->server_name);
+    if (!stream) {
+      return false;
+    }
+    stream_id = next_stream_id_++;
+    UpstreamStream& upstream = upstream_streams_[stream_id];
+    upstream.address = address;
+    upstream.stream = std::move(stream);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.upstream_tcp_connections++;
+  }
+  UpstreamStream& upstream = upstream_streams_[stream_id];
+  SetMessageId(pending->query.data(), id);
+  if (!upstream.stream->Send(pending->query.data(), pending->query.size())) {
+    closing_streams_.push_back(stream_id);
+    return false;
+  }
+  if (upstream.in_flight++ == 0) {
+    upstream.last_answer = now;
+  }
+  pending->stream = stream_id;
+  pending->socket = 0;
+  pending->sent = now;
+  pending->deadline = now + std::chrono::milliseconds(pending->timeout_ms);
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stats_.upstream_tcp_queries++;
+  return true;
+}
+
+const TlsUpstream* LocalResolver::Shard::TlsFor(
+    const SocketAddress& upstream) const {
+  for (const TlsUpstream& tls : config_.tls_upstreams) {
+    if (tls.address == upstream) {
+      return &tls;
+    }
+  }
+  return nullptr;
+}
+
+void LocalResolver::Shard::CloseStream(uint64_t id) {
+  if (client_streams_.erase(id) != 0) {
+    return;
+  }
+  auto it = upstream_streams_.find(id);
+  if (it == upstream_streams_.end()) {
+    return;
+  }
+  upstream_streams_.erase(it);
+  // The server may have closed an idle connection just as a query went
+  // out on it: try once more on a fresh one before moving on. That includes
+  // DNS-over-TLS queries from UDP clients, which are not |tcp| themselves.
+  Clock::time_point now = Clock::now();
+  for (auto& item : pending_) {
+    PendingQuery& pending = item.second;
+    if (pending.stream != id) {
+      continue;
+    }
+    pending.stream = 0;
+    if (pending.resent || !SendOverTcp(item.first, &pending)) {
+      // Let ExpirePendingQueries() move on to the next upstream.
+      pending.deadline = now;
+    }
+    pending.resent = true;
+  }
+}
+
+LocalResolver::Clock::time_point LocalResolver::Shard::UpstreamStreamDeadline(
+    const UpstreamStream& upstream) const {
+  if (upstream.in_flight == 0) {
+    return upstream.stream->last_active() +
+           std::chrono::milliseconds(config_.upstream_tcp_idle_timeout_ms);
+  }
+  return upstream.last_answer +
+         std::chrono::milliseconds(config_.upstream_timeout_ms *
+                                   kStalledStreamTimeouts);
+}
+
+void LocalResolver::Shard::CloseIdleStreams(Clock::time_point now) {
+  auto idle_limit = std::chrono::milliseconds(config_.tcp_idle_timeout_ms);
+  for (auto it = client_streams_.begin(); it != client_streams_.end();) {
+    if (it->second->last_active() + idle_limit <= now) {
+      it = client_streams_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::vector<uint64_t> expired;
+  for (const auto& item : upstream_streams_) {
+    if (UpstreamStreamDeadline(item.second) <= now) {
+      expired.push_back(item.first);
+    }
+  }
+  for (uint64_t id : expired) {
+    CloseStream(id);
+  }
+}
+
+void LocalResolver::Shard::ExpirePendingQueries(Clock::time_point now) {
+  for (auto it = pending_.begin(); it != pending_.end();) {
+    PendingQuery& pending = it->second;
+    if (pending.client_deadline <= now) {
+      // Upstream is slow: answer stale now if possible and let the upstream
+      // reply, if any, refresh the cache.
+      pending.answered = AnswerWithStale(pending, now);
+      pending.client_deadline = Clock::time_point::max();
+    }
+    if (pending.deadline > now) {
+      ++it;
+      continue;
+    }
+    resolver_->upstream_health_.RecordTimeout(
+        (*pending.upstreams)[pending.upstream], now);
+    if (SendToUpstream(it->first, &pending)) {
+      ++it;
+    } else {
+      FailPendingQuery(pending);
+      it = pending_.erase(it);
+    }
+  }
+}
+
+int LocalResolver::Shard::NextTimeoutMs(Clock::time_point now) const {
+  Clock::time_point earliest = next_persist_;
+  for (const auto& entry : pending_) {
+    earliest = std::min(
+        {earliest, entry.second.deadline, entry.second.client_deadline});
+  }
+  for (const auto& item : client_streams_) {
+    earliest = std::min(earliest, item.second->last_active() +
+                                      std::chrono::milliseconds(
+                                          config_.tcp_idle_timeout_ms));
+  }
+  for (const auto& item : upstream_streams_) {
+    earliest = std::min(earliest, UpstreamStreamDeadline(item.second));
+  }
+  for (const RetiredSocket& socket : retired_sockets_) {
+    earliest = std::min(earliest, socket.close_at);
+  }
+  if (earliest == Clock::time_point::max()) {
+    return -1;
+  }
+  if (earliest <= now) {
+    return 0;
+  }
+  auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+      earliest - now);
+  return static_cast<int>(wait.count()) + 1;
+}
+
+void LocalResolver::Shard::SendServFail(const PendingQuery& pending) {
+  uint8_t response[kMaxUdpMessageSize];
+  std::vector<uint8_t> query = pending.query;
+  SetMessageId(query.data(), pending.client_id);
+  size_t length = BuildErrorResponse(query.data(), query.size(),
+                                     kRcodeServFail, response,
+                                     sizeof(response));
+  if (length > 0) {
+    SendToClient(pending.client, response, length);
+    RecordQuery(pending.cache_key, kRcodeServFail, QuerySource::kFailed,
+                pending.received);
+  }
+}
+
+void LocalResolver::Shard::RecordQuery(const char* name, size_t length,
+                                       uint16_t qtype, uint8_t rcode,
+                                       QuerySource source,
+                                       Clock::time_point received) {
+  if (!query_events_ || !query_events_->enabled()) {
+    return;
+  }
+  QueryEvent* event = query_events_->Reserve();
+  if (event == nullptr) {
+    return;
+  }
+  Clock::time_point now = Clock::now();
+  event->time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  event->latency_us = static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(now - received)
+          .count());
+  event->qtype = qtype;
+  event->rcode = rcode;
+  event->source = source;
+  event->name_length =
+      static_cast<uint8_t>(std::min(length, sizeof(event->name)));
+  memcpy(event->name, name, event->name_length);
+  query_events_->Commit();
+}
+
+void LocalResolver::Shard::RecordQuery(const std::string& key, uint8_t rcode,
+                                       QuerySource source,
+                                       Clock::time_point received) {
+  // The key is the question's type and class followed by its name.
+  RecordQuery(key.data() + 4, key.size() - 4,
+              static_cast<uint16_t>(static_cast<uint8_t>(key[0]) << 8 |
+                                    static_cast<uint8_t>(key[1])),
+              rcode, source, received);
+}
+
+void LocalResolver::Shard::CountWastedPrefetch(void* shard) {
+  Shard* self = static_cast<Shard*>(shard);
+  std::lock_guard<std::mutex> lock(self->stats_mutex_);
+  self->stats_.prefetches_wasted++;
+}
+
+void LocalResolver::PersistCache(const AnswerCache& cache,
+                                 Clock::time_point now, bool wait) {
+  PersistentCacheWriter writer;
+  int64_t wall_now = time(nullptr);
+  auto add = [&](const std::string& key, const AnswerCache::Entry& entry,
+                 const uint8_t* response, size_t length) {
+    if (entry.StaleSeconds(now) <= config_.max_stale_seconds) {
+      writer.Add(key, response, length, wall_now - entry.AgeSeconds(now),
+                 entry.ttl);
+    }
+  };
+  // Every answer any thread has is also in the shared tier.
+  if (shared_cache_) {
+    shared_cache_->ForEach(add);
+  } else {
+    cache.ForEach(add);
+  }
+  // Carry over what the previous run knew and this one has not looked up.
+  if (warm_cache_) {
+    std::lock_guard<std::mutex> lock(warm_cache_mutex_);
+    warm_cache_->ForEach(
+        wall_now, config_.max_stale_seconds,
+        [&](const std::string& key, const PersistentCache::Record& record) {
+          bool known = shared_cache_ ? shared_cache_->Contains(key)
+                                     : cache.Contains(key);
+          if (writer.size() < config_.cache_max_entries && !known) {
+            writer.Add(key, record.response, record.length,
+                       record.stored_wall_seconds, record.ttl);
+          }
+        });
+  }
+
+  // Serialising is cheap; the fsync is not, so it runs off the resolver
+  // threads. Only one write is in flight at a time.
+  if (persist_thread_.joinable()) {
+    persist_thread_.join();
+  }
+  std::vector<uint8_t> image = writer.Build();
+  std::string path = config_.cache_file;
+  persist_thread_ = std::thread([path, image = std::move(image)]() {
+    // A failed write leaves the previous snapshot in place.
+    std::string error;
+    PersistentCacheWriter::Commit(path, image, &error);
+  });
+  if (wait) {
+    persist_thread_.join();
+  }
+}
+
+bool LocalResolver::Shard::AllocateId(uint16_t* id) {
+  // Random IDs make off-path spoofing of upstream answers harder.
+  for (int attempt = 0; attempt < 64; attempt++) {
+    uint16_t candidate = static_cast<uint16_t>(random_());
+    if (pending_.find(candidate) == pending_.end()) {
+      *id = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+LocalResolver::Shard::UpstreamSocket*
+LocalResolver::Shard::UpstreamSocketFor(const SocketAddress& upstream) {
+  size_t first = upstream.family() == AF_INET6 ? kUpstreamSocketsPerFamily : 0;
+  UpstreamSocket& socket =
+      upstream_sockets_[first + random_() % kUpstreamSocketsPerFamily];
+  if (socket.fd >= 0 && socket.queries >= kQueriesPerUpstreamSocket) {
+    // If no new socket can be had, the old one carries on.
+    int fd = OpenUdpSocket(socket.family, nullptr);
+    if (fd >= 0) {
+      // What is queued goes out from the old port, which the answers will
+      // come back to.
+      socket.writer->Flush();
+      RetiredSocket retired;
+      retired.fd = socket.fd;
+      retired.id = socket.id;
+      retired.close_at =
+          Clock::now() +
+          std::chrono::milliseconds(2 * config_.upstream_timeout_ms);
+      retired_sockets_.push_back(retired);
+      socket.fd = fd;
+      socket.id = next_stream_id_++;
+      socket.writer->set_fd(fd);
+      socket.queries = 0;
+    }
+  }
+  socket.queries++;
+  return &socket;
+}
+
+void LocalResolver::Shard::CloseRetiredSockets(Clock::time_point now) {
+  for (size_t i = 0; i < retired_sockets_.size();) {
+    if (retired_sockets_[i].close_at <= now) {
+      CloseFd(&retired_sockets_[i].fd);
+      retired_sockets_[i] = retired_sockets_.back();
+      retired_sockets_.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+void LocalResolver::Shard::FlushDatagrams() {
+  while (true) {
+    for (UpstreamSocket& socket : upstream_sockets_) {
+      socket.writer->Flush();
+      socket.writer->TakeFailed(&failed_sends_);
+    }
+    if (failed_sends_.empty()) {
+      break;
+    }
+    // Sending again queues more; each query runs out of servers eventually.
+    std::vector<uint32_t> failed;
+    failed.swap(failed_sends_);
+    for (uint32_t id : failed) {
+      auto it = pending_.find(static_cast<uint16_t>(id));
+      if (it != pending_.end() && it->second.stream == 0 &&
+          !SendToUpstream(it->first, &it->second)) {
+        FailPendingQuery(it->second);
+        pending_.erase(it);
+      }
+    }
+  }
+  client_writer_.Flush();
+  // A client that cannot be sent to will ask again.
+  client_writer_.TakeFailed(&failed_sends_);
+  failed_sends_.clear();
+}
+
+double LocalResolver::NowSeconds() const {
+  return std::chrono::duration<double>(Clock::now() - start_time_).count();
+}
+
+bool ParseUpstreams(const std::string& text, ResolverConfig* config) {
+  static const char kTlsScheme[] = "tls://";
+  config->upstreams.clear();
+  config->tls_upstreams.clear();
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t comma = text.find(',', start);
+    if (comma == std::string::npos) {
+      comma = text.size();
+    }
+    std::string entry = TrimSpaces(text.substr(start, comma - start));
+    start = comma + 1;
+    if (entry.empty()) {
+      continue;
+    }
+    SocketAddress address;
+    if (entry.compare(0, sizeof(kTlsScheme) - 1, kTlsScheme) != 0) {
+      if (!SocketAddress::Parse(entry, 53, &address)) {
+        return false;
+      }
+      config->upstreams.push_back(address);
+      continue;
+    }
+    entry.erase(0, sizeof(kTlsScheme) - 1);
+    TlsUpstream tls;
+    size_t hash = entry.find('#');
+    if (hash != std::string::npos) {
+      tls.server_name = entry.substr(hash + 1);
+      entry.resize(hash);
+      if (tls.server_name.empty()) {
+        return false;
+      }
+    }
+    if (!SocketAddress::Parse(entry, kTlsPort, &tls.address)) {
+      return false;
+    }
+    config->upstreams.push_back(tls.address);
+    config->tls_upstreams.push_back(std::move(tls));
+  }
+  return !config->upstreams.empty();
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,358 @@
+#ifndef DNS_MANAGER_LOCAL_RESOLVER_H_
+#define DNS_MANAGER_LOCAL_RESOLVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "answer_cache.h"
+#include "blocklist.h"
+#include "domain_trie.h"
+#include "epoch.h"
+#include "host_overrides.h"
+#include "persistent_cache.h"
+#include "query_events.h"
+#include "rate_limiter.h"
+#include "shared_answer_cache.h"
+#include "socket_address.h"
+#include "tls_context.h"
+#include "top_domains.h"
+#include "upstream_health.h"
+
+namespace dns_manager {
+
+// How queries for blocked names are answered.
+enum class BlockingMode : uint8_t {
+  kNxDomain,
+  // 0.0.0.0 for A, :: for AAAA and an empty answer for other types.
+  kNullAddress,
+};
+
+// How a UDP query from a client over its rate limit is answered.
+enum class RateLimitAction : uint8_t {
+  kRefused,
+  // An empty answer with TC set: the client has to retry over TCP, which
+  // slows a retry storm down, and a TCP query over the limit is refused.
+  kTruncated,
+};
+
+// Split DNS: queries for |suffix| and names below it go to |upstreams|
+// instead of the default ones.
+struct DnsRoute {
+  std::string suffix;
+  std::vector<SocketAddress> upstreams;
+};
+
+// An upstream spoken to over DNS-over-TLS (RFC 7858), whose certificate
+// must be for |server_name|, or for its address if the name is empty.
+struct TlsUpstream {
+  SocketAddress address;
+  std::string server_name;
+};
+
+struct ResolverConfig {
+  // Address the resolver listens on; the connection's DNS is pointed here.
+  std::string listen_address = "127.0.0.1";
+  // 0 picks an ephemeral port (used by tests and benchmarks).
+  uint16_t listen_port = 53;
+  // Servers queries are forwarded to, in order of preference.
+  std::vector<SocketAddress> upstreams;
+  // Per-suffix upstreams, installed by Start(); the longest matching suffix
+  // wins. See also LocalResolver::SetRoutes().
+  std::vector<DnsRoute> routes;
+  // How long to wait for an upstream not heard from yet before trying the
+  // next, and the most any upstream is waited for.
+  int upstream_timeout_ms = 1500;
+  // Adaptive upstream selection (see UpstreamHealth): each query goes first
+  // to the server with the lowest timeout derived from its measured round
+  // trips, never below |upstream_min_timeout_ms|, and servers that time out
+  // are held down. False tries the servers in list order, waiting
+  // |upstream_timeout_ms| for each.
+  bool adaptive_upstreams = true;
+  int upstream_min_timeout_ms = 100;
+  // Number of counters in the top-domains sketch.
+  size_t top_domains_capacity = 1024;
+  // Half-life of the exponential decay applied to top-domain counts.
+  double top_domains_half_life_seconds = 600;
+  // Maximum number of cached responses.
+  size_t cache_max_entries = 10000;
+  // Hard cap on the memory all answer caches take together, in bytes. Fewer
+  // than |cache_max_entries| answers are kept if they do not fit.
+  size_t cache_max_bytes = 16 << 20;
+  // Upper bound on how long any response is cached, in seconds.
+  uint32_t cache_max_ttl = 86400;
+  // Refresh-ahead: a cached entry served at least |prefetch_min_hits| times
+  // is re-resolved in the background once no more than |prefetch_fraction|
+  // of its TTL remains. A fraction of 0 disables refresh-ahead.
+  double prefetch_fraction = 0.1;
+  uint32_t prefetch_min_hits = 3;
+  // Negative answers are cached for the SOA-derived TTL (RFC 2308), capped
+  // at this many seconds.
+  uint32_t negative_max_ttl = 10800;
+  // Serve-stale (RFC 8767): when every upstream fails, or none has answered
+  // within |client_response_timeout_ms|, answer from a cache entry that
+  // expired at most |max_stale_seconds| ago, with TTLs of
+  // |stale_answer_ttl|. A |max_stale_seconds| of 0 disables serve-stale.
+  uint32_t max_stale_seconds = 86400;
+  int client_response_timeout_ms = 1800;
+  uint32_t stale_answer_ttl = 30;
+  // Where the cache is snapshotted (see PersistentCache) every
+  // |cache_persist_interval_seconds| and on Stop(). Empty disables
+  // persistence.
+  std::string cache_file;
+  int cache_persist_interval_seconds = 300;
+  // Answer for names on the blocklist (see LocalResolver::SetBlocklist), and
+  // the TTL of synthesised addresses.
+  BlockingMode blocking_mode = BlockingMode::kNxDomain;
+  uint32_t blocked_answer_ttl = 60;
+  // TTL of answers from the host overrides (see
+  // LocalResolver::SetHostOverrides).
+  uint32_t host_override_ttl = 60;
+  // Size of the ring answered client queries are recorded in while query
+  // events are enabled (see LocalResolver::DrainQueryEvents), per thread. 0
+  // records nothing.
+  size_t query_event_capacity = 0;
+  // Resolver threads. Each binds its own socket to the listening address
+  // with SO_REUSEPORT, so the kernel spreads clients across them, and keeps
+  // its own cache of |cache_max_entries| / |threads| answers in front of a
+  // shared tier of |cache_max_entries|; the shared tier gets half of
+  // |cache_max_bytes| and the threads split the rest. 0 starts one per CPU
+  // the process may run on, up to LocalResolver::kMaxThreads.
+  size_t threads = 1;
+  // Pins thread i to the i-th CPU the process may run on.
+  bool pin_threads = false;
+  // Also accept queries over TCP on the listening port (RFC 7766), from at
+  // most |max_tcp_clients| connections per thread, each closed after
+  // |tcp_idle_timeout_ms| without a message.
+  bool tcp = true;
+  size_t max_tcp_clients = 256;
+  int tcp_idle_timeout_ms = 10000;
+  // Queries asked over TCP, answers that came back truncated over UDP and
+  // every query to a TLS upstream are pipelined on connections to the
+  // upstream, kept open this long once nothing is waiting on them. 0 closes
+  // them as soon as they go quiet. Each thread opens at most
+  // |upstream_connections| per upstream, a further one only once the open
+  // ones are busy.
+  int upstream_tcp_idle_timeout_ms = 10000;
+  size_t upstream_connections = 2;
+  // Upstreams, also listed in |upstreams| or a route, that are queried over
+  // TLS instead of UDP (see ParseUpstreams), with certificates checked
+  // against the CA certificates in |tls_ca_file|, or the system's trust
+  // store if it is empty. A new connection resumes the server's last TLS
+  // session.
+  std::vector<TlsUpstream> tls_upstreams;
+  std::string tls_ca_file;
+  // Per-client rate limiting (see RateLimiter), checked before anything
+  // else is done with a query: each client address may send
+  // |rate_limit_qps| queries a second across all threads, UDP and TCP, and
+  // |rate_limit_burst| at once. Queries over the limit get
+  // |rate_limit_action| over UDP and REFUSED over TCP. Up to
+  // |rate_limit_clients| addresses are tracked. A |rate_limit_qps| of 0
+  // disables it.
+  double rate_limit_qps = 0;
+  uint32_t rate_limit_burst = 200;
+  RateLimitAction rate_limit_action = RateLimitAction::kRefused;
+  size_t rate_limit_clients = 4096;
+  // Moves UDP datagrams, to and from clients and upstreams alike, up to
+  // DatagramReader::kBatch per recvmmsg() or sendmmsg() call instead of one
+  // per recvfrom() or sendto(). Kernels without those calls fall back to
+  // one at a time by themselves.
+  bool batch_udp_io = true;
+};
+
+// Parses a comma-separated server list as passed to setDNS into
+// |config->upstreams|. Entries written "tls://1.1.1.1#cloudflare-dns.com",
+// on port 853 unless one is given, are added to |config->tls_upstreams| too,
+// with the part after '#' as the certificate name. Returns false if any
+// entry fails to parse.
+bool ParseUpstreams(const std::string& text, ResolverConfig* config);
+
+struct ResolverStats {
+  uint64_t queries = 0;
+  uint64_t cache_hits = 0;
+  uint64_t cache_misses = 0;
+  // Background refreshes sent upstream.
+  uint64_t prefetches_issued = 0;
+  // Refreshed entries that were served at least once afterwards.
+  uint64_t prefetch_hits = 0;
+  // Refreshed entries evicted, expired or refreshed again without being
+  // served.
+  uint64_t prefetches_wasted = 0;
+  // Cache hits that were NXDOMAIN or NODATA answers.
+  uint64_t negative_cache_hits = 0;
+  // Expired answers served because upstreams failed or were too slow.
+  uint64_t stale_answers_served = 0;
+  // Memory-cache misses answered from the snapshot of a previous run.
+  uint64_t warm_cache_hits = 0;
+  // Misses in a thread's own cache answered from the answers another thread
+  // received (see ResolverConfig::threads).
+  uint64_t shared_cache_hits = 0;
+  // Queries answered locally because the name is on the blocklist.
+  uint64_t blocked_queries = 0;
+  // Queries answered from the host overrides.
+  uint64_t host_override_queries = 0;
+  // Client queries that arrived over TCP.
+  uint64_t tcp_queries = 0;
+  // Queries sent upstream over TCP or TLS, and the connections opened for
+  // them.
+  uint64_t upstream_tcp_queries = 0;
+  uint64_t upstream_tcp_connections = 0;
+  // TLS handshakes with upstreams, and how many resumed an earlier session.
+  uint64_t tls_handshakes = 0;
+  uint64_t tls_resumed_handshakes = 0;
+  // Queries refused or truncated because their client was over its rate
+  // limit.
+  uint64_t rate_limited_queries = 0;
+  // Receive and send calls on UDP sockets, each moving one datagram, or a
+  // batch of them (see ResolverConfig::batch_udp_io).
+  uint64_t udp_syscalls = 0;
+};
+
+// A forwarding resolver hosted inside the plugin, serving clients over UDP
+// and TCP. It runs on its own threads (see ResolverConfig::threads), answers
+// from an AnswerCache where it can, relays other queries over UDP, TCP or
+// TLS to the configured upstreams, or to a split-DNS route's servers for
+// names under its suffix (the fastest healthy server first, moving on to the
+// next on timeout; see UpstreamHealth), and feeds every query name into a
+// TopDomainsSketch.
+// Popular cache entries are refreshed before they expire so hot names never
+// wait for upstream, and expired entries stand in when upstreams are down or
+// slow. With a cache file configured the cache survives restarts: misses
+// fall through to the snapshot left by the previous run. Clients sending
+// faster than a configured rate limit are turned away before any of this.
+class LocalResolver {
+ public:
+  static constexpr size_t kMaxThreads = 32;
+
+  explicit LocalResolver(const ResolverConfig& config);
+  ~LocalResolver();
+
+  LocalResolver(const LocalResolver&) = delete;
+  LocalResolver& operator=(const LocalResolver&) = delete;
+
+  // Binds the sockets and starts the resolver threads. On failure returns
+  // false and sets |error|.
+  bool Start(std::string* error);
+  // Stops the resolver threads and closes the sockets, writing a final cache
+  // snapshot if a cache file is configured. Safe to call twice.
+  void Stop();
+
+  // Snapshot of a previous run to consult on cache misses, typically opened
+  // from |config().cache_file|. Call before Start().
+  void set_warm_cache(std::unique_ptr<PersistentCache> warm_cache) {
+    warm_cache_ = std::move(warm_cache);
+  }
+
+  // Replaces the rules queries are checked against; an empty view turns
+  // blocking off. Queries in flight never wait: the new rules are published
+  // with an atomic swap and the call returns once no query can still see the
+  // old ones, which have then been released. Thread-safe.
+  void SetBlocklist(BlocklistView blocklist);
+
+  // Replaces the host overrides A, AAAA and CNAME queries are answered from
+  // before the blocklist and cache are consulted; nullptr removes them.
+  // Published and released the same way as the blocklist. Thread-safe.
+  void SetHostOverrides(std::shared_ptr<const HostOverrides> overrides);
+
+  // Replaces the split-DNS routes. Queries already sent upstream finish with
+  // the servers they started with and cached answers are kept until they
+  // expire. Returns false and sets |error| if a
+  // suffix is invalid or a route has no servers; the old routes then stay.
+  // Thread-safe.
+  bool SetRoutes(const std::vector<DnsRoute>& routes, std::string* error);
+
+  // Turns recording of answered client queries on or off. Does nothing
+  // without a query event capacity. Thread-safe.
+  void SetQueryEventsEnabled(bool enabled);
+  // Has |callback| called on a resolver thread each time |threshold|
+  // events are waiting there to be drained. Call before Start().
+  void set_query_events_ready(QueryEventRing::ReadyCallback callback,
+                              void* context, size_t threshold);
+  // Moves up to |max_events| recorded events into |batch|, oldest first
+  // across threads, and returns how many. Lock-free with respect to the
+  // resolver threads; one caller at a time.
+  size_t DrainQueryEvents(QueryEventBatch* batch, size_t max_events);
+
+  bool running() const { return running_.load(); }
+  const ResolverConfig& config() const { return config_; }
+  // Resolver threads started, after resolving a |config().threads| of 0.
+  size_t threads() const { return shards_.size(); }
+  // The address actually bound, including the chosen port when the config
+  // asked for port 0.
+  const SocketAddress& bound_address() const { return bound_address_; }
+
+  // The |count| most queried names, most popular first. Thread-safe.
+  std::vector<DomainCount> TopDomains(size_t count) const;
+  // Counters since Start(). Thread-safe.
+  ResolverStats Stats() const;
+  // Round-trip estimates and timeouts of every upstream queried so far.
+  // Thread-safe.
+  std::vector<UpstreamScore> UpstreamScores() const;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  using UpstreamList = std::vector<SocketAddress>;
+
+  // Compiled DnsRoutes: the trie maps a suffix to an index into |upstreams|.
+  struct RouteTable {
+    DomainTrie trie;
+    std::vector<std::shared_ptr<const UpstreamList>> upstreams;
+  };
+
+  // One resolver thread and everything only it touches (local_resolver.cc).
+  class Shard;
+
+  // Writes the cache to |config_.cache_file|. |cache| is the calling
+  // thread's own; with several threads the shared tier is written instead.
+  void PersistCache(const AnswerCache& cache, Clock::time_point now,
+                    bool wait);
+  double NowSeconds() const;
+
+  const ResolverConfig config_;
+  SocketAddress bound_address_;
+  // Wakes every thread for Stop().
+  int wake_fd_ = -1;
+  std::atomic<bool> running_{false};
+  const Clock::time_point start_time_;
+
+  std::unique_ptr<PersistentCache> warm_cache_;
+  // The warm cache validates segments on first use, so lookups are
+  // serialised. They only happen on misses.
+  std::mutex warm_cache_mutex_;
+  // Writes the snapshot built on a resolver thread to disk.
+  std::thread persist_thread_;
+
+  // Answers shared between threads; nullptr with a single thread.
+  std::unique_ptr<SharedAnswerCache> shared_cache_;
+  // Set up by Start() when there are TLS upstreams.
+  std::unique_ptr<TlsContext> tls_;
+
+  // The blocklist and host overrides, read lock-free by the resolver
+  // threads.
+  EpochDomain epochs_;
+  RcuPointer<BlocklistView> blocklist_{&epochs_};
+  RcuPointer<std::shared_ptr<const HostOverrides>> host_overrides_{&epochs_};
+  // Split-DNS routes, read the same way; queries no route covers go to
+  // |default_upstreams_|.
+  RcuPointer<RouteTable> routes_{&epochs_};
+  const std::shared_ptr<const UpstreamList> default_upstreams_;
+  // Shared by the threads, so that one thread's timeouts steer the others
+  // away from a failing server too.
+  UpstreamHealth upstream_health_;
+  // Shared the same way; nullptr without a rate limit.
+  std::unique_ptr<RateLimiter> rate_limiter_;
+
+  // Created with the resolver, so that query event settings apply before
+  // Start(). Each has its own listening socket bound with SO_REUSEPORT,
+  // upstream sockets, cache, statistics and query event ring.
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_LOCAL_RESOLVER_H_
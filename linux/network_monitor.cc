@@ -0,0 +1,486 @@
+#include "network_monitor.h"
+
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace dns_manager {
+
+namespace {
+
+constexpr char kNetworkManager[] = "org.freedesktop.NetworkManager";
+constexpr char kNetworkManagerPath[] = "/org/freedesktop/NetworkManager";
+constexpr char kDeviceInterface[] = "org.freedesktop.NetworkManager.Device";
+constexpr char kActiveInterface[] =
+    "org.freedesktop.NetworkManager.Connection.Active";
+constexpr char kSettingsInterface[] =
+    "org.freedesktop.NetworkManager.Settings.Connection";
+
+// NetworkManager signals arrive in bursts while a connection comes up; one
+// rebuild per burst is enough.
+constexpr guint kRefreshDelayMs = 100;
+constexpr gint kCallTimeoutMs = 2000;
+
+// The a{sv} properties of |interface| on |path|, or nullptr.
+GVariant* GetAllProperties(GDBusConnection* bus, const char* path,
+                           const char* interface) {
+  GVariant* reply = g_dbus_connection_call_sync(
+      bus, kNetworkManager, path, "org.freedesktop.DBus.Properties", "GetAll",
+      g_variant_new("(s)", interface), G_VARIANT_TYPE("(a{sv})"),
+      G_DBUS_CALL_FLAGS_NONE, kCallTimeoutMs, nullptr, nullptr);
+  if (reply == nullptr) {
+    return nullptr;
+  }
+  GVariant* properties = g_variant_get_child_value(reply, 0);
+  g_variant_unref(reply);
+  return properties;
+}
+
+std::string LookupString(GVariant* properties, const char* key) {
+  const gchar* value = nullptr;
+  if (!g_variant_lookup(properties, key, "&s", &value)) {
+    return "";
+  }
+  return value;
+}
+
+uint32_t LookupUint32(GVariant* properties, const char* key) {
+  guint32 value = 0;
+  g_variant_lookup(properties, key, "u", &value);
+  return value;
+}
+
+bool LookupBool(GVariant* properties, const char* key) {
+  gboolean value = FALSE;
+  g_variant_lookup(properties, key, "b", &value);
+  return value;
+}
+
+// An "o" property, or "" if it is missing or "/", which stands for no
+// object.
+std::string LookupPath(GVariant* properties, const char* key) {
+  const gchar* value = nullptr;
+  if (!g_variant_lookup(properties, key, "&o", &value) ||
+      strcmp(value, "/") == 0) {
+    return "";
+  }
+  return value;
+}
+
+// Object paths in an "ao" property. "/" stands for no object and is skipped.
+std::vector<std::string> LookupPaths(GVariant* properties, const char* key) {
+  std::vector<std::string> paths;
+  GVariant* value = g_variant_lookup_value(properties, key,
+                                           G_VARIANT_TYPE_OBJECT_PATH_ARRAY);
+  if (value == nullptr) {
+    return paths;
+  }
+  gsize count = 0;
+  const gchar** array = g_variant_get_objv(value, &count);
+  for (gsize i = 0; i < count; i++) {
+    if (strcmp(array[i], "/") != 0) {
+      paths.push_back(array[i]);
+    }
+  }
+  g_free(array);
+  g_variant_unref(value);
+  return paths;
+}
+
+// Reads the servers of one family from an ipv4 or ipv6 settings group.
+// Recent NetworkManager versions expose them as strings in "dns-data"; older
+// ones only have "dns", as network-order integers for IPv4 and byte arrays
+// for IPv6.
+std::vector<std::string> ServersFrom(GVariant* group, int family) {
+  std::vector<std::string> servers;
+  GVariant* data =
+      g_variant_lookup_value(group, "dns-data", G_VARIANT_TYPE_STRING_ARRAY);
+  if (data != nullptr) {
+    gsize count = 0;
+    const gchar** array = g_variant_get_strv(data, &count);
+    for (gsize i = 0; i < count; i++) {
+      servers.push_back(array[i]);
+    }
+    g_free(array);
+    g_variant_unref(data);
+    return servers;
+  }
+  GVariant* dns = g_variant_lookup_value(
+      group, "dns",
+      family == AF_INET ? G_VARIANT_TYPE("au") : G_VARIANT_TYPE("aay"));
+  if (dns == nullptr) {
+    return servers;
+  }
+  char text[INET6_ADDRSTRLEN];
+  gsize count = g_variant_n_children(dns);
+  for (gsize i = 0; i < count; i++) {
+    GVariant* entry = g_variant_get_child_value(dns, i);
+    if (family == AF_INET) {
+      guint32 address = g_variant_get_uint32(entry);
+      if (inet_ntop(AF_INET, &address, text, sizeof(text)) != nullptr) {
+        servers.push_back(text);
+      }
+    } else {
+      gsize length = 0;
+      const void* bytes = g_variant_get_fixed_array(entry, &length, 1);
+      if (length == 16 &&
+          inet_ntop(AF_INET6, bytes, text, sizeof(text)) != nullptr) {
+        servers.push_back(text);
+      }
+    }
+    g_variant_unref(entry);
+  }
+  g_variant_unref(dns);
+  return servers;
+}
+
+// Fills in the DNS settings of |connection| from its settings profile at
+// |path|.
+void ReadSettings(GDBusConnection* bus, const std::string& path,
+                  NetworkConnection* connection) {
+  GVariant* reply = g_dbus_connection_call_sync(
+      bus, kNetworkManager, path.c_str(), kSettingsInterface, "GetSettings",
+      nullptr, G_VARIANT_TYPE("(a{sa{sv}})"), G_DBUS_CALL_FLAGS_NONE,
+      kCallTimeoutMs, nullptr, nullptr);
+  if (reply == nullptr) {
+    return;
+  }
+  GVariant* settings = g_variant_get_child_value(reply, 0);
+  GVariant* ipv4 =
+      g_variant_lookup_value(settings, "ipv4", G_VARIANT_TYPE_VARDICT);
+  if (ipv4 != nullptr) {
+    connection->ipv4_dns = ServersFrom(ipv4, AF_INET);
+    connection->ipv4_ignore_auto_dns = LookupBool(ipv4, "ignore-auto-dns");
+    g_variant_unref(ipv4);
+  }
+  GVariant* ipv6 =
+      g_variant_lookup_value(settings, "ipv6", G_VARIANT_TYPE_VARDICT);
+  if (ipv6 != nullptr) {
+    connection->ipv6_dns = ServersFrom(ipv6, AF_INET6);
+    connection->ipv6_ignore_auto_dns = LookupBool(ipv6, "ignore-auto-dns");
+    g_variant_unref(ipv6);
+  }
+  connection->has_settings = true;
+  g_variant_unref(settings);
+  g_variant_unref(reply);
+}
+
+// Builds a snapshot from NetworkManager's current state. Returns nullptr if
+// NetworkManager does not answer.
+std::unique_ptr<NetworkSnapshot> TakeSnapshot(GDBusConnection* bus) {
+  GVariant* manager =
+      GetAllProperties(bus, kNetworkManagerPath, kNetworkManager);
+  if (manager == nullptr) {
+    return nullptr;
+  }
+  auto snapshot = std::make_unique<NetworkSnapshot>();
+  snapshot->state = LookupUint32(manager, "State");
+  snapshot->connectivity = LookupUint32(manager, "Connectivity");
+  GVariant* global_dns = g_variant_lookup_value(
+      manager, "GlobalDnsConfiguration", G_VARIANT_TYPE_VARDICT);
+  if (global_dns != nullptr) {
+    snapshot->global_dns = GlobalDnsServers(global_dns);
+    g_variant_unref(global_dns);
+  }
+  std::vector<std::string> device_paths = LookupPaths(manager, "Devices");
+  std::vector<std::string> active_paths =
+      LookupPaths(manager, "ActiveConnections");
+  g_variant_unref(manager);
+
+  // Object paths of each device and of its active connection, to link the
+  // two below.
+  std::vector<std::string> devices_at;
+  std::vector<std::string> device_connections;
+  for (const std::string& path : device_paths) {
+    GVariant* properties =
+        GetAllProperties(bus, path.c_str(), kDeviceInterface);
+    if (properties == nullptr) {
+      // Removed since the list was read.
+      continue;
+    }
+    NetworkDevice device;
+    device.interface = LookupString(properties, "Interface");
+    device.type = LookupUint32(properties, "DeviceType");
+    device.state = LookupUint32(properties, "State");
+    devices_at.push_back(path);
+    device_connections.push_back(LookupPath(properties, "ActiveConnection"));
+    g_variant_unref(properties);
+    snapshot->devices.push_back(std::move(device));
+  }
+
+  for (const std::string& path : active_paths) {
+    GVariant* active = GetAllProperties(bus, path.c_str(), kActiveInterface);
+    if (active == nullptr) {
+      continue;
+    }
+    NetworkConnection connection;
+    connection.id = LookupString(active, "Id");
+    connection.uuid = LookupString(active, "Uuid");
+    connection.type = LookupString(active, "Type");
+    connection.state = LookupUint32(active, "State");
+    connection.is_default =
+        LookupBool(active, "Default") || LookupBool(active, "Default6");
+    std::vector<std::string> devices = LookupPaths(active, "Devices");
+    std::string settings_path = LookupPath(active, "Connection");
+    g_variant_unref(active);
+
+    for (size_t i = 0; i < devices_at.size(); i++) {
+      if (std::find(devices.begin(), devices.end(), devices_at[i]) !=
+          devices.end()) {
+        connection.devices.push_back(snapshot->devices[i].interface);
+      }
+      if (device_connections[i] == path) {
+        snapshot->devices[i].connection_uuid = connection.uuid;
+      }
+    }
+    if (!settings_path.empty()) {
+      ReadSettings(bus, settings_path, &connection);
+    }
+    snapshot->connections.push_back(std::move(connection));
+  }
+  return snapshot;
+}
+
+// A read or change of the global DNS configuration waiting on the system
+// bus, then on NetworkManager. |configuration| is nullptr for a read.
+struct GlobalDnsCall {
+  GVariant* configuration;
+  GlobalDnsCallback changed;
+  GlobalDnsReadCallback read;
+  void* context;
+};
+
+void FinishGlobalDnsCall(GlobalDnsCall* call, GVariant* reply,
+                         GError* failure) {
+  std::string error = failure != nullptr ? failure->message : "";
+  if (call->configuration != nullptr) {
+    call->changed(error, call->context);
+    g_variant_unref(call->configuration);
+  } else {
+    std::vector<std::string> servers;
+    if (reply != nullptr) {
+      GVariant* configuration = nullptr;
+      g_variant_get(reply, "(v)", &configuration);
+      servers = GlobalDnsServers(configuration);
+      g_variant_unref(configuration);
+    }
+    call->read(servers, error, call->context);
+  }
+  if (reply != nullptr) {
+    g_variant_unref(reply);
+  }
+  if (failure != nullptr) {
+    g_error_free(failure);
+  }
+  delete call;
+}
+
+void GlobalDnsReplied(GObject* bus, GAsyncResult* result, gpointer data) {
+  GError* failure = nullptr;
+  GVariant* reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(bus),
+                                                  result, &failure);
+  FinishGlobalDnsCall(static_cast<GlobalDnsCall*>(data), reply, failure);
+}
+
+void SystemBusReady(GObject* source, GAsyncResult* result, gpointer data) {
+  GlobalDnsCall* call = static_cast<GlobalDnsCall*>(data);
+  GError* failure = nullptr;
+  GDBusConnection* bus = g_bus_get_finish(result, &failure);
+  if (bus == nullptr) {
+    FinishGlobalDnsCall(call, nullptr, failure);
+    return;
+  }
+  if (call->configuration != nullptr) {
+    g_dbus_connection_call(
+        bus, kNetworkManager, kNetworkManagerPath,
+        "org.freedesktop.DBus.Properties", "Set",
+        g_variant_new("(ssv)", kNetworkManager, "GlobalDnsConfiguration",
+                      call->configuration),
+        nullptr, G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+        kGlobalDnsTimeoutMs, nullptr, GlobalDnsReplied, call);
+  } else {
+    g_dbus_connection_call(
+        bus, kNetworkManager, kNetworkManagerPath,
+        "org.freedesktop.DBus.Properties", "Get",
+        g_variant_new("(ss)", kNetworkManager, "GlobalDnsConfiguration"),
+        G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, kCallTimeoutMs,
+        nullptr, GlobalDnsReplied, call);
+  }
+  g_object_unref(bus);
+}
+
+}  // namespace
+
+GVariant* GlobalDnsConfiguration(const std::vector<std::string>& servers) {
+  GVariantBuilder configuration;
+  g_variant_builder_init(&configuration, G_VARIANT_TYPE_VARDICT);
+  if (!servers.empty()) {
+    // {"domains": {"*": {"servers": [...]}}}, "*" standing for every domain
+    // without a more specific entry.
+    GVariantBuilder list;
+    g_variant_builder_init(&list, G_VARIANT_TYPE_STRING_ARRAY);
+    for (const std::string& server : servers) {
+      g_variant_builder_add(&list, "s", server.c_str());
+    }
+    GVariantBuilder domain;
+    g_variant_builder_init(&domain, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&domain, "{sv}", "servers",
+                          g_variant_builder_end(&list));
+    GVariantBuilder domains;
+    g_variant_builder_init(&domains, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&domains, "{sv}", "*",
+                          g_variant_builder_end(&domain));
+    g_variant_builder_add(&configuration, "{sv}", "domains",
+                          g_variant_builder_end(&domains));
+  }
+  return g_variant_ref_sink(g_variant_builder_end(&configuration));
+}
+
+std::vector<std::string> GlobalDnsServers(GVariant* configuration) {
+  std::vector<std::string> servers;
+  GVariant* domains = g_variant_lookup_value(configuration, "domains",
+                                             G_VARIANT_TYPE_VARDICT);
+  if (domains == nullptr) {
+    return servers;
+  }
+  GVariant* domain =
+      g_variant_lookup_value(domains, "*", G_VARIANT_TYPE_VARDICT);
+  g_variant_unref(domains);
+  if (domain == nullptr) {
+    return servers;
+  }
+  GVariant* list = g_variant_lookup_value(domain, "servers",
+                                          G_VARIANT_TYPE_STRING_ARRAY);
+  g_variant_unref(domain);
+  if (list == nullptr) {
+    return servers;
+  }
+  gsize count = 0;
+  const gchar** array = g_variant_get_strv(list, &count);
+  servers.assign(array, array + count);
+  g_free(array);
+  g_variant_unref(list);
+  return servers;
+}
+
+void SetGlobalDns(const std::vector<std::string>& servers,
+                  GlobalDnsCallback done, void* context) {
+  GlobalDnsCall* call = new GlobalDnsCall{GlobalDnsConfiguration(servers),
+                                          done, nullptr, context};
+  g_bus_get(G_BUS_TYPE_SYSTEM, nullptr, SystemBusReady, call);
+}
+
+void GetGlobalDns(GlobalDnsReadCallback done, void* context) {
+  GlobalDnsCall* call = new GlobalDnsCall{nullptr, nullptr, done, context};
+  g_bus_get(G_BUS_TYPE_SYSTEM, nullptr, SystemBusReady, call);
+}
+
+NetworkMonitor::NetworkMonitor() = default;
+
+NetworkMonitor::~NetworkMonitor() { Stop(); }
+
+void NetworkMonitor::Start() {
+  if (thread_.joinable()) {
+    return;
+  }
+  context_ = g_main_context_new();
+  loop_ = g_main_loop_new(context_, FALSE);
+  thread_ = std::thread(&NetworkMonitor::Run, this);
+}
+
+void NetworkMonitor::Stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  // Quitting from a source on the monitor's own context cannot race with
+  // the loop starting up.
+  GSource* source = g_idle_source_new();
+  g_source_set_callback(source, OnStop, this, nullptr);
+  g_source_attach(source, context_);
+  g_source_unref(source);
+  thread_.join();
+  g_main_loop_unref(loop_);
+  g_main_context_unref(context_);
+  loop_ = nullptr;
+  context_ = nullptr;
+  snapshot_.Publish(nullptr);
+}
+
+void NetworkMonitor::Run() {
+  g_main_context_push_thread_default(context_);
+  bus_ = g_bus_get_sync(G_BUS_TYPE_SYSTEM, nullptr, nullptr);
+  guint changes = 0;
+  guint owner = 0;
+  if (bus_ != nullptr) {
+    // Device, connection and settings changes all come from
+    // NetworkManager; a restart of the daemon shows up as an owner change.
+    changes = g_dbus_connection_signal_subscribe(
+        bus_, kNetworkManager, nullptr, nullptr, nullptr, nullptr,
+        G_DBUS_SIGNAL_FLAGS_NONE, OnSignal, this, nullptr);
+    owner = g_dbus_connection_signal_subscribe(
+        bus_, "org.freedesktop.DBus", "org.freedesktop.DBus",
+        "NameOwnerChanged", "/org/freedesktop/DBus", kNetworkManager,
+        G_DBUS_SIGNAL_FLAGS_NONE, OnSignal, this, nullptr);
+    Refresh();
+  }
+
+  g_main_loop_run(loop_);
+
+  if (refresh_source_ != nullptr) {
+    g_source_destroy(refresh_source_);
+    g_source_unref(refresh_source_);
+    refresh_source_ = nullptr;
+  }
+  if (bus_ != nullptr) {
+    g_dbus_connection_signal_unsubscribe(bus_, changes);
+    g_dbus_connection_signal_unsubscribe(bus_, owner);
+    g_object_unref(bus_);
+    bus_ = nullptr;
+  }
+  g_main_context_pop_thread_default(context_);
+}
+
+void NetworkMonitor::Refresh() {
+  std::unique_ptr<NetworkSnapshot> snapshot = TakeSnapshot(bus_);
+  if (snapshot) {
+    snapshot->generation = ++generation_;
+  }
+  snapshot_.Publish(std::move(snapshot));
+  if (change_callback_ != nullptr) {
+    change_callback_(change_context_);
+  }
+}
+
+void NetworkMonitor::ScheduleRefresh() {
+  if (refresh_source_ != nullptr) {
+    return;
+  }
+  refresh_source_ = g_timeout_source_new(kRefreshDelayMs);
+  g_source_set_callback(refresh_source_, OnRefreshDue, this, nullptr);
+  g_source_attach(refresh_source_, context_);
+}
+
+void NetworkMonitor::OnSignal(GDBusConnection* connection,
+                              const gchar* sender, const gchar* path,
+                              const gchar* interface, const gchar* signal,
+                              GVariant* parameters, gpointer monitor) {
+  static_cast<NetworkMonitor*>(monitor)->ScheduleRefresh();
+}
+
+gboolean NetworkMonitor::OnRefreshDue(gpointer data) {
+  auto* monitor = static_cast<NetworkMonitor*>(data);
+  g_source_unref(monitor->refresh_source_);
+  monitor->refresh_source_ = nullptr;
+  monitor->Refresh();
+  return G_SOURCE_REMOVE;
+}
+
+gboolean NetworkMonitor::OnStop(gpointer data) {
+  g_main_loop_quit(static_cast<NetworkMonitor*>(data)->loop_);
+  return G_SOURCE_REMOVE;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,115 @@
+#ifndef DNS_MANAGER_NETWORK_MONITOR_H_
+#define DNS_MANAGER_NETWORK_MONITOR_H_
+
+#include <gio/gio.h>
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "epoch.h"
+#include "network_snapshot.h"
+
+namespace dns_manager {
+
+// NetworkManager's GlobalDnsConfiguration value sending every domain to
+// |servers|, or with none the empty value that clears it. Returns a full
+// reference.
+GVariant* GlobalDnsConfiguration(const std::vector<std::string>& servers);
+// The servers a GlobalDnsConfiguration value sends every domain to.
+std::vector<std::string> GlobalDnsServers(GVariant* configuration);
+
+// Called once NetworkManager has answered a global DNS change, with an
+// empty |error| if it took it.
+typedef void (*GlobalDnsCallback)(const std::string& error, void* context);
+
+// Sets NetworkManager's GlobalDnsConfiguration to send every domain to
+// |servers|, or clears it with none. It applies to all connections, present
+// and future, without touching their profiles or restarting them. Returns at
+// once; |done| runs on the calling thread's default main context when
+// NetworkManager answers, which may take a polkit prompt, or after
+// kGlobalDnsTimeoutMs. On failure, e.g. when polkit denies it or
+// NetworkManager.conf fixes the global DNS settings, |error| says why.
+constexpr int kGlobalDnsTimeoutMs = 60000;
+void SetGlobalDns(const std::vector<std::string>& servers,
+                  GlobalDnsCallback done, void* context);
+
+// Called with the servers of NetworkManager's global DNS configuration, or
+// with a non-empty |error| if they could not be read.
+typedef void (*GlobalDnsReadCallback)(const std::vector<std::string>& servers,
+                                      const std::string& error, void* context);
+
+// Reads the servers of NetworkManager's GlobalDnsConfiguration, for when
+// there is no snapshot to take them from. Returns at once; |done| runs on the
+// calling thread's default main context within two seconds.
+void GetGlobalDns(GlobalDnsReadCallback done, void* context);
+
+// Keeps a NetworkSnapshot up to date on a background thread.
+//
+// The thread talks to NetworkManager over D-Bus, rebuilds the snapshot when
+// NetworkManager signals a change (coalescing bursts of signals) and
+// publishes it with an atomic pointer swap, so reading it from the main
+// thread never runs a subprocess or waits on D-Bus.
+class NetworkMonitor {
+ public:
+  using ChangeCallback = void (*)(void* context);
+
+  NetworkMonitor();
+  ~NetworkMonitor();
+
+  NetworkMonitor(const NetworkMonitor&) = delete;
+  NetworkMonitor& operator=(const NetworkMonitor&) = delete;
+
+  // Called on the monitor thread after each new snapshot is published. Set
+  // before Start().
+  void set_change_callback(ChangeCallback callback, void* context) {
+    change_callback_ = callback;
+    change_context_ = context;
+  }
+
+  // Starts the monitor thread, which takes the first snapshot straight
+  // away. Returns without waiting for it.
+  void Start();
+  void Stop();
+
+  // Calls |visit| with the current snapshot, or with nullptr before the
+  // first one is ready or while NetworkManager is unreachable. The snapshot
+  // is only valid inside |visit|. Main thread only.
+  template <typename Visitor>
+  void Read(Visitor visit) {
+    EpochDomain::ReadSection read(&main_reader_);
+    visit(snapshot_.Load());
+  }
+
+ private:
+  void Run();
+  // Rebuilds and publishes the snapshot; publishes nullptr if
+  // NetworkManager cannot be reached.
+  void Refresh();
+  void ScheduleRefresh();
+  static void OnSignal(GDBusConnection* connection, const gchar* sender,
+                       const gchar* path, const gchar* interface,
+                       const gchar* signal, GVariant* parameters,
+                       gpointer monitor);
+  static gboolean OnRefreshDue(gpointer monitor);
+  static gboolean OnStop(gpointer monitor);
+
+  std::thread thread_;
+  // Owned by the monitor thread while it runs.
+  GMainContext* context_ = nullptr;
+  GMainLoop* loop_ = nullptr;
+  GDBusConnection* bus_ = nullptr;
+  GSource* refresh_source_ = nullptr;
+  uint64_t generation_ = 0;
+  ChangeCallback change_callback_ = nullptr;
+  void* change_context_ = nullptr;
+
+  EpochDomain epochs_;
+  RcuPointer<NetworkSnapshot> snapshot_{&epochs_};
+  EpochDomain::Reader main_reader_{&epochs_};
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_NETWORK_MONITOR_H_
@@ -0,0 +1,133 @@
+#include "network_snapshot.h"
+
+#include <algorithm>
+
+namespace dns_manager {
+
+const NetworkConnection* NetworkSnapshot::PrimaryConnection(
+    const std::string& default_interface) const {
+  if (!default_interface.empty()) {
+    for (const NetworkConnection& connection : connections) {
+      if (std::find(connection.devices.begin(), connection.devices.end(),
+                    default_interface) != connection.devices.end()) {
+        return &connection;
+      }
+    }
+  }
+  for (const char* type : {"802-3-ethernet", "802-11-wireless"}) {
+    for (const NetworkConnection& connection : connections) {
+      if (connection.type == type) {
+        return &connection;
+      }
+    }
+  }
+  return nullptr;
+}
+
+const char* NetworkStateName(uint32_t state) {
+  switch (state) {
+    case 10:
+      return "asleep";
+    case 20:
+      return "disconnected";
+    case 30:
+      return "disconnecting";
+    case 40:
+      return "connecting";
+    case 50:
+      return "connected (local only)";
+    case 60:
+      return "connected (site only)";
+    case 70:
+      return "connected";
+    default:
+      return "unknown";
+  }
+}
+
+const char* ConnectivityName(uint32_t connectivity) {
+  switch (connectivity) {
+    case 1:
+      return "none";
+    case 2:
+      return "portal";
+    case 3:
+      return "limited";
+    case 4:
+      return "full";
+    default:
+      return "unknown";
+  }
+}
+
+const char* DeviceTypeName(uint32_t type) {
+  switch (type) {
+    case 1:
+      return "ethernet";
+    case 2:
+      return "wifi";
+    case 5:
+      return "bt";
+    case 8:
+      return "gsm";
+    case 10:
+      return "bond";
+    case 11:
+      return "vlan";
+    case 13:
+      return "bridge";
+    case 14:
+      return "generic";
+    case 16:
+      return "tun";
+    case 29:
+      return "wireguard";
+    case 32:
+      return "loopback";
+    default:
+      return "unknown";
+  }
+}
+
+const char* DeviceStateName(uint32_t state) {
+  switch (state) {
+    case 10:
+      return "unmanaged";
+    case 20:
+      return "unavailable";
+    case 30:
+      return "disconnected";
+    case 40:
+    case 50:
+    case 60:
+    case 70:
+    case 80:
+    case 90:
+      return "connecting";
+    case 100:
+      return "connected";
+    case 110:
+      return "deactivating";
+    case 120:
+      return "failed";
+    default:
+      return "unknown";
+  }
+}
+
+const char* ConnectionStateName(uint32_t state) {
+  switch (state) {
+    case 1:
+      return "activating";
+    case 2:
+      return "activated";
+    case 3:
+      return "deactivating";
+    case 4:
+      return "deactivated";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace dns_manager
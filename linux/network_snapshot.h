@@ -0,0 +1,70 @@
+#ifndef DNS_MANAGER_NETWORK_SNAPSHOT_H_
+#define DNS_MANAGER_NETWORK_SNAPSHOT_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+
+struct NetworkDevice {
+  std::string interface;
+  // NMDeviceType and NMDeviceState values.
+  uint32_t type = 0;
+  uint32_t state = 0;
+  // UUID of the connection active on the device, empty if none.
+  std::string connection_uuid;
+};
+
+// An active NetworkManager connection and the DNS settings of its profile.
+struct NetworkConnection {
+  std::string id;
+  std::string uuid;
+  // Setting type, e.g. "802-3-ethernet", "802-11-wireless" or "vpn".
+  std::string type;
+  std::vector<std::string> devices;
+  // NMActiveConnectionState value.
+  uint32_t state = 0;
+  // Whether it holds the default IPv4 or IPv6 route.
+  bool is_default = false;
+  // Whether the DNS settings below could be read from the profile.
+  bool has_settings = false;
+  std::vector<std::string> ipv4_dns;
+  std::vector<std::string> ipv6_dns;
+  bool ipv4_ignore_auto_dns = false;
+  bool ipv6_ignore_auto_dns = false;
+};
+
+// NetworkManager's view of the machine at one point in time. Immutable once
+// published.
+struct NetworkSnapshot {
+  // NMState and NMConnectivityState values.
+  uint32_t state = 0;
+  uint32_t connectivity = 0;
+  // Servers NetworkManager's GlobalDnsConfiguration sends every domain to,
+  // empty if it has none. They take precedence over every connection's.
+  std::vector<std::string> global_dns;
+  std::vector<NetworkDevice> devices;
+  std::vector<NetworkConnection> connections;
+  // Counts rebuilds since the monitor started.
+  uint64_t generation = 0;
+
+  // The connection the DNS methods act on: the one active on
+  // |default_interface|, the interface holding the default route, if any;
+  // otherwise the first active ethernet connection, else the first Wi-Fi
+  // one. nullptr if there is none of these.
+  const NetworkConnection* PrimaryConnection(
+      const std::string& default_interface) const;
+};
+
+// Names of NetworkManager's enum values as nmcli prints them, e.g.
+// "connected (site only)" for NM_STATE_CONNECTED_SITE or "activated".
+const char* NetworkStateName(uint32_t state);
+const char* ConnectivityName(uint32_t connectivity);
+const char* DeviceTypeName(uint32_t type);
+const char* DeviceStateName(uint32_t state);
+const char* ConnectionStateName(uint32_t state);
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_NETWORK_SNAPSHOT_H_
@@ -0,0 +1,331 @@
+#include "persistent_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#include "checksum.h"
+#include "file_util.h"
+#include "hash.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr char kFileMagic[8] = {'D', 'N', 'S', 'M', 'C', 'C', 'H', '\0'};
+constexpr uint32_t kSegmentMagic = 0x53434d44;  // "DMCS"
+// Aim for this many records per segment so a corrupt segment loses little
+// and checking one on first access stays cheap.
+constexpr size_t kRecordsPerSegment = 32;
+constexpr uint32_t kMaxSegments = 1u << 20;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t segment_count;
+  int64_t created_wall_seconds;
+  // CRC-32C of this header with |crc| zeroed. Directory entries are checked
+  // with the segment they point to, so that Open() stays O(1).
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t record_count;
+  uint32_t payload_bytes;
+  // CRC-32C of the payload.
+  uint32_t crc;
+};
+
+struct RecordHeader {
+  int64_t stored_wall_seconds;
+  uint32_t ttl;
+  uint16_t key_length;
+  uint16_t response_length;
+};
+
+static_assert(sizeof(FileHeader) == 32, "unexpected FileHeader padding");
+static_assert(sizeof(SegmentHeader) == 16, "unexpected SegmentHeader padding");
+static_assert(sizeof(RecordHeader) == 16, "unexpected RecordHeader padding");
+
+size_t AlignUp(size_t value) { return (value + 7) & ~static_cast<size_t>(7); }
+
+unsigned Log2(size_t power_of_two) {
+  unsigned bits = 0;
+  while ((static_cast<size_t>(1) << bits) < power_of_two) {
+    bits++;
+  }
+  return bits;
+}
+
+// Segments are picked by the top bits of the hash; a shift of 64 means a
+// single segment.
+size_t SegmentFor(uint64_t hash, unsigned shift) {
+  return shift >= 64 ? 0 : static_cast<size_t>(hash >> shift);
+}
+
+uint32_t HeaderCrc(FileHeader header) {
+  header.crc = 0;
+  return Crc32c(&header, sizeof(header));
+}
+
+template <typename T>
+void Append(std::vector<uint8_t>* out, const T& value) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+  out->insert(out->end(), bytes, bytes + sizeof(value));
+}
+
+}  // namespace
+
+std::unique_ptr<PersistentCache> PersistentCache::Open(const std::string& path,
+                                                       std::string* error) {
+  std::unique_ptr<MappedFile> file = MappedFile::Open(path, error);
+  if (!file) {
+    return nullptr;
+  }
+
+  FileHeader header;
+  const char* problem = nullptr;
+  if (file->size() < sizeof(header)) {
+    problem = "truncated header";
+  } else {
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0) {
+      problem = "not a resolver cache file";
+    } else if (header.version != kVersion) {
+      problem = "unsupported cache version";
+    } else if (header.segment_count == 0 ||
+               header.segment_count > kMaxSegments ||
+               (header.segment_count & (header.segment_count - 1)) != 0 ||
+               file->size() < sizeof(header) +
+                                  header.segment_count * sizeof(uint64_t)) {
+      problem = "bad segment directory";
+    } else if (HeaderCrc(header) != header.crc) {
+      problem = "header checksum mismatch";
+    }
+  }
+  if (problem != nullptr) {
+    *error = path + ": " + problem;
+    return nullptr;
+  }
+  size_t segment_count = header.segment_count;
+  return std::unique_ptr<PersistentCache>(
+      new PersistentCache(std::move(file), segment_count));
+}
+
+PersistentCache::PersistentCache(std::unique_ptr<MappedFile> file,
+                                 size_t segment_count)
+    : file_(std::move(file)),
+      data_(file_->data()),
+      size_(file_->size()),
+      segment_state_(segment_count, SegmentState::kUnchecked),
+      segment_shift_(64 - Log2(segment_count)) {}
+
+PersistentCache::~PersistentCache() = default;
+
+size_t PersistentCache::corrupt_segments() const {
+  return std::count(segment_state_.begin(), segment_state_.end(),
+                    SegmentState::kCorrupt);
+}
+
+const uint8_t* PersistentCache::SegmentAt(size_t segment) const {
+  uint64_t offset;
+  memcpy(&offset, data_ + sizeof(FileHeader) + segment * sizeof(uint64_t),
+         sizeof(offset));
+  return data_ + offset;
+}
+
+bool PersistentCache::CheckSegment(size_t segment) {
+  if (segment_state_[segment] != SegmentState::kUnchecked) {
+    return segment_state_[segment] == SegmentState::kValid;
+  }
+  segment_state_[segment] = SegmentState::kCorrupt;
+
+  uint64_t offset;
+  memcpy(&offset, data_ + sizeof(FileHeader) + segment * sizeof(uint64_t),
+         sizeof(offset));
+  SegmentHeader header;
+  if (offset % 8 != 0 || offset > size_ || size_ - offset < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, data_ + offset, sizeof(header));
+  const uint8_t* payload = data_ + offset + sizeof(header);
+  size_t index_bytes =
+      AlignUp(static_cast<size_t>(header.record_count) * 12);
+  if (header.magic != kSegmentMagic ||
+      header.payload_bytes > size_ - offset - sizeof(header) ||
+      index_bytes > header.payload_bytes ||
+      Crc32c(payload, header.payload_bytes) != header.crc) {
+    return false;
+  }
+  segment_state_[segment] = SegmentState::kValid;
+  return true;
+}
+
+size_t PersistentCache::RecordCount(size_t segment) {
+  if (!CheckSegment(segment)) {
+    return 0;
+  }
+  SegmentHeader header;
+  memcpy(&header, SegmentAt(segment), sizeof(header));
+  return header.record_count;
+}
+
+bool PersistentCache::ReadRecord(size_t segment, size_t index,
+                                 int64_t now_wall_seconds,
+                                 uint32_t max_stale_seconds, std::string* key,
+                                 Record* record) const {
+  SegmentHeader header;
+  memcpy(&header, SegmentAt(segment), sizeof(header));
+  const uint8_t* payload = SegmentAt(segment) + sizeof(header);
+  uint32_t record_offset;
+  memcpy(&record_offset,
+         payload + header.record_count * sizeof(uint64_t) +
+             index * sizeof(uint32_t),
+         sizeof(record_offset));
+
+  // The checksum matched, but the writer could still have been buggy.
+  RecordHeader record_header;
+  if (record_offset > header.payload_bytes ||
+      header.payload_bytes - record_offset < sizeof(record_header)) {
+    return false;
+  }
+  memcpy(&record_header, payload + record_offset, sizeof(record_header));
+  const uint8_t* record_key = payload + record_offset + sizeof(record_header);
+  if (header.payload_bytes - record_offset - sizeof(record_header) <
+      static_cast<size_t>(record_header.key_length) +
+          record_header.response_length) {
+    return false;
+  }
+
+  // TTLs are checked against wall-clock time only now, on first use.
+  int64_t age = std::max<int64_t>(
+      now_wall_seconds - record_header.stored_wall_seconds, 0);
+  if (age > static_cast<int64_t>(record_header.ttl) + max_stale_seconds) {
+    return false;
+  }
+  key->assign(reinterpret_cast<const char*>(record_key),
+              record_header.key_length);
+  record->response = record_key + record_header.key_length;
+  record->length = record_header.response_length;
+  record->stored_wall_seconds = record_header.stored_wall_seconds;
+  record->ttl = record_header.ttl;
+  return true;
+}
+
+bool PersistentCache::Find(const std::string& key, int64_t now_wall_seconds,
+                           uint32_t max_stale_seconds, Record* record) {
+  uint64_t hash = HashBytes(key.data(), key.size());
+  size_t segment = SegmentFor(hash, segment_shift_);
+  size_t count = RecordCount(segment);
+  if (count == 0) {
+    return false;
+  }
+
+  const uint64_t* hashes = reinterpret_cast<const uint64_t*>(
+      SegmentAt(segment) + sizeof(SegmentHeader));
+  const uint64_t* it = std::lower_bound(hashes, hashes + count, hash);
+  std::string record_key;
+  for (; it != hashes + count && *it == hash; ++it) {
+    if (ReadRecord(segment, it - hashes, now_wall_seconds, max_stale_seconds,
+                   &record_key, record) &&
+        record_key == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PersistentCacheWriter::Add(const std::string& key,
+                                const uint8_t* response, size_t length,
+                                int64_t stored_wall_seconds, uint32_t ttl) {
+  if (key.size() > UINT16_MAX || length > UINT16_MAX) {
+    return;
+  }
+  PendingRecord record;
+  record.hash = HashBytes(key.data(), key.size());
+  record.key = key;
+  record.response.assign(response, response + length);
+  record.stored_wall_seconds = stored_wall_seconds;
+  record.ttl = ttl;
+  records_.push_back(std::move(record));
+}
+
+std::vector<uint8_t> PersistentCacheWriter::Build() const {
+  size_t segment_count = 1;
+  while (segment_count * kRecordsPerSegment < records_.size() &&
+         segment_count < kMaxSegments) {
+    segment_count *= 2;
+  }
+  unsigned shift = 64 - Log2(segment_count);
+
+  std::vector<const PendingRecord*> sorted;
+  sorted.reserve(records_.size());
+  for (const PendingRecord& record : records_) {
+    sorted.push_back(&record);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            [](const PendingRecord* a, const PendingRecord* b) {
+              return a->hash < b->hash;
+            });
+
+  std::vector<uint8_t> image(sizeof(FileHeader) +
+                             segment_count * sizeof(uint64_t));
+  size_t next = 0;
+  for (size_t segment = 0; segment < segment_count; segment++) {
+    size_t first = next;
+    while (next < sorted.size() &&
+           SegmentFor(sorted[next]->hash, shift) == segment) {
+      next++;
+    }
+    size_t count = next - first;
+
+    std::vector<uint8_t> payload;
+    for (size_t i = first; i < next; i++) {
+      Append(&payload, sorted[i]->hash);
+    }
+    size_t offsets_at = payload.size();
+    payload.resize(AlignUp(payload.size() + count * sizeof(uint32_t)));
+    for (size_t i = first; i < next; i++) {
+      const PendingRecord& record = *sorted[i];
+      uint32_t record_offset = static_cast<uint32_t>(payload.size());
+      memcpy(payload.data() + offsets_at + (i - first) * sizeof(uint32_t),
+             &record_offset, sizeof(record_offset));
+      RecordHeader header = {record.stored_wall_seconds, record.ttl,
+                             static_cast<uint16_t>(record.key.size()),
+                             static_cast<uint16_t>(record.response.size())};
+      Append(&payload, header);
+      payload.insert(payload.end(), record.key.begin(), record.key.end());
+      payload.insert(payload.end(), record.response.begin(),
+                     record.response.end());
+      payload.resize(AlignUp(payload.size()));
+    }
+
+    uint64_t offset = image.size();
+    memcpy(image.data() + sizeof(FileHeader) + segment * sizeof(uint64_t),
+           &offset, sizeof(offset));
+    SegmentHeader header = {kSegmentMagic, static_cast<uint32_t>(count),
+                            static_cast<uint32_t>(payload.size()),
+                            Crc32c(payload.data(), payload.size())};
+    Append(&image, header);
+    image.insert(image.end(), payload.begin(), payload.end());
+  }
+
+  FileHeader header = {};
+  memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+  header.version = PersistentCache::kVersion;
+  header.segment_count = static_cast<uint32_t>(segment_count);
+  header.created_wall_seconds = time(nullptr);
+  header.crc = HeaderCrc(header);
+  memcpy(image.data(), &header, sizeof(header));
+  return image;
+}
+
+bool PersistentCacheWriter::Commit(const std::string& path,
+                                   const std::vector<uint8_t>& image,
+                                   std::string* error) {
+  return WriteFileAtomically(path, image.data(), image.size(), error);
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,137 @@
+#ifndef DNS_MANAGER_PERSISTENT_CACHE_H_
+#define DNS_MANAGER_PERSISTENT_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+
+class MappedFile;
+
+// On-disk snapshot of the resolver's answer cache, read through mmap so a
+// restarted plugin can answer from it immediately.
+//
+// File layout (version 1; integers in host byte order, since the file never
+// leaves the machine that wrote it):
+//
+//   FileHeader        magic, version, segment count, header CRC
+//   uint64_t[count]   offset of each segment
+//   Segment...        SegmentHeader, then the segment payload:
+//                       uint64_t hashes[records]   sorted
+//                       uint32_t offsets[records]  into the payload
+//                       records, each a RecordHeader + key + response,
+//                       padded to 8 bytes
+//
+// A record lives in the segment selected by the top bits of its key hash.
+// Open() checks only the fixed-size header, so loading costs the same for
+// any number of records. Each segment carries its own CRC-32C,
+// which is verified the first time a lookup touches that segment; a corrupt
+// segment only loses its own records. Writes go to a temporary file that is
+// fsynced and renamed over the old one, so a crash leaves either the old or
+// the new snapshot.
+class PersistentCache {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  struct Record {
+    const uint8_t* response = nullptr;
+    size_t length = 0;
+    // Wall-clock time the response was received, in seconds since the epoch.
+    int64_t stored_wall_seconds = 0;
+    uint32_t ttl = 0;
+  };
+
+  // Maps |path|. Returns nullptr and sets |error| if the file is missing, has
+  // a different version or a corrupt header.
+  static std::unique_ptr<PersistentCache> Open(const std::string& path,
+                                               std::string* error);
+
+  ~PersistentCache();
+
+  PersistentCache(const PersistentCache&) = delete;
+  PersistentCache& operator=(const PersistentCache&) = delete;
+
+  // Looks up the record for a cache |key| (see AnswerCache::KeyFor). Records
+  // whose TTL ran out more than |max_stale_seconds| before |now_wall_seconds|
+  // are treated as missing. Not thread-safe: the first lookup in a segment
+  // records whether its checksum matched.
+  bool Find(const std::string& key, int64_t now_wall_seconds,
+            uint32_t max_stale_seconds, Record* record);
+
+  // Calls |visit(key, record)| for every record in an intact segment that
+  // Find() would return.
+  template <typename Visitor>
+  void ForEach(int64_t now_wall_seconds, uint32_t max_stale_seconds,
+               Visitor visit) {
+    std::string key;
+    Record record;
+    for (size_t segment = 0; segment < segment_count(); segment++) {
+      size_t count = RecordCount(segment);
+      for (size_t i = 0; i < count; i++) {
+        if (ReadRecord(segment, i, now_wall_seconds, max_stale_seconds, &key,
+                       &record)) {
+          visit(key, record);
+        }
+      }
+    }
+  }
+
+  size_t segment_count() const { return segment_state_.size(); }
+  size_t corrupt_segments() const;
+  size_t file_size() const { return size_; }
+
+ private:
+  enum class SegmentState : uint8_t { kUnchecked, kValid, kCorrupt };
+
+  PersistentCache(std::unique_ptr<MappedFile> file, size_t segment_count);
+
+  bool CheckSegment(size_t segment);
+  // Number of records in |segment|, 0 if it is corrupt.
+  size_t RecordCount(size_t segment);
+  // Decodes record |index| of a checked |segment|. Returns false if it is
+  // malformed or too old.
+  bool ReadRecord(size_t segment, size_t index, int64_t now_wall_seconds,
+                  uint32_t max_stale_seconds, std::string* key,
+                  Record* record) const;
+  const uint8_t* SegmentAt(size_t segment) const;
+
+  std::unique_ptr<MappedFile> file_;
+  const uint8_t* data_;
+  size_t size_;
+  std::vector<SegmentState> segment_state_;
+  unsigned segment_shift_;
+};
+
+// Builds a snapshot in memory and commits it atomically to disk.
+class PersistentCacheWriter {
+ public:
+  void Add(const std::string& key, const uint8_t* response, size_t length,
+           int64_t stored_wall_seconds, uint32_t ttl);
+
+  size_t size() const { return records_.size(); }
+
+  // Serialises the records added so far into a file image.
+  std::vector<uint8_t> Build() const;
+
+  // Writes |image| to |path| through a temporary file and rename().
+  static bool Commit(const std::string& path, const std::vector<uint8_t>& image,
+                     std::string* error);
+
+ private:
+  struct PendingRecord {
+    uint64_t hash;
+    std::string key;
+    std::vector<uint8_t> response;
+    int64_t stored_wall_seconds;
+    uint32_t ttl;
+  };
+
+  std::vector<PendingRecord> records_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_PERSISTENT_CACHE_H_
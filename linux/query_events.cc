@@ -0,0 +1,129 @@
+#include "query_events.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace dns_manager {
+
+namespace {
+
+void PutU16(uint8_t* p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void PutU32(uint8_t* p, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+void PutU64(uint8_t* p, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    p[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+}  // namespace
+
+QueryEventBatch::QueryEventBatch() { Clear(); }
+
+void QueryEventBatch::Clear() {
+  bytes_.assign(kHeaderSize, 0);
+  count_ = 0;
+  dropped_ = 0;
+  base_time_us_ = 0;
+}
+
+void QueryEventBatch::Add(const QueryEvent& event) {
+  if (count_ == 0) {
+    base_time_us_ = event.time_us;
+  }
+  // Events from one ring arrive in order; clamp anything earlier to the
+  // base rather than wrap.
+  int64_t offset = std::max<int64_t>(event.time_us - base_time_us_, 0);
+  size_t at = bytes_.size();
+  bytes_.resize(at + 13 + event.name_length);
+  uint8_t* p = bytes_.data() + at;
+  PutU32(p, static_cast<uint32_t>(std::min<int64_t>(offset, UINT32_MAX)));
+  PutU32(p + 4, event.latency_us);
+  PutU16(p + 8, event.qtype);
+  p[10] = event.rcode;
+  p[11] = static_cast<uint8_t>(event.source);
+  p[12] = event.name_length;
+  memcpy(p + 13, event.name, event.name_length);
+  count_++;
+}
+
+const std::vector<uint8_t>& QueryEventBatch::bytes() {
+  uint8_t* p = bytes_.data();
+  p[0] = kVersion;
+  p[1] = 0;
+  PutU16(p + 2, 0);
+  PutU32(p + 4, count_);
+  PutU32(p + 8, dropped_);
+  PutU64(p + 12, static_cast<uint64_t>(base_time_us_));
+  return bytes_;
+}
+
+QueryEventRing::QueryEventRing(size_t capacity)
+    : slots_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 1))),
+      mask_(slots_.size() - 1) {}
+
+QueryEvent* QueryEventRing::Reserve() {
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) >= slots_.size()) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  return &slots_[tail & mask_];
+}
+
+void QueryEventRing::Commit() {
+  uint64_t tail = tail_.load(std::memory_order_relaxed) + 1;
+  tail_.store(tail, std::memory_order_release);
+  if (ready_callback_ != nullptr &&
+      tail - head_.load(std::memory_order_relaxed) == ready_threshold_) {
+    ready_callback_(ready_context_);
+  }
+}
+
+size_t QueryEventRing::Drain(QueryEventBatch* batch, size_t max_events) {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  uint64_t tail = tail_.load(std::memory_order_acquire);
+  size_t count = static_cast<size_t>(std::min<uint64_t>(tail - head,
+                                                        max_events));
+  for (size_t i = 0; i < count; i++) {
+    batch->Add(slots_[(head + i) & mask_]);
+  }
+  head_.store(head + count, std::memory_order_release);
+  batch->AddDropped(TakeDropped());
+  return count;
+}
+
+const QueryEvent* QueryEventRing::Front() const {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return &slots_[head & mask_];
+}
+
+void QueryEventRing::Pop() {
+  head_.store(head_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+uint32_t QueryEventRing::TakeDropped() {
+  return dropped_.exchange(0, std::memory_order_relaxed);
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,142 @@
+#ifndef DNS_MANAGER_QUERY_EVENTS_H_
+#define DNS_MANAGER_QUERY_EVENTS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dns_manager {
+
+// Where the answer to a client query came from.
+enum class QuerySource : uint8_t {
+  kCache = 0,
+  // The cache saved by a previous run (see PersistentCache).
+  kWarmCache = 1,
+  kUpstream = 2,
+  // An expired cache entry, served because upstreams failed or were slow.
+  kStale = 3,
+  kBlocked = 4,
+  // SERVFAIL after every upstream failed.
+  kFailed = 5,
+  // Answered from the host overrides (see LocalResolver::SetHostOverrides).
+  kHostOverride = 6,
+};
+
+// One answered client query.
+struct QueryEvent {
+  // Wall-clock time the answer was sent, in microseconds since the epoch.
+  int64_t time_us = 0;
+  // From receiving the query to sending the answer.
+  uint32_t latency_us = 0;
+  uint16_t qtype = 0;
+  uint8_t rcode = 0;
+  QuerySource source = QuerySource::kCache;
+  uint8_t name_length = 0;
+  char name[255];
+};
+
+// Packs query events into the byte layout the Dart side decodes
+// (lib/query_events.dart). All integers are little-endian.
+//
+//   Header, 20 bytes:
+//     u8   version (1)
+//     u8   reserved, 0
+//     u16  reserved, 0
+//     u32  number of events
+//     u32  events dropped since the previous batch because the buffer was
+//          full
+//     i64  time of the first event, microseconds since the epoch
+//   Then per event, 13 bytes plus the name:
+//     u32  time after the first event, microseconds
+//     u32  latency, microseconds
+//     u16  query type
+//     u8   response code
+//     u8   QuerySource
+//     u8   name length
+//     ...  name, lower-case ASCII without the trailing dot
+class QueryEventBatch {
+ public:
+  static constexpr uint8_t kVersion = 1;
+  static constexpr size_t kHeaderSize = 20;
+
+  QueryEventBatch();
+
+  // Empties the batch for reuse, keeping its memory.
+  void Clear();
+  void Add(const QueryEvent& event);
+  void AddDropped(uint32_t dropped) { dropped_ += dropped; }
+
+  size_t count() const { return count_; }
+  uint32_t dropped() const { return dropped_; }
+  // The encoded batch, valid until the next Add() or Clear().
+  const std::vector<uint8_t>& bytes();
+
+ private:
+  std::vector<uint8_t> bytes_;
+  uint32_t count_ = 0;
+  uint32_t dropped_ = 0;
+  int64_t base_time_us_ = 0;
+};
+
+// A fixed-size ring of query events with one producer, the resolver thread,
+// and one consumer. Neither side takes a lock: the producer drops events
+// (and counts them) rather than wait for a slow consumer.
+class QueryEventRing {
+ public:
+  using ReadyCallback = void (*)(void* context);
+
+  // |capacity| is rounded up to a power of two.
+  explicit QueryEventRing(size_t capacity);
+
+  QueryEventRing(const QueryEventRing&) = delete;
+  QueryEventRing& operator=(const QueryEventRing&) = delete;
+
+  // Called on the producer thread each time |threshold| events are waiting,
+  // so the consumer can drain early instead of on its next timer tick. Set
+  // before the producer starts.
+  void set_ready_callback(ReadyCallback callback, void* context,
+                          size_t threshold) {
+    ready_callback_ = callback;
+    ready_context_ = context;
+    ready_threshold_ = threshold;
+  }
+
+  // Events are only recorded while enabled. Thread-safe.
+  void set_enabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  // Producer only. Returns the slot to fill in, or nullptr if the ring is
+  // full; Commit() makes the filled slot visible to the consumer.
+  QueryEvent* Reserve();
+  void Commit();
+
+  // Consumer only. Moves up to |max_events| events into |batch| and returns
+  // how many.
+  size_t Drain(QueryEventBatch* batch, size_t max_events);
+  // Consumer only, for merging several rings: the oldest waiting event or
+  // nullptr, removing it, and the number of events dropped since the last
+  // call.
+  const QueryEvent* Front() const;
+  void Pop();
+  uint32_t TakeDropped();
+
+ private:
+  std::vector<QueryEvent> slots_;
+  const size_t mask_;
+  std::atomic<bool> enabled_{false};
+  ReadyCallback ready_callback_ = nullptr;
+  void* ready_context_ = nullptr;
+  size_t ready_threshold_ = 0;
+  // Written by the producer and the consumer respectively; kept on separate
+  // cache lines so they do not contend.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<uint32_t> dropped_{0};
+  alignas(64) std::atomic<uint64_t> head_{0};
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_QUERY_EVENTS_H_
@@ -0,0 +1,704 @@
+#include "query_log.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "checksum.h"
+
+namespace dns_manager {
+
+namespace {
+
+constexpr char kFileMagic[8] = {'D', 'N', 'S', 'M', 'Q', 'L', 'G', '\0'};
+constexpr uint32_t kBlockMagic = 0x42514d44;  // "DMQB"
+constexpr char kFileSuffix[] = ".qlog";
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct BlockHeader {
+  uint32_t magic;
+  uint32_t event_count;
+  uint32_t payload_bytes;
+  // CRC-32C of the payload.
+  uint32_t crc;
+  int64_t first_us;
+  int64_t last_us;
+};
+
+static_assert(sizeof(FileHeader) == 16, "unexpected FileHeader padding");
+static_assert(sizeof(BlockHeader) == 32, "unexpected BlockHeader padding");
+
+int64_t PartitionOf(int64_t time_us) {
+  int64_t seconds = time_us / 1000000;
+  if (time_us < 0 && seconds * 1000000 != time_us) {
+    seconds--;
+  }
+  int64_t partition = seconds / QueryLog::kPartitionSeconds;
+  if (seconds < 0 && partition * QueryLog::kPartitionSeconds != seconds) {
+    partition--;
+  }
+  return partition;
+}
+
+// Bits needed for an index into |count| entries.
+unsigned BitsFor(size_t count) {
+  unsigned bits = 0;
+  while ((static_cast<size_t>(1) << bits) < count) {
+    bits++;
+  }
+  return bits;
+}
+
+void PutVarint(std::vector<uint8_t>* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint32_t GetU32(const uint8_t* p) {
+  return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+         static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<uint8_t>* out) : out_(out) {}
+
+  void Put(uint32_t value, unsigned width) {
+    bits_ |= static_cast<uint64_t>(value) << count_;
+    count_ += width;
+    while (count_ >= 8) {
+      out_->push_back(static_cast<uint8_t>(bits_));
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+  }
+
+  void Finish() {
+    if (count_ > 0) {
+      out_->push_back(static_cast<uint8_t>(bits_));
+    }
+    bits_ = 0;
+    count_ = 0;
+  }
+
+ private:
+  std::vector<uint8_t>* out_;
+  uint64_t bits_ = 0;
+  unsigned count_ = 0;
+};
+
+// Reads varints and bit-packed columns, failing on the first read past the
+// end.
+class Reader {
+ public:
+  Reader(const uint8_t* data, size_t length)
+      : p_(data), end_(data + length) {}
+
+  bool ok() const { return ok_; }
+
+  uint64_t Varint() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      if (p_ == end_) {
+        ok_ = false;
+        return 0;
+      }
+      uint8_t byte = *p_++;
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+
+  const uint8_t* Bytes(size_t length) {
+    if (static_cast<size_t>(end_ - p_) < length) {
+      ok_ = false;
+      return nullptr;
+    }
+    const uint8_t* bytes = p_;
+    p_ += length;
+    return bytes;
+  }
+
+  uint32_t Bits(unsigned width) {
+    while (count_ < width) {
+      if (p_ == end_) {
+        ok_ = false;
+        return 0;
+      }
+      bits_ |= static_cast<uint64_t>(*p_++) << count_;
+      count_ += 8;
+    }
+    uint32_t value = static_cast<uint32_t>(bits_ & ((1ull << width) - 1));
+    bits_ >>= width;
+    count_ -= width;
+    return value;
+  }
+
+  // Drops the rest of a bit-packed column.
+  void EndBits() {
+    bits_ = 0;
+    count_ = 0;
+  }
+
+ private:
+  const uint8_t* p_;
+  const uint8_t* end_;
+  uint64_t bits_ = 0;
+  unsigned count_ = 0;
+  bool ok_ = true;
+};
+
+bool ReadFully(int fd, void* data, size_t length, uint64_t offset) {
+  uint8_t* p = static_cast<uint8_t*>(data);
+  while (length > 0) {
+    ssize_t n = pread(fd, p, length, static_cast<off_t>(offset));
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    length -= static_cast<size_t>(n);
+    offset += static_cast<uint64_t>(n);
+  }
+  return true;
+}
+
+bool WriteFully(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+}  // namespace
+
+std::unique_ptr<QueryLog> QueryLog::Open(const std::string& directory,
+                                         uint64_t max_bytes,
+                                         std::string* error) {
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    *error = directory + ": " + strerror(errno);
+    return nullptr;
+  }
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    *error = directory + ": " + strerror(errno);
+    return nullptr;
+  }
+  std::unique_ptr<QueryLog> log(new QueryLog(directory, max_bytes));
+  while (dirent* entry = readdir(dir)) {
+    const char* name = entry->d_name;
+    char* end = nullptr;
+    long long seconds = strtoll(name, &end, 10);
+    if (end == name || strcmp(end, kFileSuffix) != 0 || seconds < 0 ||
+        seconds % kPartitionSeconds != 0) {
+      continue;
+    }
+    Partition partition;
+    if (LoadPartition(directory + "/" + name, &partition)) {
+      log->bytes_ += partition.bytes;
+      for (const BlockIndex& block : partition.blocks) {
+        log->events_ += block.event_count;
+      }
+      log->partitions_[seconds / kPartitionSeconds] = std::move(partition);
+    }
+  }
+  closedir(dir);
+  log->EnforceBudget();
+  return log;
+}
+
+QueryLog::QueryLog(const std::string& directory, uint64_t max_bytes)
+    : directory_(directory), max_bytes_(max_bytes) {}
+
+QueryLog::~QueryLog() {
+  Flush();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+std::string QueryLog::PathFor(int64_t partition) const {
+  return directory_ + "/" + std::to_string(partition * kPartitionSeconds) +
+         kFileSuffix;
+}
+
+bool QueryLog::LoadPartition(const std::string& path, Partition* partition) {
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  FileHeader header;
+  if (fstat(fd, &info) != 0 || !ReadFully(fd, &header, sizeof(header), 0) ||
+      memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+      header.version != kVersion) {
+    close(fd);
+    return false;
+  }
+  uint64_t size = static_cast<uint64_t>(info.st_size);
+  uint64_t offset = sizeof(header);
+  BlockHeader block;
+  while (offset + sizeof(block) <= size &&
+         ReadFully(fd, &block, sizeof(block), offset) &&
+         block.magic == kBlockMagic &&
+         block.payload_bytes <= size - offset - sizeof(block)) {
+    partition->blocks.push_back({block.first_us, block.last_us, offset,
+                                 block.payload_bytes, block.event_count});
+    partition->first_us = std::min(partition->first_us, block.first_us);
+    partition->last_us = std::max(partition->last_us, block.last_us);
+    offset += sizeof(block) + block.payload_bytes;
+  }
+  // Whatever follows the last whole block was cut short by a crash.
+  if (offset < size && ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+    close(fd);
+    return false;
+  }
+  close(fd);
+  partition->path = path;
+  partition->bytes = offset;
+  return true;
+}
+
+void QueryLog::Append(const QueryEvent& event) {
+  int64_t partition = PartitionOf(event.time_us);
+  if (!times_.empty() && (partition != buffer_partition_ ||
+                          event.time_us - times_[0] >= kMaxBlockAgeUs)) {
+    Flush();
+  }
+  if (times_.empty()) {
+    buffer_partition_ = partition;
+  }
+  std::string name(event.name, event.name_length);
+  auto it = name_index_.find(name);
+  uint32_t name_id;
+  if (it != name_index_.end()) {
+    name_id = it->second;
+  } else {
+    name_id = static_cast<uint32_t>(names_.size());
+    name_index_.emplace(name, name_id);
+    names_.push_back(std::move(name));
+  }
+  times_.push_back(event.time_us);
+  latencies_.push_back(event.latency_us);
+  name_ids_.push_back(name_id);
+  qtypes_.push_back(event.qtype);
+  rcodes_.push_back(event.rcode);
+  sources_.push_back(static_cast<uint8_t>(event.source));
+  if (times_.size() >= kBlockEvents) {
+    Flush();
+  }
+}
+
+size_t QueryLog::Append(const uint8_t* batch, size_t length) {
+  if (length < QueryEventBatch::kHeaderSize ||
+      batch[0] != QueryEventBatch::kVersion) {
+    return 0;
+  }
+  uint32_t count = GetU32(batch + 4);
+  int64_t base_us = static_cast<int64_t>(
+      static_cast<uint64_t>(GetU32(batch + 12)) |
+      static_cast<uint64_t>(GetU32(batch + 16)) << 32);
+  size_t at = QueryEventBatch::kHeaderSize;
+  QueryEvent event;
+  for (uint32_t i = 0; i < count; i++) {
+    if (length - at < 13 || length - at - 13 < batch[at + 12]) {
+      return i;
+    }
+    const uint8_t* p = batch + at;
+    event.time_us = base_us + GetU32(p);
+    event.latency_us = GetU32(p + 4);
+    event.qtype = static_cast<uint16_t>(p[8] | p[9] << 8);
+    event.rcode = p[10];
+    event.source = static_cast<QuerySource>(p[11]);
+    event.name_length = p[12];
+    memcpy(event.name, p + 13, event.name_length);
+    Append(event);
+    at += 13 + event.name_length;
+  }
+  return count;
+}
+
+std::vector<uint8_t> QueryLog::EncodeBlock(BlockIndex* index) const {
+  std::vector<uint8_t> out;
+  out.reserve(times_.size() * 4 + names_.size() * 24);
+  PutVarint(&out, names_.size());
+  for (const std::string& name : names_) {
+    out.push_back(static_cast<uint8_t>(name.size()));
+    out.insert(out.end(), name.begin(), name.end());
+  }
+  // Only a handful of types show up in a block.
+  std::vector<uint16_t> types;
+  std::vector<uint32_t> type_ids(qtypes_.size());
+  for (size_t i = 0; i < qtypes_.size(); i++) {
+    auto it = std::find(types.begin(), types.end(), qtypes_[i]);
+    type_ids[i] = static_cast<uint32_t>(it - types.begin());
+    if (it == types.end()) {
+      types.push_back(qtypes_[i]);
+    }
+  }
+  PutVarint(&out, types.size());
+  for (uint16_t type : types) {
+    PutVarint(&out, type);
+  }
+
+  int64_t first = *std::min_element(times_.begin(), times_.end());
+  int64_t previous = first;
+  for (int64_t time : times_) {
+    PutVarint(&out, ZigZag(time - previous));
+    previous = time;
+  }
+  for (uint32_t latency : latencies_) {
+    PutVarint(&out, latency);
+  }
+  BitWriter bits(&out);
+  unsigned name_bits = BitsFor(names_.size());
+  for (uint32_t id : name_ids_) {
+    bits.Put(id, name_bits);
+  }
+  bits.Finish();
+  unsigned type_bits = BitsFor(types.size());
+  for (uint32_t id : type_ids) {
+    bits.Put(id, type_bits);
+  }
+  bits.Finish();
+  for (uint8_t rcode : rcodes_) {
+    bits.Put(rcode & 0xf, 4);
+  }
+  bits.Finish();
+  for (uint8_t source : sources_) {
+    bits.Put(source & 0x7, 3);
+  }
+  bits.Finish();
+
+  index->first_us = first;
+  index->last_us = *std::max_element(times_.begin(), times_.end());
+  index->payload_bytes = static_cast<uint32_t>(out.size());
+  index->event_count = static_cast<uint32_t>(times_.size());
+  return out;
+}
+
+bool QueryLog::DecodeBlock(const uint8_t* payload, size_t length,
+                           uint32_t event_count, int64_t first_us,
+                           int64_t from_us, int64_t to_us,
+                           std::vector<QueryEvent>* events) {
+  Reader reader(payload, length);
+  uint64_t name_count = reader.Varint();
+  if (name_count > event_count) {
+    return false;
+  }
+  std::vector<std::pair<const uint8_t*, uint8_t>> names(name_count);
+  for (auto& name : names) {
+    const uint8_t* length_byte = reader.Bytes(1);
+    if (length_byte == nullptr) {
+      return false;
+    }
+    name = {reader.Bytes(*length_byte), *length_byte};
+  }
+  uint64_t type_count = reader.Varint();
+  if (type_count > event_count) {
+    return false;
+  }
+  std::vector<uint16_t> types(type_count);
+  for (uint16_t& type : types) {
+    type = static_cast<uint16_t>(reader.Varint());
+  }
+
+  // Only the time column is decoded for every event; the rest only for the
+  // events in range.
+  std::vector<int64_t> times(event_count);
+  int64_t time = first_us;
+  for (int64_t& t : times) {
+    time += UnZigZag(reader.Varint());
+    t = time;
+  }
+  std::vector<uint32_t> latencies(event_count);
+  for (uint32_t& latency : latencies) {
+    latency = static_cast<uint32_t>(reader.Varint());
+  }
+  if (!reader.ok()) {
+    return false;
+  }
+  size_t begin = events->size();
+  std::vector<uint32_t> matches;
+  for (uint32_t i = 0; i < event_count; i++) {
+    if (times[i] >= from_us && times[i] < to_us) {
+      matches.push_back(i);
+      events->emplace_back();
+      QueryEvent& event = events->back();
+      event.time_us = times[i];
+      event.latency_us = latencies[i];
+    }
+  }
+  if (matches.empty()) {
+    return true;
+  }
+  unsigned name_bits = BitsFor(name_count);
+  unsigned type_bits = BitsFor(type_count);
+  size_t next = 0;
+  for (uint32_t i = 0; i < event_count && reader.ok(); i++) {
+    uint32_t id = reader.Bits(name_bits);
+    if (next < matches.size() && matches[next] == i) {
+      if (id >= name_count) {
+        break;
+      }
+      QueryEvent& event = (*events)[begin + next++];
+      event.name_length = names[id].second;
+      memcpy(event.name, names[id].first, names[id].second);
+    }
+  }
+  reader.EndBits();
+  next = 0;
+  for (uint32_t i = 0; i < event_count && reader.ok(); i++) {
+    uint32_t id = reader.Bits(type_bits);
+    if (next < matches.size() && matches[next] == i) {
+      (*events)[begin + next++].qtype = id < type_count ? types[id] : 0;
+    }
+  }
+  reader.EndBits();
+  next = 0;
+  for (uint32_t i = 0; i < event_count && reader.ok(); i++) {
+    uint32_t rcode = reader.Bits(4);
+    if (next < matches.size() && matches[next] == i) {
+      (*events)[begin + next++].rcode = static_cast<uint8_t>(rcode);
+    }
+  }
+  reader.EndBits();
+  next = 0;
+  for (uint32_t i = 0; i < event_count && reader.ok(); i++) {
+    uint32_t source = reader.Bits(3);
+    if (next < matches.size() && matches[next] == i) {
+      (*events)[begin + next++].source = static_cast<QuerySource>(source);
+    }
+  }
+  if (!reader.ok()) {
+    events->resize(begin);
+    return false;
+  }
+  return true;
+}
+
+void QueryLog::ClearBuffer() {
+  times_.clear();
+  latencies_.clear();
+  name_ids_.clear();
+  qtypes_.clear();
+  rcodes_.clear();
+  sources_.clear();
+  names_.clear();
+  name_index_.clear();
+}
+
+bool QueryLog::Flush() {
+  if (times_.empty()) {
+    return true;
+  }
+  BlockIndex index;
+  std::vector<uint8_t> payload = EncodeBlock(&index);
+  bool written = WriteBlock(buffer_partition_, payload, index);
+  ClearBuffer();
+  return written;
+}
+
+bool QueryLog::WriteBlock(int64_t partition,
+                          const std::vector<uint8_t>& payload,
+                          const BlockIndex& index) {
+  Partition& target = partitions_[partition];
+  if (fd_partition_ != partition) {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+    fd_partition_ = -1;
+    target.path = PathFor(partition);
+    fd_ = open(target.path.c_str(),
+               O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+      return false;
+    }
+    fd_partition_ = partition;
+    struct stat info;
+    if (fstat(fd_, &info) != 0 ||
+        (info.st_size != 0 &&
+         static_cast<uint64_t>(info.st_size) != target.bytes)) {
+      // Not a file Open() loaded; leave it alone.
+      close(fd_);
+      fd_ = -1;
+      fd_partition_ = -1;
+      return false;
+    }
+    if (info.st_size == 0) {
+      FileHeader header = {};
+      memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+      header.version = kVersion;
+      if (!WriteFully(fd_, reinterpret_cast<const uint8_t*>(&header),
+                      sizeof(header))) {
+        return false;
+      }
+      bytes_ += sizeof(header) - target.bytes;
+      target.bytes = sizeof(header);
+    }
+  }
+
+  BlockHeader header;
+  header.magic = kBlockMagic;
+  header.event_count = index.event_count;
+  header.payload_bytes = index.payload_bytes;
+  header.crc = Crc32c(payload.data(), payload.size());
+  header.first_us = index.first_us;
+  header.last_us = index.last_us;
+  std::vector<uint8_t> block(sizeof(header) + payload.size());
+  memcpy(block.data(), &header, sizeof(header));
+  memcpy(block.data() + sizeof(header), payload.data(), payload.size());
+  if (!WriteFully(fd_, block.data(), block.size())) {
+    // Leave no partial block behind for the next one to follow.
+    if (ftruncate(fd_, static_cast<off_t>(target.bytes)) != 0) {
+      close(fd_);
+      fd_ = -1;
+      fd_partition_ = -1;
+    }
+    return false;
+  }
+  BlockIndex written = index;
+  written.offset = target.bytes;
+  target.blocks.push_back(written);
+  target.first_us = std::min(target.first_us, index.first_us);
+  target.last_us = std::max(target.last_us, index.last_us);
+  target.bytes += block.size();
+  bytes_ += block.size();
+  events_ += index.event_count;
+  EnforceBudget();
+  return true;
+}
+
+void QueryLog::EnforceBudget() {
+  while (bytes_ > max_bytes_ && partitions_.size() > 1) {
+    auto oldest = partitions_.begin();
+    if (oldest->first == fd_partition_) {
+      break;
+    }
+    unlink(oldest->second.path.c_str());
+    bytes_ -= oldest->second.bytes;
+    for (const BlockIndex& block : oldest->second.blocks) {
+      events_ -= block.event_count;
+    }
+    partitions_.erase(oldest);
+  }
+}
+
+void QueryLog::ScanBuffer(int64_t from_us, int64_t to_us,
+                          std::vector<QueryEvent>* events) const {
+  for (size_t i = 0; i < times_.size(); i++) {
+    if (times_[i] < from_us || times_[i] >= to_us) {
+      continue;
+    }
+    events->emplace_back();
+    QueryEvent& event = events->back();
+    event.time_us = times_[i];
+    event.latency_us = latencies_[i];
+    event.qtype = qtypes_[i];
+    event.rcode = rcodes_[i];
+    event.source = static_cast<QuerySource>(sources_[i]);
+    const std::string& name = names_[name_ids_[i]];
+    event.name_length = static_cast<uint8_t>(name.size());
+    memcpy(event.name, name.data(), name.size());
+  }
+}
+
+size_t QueryLog::Scan(int64_t from_us, int64_t to_us, size_t max_events,
+                      std::vector<QueryEvent>* events,
+                      ScanStats* stats) const {
+  ScanStats unused;
+  if (stats == nullptr) {
+    stats = &unused;
+  }
+  size_t begin = events->size();
+  std::vector<uint8_t> buffer;
+  for (const auto& item : partitions_) {
+    const Partition& partition = item.second;
+    if (partition.last_us < from_us || partition.first_us >= to_us ||
+        events->size() - begin >= max_events) {
+      stats->blocks_skipped += partition.blocks.size();
+      continue;
+    }
+    int fd = open(partition.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      continue;
+    }
+    for (const BlockIndex& block : partition.blocks) {
+      if (block.last_us < from_us || block.first_us >= to_us ||
+          events->size() - begin >= max_events) {
+        stats->blocks_skipped++;
+        continue;
+      }
+      BlockHeader header;
+      buffer.resize(sizeof(header) + block.payload_bytes);
+      const uint8_t* payload = buffer.data() + sizeof(header);
+      bool read = ReadFully(fd, buffer.data(), buffer.size(), block.offset);
+      if (read) {
+        memcpy(&header, buffer.data(), sizeof(header));
+      }
+      if (!read || header.magic != kBlockMagic ||
+          Crc32c(payload, block.payload_bytes) != header.crc ||
+          !DecodeBlock(payload, block.payload_bytes, block.event_count,
+                       block.first_us, from_us, to_us, events)) {
+        stats->corrupt_blocks++;
+        continue;
+      }
+      stats->blocks_read++;
+    }
+    close(fd);
+  }
+  if (!times_.empty()) {
+    ScanBuffer(from_us, to_us, events);
+  }
+  // Blocks are in order, but the events of neighbouring blocks, merged from
+  // several resolver threads, may overlap slightly.
+  auto earlier = [](const QueryEvent& a, const QueryEvent& b) {
+    return a.time_us < b.time_us;
+  };
+  if (!std::is_sorted(events->begin() + begin, events->end(), earlier)) {
+    std::stable_sort(events->begin() + begin, events->end(), earlier);
+  }
+  if (events->size() - begin > max_events) {
+    events->resize(begin + max_events);
+  }
+  return events->size() - begin;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,154 @@
+#ifndef DNS_MANAGER_QUERY_LOG_H_
+#define DNS_MANAGER_QUERY_LOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "query_events.h"
+
+namespace dns_manager {
+
+// An on-disk log of answered queries that can be read back by time range.
+//
+// Events are buffered into a block of up to kBlockEvents and stored column
+// by column, which is what keeps a record to a few bytes:
+//
+//   names     block dictionary: varint count, then u8 length + name each
+//   qtypes    block dictionary: varint count, then varint type each
+//   time      zigzag varint delta from the previous event (the first from
+//             the block's start)
+//   latency   varint microseconds
+//   name      dictionary index, bit-packed as wide as the dictionary needs
+//   qtype     dictionary index, bit-packed likewise
+//   rcode     4 bits each
+//   source    3 bits each
+//
+// Blocks are appended to one file per hour (partition), named after the
+// hour's first second, each behind a BlockHeader holding its time range,
+// event count and CRC-32C (integers in host byte order). Open() walks the
+// block headers, not the payloads, into a sparse in-memory index of
+// (first time, last time, offset) per block, so a range scan reads and
+// decodes only the blocks that overlap the range. The oldest hours are
+// deleted once the files exceed the size budget. Not thread-safe.
+class QueryLog {
+ public:
+  static constexpr uint32_t kVersion = 1;
+  static constexpr size_t kBlockEvents = 4096;
+  static constexpr int64_t kPartitionSeconds = 3600;
+  // A block is written once its first event is this old, so at most this
+  // much history is lost if the process dies.
+  static constexpr int64_t kMaxBlockAgeUs = 60 * 1000000LL;
+
+  struct ScanStats {
+    // Blocks read and decoded, and blocks the index ruled out.
+    size_t blocks_read = 0;
+    size_t blocks_skipped = 0;
+    // Blocks whose checksum did not match; their events are missing.
+    size_t corrupt_blocks = 0;
+  };
+
+  // Opens the log in |directory|, creating it if needed, and keeps its files
+  // under |max_bytes| by deleting whole hours, oldest first; the hour being
+  // written is never deleted. A block cut short by a crash is truncated
+  // away. Returns nullptr and sets |error| if the directory cannot be
+  // created or read.
+  static std::unique_ptr<QueryLog> Open(const std::string& directory,
+                                        uint64_t max_bytes,
+                                        std::string* error);
+
+  // Writes the buffered events.
+  ~QueryLog();
+
+  QueryLog(const QueryLog&) = delete;
+  QueryLog& operator=(const QueryLog&) = delete;
+
+  void Append(const QueryEvent& event);
+  // Appends every event of a packed QueryEventBatch (see
+  // QueryEventBatch::bytes()). Returns how many, 0 for a malformed batch.
+  size_t Append(const uint8_t* batch, size_t length);
+
+  // Writes the buffered events as a block. Returns false if the write
+  // failed; the events are dropped either way.
+  bool Flush();
+
+  // Copies the events with |from_us| <= time_us < |to_us|, oldest first, into
+  // |events|, up to |max_events|, including those not written yet. Returns
+  // how many.
+  size_t Scan(int64_t from_us, int64_t to_us, size_t max_events,
+              std::vector<QueryEvent>* events,
+              ScanStats* stats = nullptr) const;
+
+  // Bytes in the log's files, and events in them.
+  uint64_t bytes() const { return bytes_; }
+  uint64_t events() const { return events_; }
+  // Events buffered for the next block.
+  size_t buffered() const { return times_.size(); }
+
+ private:
+  struct BlockIndex {
+    int64_t first_us;
+    int64_t last_us;
+    uint64_t offset;
+    uint32_t payload_bytes;
+    uint32_t event_count;
+  };
+
+  struct Partition {
+    std::string path;
+    uint64_t bytes = 0;
+    int64_t first_us = INT64_MAX;
+    int64_t last_us = INT64_MIN;
+    std::vector<BlockIndex> blocks;
+  };
+
+  QueryLog(const std::string& directory, uint64_t max_bytes);
+
+  std::string PathFor(int64_t partition) const;
+  // Reads the block headers of the file at |path| into |partition|,
+  // truncating it after the last whole block. False if it is no log file.
+  static bool LoadPartition(const std::string& path, Partition* partition);
+  // Appends |payload| to the file of |partition|, creating it if needed.
+  bool WriteBlock(int64_t partition, const std::vector<uint8_t>& payload,
+                  const BlockIndex& index);
+  void EnforceBudget();
+  std::vector<uint8_t> EncodeBlock(BlockIndex* index) const;
+  void ClearBuffer();
+  // Adds the events of a block within [from_us, to_us) to |events|. False
+  // if the payload does not decode.
+  static bool DecodeBlock(const uint8_t* payload, size_t length,
+                          uint32_t event_count, int64_t first_us,
+                          int64_t from_us, int64_t to_us,
+                          std::vector<QueryEvent>* events);
+  void ScanBuffer(int64_t from_us, int64_t to_us,
+                  std::vector<QueryEvent>* events) const;
+
+  const std::string directory_;
+  const uint64_t max_bytes_;
+  // By partition, the hour's first second divided by kPartitionSeconds.
+  std::map<int64_t, Partition> partitions_;
+  uint64_t bytes_ = 0;
+  uint64_t events_ = 0;
+  // The file blocks are appended to, and its partition.
+  int fd_ = -1;
+  int64_t fd_partition_ = -1;
+
+  // The block being filled, column by column.
+  int64_t buffer_partition_ = 0;
+  std::vector<int64_t> times_;
+  std::vector<uint32_t> latencies_;
+  std::vector<uint32_t> name_ids_;
+  std::vector<uint16_t> qtypes_;
+  std::vector<uint8_t> rcodes_;
+  std::vector<uint8_t> sources_;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, uint32_t> name_index_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_QUERY_LOG_H_
@@ -0,0 +1,86 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+
+#include "hash.h"
+
+namespace dns_manager {
+
+RateLimiter::RateLimiter(double rate, uint32_t burst, size_t capacity)
+    : interval_ns_(static_cast<int64_t>(1e9 / std::max(rate, 1e-3))),
+      tolerance_ns_(interval_ns_ * std::max<uint32_t>(burst, 1)) {
+  size_t sets = 1;
+  while (sets * kWays < capacity) {
+    sets *= 2;
+  }
+  set_mask_ = sets - 1;
+  sets_.reset(new Set[sets]);
+}
+
+uint64_t RateLimiter::KeyFor(const SocketAddress& client) {
+  uint64_t key;
+  if (client.family() == AF_INET6) {
+    const sockaddr_in6* address =
+        reinterpret_cast<const sockaddr_in6*>(&client.storage);
+    key = HashBytes(&address->sin6_addr, sizeof(address->sin6_addr),
+                    AF_INET6);
+  } else {
+    const sockaddr_in* address =
+        reinterpret_cast<const sockaddr_in*>(&client.storage);
+    key = HashBytes(&address->sin_addr, sizeof(address->sin_addr), AF_INET);
+  }
+  return key != 0 ? key : 1;
+}
+
+RateLimiter::Slot* RateLimiter::Find(uint64_t key) {
+  Set& set = sets_[key & set_mask_];
+  while (true) {
+    Slot* victim = nullptr;
+    uint64_t victim_key = 0;
+    int64_t victim_tat = INT64_MAX;
+    for (Slot& slot : set.ways) {
+      uint64_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == key) {
+        return &slot;
+      }
+      int64_t tat = slot_key == 0 ? INT64_MIN
+                                  : slot.tat.load(std::memory_order_relaxed);
+      if (tat < victim_tat) {
+        victim = &slot;
+        victim_key = slot_key;
+        victim_tat = tat;
+      }
+    }
+    if (victim->key.compare_exchange_strong(victim_key, key,
+                                            std::memory_order_relaxed)) {
+      // A full bucket for the newcomer, unless the evicted client got in a
+      // last query meanwhile; the newcomer then inherits its bucket.
+      if (victim_key != 0) {
+        victim->tat.compare_exchange_strong(victim_tat, 0,
+                                            std::memory_order_relaxed);
+      }
+      return victim;
+    }
+    // Another thread took the way first; look again.
+  }
+}
+
+bool RateLimiter::Allow(const SocketAddress& client, Clock::time_point now) {
+  int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       now.time_since_epoch())
+                       .count();
+  Slot* slot = Find(KeyFor(client));
+  int64_t tat = slot->tat.load(std::memory_order_relaxed);
+  while (true) {
+    int64_t next = std::max(tat, now_ns) + interval_ns_;
+    if (next - now_ns > tolerance_ns_) {
+      return false;
+    }
+    if (slot->tat.compare_exchange_weak(tat, next,
+                                        std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,76 @@
+#ifndef DNS_MANAGER_RATE_LIMITER_H_
+#define DNS_MANAGER_RATE_LIMITER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "socket_address.h"
+
+namespace dns_manager {
+
+// Per-client token buckets: each client address may send |rate| queries a
+// second on average, and up to |burst| at once after being quiet.
+//
+// A bucket is kept as the single timestamp of the generic cell rate
+// algorithm, which is equivalent to a token bucket: the time at which the
+// bucket would be full again (the theoretical arrival time, TAT). A query
+// at |now| is allowed if TAT - now leaves room for one more token, and
+// moves TAT on by 1 / |rate|. One compare-and-swap updates it, so the
+// resolver threads share the table without a lock.
+//
+// The table has a fixed number of slots, grouped into sets of kWays that
+// share a cache line; a client's address hash picks the set. A client not
+// in its set takes the way with the oldest TAT, which is roughly the least
+// recently active client, and whose bucket has usually refilled, so that
+// evicting it loses nothing. Clients are keyed by a 64-bit hash of the
+// address without the port; two addresses sharing a hash share a bucket.
+// Thread-safe.
+class RateLimiter {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kWays = 4;
+
+  // |capacity| is rounded up to a power of two of at least kWays slots.
+  RateLimiter(double rate, uint32_t burst, size_t capacity);
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  // Takes a token from the bucket of |client|. False if it is empty; the
+  // query is then not counted against the client.
+  bool Allow(const SocketAddress& client, Clock::time_point now);
+
+  size_t capacity() const { return (set_mask_ + 1) * kWays; }
+
+  // The key |client| is tracked under: a hash of its family and address.
+  static uint64_t KeyFor(const SocketAddress& client);
+
+ private:
+  struct Slot {
+    // 0 for an unused slot.
+    std::atomic<uint64_t> key{0};
+    // In nanoseconds since the clock's epoch; 0 is a full bucket.
+    std::atomic<int64_t> tat{0};
+  };
+
+  struct alignas(64) Set {
+    Slot ways[kWays];
+  };
+
+  // The slot of |key| in its set, taking over the stalest way if absent.
+  Slot* Find(uint64_t key);
+
+  const int64_t interval_ns_;
+  // How far TAT may run ahead of now before queries are refused.
+  const int64_t tolerance_ns_;
+  size_t set_mask_ = 0;
+  std::unique_ptr<Set[]> sets_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_RATE_LIMITER_H_
@@ -0,0 +1,328 @@
+#include "route_monitor.h"
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace dns_manager {
+
+namespace {
+
+constexpr size_t kReceiveBufferSize = 1 << 20;
+// How long Start() waits for each dump to finish.
+constexpr int kDumpTimeoutMs = 2000;
+
+void CloseFd(int* fd) {
+  if (*fd >= 0) {
+    close(*fd);
+    *fd = -1;
+  }
+}
+
+}  // namespace
+
+RouteMonitor::RouteMonitor() = default;
+
+RouteMonitor::~RouteMonitor() { Stop(); }
+
+bool RouteMonitor::Start(std::string* error) {
+  if (running_) {
+    return true;
+  }
+  netlink_fd_ =
+      socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (netlink_fd_ < 0) {
+    *error = std::string("netlink socket: ") + strerror(errno);
+    return false;
+  }
+  // Bursts of changes, e.g. a VPN installing many routes, must not overflow
+  // the socket.
+  int size = kReceiveBufferSize;
+  setsockopt(netlink_fd_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  sockaddr_nl local = {};
+  local.nl_family = AF_NETLINK;
+  local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(netlink_fd_, reinterpret_cast<sockaddr*>(&local), sizeof(local)) !=
+      0) {
+    *error = std::string("netlink bind: ") + strerror(errno);
+    CloseFd(&netlink_fd_);
+    return false;
+  }
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) {
+    *error = std::string("eventfd: ") + strerror(errno);
+    CloseFd(&netlink_fd_);
+    return false;
+  }
+  // Subscribed first, so nothing that changes during the dump is missed.
+  if (!Dump(error)) {
+    CloseFd(&netlink_fd_);
+    CloseFd(&wake_fd_);
+    return false;
+  }
+  running_ = true;
+  thread_ = std::thread(&RouteMonitor::Run, this);
+  return true;
+}
+
+void RouteMonitor::Stop() {
+  bool was_running = running_.exchange(false);
+  if (was_running) {
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd_, &one, sizeof(one));
+    (void)written;
+  }
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  CloseFd(&netlink_fd_);
+  CloseFd(&wake_fd_);
+}
+
+std::string RouteMonitor::DefaultInterface() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return default_interface_;
+}
+
+void RouteMonitor::Run() {
+  pollfd fds[2] = {{wake_fd_, POLLIN, 0}, {netlink_fd_, POLLIN, 0}};
+  while (running_) {
+    if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+      break;
+    }
+    if (!(fds[1].revents & POLLIN)) {
+      continue;
+    }
+    std::string error;
+    if (!ReadMessages(false, &error)) {
+      // Notifications were dropped; start over from the kernel's state.
+      Dump(&error);
+    }
+    UpdateDefaultInterface();
+  }
+}
+
+bool RouteMonitor::Dump(std::string* error) {
+  links_.clear();
+  routes_.clear();
+  if (!Request(RTM_GETLINK, error) || !ReadMessages(true, error) ||
+      !Request(RTM_GETROUTE, error) || !ReadMessages(true, error)) {
+    return false;
+  }
+  UpdateDefaultInterface();
+  return true;
+}
+
+bool RouteMonitor::Request(uint16_t type, std::string* error) {
+  struct {
+    nlmsghdr header;
+    rtgenmsg body;
+  } request = {};
+  request.header.nlmsg_len = sizeof(request);
+  request.header.nlmsg_type = type;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = ++sequence_;
+  request.body.rtgen_family = AF_UNSPEC;
+  sockaddr_nl kernel = {};
+  kernel.nl_family = AF_NETLINK;
+  if (sendto(netlink_fd_, &request, sizeof(request), 0,
+             reinterpret_cast<sockaddr*>(&kernel), sizeof(kernel)) < 0) {
+    *error = std::string("netlink send: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool RouteMonitor::ReadMessages(bool until_done, std::string* error) {
+  alignas(nlmsghdr) char buffer[32768];
+  while (true) {
+    ssize_t received = recv(netlink_fd_, buffer, sizeof(buffer), 0);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (!until_done) {
+          return true;
+        }
+        pollfd fd = {netlink_fd_, POLLIN, 0};
+        if (poll(&fd, 1, kDumpTimeoutMs) <= 0) {
+          *error = "netlink dump timed out";
+          return false;
+        }
+        continue;
+      }
+      *error = std::string("netlink receive: ") + strerror(errno);
+      return false;
+    }
+    size_t length = static_cast<size_t>(received);
+    for (const nlmsghdr* header = reinterpret_cast<const nlmsghdr*>(buffer);
+         NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+      switch (header->nlmsg_type) {
+        case NLMSG_DONE:
+          if (until_done && header->nlmsg_seq == sequence_) {
+            return true;
+          }
+          break;
+        case NLMSG_ERROR:
+          if (until_done && header->nlmsg_seq == sequence_) {
+            *error = "netlink dump failed";
+            return false;
+          }
+          break;
+        case RTM_NEWLINK:
+        case RTM_DELLINK:
+          ApplyLink(header->nlmsg_type, NLMSG_DATA(header),
+                    NLMSG_PAYLOAD(header, 0));
+          break;
+        case RTM_NEWROUTE:
+        case RTM_DELROUTE:
+          ApplyRoute(header->nlmsg_type, NLMSG_DATA(header),
+                     NLMSG_PAYLOAD(header, 0));
+          break;
+      }
+    }
+  }
+}
+
+void RouteMonitor::ApplyLink(uint16_t type, const void* message,
+                             size_t length) {
+  if (length < sizeof(ifinfomsg)) {
+    return;
+  }
+  const ifinfomsg* info = static_cast<const ifinfomsg*>(message);
+  int index = info->ifi_index;
+  bool up = type == RTM_NEWLINK && (info->ifi_flags & IFF_UP);
+  if (!up) {
+    // The kernel drops a link's routes when it goes down without always
+    // reporting each one.
+    routes_.erase(std::remove_if(routes_.begin(), routes_.end(),
+                                 [index](const DefaultRoute& route) {
+                                   return route.interface_index == index;
+                                 }),
+                  routes_.end());
+  }
+  if (type == RTM_DELLINK) {
+    links_.erase(index);
+    return;
+  }
+  Link& link = links_[index];
+  link.up = up;
+  link.running = info->ifi_flags & IFF_RUNNING;
+  size_t attributes_length = length - NLMSG_ALIGN(sizeof(ifinfomsg));
+  for (const rtattr* attribute = IFLA_RTA(info);
+       RTA_OK(attribute, attributes_length);
+       attribute = RTA_NEXT(attribute, attributes_length)) {
+    if (attribute->rta_type == IFLA_IFNAME) {
+      link.name.assign(static_cast<const char*>(RTA_DATA(attribute)),
+                       strnlen(static_cast<const char*>(RTA_DATA(attribute)),
+                               RTA_PAYLOAD(attribute)));
+    }
+  }
+}
+
+void RouteMonitor::ApplyRoute(uint16_t type, const void* message,
+                              size_t length) {
+  if (length < sizeof(rtmsg)) {
+    return;
+  }
+  const rtmsg* route = static_cast<const rtmsg*>(message);
+  if (route->rtm_dst_len != 0 || route->rtm_type != RTN_UNICAST ||
+      (route->rtm_family != AF_INET && route->rtm_family != AF_INET6)) {
+    return;
+  }
+  uint32_t table = route->rtm_table;
+  DefaultRoute entry;
+  entry.family = route->rtm_family;
+  size_t attributes_length = length - NLMSG_ALIGN(sizeof(rtmsg));
+  for (const rtattr* attribute = RTM_RTA(route);
+       RTA_OK(attribute, attributes_length);
+       attribute = RTA_NEXT(attribute, attributes_length)) {
+    const void* data = RTA_DATA(attribute);
+    switch (attribute->rta_type) {
+      case RTA_TABLE:
+        memcpy(&table, data, sizeof(table));
+        break;
+      case RTA_OIF:
+        memcpy(&entry.interface_index, data, sizeof(entry.interface_index));
+        break;
+      case RTA_PRIORITY:
+        memcpy(&entry.metric, data, sizeof(entry.metric));
+        break;
+      case RTA_MULTIPATH:
+        // Count an ECMP default route as going out of its first hop.
+        if (entry.interface_index == 0 &&
+            RTA_PAYLOAD(attribute) >= sizeof(rtnexthop)) {
+          entry.interface_index =
+              static_cast<const rtnexthop*>(data)->rtnh_ifindex;
+        }
+        break;
+    }
+  }
+  if (table != RT_TABLE_MAIN || entry.interface_index == 0) {
+    return;
+  }
+  auto same = std::find_if(routes_.begin(), routes_.end(),
+                           [&entry](const DefaultRoute& other) {
+                             return other.family == entry.family &&
+                                    other.interface_index ==
+                                        entry.interface_index &&
+                                    other.metric == entry.metric;
+                           });
+  if (type == RTM_DELROUTE) {
+    if (same != routes_.end()) {
+      routes_.erase(same);
+    }
+  } else if (same == routes_.end()) {
+    routes_.push_back(entry);
+  }
+}
+
+void RouteMonitor::UpdateDefaultInterface() {
+  const DefaultRoute* best = nullptr;
+  for (const DefaultRoute& route : routes_) {
+    auto link = links_.find(route.interface_index);
+    if (link != links_.end() && !(link->second.up && link->second.running)) {
+      continue;
+    }
+    if (best == nullptr || route.metric < best->metric ||
+        (route.metric == best->metric &&
+         (route.family < best->family ||
+          (route.family == best->family &&
+           route.interface_index < best->interface_index)))) {
+      best = &route;
+    }
+  }
+  std::string name;
+  if (best != nullptr) {
+    auto link = links_.find(best->interface_index);
+    if (link != links_.end() && !link->second.name.empty()) {
+      name = link->second.name;
+    } else {
+      char buffer[IF_NAMESIZE];
+      if (if_indextoname(best->interface_index, buffer) != nullptr) {
+        name = buffer;
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (name == default_interface_) {
+      return;
+    }
+    default_interface_ = name;
+  }
+  if (change_callback_ != nullptr) {
+    change_callback_(change_context_);
+  }
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,91 @@
+#ifndef DNS_MANAGER_ROUTE_MONITOR_H_
+#define DNS_MANAGER_ROUTE_MONITOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace dns_manager {
+
+// Tracks which interface carries the default route, from the kernel's
+// rtnetlink notifications.
+//
+// Start() reads the current links and routes; afterwards a thread applies
+// route and link changes as the kernel reports them, so DefaultInterface()
+// is up to date within milliseconds of a change and never spawns a process.
+// Among the IPv4 and IPv6 default routes of the main table on interfaces
+// that are up and running, the one with the lowest metric wins; on a tie
+// IPv4 is preferred, then the lower interface index.
+class RouteMonitor {
+ public:
+  using ChangeCallback = void (*)(void* context);
+
+  RouteMonitor();
+  ~RouteMonitor();
+
+  RouteMonitor(const RouteMonitor&) = delete;
+  RouteMonitor& operator=(const RouteMonitor&) = delete;
+
+  // Called on the monitor thread whenever DefaultInterface() changes. Set
+  // before Start().
+  void set_change_callback(ChangeCallback callback, void* context) {
+    change_callback_ = callback;
+    change_context_ = context;
+  }
+
+  // Subscribes to route and link changes, reads the current state and
+  // starts the monitor thread. On failure returns false and sets |error|.
+  bool Start(std::string* error);
+  void Stop();
+
+  // Name of the interface with the best default route, or "" if there is
+  // none. Thread-safe.
+  std::string DefaultInterface() const;
+
+ private:
+  struct Link {
+    std::string name;
+    bool up = false;
+    bool running = false;
+  };
+  struct DefaultRoute {
+    int family = 0;
+    int interface_index = 0;
+    uint32_t metric = 0;
+  };
+
+  void Run();
+  // Asks the kernel for all links and routes and applies the answers.
+  bool Dump(std::string* error);
+  bool Request(uint16_t type, std::string* error);
+  // Reads and applies what is waiting on the socket. With |until_done|,
+  // blocks until the end of a dump. Returns false if notifications were lost
+  // or the socket failed.
+  bool ReadMessages(bool until_done, std::string* error);
+  void ApplyLink(uint16_t type, const void* message, size_t length);
+  void ApplyRoute(uint16_t type, const void* message, size_t length);
+  void UpdateDefaultInterface();
+
+  int netlink_fd_ = -1;
+  int wake_fd_ = -1;
+  uint32_t sequence_ = 0;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+  ChangeCallback change_callback_ = nullptr;
+  void* change_context_ = nullptr;
+
+  // Owned by the monitor thread once it runs.
+  std::unordered_map<int, Link> links_;
+  std::vector<DefaultRoute> routes_;
+
+  mutable std::mutex mutex_;
+  std::string default_interface_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_ROUTE_MONITOR_H_
@@ -0,0 +1,75 @@
+#include "shared_answer_cache.h"
+
+#include <mutex>
+
+#include "hash.h"
+
+namespace dns_manager {
+
+SharedAnswerCache::SharedAnswerCache(size_t max_entries, size_t max_bytes,
+                                     uint32_t max_ttl,
+                                     uint32_t negative_max_ttl)
+    : stripes_(new Stripe[kStripes]) {
+  size_t stripe_entries = (max_entries + kStripes - 1) / kStripes;
+  for (size_t i = 0; i < kStripes; i++) {
+    stripes_[i].cache.reset(new AnswerCache(
+        stripe_entries, max_bytes / kStripes, max_ttl, negative_max_ttl));
+  }
+}
+
+bool SharedAnswerCache::Find(const std::string& key, Clock::time_point now,
+                             uint32_t max_stale_seconds,
+                             std::vector<uint8_t>* response,
+                             Clock::time_point* stored_at) const {
+  const Stripe& stripe = StripeFor(key);
+  std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+  const AnswerCache::Entry* entry = stripe.cache->Peek(key);
+  if (entry == nullptr || entry->StaleSeconds(now) > max_stale_seconds) {
+    return false;
+  }
+  response->resize(entry->response_length());
+  stripe.cache->CopyResponse(*entry, response->data(), response->size());
+  *stored_at = entry->stored_at;
+  return true;
+}
+
+bool SharedAnswerCache::Contains(const std::string& key) const {
+  const Stripe& stripe = StripeFor(key);
+  std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+  return stripe.cache->Contains(key);
+}
+
+void SharedAnswerCache::Insert(const std::string& key,
+                               const uint8_t* response, size_t length,
+                               Clock::time_point stored_at) {
+  Stripe& stripe = StripeFor(key);
+  std::unique_lock<std::shared_mutex> lock(stripe.mutex);
+  // Only the answer is shared; hit counts and refresh state are per thread.
+  stripe.cache->Insert(key, response, length, stored_at, false);
+}
+
+size_t SharedAnswerCache::size() const {
+  size_t total = 0;
+  for (size_t i = 0; i < kStripes; i++) {
+    std::shared_lock<std::shared_mutex> lock(stripes_[i].mutex);
+    total += stripes_[i].cache->size();
+  }
+  return total;
+}
+
+size_t SharedAnswerCache::memory_bytes() const {
+  size_t total = 0;
+  for (size_t i = 0; i < kStripes; i++) {
+    total += stripes_[i].cache->memory_bytes();
+  }
+  return total;
+}
+
+SharedAnswerCache::Stripe& SharedAnswerCache::StripeFor(
+    const std::string& key) const {
+  // AnswerCache indexes by the low bits of the same hash, so every stripe
+  // would otherwise use one in |kStripes| of its index slots.
+  return stripes_[(HashBytes(key.data(), key.size()) >> 32) % kStripes];
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,77 @@
+#ifndef DNS_MANAGER_SHARED_ANSWER_CACHE_H_
+#define DNS_MANAGER_SHARED_ANSWER_CACHE_H_
+
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "answer_cache.h"
+
+namespace dns_manager {
+
+// The answer tier the threads of a sharded LocalResolver share.
+//
+// Each resolver thread answers from its own AnswerCache without taking a
+// lock. Only when that misses does it look here, and every answer a thread
+// receives from upstream is published here, so a name one thread resolved
+// is a hit for the others instead of another upstream query. The table is
+// split into stripes, each an AnswerCache with its share of the entries and
+// memory behind its own reader-writer lock, so lookups only wait for inserts
+// of names in the same stripe. Lookups do not mark entries as used, so each
+// stripe evicts in roughly the order answers arrived. Thread-safe.
+class SharedAnswerCache {
+ public:
+  using Clock = AnswerCache::Clock;
+
+  SharedAnswerCache(size_t max_entries, size_t max_bytes, uint32_t max_ttl,
+                    uint32_t negative_max_ttl);
+
+  SharedAnswerCache(const SharedAnswerCache&) = delete;
+  SharedAnswerCache& operator=(const SharedAnswerCache&) = delete;
+
+  // Copies the answer for |key| into |response| and the time it was received
+  // into |stored_at|, unless it expired more than |max_stale_seconds| before
+  // |now|.
+  bool Find(const std::string& key, Clock::time_point now,
+            uint32_t max_stale_seconds, std::vector<uint8_t>* response,
+            Clock::time_point* stored_at) const;
+  bool Contains(const std::string& key) const;
+
+  // Stores a copy of |response|, as just inserted into a thread's own cache.
+  void Insert(const std::string& key, const uint8_t* response, size_t length,
+              Clock::time_point stored_at);
+
+  size_t size() const;
+  // Bytes all stripes may use together.
+  size_t memory_bytes() const;
+
+  // Calls |visit(key, entry, response, length)| for every entry, one stripe
+  // at a time; inserts into the stripe being visited wait until it is done.
+  template <typename Visitor>
+  void ForEach(Visitor visit) const {
+    for (size_t i = 0; i < kStripes; i++) {
+      const Stripe& stripe = stripes_[i];
+      std::shared_lock<std::shared_mutex> lock(stripe.mutex);
+      stripe.cache->ForEach(visit);
+    }
+  }
+
+ private:
+  static constexpr size_t kStripes = 64;
+
+  // One cache line per lock so that stripes do not contend.
+  struct alignas(64) Stripe {
+    mutable std::shared_mutex mutex;
+    std::unique_ptr<AnswerCache> cache;
+  };
+
+  Stripe& StripeFor(const std::string& key) const;
+
+  std::unique_ptr<Stripe[]> stripes_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_SHARED_ANSWER_CACHE_H_
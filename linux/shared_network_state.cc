@@ -0,0 +1,320 @@
+#include "shared_network_state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+
+namespace dns_manager {
+
+constexpr uint32_t kSegmentMagic = 0x534e4d44;  // "DMNS"
+
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint32_t> payload_length;
+  uint32_t reserved;
+  uint64_t reserved2;
+};
+
+static_assert(sizeof(SegmentHeader) == 32, "unexpected SegmentHeader padding");
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the seqlock needs address-free atomics");
+
+namespace {
+
+// Bounds how long a read keeps retrying while the owner writes before it
+// settles for the previous state.
+constexpr int kReadAttempts = 64;
+
+void PutU32(std::vector<uint8_t>* out, uint32_t value) {
+  uint8_t bytes[4];
+  memcpy(bytes, &value, sizeof(value));
+  out->insert(out->end(), bytes, bytes + sizeof(bytes));
+}
+
+void PutU64(std::vector<uint8_t>* out, uint64_t value) {
+  uint8_t bytes[8];
+  memcpy(bytes, &value, sizeof(value));
+  out->insert(out->end(), bytes, bytes + sizeof(bytes));
+}
+
+void PutString(std::vector<uint8_t>* out, const std::string& value) {
+  PutU32(out, static_cast<uint32_t>(value.size()));
+  out->insert(out->end(), value.begin(), value.end());
+}
+
+void PutStrings(std::vector<uint8_t>* out,
+                const std::vector<std::string>& values) {
+  PutU32(out, static_cast<uint32_t>(values.size()));
+  for (const std::string& value : values) {
+    PutString(out, value);
+  }
+}
+
+// Reads the payload back, failing rather than reading past its end.
+class PayloadReader {
+ public:
+  PayloadReader(const uint8_t* data, size_t size)
+      : next_(data), end_(data + size) {}
+
+  bool U32(uint32_t* value) { return Bytes(value, sizeof(*value)); }
+  bool U64(uint64_t* value) { return Bytes(value, sizeof(*value)); }
+
+  bool String(std::string* value) {
+    uint32_t length;
+    if (!U32(&length) || length > static_cast<size_t>(end_ - next_)) {
+      return false;
+    }
+    value->assign(reinterpret_cast<const char*>(next_), length);
+    next_ += length;
+    return true;
+  }
+
+  bool Strings(std::vector<std::string>* values) {
+    uint32_t count;
+    if (!U32(&count) || count > static_cast<size_t>(end_ - next_) / 4) {
+      return false;
+    }
+    values->resize(count);
+    for (std::string& value : *values) {
+      if (!String(&value)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool done() const { return next_ == end_; }
+
+ private:
+  bool Bytes(void* value, size_t length) {
+    if (length > static_cast<size_t>(end_ - next_)) {
+      return false;
+    }
+    memcpy(value, next_, length);
+    next_ += length;
+    return true;
+  }
+
+  const uint8_t* next_;
+  const uint8_t* end_;
+};
+
+enum ConnectionFlags : uint32_t {
+  kIsDefault = 1 << 0,
+  kHasSettings = 1 << 1,
+  kIpv4IgnoreAutoDns = 1 << 2,
+  kIpv6IgnoreAutoDns = 1 << 3,
+};
+
+void Encode(const NetworkSnapshot& snapshot,
+            const std::string& default_interface, std::vector<uint8_t>* out) {
+  PutU32(out, snapshot.state);
+  PutU32(out, snapshot.connectivity);
+  PutU64(out, snapshot.generation);
+  PutString(out, default_interface);
+  PutStrings(out, snapshot.global_dns);
+  PutU32(out, static_cast<uint32_t>(snapshot.devices.size()));
+  for (const NetworkDevice& device : snapshot.devices) {
+    PutString(out, device.interface);
+    PutU32(out, device.type);
+    PutU32(out, device.state);
+    PutString(out, device.connection_uuid);
+  }
+  PutU32(out, static_cast<uint32_t>(snapshot.connections.size()));
+  for (const NetworkConnection& connection : snapshot.connections) {
+    PutString(out, connection.id);
+    PutString(out, connection.uuid);
+    PutString(out, connection.type);
+    PutStrings(out, connection.devices);
+    PutU32(out, connection.state);
+    PutU32(out,
+           (connection.is_default ? static_cast<uint32_t>(kIsDefault) : 0u) |
+               (connection.has_settings ? static_cast<uint32_t>(kHasSettings)
+                                        : 0u) |
+               (connection.ipv4_ignore_auto_dns
+                    ? static_cast<uint32_t>(kIpv4IgnoreAutoDns)
+                    : 0u) |
+               (connection.ipv6_ignore_auto_dns
+                    ? static_cast<uint32_t>(kIpv6IgnoreAutoDns)
+                    : 0u));
+    PutStrings(out, connection.ipv4_dns);
+    PutStrings(out, connection.ipv6_dns);
+  }
+}
+
+bool Decode(const uint8_t* data, size_t size, NetworkSnapshot* snapshot,
+            std::string* default_interface) {
+  PayloadReader reader(data, size);
+  uint32_t count;
+  if (!reader.U32(&snapshot->state) || !reader.U32(&snapshot->connectivity) ||
+      !reader.U64(&snapshot->generation) ||
+      !reader.String(default_interface) ||
+      !reader.Strings(&snapshot->global_dns) || !reader.U32(&count) ||
+      count > size) {
+    return false;
+  }
+  snapshot->devices.resize(count);
+  for (NetworkDevice& device : snapshot->devices) {
+    if (!reader.String(&device.interface) || !reader.U32(&device.type) ||
+        !reader.U32(&device.state) ||
+        !reader.String(&device.connection_uuid)) {
+      return false;
+    }
+  }
+  if (!reader.U32(&count) || count > size) {
+    return false;
+  }
+  snapshot->connections.resize(count);
+  for (NetworkConnection& connection : snapshot->connections) {
+    uint32_t flags;
+    if (!reader.String(&connection.id) || !reader.String(&connection.uuid) ||
+        !reader.String(&connection.type) ||
+        !reader.Strings(&connection.devices) ||
+        !reader.U32(&connection.state) || !reader.U32(&flags) ||
+        !reader.Strings(&connection.ipv4_dns) ||
+        !reader.Strings(&connection.ipv6_dns)) {
+      return false;
+    }
+    connection.is_default = flags & kIsDefault;
+    connection.has_settings = flags & kHasSettings;
+    connection.ipv4_ignore_auto_dns = flags & kIpv4IgnoreAutoDns;
+    connection.ipv6_ignore_auto_dns = flags & kIpv6IgnoreAutoDns;
+  }
+  return reader.done();
+}
+
+}  // namespace
+
+std::string SharedNetworkState::DefaultName() {
+  return "/dns_manager-network-v" + std::to_string(kVersion) + "-" +
+         std::to_string(getuid());
+}
+
+std::unique_ptr<SharedNetworkState> SharedNetworkState::Open(
+    const std::string& name, std::string* error) {
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    *error = "shm_open " + name + ": " + strerror(errno);
+    return nullptr;
+  }
+  // Every instance sizes the segment itself, so none maps it before it is
+  // as large as the mapping; growing from zero also zeroes it.
+  struct stat status;
+  if (fstat(fd, &status) != 0 ||
+      (static_cast<size_t>(status.st_size) < kSegmentSize &&
+       ftruncate(fd, kSegmentSize) != 0)) {
+    *error = "ftruncate " + name + ": " + strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  void* memory = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    *error = "mmap " + name + ": " + strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<SharedNetworkState>(
+      new SharedNetworkState(fd, static_cast<uint8_t*>(memory)));
+}
+
+void SharedNetworkState::Remove(const std::string& name) {
+  shm_unlink(name.c_str());
+}
+
+SharedNetworkState::SharedNetworkState(int fd, uint8_t* memory)
+    : fd_(fd),
+      header_(reinterpret_cast<SegmentHeader*>(memory)),
+      payload_(memory + sizeof(SegmentHeader)) {}
+
+SharedNetworkState::~SharedNetworkState() {
+  munmap(header_, kSegmentSize);
+  // Closing the descriptor releases ownership.
+  close(fd_);
+}
+
+bool SharedNetworkState::TryBecomeOwner() {
+  // Each Open() has its own open file description, so the lock also keeps
+  // out other instances in this process.
+  if (!owner_ && flock(fd_, LOCK_EX | LOCK_NB) == 0) {
+    owner_ = true;
+  }
+  return owner_;
+}
+
+bool SharedNetworkState::Publish(const NetworkSnapshot* snapshot,
+                                 const std::string& default_interface) {
+  if (!owner_) {
+    return false;
+  }
+  buffer_.clear();
+  if (snapshot != nullptr) {
+    Encode(*snapshot, default_interface, &buffer_);
+  }
+  bool fits = buffer_.size() <= kSegmentSize - sizeof(SegmentHeader);
+  if (!fits) {
+    buffer_.clear();
+  }
+  // A previous owner may have died mid-write and left the sequence odd;
+  // the next even value after it is still ahead of what readers hold.
+  uint64_t sequence =
+      (header_->sequence.load(std::memory_order_relaxed) + 2) & ~uint64_t{1};
+  header_->sequence.store(sequence - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = kSegmentMagic;
+  header_->version = kVersion;
+  memcpy(payload_, buffer_.data(), buffer_.size());
+  header_->payload_length.store(static_cast<uint32_t>(buffer_.size()),
+                                std::memory_order_relaxed);
+  header_->sequence.store(sequence, std::memory_order_release);
+  return fits;
+}
+
+void SharedNetworkState::Update() {
+  for (int attempt = 0; attempt < kReadAttempts; attempt++) {
+    uint64_t sequence = header_->sequence.load(std::memory_order_acquire);
+    if (sequence == sequence_) {
+      return;
+    }
+    if (sequence & 1) {
+      continue;
+    }
+    size_t length = header_->payload_length.load(std::memory_order_relaxed);
+    bool valid = header_->magic == kSegmentMagic &&
+                 header_->version == kVersion &&
+                 length <= kSegmentSize - sizeof(SegmentHeader);
+    if (valid) {
+      buffer_.assign(payload_, payload_ + length);
+    }
+    // The copy may have overlapped a write; only keep it if the sequence
+    // did not move meanwhile.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header_->sequence.load(std::memory_order_relaxed) != sequence) {
+      torn_reads_++;
+      continue;
+    }
+    sequence_ = sequence;
+    snapshot_.reset();
+    default_interface_.clear();
+    if (valid && length > 0) {
+      auto snapshot = std::make_unique<NetworkSnapshot>();
+      if (Decode(buffer_.data(), buffer_.size(), snapshot.get(),
+                 &default_interface_)) {
+        snapshot_ = std::move(snapshot);
+      } else {
+        default_interface_.clear();
+      }
+    }
+    return;
+  }
+}
+
+}  // namespace dns_manager
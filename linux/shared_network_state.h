@@ -0,0 +1,105 @@
+#ifndef DNS_MANAGER_SHARED_NETWORK_STATE_H_
+#define DNS_MANAGER_SHARED_NETWORK_STATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "network_snapshot.h"
+
+namespace dns_manager {
+
+struct SegmentHeader;
+
+// The network state, and the interface holding the default route, shared
+// by every app on the machine that embeds the plugin.
+//
+// Instead of each following NetworkManager and the routing table, and each
+// running nmcli until it has a snapshot of its own, the instances elect one
+// owner: the one holding an exclusive flock() on the segment, which the
+// kernel releases however the owner exits. Only the owner runs the monitors
+// and publishes what they see; the others copy the state out under a
+// seqlock, so a read takes no lock, never waits for the owner and runs no
+// subprocess.
+//
+// Segment layout (version 2; integers in host byte order, since the segment
+// never leaves the machine):
+//
+//   SegmentHeader   magic, version, sequence, payload length
+//   payload         state, connectivity, generation, default interface,
+//                   global DNS servers, then the devices and connections in
+//                   order, counts and strings as uint32_t lengths
+//
+// The sequence is odd while the owner writes and advances by two per
+// snapshot; 0 means nothing was published yet, and a payload length of 0
+// that the owner has no snapshot to share. The segment name carries the
+// version, so instances of another layout use their own segment.
+class SharedNetworkState {
+ public:
+  static constexpr uint32_t kVersion = 2;
+  static constexpr size_t kSegmentSize = 64 << 10;
+
+  // The segment of the current user, e.g. "/dns_manager-network-v2-1000".
+  static std::string DefaultName();
+
+  // Opens or creates segment |name| and maps it. Returns nullptr and sets
+  // |error| if shared memory is unavailable.
+  static std::unique_ptr<SharedNetworkState> Open(const std::string& name,
+                                                  std::string* error);
+  // Removes segment |name|; instances that have it open keep using it.
+  static void Remove(const std::string& name);
+
+  ~SharedNetworkState();
+
+  SharedNetworkState(const SharedNetworkState&) = delete;
+  SharedNetworkState& operator=(const SharedNetworkState&) = delete;
+
+  // Makes this instance the owner if no other instance is. Returns whether
+  // it is the owner, which it stays until destroyed.
+  bool TryBecomeOwner();
+  bool owner() const { return owner_; }
+
+  // Replaces the shared state; nullptr |snapshot| says there is none.
+  // Owner only. Returns false, publishing that there is none, if the
+  // snapshot does not fit the segment.
+  bool Publish(const NetworkSnapshot* snapshot,
+               const std::string& default_interface);
+
+  // Calls |visit(snapshot, default_interface)| with the shared state, or
+  // with nullptr before the owner published one or while it has none. Only
+  // a new state is decoded; while the owner is writing, the previous one is
+  // used rather than waiting. The snapshot is only valid inside |visit|.
+  // Not thread-safe.
+  template <typename Visitor>
+  void Read(Visitor visit) {
+    Update();
+    visit(snapshot_.get(), default_interface_);
+  }
+
+  // Copies that overlapped a write and were discarded.
+  uint64_t torn_reads() const { return torn_reads_; }
+
+ private:
+  SharedNetworkState(int fd, uint8_t* memory);
+
+  // Decodes the shared state if it changed since the last call.
+  void Update();
+
+  int fd_;
+  SegmentHeader* header_;
+  uint8_t* payload_;
+  bool owner_ = false;
+
+  // The last state decoded, and the sequence it was published under.
+  uint64_t sequence_ = 0;
+  std::unique_ptr<NetworkSnapshot> snapshot_;
+  std::string default_interface_;
+  std::vector<uint8_t> buffer_;
+  uint64_t torn_reads_ = 0;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_SHARED_NETWORK_STATE_H_
@@ -0,0 +1,150 @@
+#include "socket_address.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace dns_manager {
+
+namespace {
+
+bool ParsePort(const std::string& text, uint16_t* port) {
+  if (text.empty() || text.size() > 5) {
+    return false;
+  }
+  char* end = nullptr;
+  long value = strtol(text.c_str(), &end, 10);
+  if (*end != '\0' || value <= 0 || value > 65535) {
+    return false;
+  }
+  *port = static_cast<uint16_t>(value);
+  return true;
+}
+
+std::string Trim(const std::string& text) {
+  size_t begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = text.find_last_not_of(" \t\r\n");
+  return text.substr(begin, end - begin + 1);
+}
+
+}  // namespace
+
+bool SocketAddress::Parse(const std::string& raw_text, uint16_t default_port,
+                          SocketAddress* address) {
+  std::string text = Trim(raw_text);
+  std::string host = text;
+  uint16_t port = default_port;
+
+  if (!text.empty() && text[0] == '[') {
+    size_t close = text.find(']');
+    if (close == std::string::npos) {
+      return false;
+    }
+    host = text.substr(1, close - 1);
+    if (close + 1 < text.size()) {
+      if (text[close + 1] != ':' || !ParsePort(text.substr(close + 2), &port)) {
+        return false;
+      }
+    }
+  } else if (std::count(text.begin(), text.end(), ':') == 1) {
+    size_t colon = text.find(':');
+    host = text.substr(0, colon);
+    if (!ParsePort(text.substr(colon + 1), &port)) {
+      return false;
+    }
+  }
+
+  *address = SocketAddress();
+  sockaddr_in* v4 = reinterpret_cast<sockaddr_in*>(&address->storage);
+  if (inet_pton(AF_INET, host.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port);
+    address->length = sizeof(sockaddr_in);
+    return true;
+  }
+  sockaddr_in6* v6 = reinterpret_cast<sockaddr_in6*>(&address->storage);
+  if (inet_pton(AF_INET6, host.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+    address->length = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+bool SocketAddress::ParseList(const std::string& text, uint16_t default_port,
+                              std::vector<SocketAddress>* addresses) {
+  addresses->clear();
+  size_t start = 0;
+  while (start <= text.size()) {
+    size_t comma = text.find(',', start);
+    if (comma == std::string::npos) {
+      comma = text.size();
+    }
+    std::string entry = Trim(text.substr(start, comma - start));
+    if (!entry.empty()) {
+      SocketAddress address;
+      if (!Parse(entry, default_port, &address)) {
+        return false;
+      }
+      addresses->push_back(address);
+    }
+    start = comma + 1;
+  }
+  return !addresses->empty();
+}
+
+uint16_t SocketAddress::port() const {
+  if (family() == AF_INET) {
+    return ntohs(reinterpret_cast<const sockaddr_in*>(&storage)->sin_port);
+  }
+  if (family() == AF_INET6) {
+    return ntohs(reinterpret_cast<const sockaddr_in6*>(&storage)->sin6_port);
+  }
+  return 0;
+}
+
+std::string SocketAddress::HostString() const {
+  char buffer[INET6_ADDRSTRLEN] = {};
+  if (family() == AF_INET) {
+    inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(&storage)->sin_addr,
+              buffer, sizeof(buffer));
+  } else if (family() == AF_INET6) {
+    inet_ntop(AF_INET6,
+              &reinterpret_cast<const sockaddr_in6*>(&storage)->sin6_addr,
+              buffer, sizeof(buffer));
+  }
+  return buffer;
+}
+
+std::string SocketAddress::ToString() const {
+  if (family() == AF_INET6) {
+    return "[" + HostString() + "]:" + std::to_string(port());
+  }
+  return HostString() + ":" + std::to_string(port());
+}
+
+bool SocketAddress::operator==(const SocketAddress& other) const {
+  if (family() != other.family() || port() != other.port()) {
+    return false;
+  }
+  if (family() == AF_INET) {
+    return memcmp(&reinterpret_cast<const sockaddr_in*>(&storage)->sin_addr,
+                  &reinterpret_cast<const sockaddr_in*>(&other.storage)->sin_addr,
+                  sizeof(in_addr)) == 0;
+  }
+  if (family() == AF_INET6) {
+    return memcmp(
+               &reinterpret_cast<const sockaddr_in6*>(&storage)->sin6_addr,
+               &reinterpret_cast<const sockaddr_in6*>(&other.storage)->sin6_addr,
+               sizeof(in6_addr)) == 0;
+  }
+  return false;
+}
+
+}  // namespace dns_manager
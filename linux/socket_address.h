@@ -0,0 +1,49 @@
+#ifndef DNS_MANAGER_SOCKET_ADDRESS_H_
+#define DNS_MANAGER_SOCKET_ADDRESS_H_
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+
+// An IPv4 or IPv6 address and port, stored in a form that can be passed
+// straight to the socket calls.
+struct SocketAddress {
+  sockaddr_storage storage = {};
+  socklen_t length = 0;
+
+  // Parses "1.2.3.4", "1.2.3.4:5353", "::1" or "[::1]:5353". The port is
+  // |default_port| when the text does not carry one.
+  static bool Parse(const std::string& text, uint16_t default_port,
+                    SocketAddress* address);
+
+  // Splits a comma-separated list such as the one passed to setDNS. Returns
+  // false if any entry fails to parse.
+  static bool ParseList(const std::string& text, uint16_t default_port,
+                        std::vector<SocketAddress>* addresses);
+
+  int family() const { return storage.ss_family; }
+  uint16_t port() const;
+  const sockaddr* sockaddr_ptr() const {
+    return reinterpret_cast<const sockaddr*>(&storage);
+  }
+  sockaddr* sockaddr_ptr() { return reinterpret_cast<sockaddr*>(&storage); }
+
+  // The address without the port, in canonical inet_ntop form.
+  std::string HostString() const;
+  // The address with the port, e.g. "1.2.3.4:53" or "[::1]:53".
+  std::string ToString() const;
+
+  bool operator==(const SocketAddress& other) const;
+  bool operator!=(const SocketAddress& other) const {
+    return !(*this == other);
+  }
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_SOCKET_ADDRESS_H_
@@ -0,0 +1,176 @@
+#include "answer_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+using Clock = AnswerCache::Clock;
+
+constexpr uint16_t kTypeTxt = 16;
+
+std::string NameFor(size_t index) {
+  return "host" + std::to_string(index) + ".example";
+}
+
+std::string KeyFor(size_t index) {
+  DnsQuestion question;
+  question.name = NameFor(index);
+  question.qtype = kTypeTxt;
+  question.qclass = kClassIn;
+  return AnswerCache::KeyFor(question);
+}
+
+// A TXT answer for |index| with |text_length| bytes of text.
+std::vector<uint8_t> AnswerFor(size_t index, uint32_t ttl,
+                               size_t text_length = 20) {
+  std::string name = NameFor(index);
+  std::vector<uint8_t> rdata(text_length + 1,
+                             static_cast<uint8_t>('a' + index % 26));
+  rdata[0] = static_cast<uint8_t>(text_length);
+  std::vector<uint8_t> response(512);
+  DnsMessageBuilder builder(response.data(), response.size());
+  builder.SetHeader(static_cast<uint16_t>(index), 0x8180);
+  builder.AddQuestion(name.data(), name.size(), kTypeTxt, kClassIn);
+  builder.AddRecord(DnsSection::kAnswer, name.data(), name.size(), kTypeTxt,
+                    kClassIn, ttl, rdata.data(),
+                    static_cast<uint16_t>(rdata.size()));
+  response.resize(builder.length());
+  return response;
+}
+
+std::vector<uint8_t> Stored(const AnswerCache& cache,
+                            const AnswerCache::Entry& entry) {
+  std::vector<uint8_t> response(entry.response_length());
+  cache.CopyResponse(entry, response.data(), response.size());
+  return response;
+}
+
+}  // namespace
+
+TEST(AnswerCacheTest, AgesTtlsOnReadWithoutChangingTheStoredAnswer) {
+  AnswerCache cache(16, 1 << 16, 86400, 3600);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> answer = AnswerFor(1, 300);
+  ASSERT_NE(cache.Insert(KeyFor(1), answer.data(), answer.size(), now, false),
+            nullptr);
+
+  AnswerCache::Entry* entry = cache.Find(KeyFor(1));
+  ASSERT_NE(entry, nullptr);
+  EXPECT_EQ(entry->ttl, 300u);
+  uint8_t out[512];
+  size_t length = BuildCachedAnswer(
+      cache, *entry, 7, now + std::chrono::seconds(100), out, sizeof(out));
+  ASSERT_EQ(length, answer.size());
+  EXPECT_EQ(GetMessageId(out), 7);
+  uint32_t ttl = 0;
+  ASSERT_TRUE(FindMinimumTtl(out, length, &ttl));
+  EXPECT_EQ(ttl, 200u);
+  EXPECT_EQ(Stored(cache, *entry), answer);
+
+  DnsQuestion question;
+  ASSERT_TRUE(AnswerCache::QuestionFor(KeyFor(1), &question));
+  EXPECT_EQ(question.name, NameFor(1));
+  EXPECT_EQ(question.qtype, kTypeTxt);
+  EXPECT_EQ(question.qclass, kClassIn);
+}
+
+TEST(AnswerCacheTest, StaysWithinItsMemoryCap) {
+  const size_t kMaxBytes = 64 * 1024;
+  AnswerCache cache(100000, kMaxBytes, 86400, 3600);
+  EXPECT_LE(cache.memory_bytes(), kMaxBytes);
+  Clock::time_point now = Clock::now();
+  for (size_t i = 0; i < 5000; i++) {
+    // Sizes spanning one to several blocks.
+    std::vector<uint8_t> answer = AnswerFor(i, 300, 10 + i % 200);
+    ASSERT_NE(cache.Insert(KeyFor(i), answer.data(), answer.size(), now,
+                           false),
+              nullptr);
+  }
+  EXPECT_GT(cache.size(), 100u);
+  EXPECT_LT(cache.size(), 5000u);
+
+  // What is left is intact, and the newest answers are among it.
+  size_t found = 0;
+  for (size_t i = 0; i < 5000; i++) {
+    const AnswerCache::Entry* entry = cache.Peek(KeyFor(i));
+    if (entry != nullptr) {
+      EXPECT_EQ(Stored(cache, *entry), AnswerFor(i, 300, 10 + i % 200));
+      found++;
+    }
+  }
+  EXPECT_EQ(found, cache.size());
+  EXPECT_TRUE(cache.Contains(KeyFor(4999)));
+}
+
+TEST(AnswerCacheTest, EvictionSparesEntriesLookedUpSinceTheLastSweep) {
+  AnswerCache cache(4, 1 << 16, 86400, 3600);
+  Clock::time_point now = Clock::now();
+  for (size_t i = 0; i < 4; i++) {
+    std::vector<uint8_t> answer = AnswerFor(i, 300);
+    cache.Insert(KeyFor(i), answer.data(), answer.size(), now, false);
+  }
+  ASSERT_NE(cache.Find(KeyFor(0)), nullptr);
+  std::vector<uint8_t> answer = AnswerFor(4, 300);
+  cache.Insert(KeyFor(4), answer.data(), answer.size(), now, false);
+  EXPECT_EQ(cache.size(), 4u);
+  EXPECT_TRUE(cache.Contains(KeyFor(0)));
+  EXPECT_FALSE(cache.Contains(KeyFor(1)));
+  EXPECT_TRUE(cache.Contains(KeyFor(4)));
+}
+
+TEST(AnswerCacheTest, EraseKeepsOtherEntriesFindable) {
+  AnswerCache cache(1000, 1 << 20, 86400, 3600);
+  Clock::time_point now = Clock::now();
+  for (size_t i = 0; i < 1000; i++) {
+    std::vector<uint8_t> answer = AnswerFor(i, 300);
+    ASSERT_NE(cache.Insert(KeyFor(i), answer.data(), answer.size(), now,
+                           false),
+              nullptr);
+  }
+  for (size_t i = 0; i < 1000; i += 2) {
+    cache.Erase(KeyFor(i));
+  }
+  EXPECT_EQ(cache.size(), 500u);
+  for (size_t i = 0; i < 1000; i++) {
+    EXPECT_EQ(cache.Contains(KeyFor(i)), i % 2 == 1) << i;
+  }
+
+  // Replacing an answer keeps one entry for the key.
+  std::vector<uint8_t> answer = AnswerFor(1, 60);
+  cache.Insert(KeyFor(1), answer.data(), answer.size(), now, false);
+  EXPECT_EQ(cache.size(), 500u);
+  EXPECT_EQ(cache.Find(KeyFor(1))->ttl, 60u);
+
+  size_t visited = 0;
+  cache.ForEach([&](const std::string& key, const AnswerCache::Entry& entry,
+                    const uint8_t* response, size_t length) {
+    DnsQuestion question;
+    ASSERT_TRUE(AnswerCache::QuestionFor(key, &question));
+    size_t index = std::stoul(question.name.substr(4));
+    std::vector<uint8_t> expected = AnswerFor(index, index == 1 ? 60 : 300);
+    EXPECT_EQ(entry.response_length(), length);
+    EXPECT_EQ(std::vector<uint8_t>(response, response + length), expected);
+    visited++;
+  });
+  EXPECT_EQ(visited, 500u);
+}
+
+TEST(AnswerCacheTest, SkipsAnswersTooLargeForThePool) {
+  AnswerCache cache(16, 2048, 86400, 3600);
+  Clock::time_point now = Clock::now();
+  std::vector<uint8_t> answer = AnswerFor(1, 300, 250);
+  EXPECT_EQ(cache.Insert(KeyFor(1), answer.data(), answer.size(), now, false),
+            nullptr);
+  answer = AnswerFor(2, 300, 10);
+  EXPECT_NE(cache.Insert(KeyFor(2), answer.data(), answer.size(), now, false),
+            nullptr);
+}
+
+}  // namespace test
+}  // namespace dns_manager
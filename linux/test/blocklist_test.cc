@@ -0,0 +1,180 @@
+#include "blocklist.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "file_util.h"
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+class BlocklistTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "blocklist_test.idx";
+  }
+  void TearDown() override { unlink(path_.c_str()); }
+
+  std::unique_ptr<Blocklist> Compile(const char* text) {
+    BlocklistBuilder builder;
+    const char* line = text;
+    while (*line != '\0') {
+      const char* end = strchr(line, '\n');
+      size_t length = end != nullptr ? end - line : strlen(line);
+      builder.AddLine(line, length);
+      line += length + (end != nullptr ? 1 : 0);
+    }
+    std::vector<uint8_t> image = builder.Build();
+    std::string error;
+    EXPECT_TRUE(WriteFileAtomically(path_, image.data(), image.size(), &error))
+        << error;
+    std::unique_ptr<Blocklist> blocklist = Blocklist::Open(path_, &error);
+    EXPECT_NE(blocklist, nullptr) << error;
+    return blocklist;
+  }
+
+  static bool Blocked(const Blocklist& blocklist, const char* name) {
+    return blocklist.Contains(name, strlen(name));
+  }
+
+  std::string path_;
+};
+
+}  // namespace
+
+TEST_F(BlocklistTest, ReadsHostsFilesAndDomainLists) {
+  std::unique_ptr<Blocklist> blocklist = Compile(
+      "# A hosts file\n"
+      "127.0.0.1 localhost\n"
+      "::1 ip6-localhost ip6-loopback\n"
+      "0.0.0.0 ads.example.com tracker.example.com  # two names\n"
+      "0.0.0.0\tTelemetry.Example.NET.\n"
+      "\n"
+      "plain.example.org\n"
+      "*.wild.example\n"
+      "||adblock.example^\n"
+      "! adblock comment\n"
+      "not a valid line with spaces?\n");
+  ASSERT_NE(blocklist, nullptr);
+  EXPECT_EQ(blocklist->size(), 7u);
+
+  EXPECT_TRUE(Blocked(*blocklist, "ads.example.com"));
+  EXPECT_TRUE(Blocked(*blocklist, "tracker.example.com"));
+  EXPECT_TRUE(Blocked(*blocklist, "telemetry.example.net"));
+  EXPECT_TRUE(Blocked(*blocklist, "plain.example.org"));
+  EXPECT_FALSE(Blocked(*blocklist, "localhost"));
+  EXPECT_FALSE(Blocked(*blocklist, "ip6-loopback"));
+  EXPECT_FALSE(Blocked(*blocklist, "example.com"));
+}
+
+TEST_F(BlocklistTest, ExactRulesDoNotCoverSubdomains) {
+  std::unique_ptr<Blocklist> blocklist = Compile("0.0.0.0 ads.example.com\n");
+  ASSERT_NE(blocklist, nullptr);
+  EXPECT_TRUE(Blocked(*blocklist, "ads.example.com"));
+  EXPECT_FALSE(Blocked(*blocklist, "cdn.ads.example.com"));
+  EXPECT_FALSE(Blocked(*blocklist, "xads.example.com"));
+}
+
+TEST_F(BlocklistTest, WildcardRulesCoverSubdomains) {
+  std::unique_ptr<Blocklist> blocklist =
+      Compile("*.wild.example\n||adblock.example^\n");
+  ASSERT_NE(blocklist, nullptr);
+  EXPECT_FALSE(Blocked(*blocklist, "wild.example"));
+  EXPECT_TRUE(Blocked(*blocklist, "a.wild.example"));
+  EXPECT_TRUE(Blocked(*blocklist, "a.b.c.wild.example"));
+  EXPECT_FALSE(Blocked(*blocklist, "notwild.example"));
+  // "||" also blocks the name itself.
+  EXPECT_TRUE(Blocked(*blocklist, "adblock.example"));
+  EXPECT_TRUE(Blocked(*blocklist, "x.adblock.example"));
+  EXPECT_FALSE(Blocked(*blocklist, "example"));
+}
+
+TEST_F(BlocklistTest, LargeListsHaveNoFalseNegatives) {
+  BlocklistBuilder builder;
+  for (int i = 0; i < 100000; i++) {
+    std::string name = "host" + std::to_string(i) + ".blocked.example";
+    ASSERT_TRUE(
+        builder.AddDomain(name.data(), name.size(), BlocklistBuilder::Match::kExact));
+  }
+  std::vector<uint8_t> image = builder.Build();
+  std::string error;
+  ASSERT_TRUE(WriteFileAtomically(path_, image.data(), image.size(), &error));
+  std::unique_ptr<Blocklist> blocklist = Blocklist::Open(path_, &error);
+  ASSERT_NE(blocklist, nullptr) << error;
+  // About ten bytes a rule.
+  EXPECT_LT(blocklist->file_size(), 100000u * 12);
+
+  for (int i = 0; i < 100000; i++) {
+    std::string name = "host" + std::to_string(i) + ".blocked.example";
+    ASSERT_TRUE(Blocked(*blocklist, name.c_str())) << name;
+  }
+  int false_positives = 0;
+  for (int i = 0; i < 100000; i++) {
+    std::string name = "host" + std::to_string(i) + ".allowed.example";
+    false_positives += Blocked(*blocklist, name.c_str()) ? 1 : 0;
+  }
+  EXPECT_EQ(false_positives, 0);
+}
+
+TEST_F(BlocklistTest, RejectsDamagedIndexes) {
+  ASSERT_NE(Compile("ads.example.com\n"), nullptr);
+  std::string error;
+  // Truncated: the size no longer matches the header.
+  ASSERT_EQ(truncate(path_.c_str(), 100), 0);
+  EXPECT_EQ(Blocklist::Open(path_, &error), nullptr);
+
+  ASSERT_NE(Compile("ads.example.com\n"), nullptr);
+  FILE* file = fopen(path_.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  // Entry count field.
+  fseek(file, 16, SEEK_SET);
+  fputc(0x7f, file);
+  fclose(file);
+  EXPECT_EQ(Blocklist::Open(path_, &error), nullptr);
+  EXPECT_NE(error.find("checksum"), std::string::npos) << error;
+}
+
+TEST_F(BlocklistTest, DeltasOverlayTheCompiledList) {
+  std::shared_ptr<const Blocklist> base =
+      Compile("ads.example.com\n||tracker.example.com^\n");
+  std::shared_ptr<const BlocklistDelta> delta = BlocklistDelta::Parse(
+      "# Today's changes\n"
+      "+new.example.org\n"
+      "*.cdn.example.net\n"
+      "-ads.example.com\n");
+  EXPECT_EQ(delta->added(), 2u);
+  EXPECT_EQ(delta->removed(), 1u);
+
+  BlocklistView view(base, delta);
+  auto blocked = [&view](const char* name) {
+    return view.Contains(name, strlen(name));
+  };
+  EXPECT_FALSE(blocked("ads.example.com"));
+  EXPECT_TRUE(blocked("new.example.org"));
+  EXPECT_TRUE(blocked("img.cdn.example.net"));
+  EXPECT_TRUE(blocked("pixel.tracker.example.com"));
+  EXPECT_EQ(view.size(), 4u);
+
+  // A later delta wins over an earlier one for the same rule.
+  std::shared_ptr<const BlocklistDelta> merged =
+      delta->Apply(*BlocklistDelta::Parse("+ads.example.com\n"
+                                          "-new.example.org\n"));
+  BlocklistView updated(base, merged);
+  EXPECT_TRUE(updated.Contains("ads.example.com", 15));
+  EXPECT_FALSE(updated.Contains("new.example.org", 15));
+  EXPECT_TRUE(updated.Contains("img.cdn.example.net", 19));
+
+  // Deltas work without a compiled list too.
+  EXPECT_TRUE(BlocklistView(nullptr, delta).Contains("new.example.org", 15));
+  EXPECT_TRUE(BlocklistView().empty());
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,119 @@
+#include "datagram_batch.h"
+
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+// A non-blocking UDP socket on an ephemeral loopback port.
+int BindLoopback(SocketAddress* address) {
+  SocketAddress::Parse("127.0.0.1", 0, address);
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  bind(fd, address->sockaddr_ptr(), address->length);
+  address->length = sizeof(address->storage);
+  getsockname(fd, address->sockaddr_ptr(), &address->length);
+  return fd;
+}
+
+void WaitReadable(int fd) {
+  pollfd poll_fd = {fd, POLLIN, 0};
+  poll(&poll_fd, 1, 2000);
+}
+
+class DatagramBatchTest : public testing::TestWithParam<bool> {};
+
+}  // namespace
+
+TEST_P(DatagramBatchTest, MovesDatagramsBothWays) {
+  bool batched = GetParam();
+  SocketAddress receiver_address;
+  SocketAddress sender_address;
+  int receiver = BindLoopback(&receiver_address);
+  int sender = BindLoopback(&sender_address);
+
+  DatagramWriter writer(batched);
+  writer.set_fd(sender);
+  const size_t kCount = DatagramWriter::kBatch + 8;
+  for (size_t i = 0; i < kCount; i++) {
+    std::string message = "message " + std::to_string(i);
+    writer.Send(receiver_address,
+                reinterpret_cast<const uint8_t*>(message.data()),
+                message.size(), static_cast<uint32_t>(i));
+  }
+  // A full batch went out when the queue filled up.
+  EXPECT_EQ(writer.queued(), batched ? 8u : 0u);
+  writer.Flush();
+  EXPECT_EQ(writer.queued(), 0u);
+  EXPECT_EQ(writer.syscalls(), batched ? 2u : kCount);
+
+  DatagramReader reader(batched);
+  std::vector<std::string> received;
+  size_t calls = 0;
+  WaitReadable(receiver);
+  while (received.size() < kCount) {
+    size_t count = reader.Receive(receiver);
+    calls++;
+    ASSERT_GT(count, 0u);
+    EXPECT_LE(count, reader.capacity());
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(reader.source(i), sender_address);
+      received.emplace_back(reinterpret_cast<char*>(reader.data(i)),
+                            reader.length(i));
+    }
+  }
+  for (size_t i = 0; i < kCount; i++) {
+    EXPECT_EQ(received[i], "message " + std::to_string(i));
+  }
+  EXPECT_EQ(calls, batched ? 2u : kCount);
+  EXPECT_EQ(reader.Receive(receiver), 0u);
+  close(receiver);
+  close(sender);
+}
+
+TEST_P(DatagramBatchTest, ReportsRefusedDatagramsByTag) {
+  SocketAddress receiver_address;
+  SocketAddress sender_address;
+  int receiver = BindLoopback(&receiver_address);
+  int sender = BindLoopback(&sender_address);
+  // Without SO_BROADCAST the kernel refuses the broadcast address.
+  SocketAddress broadcast;
+  SocketAddress::Parse("255.255.255.255", 53, &broadcast);
+
+  DatagramWriter writer(GetParam());
+  writer.set_fd(sender);
+  const uint8_t kMessage[] = {1, 2, 3};
+  writer.Send(receiver_address, kMessage, sizeof(kMessage), 1);
+  writer.Send(broadcast, kMessage, sizeof(kMessage), 2);
+  writer.Send(receiver_address, kMessage, sizeof(kMessage), 3);
+  std::vector<uint8_t> oversized(kMaxUdpMessageSize + 1);
+  writer.Send(receiver_address, oversized.data(), oversized.size(), 4);
+  writer.Flush();
+  std::vector<uint32_t> failed;
+  writer.TakeFailed(&failed);
+  std::sort(failed.begin(), failed.end());
+  EXPECT_EQ(failed, std::vector<uint32_t>({2, 4}));
+
+  // The datagrams either side of the refused one arrived.
+  DatagramReader reader(GetParam());
+  size_t received = 0;
+  WaitReadable(receiver);
+  for (size_t count; (count = reader.Receive(receiver)) > 0;) {
+    received += count;
+  }
+  EXPECT_EQ(received, 2u);
+  close(receiver);
+  close(sender);
+}
+
+INSTANTIATE_TEST_SUITE_P(BatchedAndNot, DatagramBatchTest, testing::Bool());
+
+}  // namespace test
+}  // namespace dns_manager
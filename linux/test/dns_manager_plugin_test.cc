@@ -2,8 +2,13 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include "include/dns_manager/dns_manager_plugin.h"
 #include "dns_manager_plugin_private.h"
+#include "network_monitor.h"
 
 // This demonstrates a simple unit test of the C portion of this plugin's
 // implementation.
@@ -16,8 +21,32 @@
 namespace dns_manager {
 namespace test {
 
+// Stands in for NetworkManager's global DNS configuration, so that the tests
+// never change the real one and every call is answered at once.
+std::vector<std::string> fake_global_dns;
+
+void FakeGetGlobalDns(GlobalDnsReadCallback done, void* context) {
+  done(fake_global_dns, "", context);
+}
+
+void FakeSetGlobalDns(const std::vector<std::string>& servers,
+                      GlobalDnsCallback done, void* context) {
+  fake_global_dns = servers;
+  done("", context);
+}
+
+class FakeGlobalDnsEnvironment : public ::testing::Environment {
+ public:
+  void SetUp() override {
+    set_global_dns_backend({FakeGetGlobalDns, FakeSetGlobalDns});
+  }
+};
+
+::testing::Environment* const fake_global_dns_environment =
+    ::testing::AddGlobalTestEnvironment(new FakeGlobalDnsEnvironment);
+
 TEST(DnsManagerPlugin, GetDNS) {
-  g_autoptr(FlMethodResponse) response = get_dns();
+  g_autoptr(FlMethodResponse) response = get_dns(nullptr);
   ASSERT_NE(response, nullptr);
   ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
   FlValue* result = fl_method_success_response_get_result(
@@ -32,7 +61,7 @@ TEST(DnsManagerPlugin, SetDNS) {
   g_autoptr(FlValue) args = fl_value_new_map();
   fl_value_set_string_take(args, "dns", fl_value_new_string("8.8.8.8"));
   
-  g_autoptr(FlMethodResponse) response = set_dns(args);
+  g_autoptr(FlMethodResponse) response = set_dns(args, nullptr);
   ASSERT_NE(response, nullptr);
   ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
   FlValue* result = fl_method_success_response_get_result(
@@ -42,8 +71,59 @@ TEST(DnsManagerPlugin, SetDNS) {
   EXPECT_FALSE(fl_value_get_string(result) == nullptr);
 }
 
+TEST(DnsManagerPlugin, SetGlobalDnsRejectsInvalidServers) {
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "dns", fl_value_new_string("not-an-address"));
+  fl_value_set_string_take(args, "global", fl_value_new_bool(true));
+
+  g_autoptr(FlMethodResponse) response = set_dns(args, nullptr);
+  ASSERT_NE(response, nullptr);
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_STREQ(fl_value_get_string(result), "Error: Invalid DNS server list");
+}
+
+TEST(DnsManagerPlugin, SetGlobalDnsSkipsUnchangedServers) {
+  g_autoptr(FlValue) args = fl_value_new_map();
+  fl_value_set_string_take(args, "dns", fl_value_new_string("1.1.1.1"));
+  fl_value_set_string_take(args, "global", fl_value_new_bool(true));
+
+  g_autoptr(FlMethodResponse) set = set_dns(args, nullptr);
+  ASSERT_NE(set, nullptr);
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(set));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Global DNS set", 14), 0);
+  EXPECT_EQ(fake_global_dns, std::vector<std::string>{"1.1.1.1"});
+
+  // Known from the change just made, without asking NetworkManager again.
+  fake_global_dns.clear();
+  g_autoptr(FlMethodResponse) again = set_dns(args, nullptr);
+  ASSERT_NE(again, nullptr);
+  result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(again));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_STREQ(fl_value_get_string(result),
+               "DNS unchanged - global DNS already set");
+  EXPECT_TRUE(fake_global_dns.empty());
+}
+
+TEST(DnsManagerPlugin, GlobalDnsConfigurationRoundTrips) {
+  std::vector<std::string> servers = {"1.1.1.1", "2606:4700:4700::1111"};
+  GVariant* configuration = GlobalDnsConfiguration(servers);
+  EXPECT_EQ(GlobalDnsServers(configuration), servers);
+  g_variant_unref(configuration);
+
+  // Without servers the value is empty, which clears the configuration.
+  configuration = GlobalDnsConfiguration({});
+  EXPECT_EQ(g_variant_n_children(configuration), 0u);
+  EXPECT_TRUE(GlobalDnsServers(configuration).empty());
+  g_variant_unref(configuration);
+}
+
 TEST(DnsManagerPlugin, ResetDNS) {
-  g_autoptr(FlMethodResponse) response = reset_dns();
+  g_autoptr(FlMethodResponse) response = reset_dns(nullptr);
   ASSERT_NE(response, nullptr);
   ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
   FlValue* result = fl_method_success_response_get_result(
@@ -53,5 +133,131 @@ TEST(DnsManagerPlugin, ResetDNS) {
   EXPECT_FALSE(fl_value_get_string(result) == nullptr);
 }
 
+TEST(DnsManagerPlugin, GetNetworkState) {
+  g_autoptr(FlMethodResponse) response = get_network_state();
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  // A map once the network monitor has a snapshot, an error string before
+  if (fl_value_get_type(result) == FL_VALUE_TYPE_MAP) {
+    EXPECT_NE(fl_value_lookup_string(result, "connections"), nullptr);
+    EXPECT_NE(fl_value_lookup_string(result, "ownsSharedState"), nullptr);
+    EXPECT_NE(fl_value_lookup_string(result, "commandsRun"), nullptr);
+  } else {
+    ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+    EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+  }
+}
+
+TEST(DnsManagerPlugin, DefinePresetRejectsInvalidServers) {
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "name", fl_value_new_string("corporate"));
+  fl_value_set_string_take(arguments, "dns", fl_value_new_string("not-an-address"));
+  g_autoptr(FlMethodResponse) response = define_preset(arguments);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, ApplyPresetRequiresDefinedPreset) {
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "name", fl_value_new_string("no such preset"));
+  g_autoptr(FlMethodResponse) response = apply_preset(arguments, nullptr);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, ListPresets) {
+  g_autoptr(FlMethodResponse) response = list_presets();
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  // A list of presets, or an error string if the preset file is unreadable
+  EXPECT_TRUE(fl_value_get_type(result) == FL_VALUE_TYPE_LIST ||
+              fl_value_get_type(result) == FL_VALUE_TYPE_STRING);
+}
+
+TEST(DnsManagerPlugin, GetTopDomainsWithoutResolver) {
+  g_autoptr(FlMethodResponse) response = get_top_domains(nullptr);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  // Without a running local resolver the plugin reports an error string
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+}
+
+TEST(DnsManagerPlugin, GetUpstreamHealthWithoutResolver) {
+  g_autoptr(FlMethodResponse) response = get_upstream_health();
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, LoadBlocklistRequiresSources) {
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "sources", fl_value_new_string("hosts"));
+  g_autoptr(FlMethodResponse) response = load_blocklist(arguments);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, ApplyBlocklistDeltaRequiresPath) {
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  g_autoptr(FlMethodResponse) response = apply_blocklist_delta(arguments);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, SetDnsRoutesRejectsInvalidRoutes) {
+  g_autoptr(FlValue) routes = fl_value_new_map();
+  fl_value_set_string_take(routes, "bad..suffix", fl_value_new_string("10.0.0.53"));
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string(arguments, "routes", routes);
+  g_autoptr(FlMethodResponse) response = set_dns_routes(arguments);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
+TEST(DnsManagerPlugin, SetHostOverridesRejectsInvalidEntries) {
+  g_autoptr(FlValue) addresses = fl_value_new_list();
+  fl_value_append_take(addresses, fl_value_new_string("not an address"));
+  g_autoptr(FlValue) hosts = fl_value_new_map();
+  fl_value_set_string(hosts, "git.corp.example", addresses);
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string(arguments, "hosts", hosts);
+  g_autoptr(FlMethodResponse) response = set_host_overrides(arguments);
+  ASSERT_NE(response, nullptr);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response));
+  FlValue* result = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  ASSERT_EQ(fl_value_get_type(result), FL_VALUE_TYPE_STRING);
+  EXPECT_EQ(strncmp(fl_value_get_string(result), "Error:", 6), 0);
+}
+
 }  // namespace test
 }  // namespace dns_manager
@@ -0,0 +1,381 @@
+#include "dns_message.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+const uint8_t kAddress[] = {192, 0, 2, 1};
+
+// A response for www.example.com A with a CNAME, two addresses and an NS
+// record in the authority section, built with compression.
+size_t BuildSampleResponse(uint8_t* out, size_t capacity) {
+  DnsMessageBuilder builder(out, capacity);
+  builder.SetHeader(0x1234, 0x8180);
+  std::string www = "www.example.com";
+  std::string cdn = "cdn.example.com";
+  uint8_t cname_rdata[] = {3, 'c', 'd', 'n', 0xc0, 16};
+  uint8_t ns_rdata[] = {2, 'n', 's', 0xc0, 16};
+  if (!builder.AddQuestion(www.data(), www.size(), kTypeA, kClassIn) ||
+      !builder.AddRecord(DnsSection::kAnswer, www.data(), www.size(),
+                         kTypeCname, kClassIn, 300, cname_rdata,
+                         sizeof(cname_rdata)) ||
+      !builder.AddRecord(DnsSection::kAnswer, cdn.data(), cdn.size(), kTypeA,
+                         kClassIn, 60, kAddress, sizeof(kAddress)) ||
+      !builder.AddRecord(DnsSection::kAnswer, cdn.data(), cdn.size(), kTypeA,
+                         kClassIn, 120, kAddress, sizeof(kAddress)) ||
+      !builder.AddRecord(DnsSection::kAuthority, "example.com", 11, kTypeNs,
+                         kClassIn, 3600, ns_rdata, sizeof(ns_rdata))) {
+    return 0;
+  }
+  return builder.length();
+}
+
+// Header for a message with one question and the given answer count.
+std::vector<uint8_t> Header(uint16_t questions, uint16_t answers) {
+  std::vector<uint8_t> message(kDnsHeaderSize, 0);
+  WriteU16(message.data() + 4, questions);
+  WriteU16(message.data() + 6, answers);
+  return message;
+}
+
+void AppendQuestionTail(std::vector<uint8_t>* message) {
+  const uint8_t tail[] = {0, 1, 0, 1};
+  message->insert(message->end(), tail, tail + sizeof(tail));
+}
+
+}  // namespace
+
+TEST(DnsMessage, ReadsBuiltMessage) {
+  uint8_t message[512];
+  size_t length = BuildSampleResponse(message, sizeof(message));
+  ASSERT_GT(length, 0u);
+
+  DnsMessageReader reader(message, length);
+  EXPECT_EQ(reader.header().id, 0x1234);
+  EXPECT_EQ(reader.header().flags, 0x8180);
+  EXPECT_EQ(reader.header().question_count, 1);
+  EXPECT_EQ(reader.header().answer_count, 3);
+  EXPECT_EQ(reader.header().authority_count, 1);
+
+  DnsQuestionView question;
+  ASSERT_TRUE(reader.NextQuestion(&question));
+  EXPECT_EQ(question.name.ToString(), "www.example.com");
+  EXPECT_EQ(question.qtype, kTypeA);
+  EXPECT_FALSE(reader.NextQuestion(&question));
+
+  std::vector<std::string> names;
+  std::vector<uint32_t> ttls;
+  DnsRecordView record;
+  while (reader.NextRecord(&record)) {
+    names.push_back(record.name.ToString());
+    ttls.push_back(record.ttl);
+  }
+  EXPECT_TRUE(reader.valid());
+  EXPECT_EQ(names, (std::vector<std::string>{"www.example.com",
+                                             "cdn.example.com",
+                                             "cdn.example.com",
+                                             "example.com"}));
+  EXPECT_EQ(ttls, (std::vector<uint32_t>{300, 60, 120, 3600}));
+  EXPECT_EQ(record.section, DnsSection::kAuthority);
+}
+
+TEST(DnsMessage, BuilderCompressesRepeatedNames) {
+  uint8_t message[512];
+  size_t length = BuildSampleResponse(message, sizeof(message));
+  // Header 12, question 17 + 4, CNAME 2 + 10 + 6, first cdn A 6 + 10 + 4,
+  // second cdn A 2 + 10 + 4, NS 2 + 10 + 5.
+  EXPECT_EQ(length, 104u);
+
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  ASSERT_TRUE(reader.NextRecord(&record));
+  ASSERT_TRUE(reader.NextRecord(&record));
+  // "cdn" followed by a pointer to "example.com" in the question.
+  EXPECT_EQ(message[record.name.offset()], 3);
+  EXPECT_EQ(message[record.name.offset() + 4], 0xc0);
+}
+
+TEST(DnsMessage, NamesCompareCaseInsensitively) {
+  uint8_t message[512];
+  DnsMessageBuilder builder(message, sizeof(message));
+  ASSERT_TRUE(builder.AddQuestion("WWW.Example.COM.", 16, kTypeA, kClassIn));
+  ASSERT_TRUE(builder.AddRecord(DnsSection::kAnswer, "www.example.com", 15,
+                                kTypeA, kClassIn, 1, kAddress,
+                                sizeof(kAddress)));
+  DnsMessageReader reader(message, builder.length());
+  DnsQuestionView question;
+  DnsRecordView record;
+  ASSERT_TRUE(reader.NextQuestion(&question));
+  ASSERT_TRUE(reader.NextRecord(&record));
+  EXPECT_TRUE(question.name.Equals("www.EXAMPLE.com", 15));
+  EXPECT_FALSE(question.name.Equals("www.example.co", 14));
+  EXPECT_TRUE(question.name.Equals(record.name));
+  // The whole answer name was compressed to a pointer.
+  EXPECT_EQ(message[record.name.offset()], 0xc0);
+}
+
+TEST(DnsMessage, BuilderRejectsBadNamesAndLeavesMessageIntact) {
+  uint8_t message[64];
+  DnsMessageBuilder builder(message, sizeof(message));
+  EXPECT_FALSE(builder.AddQuestion("a..b", 4, kTypeA, kClassIn));
+  std::string long_label(64, 'a');
+  EXPECT_FALSE(
+      builder.AddQuestion(long_label.data(), long_label.size(), 1, 1));
+  ASSERT_TRUE(builder.AddQuestion("example.com", 11, kTypeA, kClassIn));
+  size_t length = builder.length();
+
+  // Does not fit: the message must stay as it was.
+  std::vector<uint8_t> rdata(64, 0);
+  EXPECT_FALSE(builder.AddRecord(DnsSection::kAnswer, "example.com", 11,
+                                 kTypeA, kClassIn, 1, rdata.data(),
+                                 static_cast<uint16_t>(rdata.size())));
+  EXPECT_EQ(builder.length(), length);
+  EXPECT_EQ(ReadU16(message + 6), 0);
+  ASSERT_TRUE(builder.AddRecord(DnsSection::kAnswer, "example.com", 11,
+                                kTypeA, kClassIn, 1, kAddress,
+                                sizeof(kAddress)));
+  // Sections go in order.
+  EXPECT_FALSE(builder.AddQuestion("example.org", 11, kTypeA, kClassIn));
+
+  DnsMessageBuilder tiny(message, 4);
+  EXPECT_FALSE(tiny.AddQuestion("example.com", 11, kTypeA, kClassIn));
+  EXPECT_EQ(tiny.length(), 0u);
+}
+
+TEST(DnsMessage, BuildsRootAndMaximumLengthNames) {
+  uint8_t message[512];
+  DnsMessageBuilder builder(message, sizeof(message));
+  ASSERT_TRUE(builder.AddQuestion("", 0, kTypeNs, kClassIn));
+  // 63 + 1 + 63 + 1 + 63 + 1 + 61 = 253 characters, 255 bytes on the wire.
+  std::string label(63, 'x');
+  std::string longest = label + "." + label + "." + label + "." +
+                        std::string(61, 'y');
+  ASSERT_TRUE(builder.AddRecord(DnsSection::kAnswer, longest.data(),
+                                longest.size(), kTypeA, kClassIn, 1, kAddress,
+                                sizeof(kAddress)));
+  std::string too_long = longest + "y";
+  EXPECT_FALSE(builder.AddRecord(DnsSection::kAnswer, too_long.data(),
+                                 too_long.size(), kTypeA, kClassIn, 1,
+                                 kAddress, sizeof(kAddress)));
+
+  DnsMessageReader reader(message, builder.length());
+  DnsQuestionView question;
+  DnsRecordView record;
+  ASSERT_TRUE(reader.NextQuestion(&question));
+  EXPECT_EQ(question.name.ToString(), "");
+  ASSERT_TRUE(reader.NextRecord(&record));
+  EXPECT_EQ(record.name.ToString(), longest);
+}
+
+TEST(DnsMessage, RejectsTruncatedMessages) {
+  uint8_t message[512];
+  size_t length = BuildSampleResponse(message, sizeof(message));
+  for (size_t cut = 0; cut < length; cut++) {
+    DnsMessageReader reader(message, cut);
+    DnsRecordView record;
+    size_t records = 0;
+    while (reader.NextRecord(&record)) {
+      records++;
+    }
+    EXPECT_FALSE(reader.valid()) << "cut at " << cut;
+    EXPECT_LT(records, 4u);
+  }
+}
+
+TEST(DnsMessage, RejectsPointerLoops) {
+  // The question name is a pointer to itself.
+  std::vector<uint8_t> self = Header(1, 0);
+  self.push_back(0xc0);
+  self.push_back(12);
+  AppendQuestionTail(&self);
+  DnsQuestion question;
+  EXPECT_FALSE(ParseFirstQuestion(self.data(), self.size(), &question));
+
+  // A label followed by a pointer back to it loops forever unless stopped.
+  std::vector<uint8_t> loop = Header(1, 0);
+  loop.insert(loop.end(), {1, 'a', 0xc0, 12});
+  AppendQuestionTail(&loop);
+  EXPECT_FALSE(ParseFirstQuestion(loop.data(), loop.size(), &question));
+
+  // Two names pointing at each other: the forward pointer is rejected.
+  std::vector<uint8_t> pair = Header(2, 0);
+  pair.insert(pair.end(), {0xc0, 18, 0, 1, 0, 1, 0xc0, 12, 0, 1, 0, 1});
+  DnsMessageReader reader(pair.data(), pair.size());
+  DnsQuestionView view;
+  EXPECT_FALSE(reader.NextQuestion(&view));
+  EXPECT_FALSE(reader.valid());
+}
+
+TEST(DnsMessage, RejectsMalformedNames) {
+  DnsQuestion question;
+  // Reserved label type 0x40.
+  std::vector<uint8_t> reserved = Header(1, 0);
+  reserved.insert(reserved.end(), {0x41, 'a', 0});
+  AppendQuestionTail(&reserved);
+  EXPECT_FALSE(
+      ParseFirstQuestion(reserved.data(), reserved.size(), &question));
+
+  // A label running past the end.
+  std::vector<uint8_t> overrun = Header(1, 0);
+  overrun.insert(overrun.end(), {10, 'a', 'b'});
+  EXPECT_FALSE(ParseFirstQuestion(overrun.data(), overrun.size(), &question));
+
+  // A pointer into the header.
+  std::vector<uint8_t> into_header = Header(1, 0);
+  into_header.insert(into_header.end(), {0xc0, 2});
+  AppendQuestionTail(&into_header);
+  EXPECT_FALSE(
+      ParseFirstQuestion(into_header.data(), into_header.size(), &question));
+
+  // Questions whose names point at the previous one, each adding 61 bytes:
+  // the fifth decodes to more than 255.
+  std::vector<uint8_t> chain = Header(5, 0);
+  size_t previous = chain.size();
+  chain.push_back(60);
+  chain.insert(chain.end(), 60, 'a');
+  chain.push_back(0);
+  AppendQuestionTail(&chain);
+  for (int i = 0; i < 4; i++) {
+    size_t start = chain.size();
+    chain.push_back(60);
+    chain.insert(chain.end(), 60, 'b');
+    chain.push_back(static_cast<uint8_t>(0xc0 | (previous >> 8)));
+    chain.push_back(static_cast<uint8_t>(previous));
+    AppendQuestionTail(&chain);
+    previous = start;
+  }
+  DnsMessageReader reader(chain.data(), chain.size());
+  DnsQuestionView view;
+  size_t questions = 0;
+  while (reader.NextQuestion(&view)) {
+    questions++;
+  }
+  EXPECT_EQ(questions, 4u);
+  EXPECT_FALSE(reader.valid());
+}
+
+TEST(DnsMessage, RejectsRecordsPastTheEnd) {
+  uint8_t message[512];
+  size_t length = BuildSampleResponse(message, sizeof(message));
+  // Claim one more answer than there is.
+  WriteU16(message + 10, 1);
+  DnsMessageReader reader(message, length);
+  DnsRecordView record;
+  size_t records = 0;
+  while (reader.NextRecord(&record)) {
+    records++;
+  }
+  EXPECT_EQ(records, 4u);
+  EXPECT_FALSE(reader.valid());
+  uint32_t ttl = 0;
+  EXPECT_FALSE(FindMinimumTtl(message, length, &ttl));
+
+  // RDLENGTH larger than the rest of the message.
+  length = BuildSampleResponse(message, sizeof(message));
+  WriteU16(message + length - 7, 200);
+  EXPECT_FALSE(FindMinimumTtl(message, length, &ttl));
+}
+
+TEST(DnsMessage, SurvivesRandomCorruption) {
+  uint8_t original[512];
+  size_t length = BuildSampleResponse(original, sizeof(original));
+  std::mt19937 random(7);
+  for (int round = 0; round < 20000; round++) {
+    uint8_t message[512];
+    memcpy(message, original, length);
+    for (int flips = 1 + round % 4; flips > 0; flips--) {
+      message[random() % length] = static_cast<uint8_t>(random());
+    }
+    size_t cut = length - random() % 8;
+    DnsMessageReader reader(message, cut);
+    DnsQuestionView question;
+    DnsRecordView record;
+    char name[kMaxDnsNameLength];
+    size_t name_length;
+    while (reader.NextQuestion(&question)) {
+      ASSERT_TRUE(question.name.Decode(name, sizeof(name), &name_length));
+    }
+    while (reader.NextRecord(&record)) {
+      ASSERT_TRUE(record.name.Decode(name, sizeof(name), &name_length));
+      ASSERT_LE(record.rdata_offset + record.rdata_length, cut);
+    }
+    uint32_t ttl;
+    FindMinimumTtl(message, cut, &ttl);
+    FindNegativeTtl(message, cut, &ttl);
+  }
+}
+
+TEST(DnsMessage, BuildQueryAndErrorResponse) {
+  DnsQuestion question;
+  question.name = "example.org";
+  question.qtype = kTypeAaaa;
+  question.qclass = kClassIn;
+  uint8_t query[512];
+  size_t length = BuildQuery(question, 99, query, sizeof(query));
+  ASSERT_EQ(length, kDnsHeaderSize + 13 + 4);
+  EXPECT_EQ(GetMessageId(query), 99);
+  EXPECT_EQ(query[2], 0x01);
+
+  uint8_t response[512];
+  size_t response_length = BuildErrorResponse(
+      query, length, kRcodeServFail, response, sizeof(response));
+  ASSERT_EQ(response_length, length);
+  EXPECT_TRUE(IsResponse(response));
+  EXPECT_EQ(GetRcode(response), kRcodeServFail);
+  DnsQuestion parsed;
+  ASSERT_TRUE(ParseFirstQuestion(response, response_length, &parsed));
+  EXPECT_EQ(parsed.name, "example.org");
+  EXPECT_EQ(parsed.qtype, kTypeAaaa);
+}
+
+TEST(DnsMessage, TruncatesForSmallUdpBuffers) {
+  DnsQuestion question;
+  question.name = "big.example";
+  question.qtype = kTypeA;
+  question.qclass = kClassIn;
+  uint8_t query[512];
+  size_t length = BuildQuery(question, 5, query, sizeof(query));
+  EXPECT_EQ(MaxUdpResponseSize(query, length), kMinUdpPayloadSize);
+
+  // An OPT record advertising 1232 bytes, then one past the maximum.
+  DnsMessageBuilder builder(query, sizeof(query));
+  builder.SetHeader(5, 0x0100);
+  ASSERT_TRUE(builder.AddQuestion("big.example", 11, kTypeA, kClassIn));
+  ASSERT_TRUE(builder.AddRecord(DnsSection::kAdditional, "", 0, kTypeOpt,
+                                1232, 0, nullptr, 0));
+  EXPECT_EQ(MaxUdpResponseSize(query, builder.length()), 1232u);
+  WriteU16(query + builder.length() - 8, 65000);
+  EXPECT_EQ(MaxUdpResponseSize(query, builder.length()), kMaxUdpMessageSize);
+
+  uint8_t response[1024];
+  DnsMessageBuilder answer(response, sizeof(response));
+  answer.SetHeader(5, 0x8580);
+  ASSERT_TRUE(answer.AddQuestion("big.example", 11, kTypeA, kClassIn));
+  static const uint8_t kAddress[] = {192, 0, 2, 1};
+  for (int i = 0; i < 40; i++) {
+    ASSERT_TRUE(answer.AddRecord(DnsSection::kAnswer, "big.example", 11,
+                                 kTypeA, kClassIn, 60, kAddress, 4));
+  }
+  ASSERT_GT(answer.length(), kMinUdpPayloadSize);
+
+  uint8_t truncated[512];
+  size_t truncated_length = BuildTruncatedResponse(
+      response, answer.length(), truncated, sizeof(truncated));
+  ASSERT_EQ(truncated_length, kDnsHeaderSize + 13 + 4);
+  EXPECT_TRUE(IsResponse(truncated));
+  EXPECT_TRUE(IsTruncated(truncated));
+  EXPECT_EQ(truncated[2] & 0x04, 0x04);
+  EXPECT_EQ(ReadU16(truncated + 6), 0);
+  EXPECT_EQ(GetMessageId(truncated), 5);
+}
+
+}  // namespace test
+}  // namespace dns_manager
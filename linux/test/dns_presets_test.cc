@@ -0,0 +1,134 @@
+#include "dns_presets.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "network_snapshot.h"
+
+namespace dns_manager {
+namespace test {
+
+TEST(DnsPresets, NormalisesServersWhenDefined) {
+  DnsPresets presets;
+  std::string error;
+  ASSERT_TRUE(presets.Define("public", " 1.1.1.1, 2606:4700:4700:0:0:0:0:1111,"
+                             "1.0.0.1,1.1.1.1:53",
+                             false, &error));
+  EXPECT_FALSE(presets.Define("bad", "dns.example", false, &error));
+  EXPECT_FALSE(presets.Define("none", "", false, &error));
+  EXPECT_FALSE(presets.Define("", "1.1.1.1", false, &error));
+  EXPECT_FALSE(
+      presets.Define(std::string(256, 'x'), "1.1.1.1", false, &error));
+
+  const DnsPreset* preset = presets.Find("public");
+  ASSERT_NE(preset, nullptr);
+  EXPECT_EQ(preset->servers,
+            (std::vector<std::string>{"1.1.1.1", "1.0.0.1",
+                                      "2606:4700:4700::1111"}));
+  std::vector<ConnectionProperty> expected;
+  ASSERT_TRUE(DnsPropertiesFor("1.1.1.1,1.0.0.1,2606:4700:4700::1111",
+                               &expected));
+  ASSERT_EQ(preset->properties.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(preset->properties[i].name, expected[i].name);
+    EXPECT_EQ(preset->properties[i].value, expected[i].value);
+  }
+  EXPECT_EQ(presets.Find("bad"), nullptr);
+}
+
+TEST(DnsPresets, KeepsPresetsSortedAndReplacesByName) {
+  DnsPresets presets;
+  std::string error;
+  ASSERT_TRUE(presets.Define("public", "1.1.1.1", false, &error));
+  ASSERT_TRUE(presets.Define("corporate", "10.0.0.53", false, &error));
+  ASSERT_TRUE(presets.Define("filtering", "9.9.9.9", true, &error));
+  ASSERT_TRUE(presets.Define("public", "8.8.8.8", false, &error));
+  ASSERT_EQ(presets.presets().size(), 3u);
+  EXPECT_EQ(presets.presets()[0].name, "corporate");
+  EXPECT_EQ(presets.presets()[1].name, "filtering");
+  EXPECT_EQ(presets.presets()[2].name, "public");
+  EXPECT_EQ(presets.Find("public")->servers[0], "8.8.8.8");
+
+  EXPECT_TRUE(presets.Remove("filtering"));
+  EXPECT_FALSE(presets.Remove("filtering"));
+  EXPECT_EQ(presets.presets().size(), 2u);
+}
+
+TEST(DnsPresets, RoundTripsThroughTheFile) {
+  DnsPresets presets;
+  std::string error;
+  ASSERT_TRUE(presets.Define("corporate", "10.0.0.53,fd00::53", false, &error));
+  ASSERT_TRUE(presets.Define("filtering", "9.9.9.9,149.112.112.112", true,
+                             &error));
+  std::string path = testing::TempDir() + "dns_presets_test-" +
+                     std::to_string(getpid()) + ".bin";
+  ASSERT_TRUE(presets.Save(path, &error)) << error;
+
+  DnsPresets loaded;
+  ASSERT_TRUE(loaded.Load(path, &error)) << error;
+  ASSERT_EQ(loaded.presets().size(), 2u);
+  const DnsPreset* corporate = loaded.Find("corporate");
+  ASSERT_NE(corporate, nullptr);
+  EXPECT_FALSE(corporate->global);
+  EXPECT_EQ(corporate->servers,
+            (std::vector<std::string>{"10.0.0.53", "fd00::53"}));
+  EXPECT_EQ(corporate->properties.size(), 4u);
+  EXPECT_TRUE(loaded.Find("filtering")->global);
+  unlink(path.c_str());
+
+  // A missing file holds no presets.
+  ASSERT_TRUE(loaded.Load(path, &error));
+  EXPECT_TRUE(loaded.presets().empty());
+}
+
+TEST(DnsPresets, RejectsDamagedFiles) {
+  DnsPresets presets;
+  std::string error;
+  ASSERT_TRUE(presets.Define("public", "1.1.1.1", false, &error));
+  std::vector<uint8_t> image = presets.Serialize();
+
+  DnsPresets parsed;
+  ASSERT_TRUE(parsed.Define("kept", "8.8.8.8", false, &error));
+  std::vector<uint8_t> corrupt = image;
+  corrupt.back() ^= 1;
+  EXPECT_FALSE(parsed.Parse(corrupt.data(), corrupt.size(), &error));
+  EXPECT_FALSE(parsed.Parse(image.data(), image.size() - 1, &error));
+  EXPECT_FALSE(parsed.Parse(image.data(), 3, &error));
+  // A failed parse keeps what was there.
+  EXPECT_NE(parsed.Find("kept"), nullptr);
+
+  ASSERT_TRUE(parsed.Parse(image.data(), image.size(), &error));
+  EXPECT_EQ(parsed.Find("kept"), nullptr);
+  EXPECT_NE(parsed.Find("public"), nullptr);
+}
+
+TEST(DnsPresets, ComparesWithTheMonitoredConnection) {
+  DnsPresets presets;
+  std::string error;
+  ASSERT_TRUE(presets.Define("public", "1.1.1.1,1.0.0.1", false, &error));
+  NetworkConnection connection;
+  connection.has_settings = true;
+  connection.ipv4_dns = {"1.1.1.1", "1.0.0.1"};
+  connection.ipv4_ignore_auto_dns = true;
+  const DnsPreset* preset = presets.Find("public");
+  EXPECT_TRUE(
+      ChangedProperties(preset->properties, ConnectionDnsProperties(connection))
+          .empty());
+
+  connection.ipv4_dns = {"8.8.8.8"};
+  std::vector<ConnectionProperty> changed = ChangedProperties(
+      preset->properties, ConnectionDnsProperties(connection));
+  ASSERT_EQ(changed.size(), 1u);
+  EXPECT_EQ(changed[0].name, "ipv4.dns");
+
+  // Without the profile's settings everything counts as changed.
+  connection.has_settings = false;
+  EXPECT_TRUE(ConnectionDnsProperties(connection).empty());
+}
+
+}  // namespace test
+}  // namespace dns_manager
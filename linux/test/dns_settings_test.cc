@@ -0,0 +1,80 @@
+#include "dns_settings.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+std::vector<std::string> ChangedNames(
+    const std::vector<ConnectionProperty>& desired,
+    const std::map<std::string, std::string>& current) {
+  std::vector<std::string> names;
+  for (const ConnectionProperty& property : ChangedProperties(desired, current)) {
+    names.push_back(property.name);
+  }
+  return names;
+}
+
+}  // namespace
+
+TEST(DnsSettings, ParsesTerseNmcliOutput) {
+  std::map<std::string, std::string> properties = ParseNmcliProperties(
+      "ipv4.dns:8.8.8.8,8.8.4.4\n"
+      "ipv4.ignore-auto-dns:yes\n"
+      "ipv6.dns:2001\\:4860\\:4860\\:\\:8888\n"
+      "ipv6.ignore-auto-dns:no\n");
+  EXPECT_EQ(properties["ipv4.dns"], "8.8.8.8,8.8.4.4");
+  EXPECT_EQ(properties["ipv4.ignore-auto-dns"], "yes");
+  EXPECT_EQ(properties["ipv6.dns"], "2001:4860:4860::8888");
+  EXPECT_EQ(properties.size(), 4u);
+}
+
+TEST(DnsSettings, CanonicalisesServers) {
+  std::string ipv4;
+  std::string ipv6;
+  ASSERT_TRUE(CanonicalDnsServers(
+      " 8.8.8.8, 2001:4860:4860:0:0:0:0:8888 ,8.8.4.4,8.8.8.8:53", &ipv4,
+      &ipv6));
+  EXPECT_EQ(ipv4, "8.8.8.8,8.8.4.4");
+  EXPECT_EQ(ipv6, "2001:4860:4860::8888");
+  EXPECT_FALSE(CanonicalDnsServers("dns.example", &ipv4, &ipv6));
+  ASSERT_TRUE(CanonicalDnsServers("--", &ipv4, &ipv6));
+  EXPECT_TRUE(ipv4.empty() && ipv6.empty());
+}
+
+TEST(DnsSettings, SkipsPropertiesThatAlreadyMatch) {
+  std::vector<ConnectionProperty> desired;
+  ASSERT_TRUE(DnsPropertiesFor("8.8.8.8,8.8.4.4", &desired));
+  std::map<std::string, std::string> current = {
+      {"ipv4.dns", "8.8.8.8, 8.8.4.4"},
+      {"ipv4.ignore-auto-dns", "yes"},
+      {"ipv6.dns", ""},
+      {"ipv6.ignore-auto-dns", "no"},
+  };
+  EXPECT_TRUE(ChangedNames(desired, current).empty());
+
+  // Server order is a preference, so a reordered list is a change; only the
+  // field that differs is touched.
+  ASSERT_TRUE(DnsPropertiesFor("8.8.4.4,8.8.8.8", &desired));
+  EXPECT_EQ(ChangedNames(desired, current),
+            std::vector<std::string>({"ipv4.dns"}));
+
+  // IPv6 servers go to ipv6.dns and turn off automatic IPv6 DNS.
+  ASSERT_TRUE(DnsPropertiesFor("8.8.8.8,8.8.4.4,2001:4860:4860::8888",
+                               &desired));
+  EXPECT_EQ(ChangedNames(desired, current),
+            std::vector<std::string>({"ipv6.dns", "ipv6.ignore-auto-dns"}));
+
+  // Properties nmcli did not report are applied.
+  EXPECT_EQ(ChangedNames(AutomaticDnsProperties(), {}).size(), 4u);
+  EXPECT_FALSE(DnsPropertiesFor("", &desired));
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,70 @@
+#include "domain_trie.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+uint32_t Match(const DomainTrie& trie, const char* name) {
+  return trie.Match(name, strlen(name));
+}
+
+}  // namespace
+
+TEST(DomainTrie, PicksTheLongestMatchingSuffix) {
+  DomainTrie trie;
+  ASSERT_TRUE(trie.Insert("example.com", 1));
+  ASSERT_TRUE(trie.Insert("corp.example.com", 2));
+  ASSERT_TRUE(trie.Insert("*.lab.corp.example.com", 3));
+
+  EXPECT_EQ(Match(trie, "example.com"), 1u);
+  EXPECT_EQ(Match(trie, "www.example.com"), 1u);
+  EXPECT_EQ(Match(trie, "corp.example.com"), 2u);
+  EXPECT_EQ(Match(trie, "git.corp.example.com"), 2u);
+  EXPECT_EQ(Match(trie, "a.b.lab.corp.example.com"), 3u);
+  // Suffixes match whole labels only.
+  EXPECT_EQ(Match(trie, "notcorp.example.com"), 1u);
+  EXPECT_EQ(Match(trie, "example.org"), DomainTrie::kNoMatch);
+  EXPECT_EQ(Match(trie, "com"), DomainTrie::kNoMatch);
+  EXPECT_EQ(Match(trie, ""), DomainTrie::kNoMatch);
+  EXPECT_EQ(trie.size(), 3u);
+}
+
+TEST(DomainTrie, NormalisesAndValidatesSuffixes) {
+  DomainTrie trie;
+  EXPECT_TRUE(trie.Insert(".Corp.Example.COM.", 1));
+  EXPECT_EQ(Match(trie, "host.corp.example.com"), 1u);
+  // Re-adding a rule replaces its value.
+  EXPECT_TRUE(trie.Insert("corp.example.com", 2));
+  EXPECT_EQ(Match(trie, "host.corp.example.com"), 2u);
+  EXPECT_EQ(trie.size(), 1u);
+
+  EXPECT_FALSE(trie.Insert("bad..example", 3));
+  EXPECT_FALSE(trie.Insert("spa ce.example", 3));
+  EXPECT_FALSE(trie.Insert(std::string(64, 'a') + ".example", 3));
+
+  // The root rule catches everything else.
+  EXPECT_TRUE(trie.Insert(".", 9));
+  EXPECT_EQ(Match(trie, "example.org"), 9u);
+  EXPECT_EQ(Match(trie, "host.corp.example.com"), 2u);
+}
+
+TEST(DomainTrie, ManyRulesStayDistinct) {
+  DomainTrie trie;
+  for (uint32_t i = 0; i < 20000; i++) {
+    ASSERT_TRUE(trie.Insert("team" + std::to_string(i) + ".corp.example", i));
+  }
+  for (uint32_t i = 0; i < 20000; i += 7) {
+    std::string name = "host.team" + std::to_string(i) + ".corp.example";
+    ASSERT_EQ(trie.Match(name.data(), name.size()), i);
+  }
+  EXPECT_EQ(Match(trie, "host.team20000.corp.example"), DomainTrie::kNoMatch);
+}
+
+}  // namespace test
+}  // namespace dns_manager
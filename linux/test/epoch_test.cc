@@ -0,0 +1,87 @@
+#include "epoch.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+// Counts live instances and poisons itself on destruction so that a reader
+// using a freed object notices.
+struct Tracked {
+  explicit Tracked(std::atomic<int>* live) : live(live) { (*live)++; }
+  ~Tracked() {
+    (*live)--;
+    value = 0;
+  }
+  std::atomic<int>* live;
+  int value = 42;
+};
+
+}  // namespace
+
+TEST(RcuPointer, KeepsReplacedObjectsWhileReadersHoldThem) {
+  std::atomic<int> live{0};
+  EpochDomain domain;
+  RcuPointer<Tracked> pointer(&domain);
+  pointer.Publish(std::unique_ptr<Tracked>(new Tracked(&live)));
+
+  EpochDomain::Reader reader(&domain);
+  {
+    EpochDomain::ReadSection read(&reader);
+    const Tracked* seen = pointer.Load();
+    pointer.Publish(std::unique_ptr<Tracked>(new Tracked(&live)));
+    EXPECT_EQ(live.load(), 2);
+    EXPECT_EQ(pointer.Reclaim(), 1u);
+    EXPECT_EQ(seen->value, 42);
+    EXPECT_NE(pointer.Load(), seen);
+  }
+  EXPECT_EQ(pointer.Reclaim(), 0u);
+  EXPECT_EQ(live.load(), 1);
+
+  // Idle readers do not hold anything back.
+  pointer.Publish(nullptr);
+  EXPECT_EQ(live.load(), 0);
+}
+
+TEST(RcuPointer, ReadersNeverSeeFreedObjects) {
+  std::atomic<int> live{0};
+  EpochDomain domain;
+  RcuPointer<Tracked> pointer(&domain);
+  pointer.Publish(std::unique_ptr<Tracked>(new Tracked(&live)));
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> bad_reads{0};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&] {
+      EpochDomain::Reader reader(&domain);
+      while (!stop) {
+        EpochDomain::ReadSection read(&reader);
+        const Tracked* seen = pointer.Load();
+        if (seen == nullptr || seen->value != 42) {
+          bad_reads++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 20000; i++) {
+    pointer.Publish(std::unique_ptr<Tracked>(new Tracked(&live)));
+  }
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(bad_reads.load(), 0);
+  EXPECT_EQ(pointer.Reclaim(), 0u);
+  EXPECT_EQ(live.load(), 1);
+}
+
+}  // namespace test
+}  // namespace dns_manager
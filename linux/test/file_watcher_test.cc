@@ -0,0 +1,91 @@
+#include "file_watcher.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "file_util.h"
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+void CountChange(void* context) {
+  static_cast<std::atomic<int>*>(context)->fetch_add(1);
+}
+
+// Waits up to a second for |changes| to reach |expected|.
+int WaitFor(const std::atomic<int>& changes, int expected) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (changes < expected && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return changes;
+}
+
+void WriteText(const std::string& path, const char* text) {
+  FILE* file = fopen(path.c_str(), "w");
+  ASSERT_NE(file, nullptr);
+  fputs(text, file);
+  fclose(file);
+}
+
+}  // namespace
+
+TEST(FileWatcherTest, ReportsEditsAndReplacementsOfTheFileOnly) {
+  std::string path = testing::TempDir() + "file_watcher_test.hosts";
+  std::string other = testing::TempDir() + "file_watcher_test.other";
+  WriteText(path, "10.0.0.1 a.example\n");
+  std::atomic<int> changes{0};
+  FileWatcher watcher(path);
+  watcher.set_change_callback(CountChange, &changes);
+  std::string error;
+  ASSERT_TRUE(watcher.Start(&error)) << error;
+
+  // Written in place.
+  WriteText(path, "10.0.0.2 a.example\n");
+  EXPECT_EQ(WaitFor(changes, 1), 1);
+
+  // Replaced with a rename, as editors and configuration tools do.
+  const char kText[] = "10.0.0.3 a.example\n";
+  ASSERT_TRUE(WriteFileAtomically(path,
+                                  reinterpret_cast<const uint8_t*>(kText),
+                                  sizeof(kText) - 1, &error))
+      << error;
+  EXPECT_EQ(WaitFor(changes, 2), 2);
+
+  // Other files in the directory are ignored, and a burst of writes is
+  // reported once.
+  WriteText(other, "ignored\n");
+  for (int i = 0; i < 5; i++) {
+    WriteText(path, kText);
+  }
+  EXPECT_EQ(WaitFor(changes, 3), 3);
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(FileWatcher::kSettleMs * 3));
+  EXPECT_EQ(changes, 3);
+
+  watcher.Stop();
+  WriteText(path, kText);
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(FileWatcher::kSettleMs * 3));
+  EXPECT_EQ(changes, 3);
+  unlink(path.c_str());
+  unlink(other.c_str());
+}
+
+TEST(FileWatcherTest, FailsForAMissingDirectory) {
+  FileWatcher watcher(testing::TempDir() + "no-such-directory/hosts");
+  std::string error;
+  EXPECT_FALSE(watcher.Start(&error));
+  EXPECT_NE(error.find("inotify_add_watch"), std::string::npos) << error;
+}
+
+}  // namespace test
+}  // namespace dns_manager
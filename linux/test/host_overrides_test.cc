@@ -0,0 +1,150 @@
+#include "host_overrides.h"
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "dns_message.h"
+#include "file_util.h"
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+class HostOverridesTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "host_overrides_test.idx";
+  }
+  void TearDown() override { unlink(path_.c_str()); }
+
+  std::unique_ptr<HostOverrides> Compile(const HostOverridesBuilder& builder) {
+    std::vector<uint8_t> image = builder.Build();
+    std::string error;
+    EXPECT_TRUE(WriteFileAtomically(path_, image.data(), image.size(), &error))
+        << error;
+    std::unique_ptr<HostOverrides> overrides =
+        HostOverrides::Open(path_, &error);
+    EXPECT_NE(overrides, nullptr) << error;
+    return overrides;
+  }
+
+  std::unique_ptr<HostOverrides> Compile(const char* text) {
+    HostOverridesBuilder builder;
+    const char* line = text;
+    while (*line != '\0') {
+      const char* end = strchr(line, '\n');
+      size_t length = end != nullptr ? end - line : strlen(line);
+      builder.AddLine(line, length);
+      line += length + (end != nullptr ? 1 : 0);
+    }
+    return Compile(builder);
+  }
+
+  // The records of |name| in presentation form: addresses as text, CNAME
+  // targets as names.
+  static std::vector<std::string> Lookup(const HostOverrides& overrides,
+                                         const char* name) {
+    HostOverrides::Record records[HostOverrides::kMaxRecordsPerName];
+    size_t count = overrides.Find(name, strlen(name), records);
+    std::vector<std::string> found;
+    for (size_t i = 0; i < count; i++) {
+      char text[kMaxDnsNameLength + 1];
+      if (records[i].type == kTypeCname) {
+        found.push_back(
+            "CNAME " +
+            DnsNameView(records[i].rdata, records[i].rdata_length, 0)
+                .ToString());
+      } else {
+        inet_ntop(records[i].type == kTypeA ? AF_INET : AF_INET6,
+                  records[i].rdata, text, sizeof(text));
+        found.push_back(text);
+      }
+    }
+    return found;
+  }
+
+  std::string path_;
+};
+
+using Records = std::vector<std::string>;
+
+}  // namespace
+
+TEST_F(HostOverridesTest, ReadsHostsLinesAndAliases) {
+  std::unique_ptr<HostOverrides> overrides = Compile(
+      "# Pinned for the site\n"
+      "10.1.2.3 git.corp.example  GitLab.Corp.Example.  # two names\n"
+      "10.1.2.4\tgit.corp.example\n"
+      "fd00::5 git.corp.example\n"
+      "wiki.corp.example CNAME docs.corp.example\n"
+      "wiki.corp.example CNAME other.corp.example\n"
+      "10.9.9.9 wiki.corp.example\n"
+      "not-an-address bad.example\n"
+      "10.1.2.3 bad..example\n");
+  ASSERT_NE(overrides, nullptr);
+  EXPECT_EQ(overrides->size(), 3u);
+  EXPECT_EQ(Lookup(*overrides, "git.corp.example"),
+            (Records{"10.1.2.3", "10.1.2.4", "fd00::5"}));
+  EXPECT_EQ(Lookup(*overrides, "gitlab.corp.example"), Records{"10.1.2.3"});
+  // The first CNAME wins and excludes addresses.
+  EXPECT_EQ(Lookup(*overrides, "wiki.corp.example"),
+            Records{"CNAME docs.corp.example"});
+  EXPECT_TRUE(Lookup(*overrides, "corp.example").empty());
+  EXPECT_TRUE(Lookup(*overrides, "bad.example").empty());
+}
+
+TEST_F(HostOverridesTest, FindsEveryNameOfALargeTable) {
+  HostOverridesBuilder builder;
+  const size_t kNames = 20000;
+  for (size_t i = 0; i < kNames; i++) {
+    std::string address = "10.0." + std::to_string(i / 256) + "." +
+                          std::to_string(i % 256);
+    ASSERT_TRUE(builder.AddAddress(
+        "host" + std::to_string(i) + ".site.example", address));
+  }
+  std::unique_ptr<HostOverrides> overrides = Compile(builder);
+  ASSERT_NE(overrides, nullptr);
+  EXPECT_EQ(overrides->size(), kNames);
+  for (size_t i = 0; i < kNames; i++) {
+    std::string name = "host" + std::to_string(i) + ".site.example";
+    std::string address = "10.0." + std::to_string(i / 256) + "." +
+                          std::to_string(i % 256);
+    ASSERT_EQ(Lookup(*overrides, name.c_str()), Records{address}) << name;
+    name = "host" + std::to_string(i) + ".other.example";
+    ASSERT_TRUE(Lookup(*overrides, name.c_str()).empty()) << name;
+  }
+}
+
+TEST_F(HostOverridesTest, EmptyTableMatchesNothing) {
+  std::unique_ptr<HostOverrides> overrides = Compile("");
+  ASSERT_NE(overrides, nullptr);
+  EXPECT_EQ(overrides->size(), 0u);
+  EXPECT_TRUE(Lookup(*overrides, "git.corp.example").empty());
+}
+
+TEST_F(HostOverridesTest, RejectsDamagedFiles) {
+  ASSERT_NE(Compile("10.1.2.3 git.corp.example\n"), nullptr);
+  std::string error;
+  ASSERT_EQ(truncate(path_.c_str(), 100), 0);
+  EXPECT_EQ(HostOverrides::Open(path_, &error), nullptr);
+
+  ASSERT_NE(Compile("10.1.2.3 git.corp.example\n"), nullptr);
+  FILE* file = fopen(path_.c_str(), "r+b");
+  ASSERT_NE(file, nullptr);
+  // Name count field.
+  fseek(file, 16, SEEK_SET);
+  fputc(0x7f, file);
+  fclose(file);
+  EXPECT_EQ(HostOverrides::Open(path_, &error), nullptr);
+  EXPECT_NE(error.find("checksum"), std::string::npos) << error;
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,996 @@
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_util.h"
+#include "local_resolver.h"
+#include "test/stub_upstream.h"
+#include "test/test_certificates.h"
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+// Sends |query| to |resolver| and waits up to |timeout_ms| for the answer.
+ssize_t Exchange(const SocketAddress& resolver, const uint8_t* query,
+                 size_t length, uint8_t* response, size_t capacity,
+                 int timeout_ms = 2000) {
+  int fd = socket(resolver.family(), SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  sendto(fd, query, length, 0, resolver.sockaddr_ptr(), resolver.length);
+  pollfd poll_fd = {fd, POLLIN, 0};
+  ssize_t received = -1;
+  if (poll(&poll_fd, 1, timeout_ms) == 1) {
+    received = recv(fd, response, capacity, 0);
+  }
+  close(fd);
+  return received;
+}
+
+// Opens a TCP connection to |resolver| whose reads give up after two
+// seconds.
+int ConnectTcp(const SocketAddress& resolver) {
+  int fd = socket(resolver.family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+  timeval timeout = {2, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  connect(fd, resolver.sockaddr_ptr(), resolver.length);
+  return fd;
+}
+
+// Writes |query| to the TCP connection |fd| with its length prefix.
+void SendTcp(int fd, const uint8_t* query, size_t length) {
+  uint8_t prefix[2] = {static_cast<uint8_t>(length >> 8),
+                       static_cast<uint8_t>(length)};
+  send(fd, prefix, sizeof(prefix), MSG_MORE);
+  send(fd, query, length, 0);
+}
+
+// Reads one length-prefixed message from |fd| into |response|.
+ssize_t ReceiveTcp(int fd, uint8_t* response, size_t capacity) {
+  uint8_t prefix[2];
+  if (recv(fd, prefix, sizeof(prefix), MSG_WAITALL) != 2) {
+    return -1;
+  }
+  size_t length = static_cast<size_t>(prefix[0]) << 8 | prefix[1];
+  if (length > capacity) {
+    return -1;
+  }
+  return recv(fd, response, length, MSG_WAITALL);
+}
+
+BlocklistView BlockOne(const char* line) {
+  BlocklistBuilder builder;
+  builder.AddLine(line, strlen(line));
+  std::vector<uint8_t> image = builder.Build();
+  std::string path = testing::TempDir() + "local_resolver_blocklist.idx";
+  std::string error;
+  WriteFileAtomically(path, image.data(), image.size(), &error);
+  std::shared_ptr<const Blocklist> blocklist = Blocklist::Open(path, &error);
+  // The mapping outlives the file.
+  unlink(path.c_str());
+  return BlocklistView(std::move(blocklist), nullptr);
+}
+
+std::shared_ptr<const HostOverrides> Override(const char* text) {
+  HostOverridesBuilder builder;
+  const char* line = text;
+  while (*line != '\0') {
+    const char* end = strchr(line, '\n');
+    size_t length = end != nullptr ? end - line : strlen(line);
+    builder.AddLine(line, length);
+    line += length + (end != nullptr ? 1 : 0);
+  }
+  std::vector<uint8_t> image = builder.Build();
+  std::string path = testing::TempDir() + "local_resolver_hosts.idx";
+  std::string error;
+  WriteFileAtomically(path, image.data(), image.size(), &error);
+  std::shared_ptr<const HostOverrides> overrides =
+      HostOverrides::Open(path, &error);
+  unlink(path.c_str());
+  return overrides;
+}
+
+ResolverConfig LoopbackConfig(const SocketAddress& upstream) {
+  ResolverConfig config;
+  config.listen_port = 0;
+  config.upstreams.push_back(upstream);
+  return config;
+}
+
+}  // namespace
+
+TEST(LocalResolver, ForwardsQueriesAndCountsNames) {
+  StubUpstream upstream;
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 3; id++) {
+    size_t length = MakeQuery("Example.COM", id, 1, query);
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    EXPECT_EQ(GetMessageId(response), id);
+    EXPECT_TRUE(IsResponse(response));
+    EXPECT_EQ(ReadU16(response + 6), 1);
+  }
+
+  std::vector<DomainCount> top = resolver.TopDomains(10);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].name, "example.com");
+  EXPECT_NEAR(top[0].count, 3, 0.01);
+}
+
+TEST(LocalResolver, FailsOverToNextUpstream) {
+  StubUpstream dead;
+  dead.set_silent(true);
+  StubUpstream alive;
+  ResolverConfig config = LoopbackConfig(dead.address());
+  config.upstreams.push_back(alive.address());
+  config.upstream_timeout_ms = 100;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("example.org", 7, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(dead.queries(), 1u);
+  EXPECT_EQ(alive.queries(), 1u);
+}
+
+TEST(LocalResolver, SkipsAnUpstreamThatTimedOut) {
+  StubUpstream dead;
+  dead.set_silent(true);
+  StubUpstream alive;
+  ResolverConfig config = LoopbackConfig(dead.address());
+  config.upstreams.push_back(alive.address());
+  config.upstream_timeout_ms = 100;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  const char* names[] = {"a.example.org", "b.example.org", "c.example.org"};
+  for (const char* name : names) {
+    size_t length = MakeQuery(name, 7, 1, query);
+    auto start = std::chrono::steady_clock::now();
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    EXPECT_EQ(GetRcode(response), kRcodeNoError);
+    if (name != names[0]) {
+      EXPECT_LT(std::chrono::steady_clock::now() - start,
+                std::chrono::milliseconds(100));
+    }
+  }
+  // Only the first query waited for the dead upstream.
+  EXPECT_EQ(dead.queries(), 1u);
+  EXPECT_EQ(alive.queries(), 3u);
+
+  std::vector<UpstreamScore> scores = resolver.UpstreamScores();
+  ASSERT_EQ(scores.size(), 2u);
+  EXPECT_EQ(scores[0].address, dead.address());
+  EXPECT_EQ(scores[0].timeouts, 1u);
+  EXPECT_FALSE(scores[0].available);
+  EXPECT_EQ(scores[1].answers, 3u);
+  EXPECT_TRUE(scores[1].available);
+  EXPECT_GT(scores[1].srtt_ms, 0);
+}
+
+TEST(LocalResolver, ServFailWhenAllUpstreamsTimeOut) {
+  StubUpstream dead;
+  dead.set_silent(true);
+  ResolverConfig config = LoopbackConfig(dead.address());
+  config.upstream_timeout_ms = 50;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("example.net", 9, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetMessageId(response), 9);
+  EXPECT_EQ(GetRcode(response), kRcodeServFail);
+}
+
+TEST(LocalResolver, DropsAnswersToAnotherQuestion) {
+  StubUpstream upstream;
+  upstream.set_wrong_question(true);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.upstream_timeout_ms = 50;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("example.org", 4, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetRcode(response), kRcodeServFail);
+
+  // Nothing was cached from the forged answer.
+  upstream.set_wrong_question(false);
+  received = Exchange(resolver.bound_address(), query, length, response,
+                      sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(upstream.queries(), 2u);
+  EXPECT_EQ(resolver.Stats().cache_misses, 2u);
+}
+
+TEST(LocalResolver, SendsUpstreamQueriesFromChangingPorts) {
+  StubUpstream upstream;
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 300; id++) {
+    std::string name = "host" + std::to_string(id) + ".example";
+    size_t length = MakeQuery(name.c_str(), id, 1, query);
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    ASSERT_EQ(GetRcode(response), kRcodeNoError);
+  }
+  // Four sockets to start with, each replaced after 32 queries.
+  EXPECT_GT(upstream.source_ports(), 4u);
+}
+
+TEST(LocalResolver, AnswersRepeatedQueriesFromCache) {
+  StubUpstream upstream(300);
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 5; id++) {
+    size_t length = MakeQuery("cached.example", id, 1, query);
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    EXPECT_EQ(GetMessageId(response), id);
+    uint32_t ttl = 0;
+    ASSERT_TRUE(FindMinimumTtl(response, received, &ttl));
+    EXPECT_LE(ttl, 300u);
+  }
+
+  EXPECT_EQ(upstream.queries(), 1u);
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.queries, 5u);
+  EXPECT_EQ(stats.cache_misses, 1u);
+  EXPECT_EQ(stats.cache_hits, 4u);
+}
+
+TEST(LocalResolver, TruncatesLargeUdpAnswersAndServesThemOverTcp) {
+  StubUpstream upstream(300);
+  upstream.set_answer_count(60);
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  std::vector<uint8_t> response(kMaxTcpMessageSize);
+  size_t length = MakeQuery("large.example", 3, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response.data(), kMaxUdpMessageSize);
+  ASSERT_GT(received, 0);
+  EXPECT_LE(received, static_cast<ssize_t>(kMinUdpPayloadSize));
+  EXPECT_TRUE(IsTruncated(response.data()));
+  EXPECT_EQ(ReadU16(response.data() + 6), 0);
+
+  // The client retries over TCP, which goes straight to TCP upstream.
+  int fd = ConnectTcp(resolver.bound_address());
+  SendTcp(fd, query, length);
+  received = ReceiveTcp(fd, response.data(), response.size());
+  ASSERT_GT(received, static_cast<ssize_t>(kMinUdpPayloadSize));
+  EXPECT_EQ(GetMessageId(response.data()), 3);
+  EXPECT_FALSE(IsTruncated(response.data()));
+  EXPECT_EQ(ReadU16(response.data() + 6), 60);
+
+  // Now cached: UDP still gets it truncated, TCP in full.
+  received = Exchange(resolver.bound_address(), query, length,
+                      response.data(), kMaxUdpMessageSize);
+  ASSERT_GT(received, 0);
+  EXPECT_TRUE(IsTruncated(response.data()));
+  SendTcp(fd, query, length);
+  received = ReceiveTcp(fd, response.data(), response.size());
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(ReadU16(response.data() + 6), 60);
+  close(fd);
+
+  EXPECT_EQ(upstream.tcp_queries(), 1u);
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.tcp_queries, 2u);
+  EXPECT_EQ(stats.upstream_tcp_queries, 1u);
+  EXPECT_EQ(stats.cache_hits, 2u);
+}
+
+TEST(LocalResolver, PipelinesTcpQueriesOnOnePooledConnection) {
+  StubUpstream upstream(300);
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  // All queries go out before any answer is read; the upstream answers
+  // them out of order.
+  constexpr uint16_t kQueries = 8;
+  int fd = ConnectTcp(resolver.bound_address());
+  uint8_t query[512];
+  for (uint16_t id = 1; id <= kQueries; id++) {
+    std::string name = "pipelined" + std::to_string(id) + ".example";
+    SendTcp(fd, query, MakeQuery(name.c_str(), id, 1, query));
+  }
+  uint8_t response[kMaxUdpMessageSize];
+  std::vector<bool> answered(kQueries + 1, false);
+  for (uint16_t i = 0; i < kQueries; i++) {
+    ssize_t received = ReceiveTcp(fd, response, sizeof(response));
+    ASSERT_GT(received, 0);
+    DnsQuestion question;
+    ASSERT_TRUE(ParseFirstQuestion(response, received, &question));
+    uint16_t id = GetMessageId(response);
+    ASSERT_GE(id, 1);
+    ASSERT_LE(id, kQueries);
+    EXPECT_EQ(question.name,
+              "pipelined" + std::to_string(id) + ".example");
+    answered[id] = true;
+  }
+  close(fd);
+  for (uint16_t id = 1; id <= kQueries; id++) {
+    EXPECT_TRUE(answered[id]) << id;
+  }
+
+  EXPECT_EQ(upstream.tcp_queries(), kQueries);
+  EXPECT_EQ(upstream.tcp_connections(), 1u);
+  EXPECT_EQ(resolver.Stats().upstream_tcp_connections, 1u);
+}
+
+TEST(LocalResolver, ParsesTlsUpstreams) {
+  ResolverConfig config;
+  ASSERT_TRUE(ParseUpstreams(
+      "8.8.8.8, tls://1.1.1.1#cloudflare-dns.com,tls://[::1]:8853", &config));
+  ASSERT_EQ(config.upstreams.size(), 3u);
+  EXPECT_EQ(config.upstreams[0].ToString(), "8.8.8.8:53");
+  ASSERT_EQ(config.tls_upstreams.size(), 2u);
+  EXPECT_EQ(config.tls_upstreams[0].address.ToString(), "1.1.1.1:853");
+  EXPECT_EQ(config.tls_upstreams[0].server_name, "cloudflare-dns.com");
+  EXPECT_EQ(config.upstreams[1], config.tls_upstreams[0].address);
+  EXPECT_EQ(config.tls_upstreams[1].address.ToString(), "[::1]:8853");
+  EXPECT_EQ(config.tls_upstreams[1].server_name, "");
+
+  EXPECT_FALSE(ParseUpstreams("tls://1.1.1.1#", &config));
+  EXPECT_FALSE(ParseUpstreams("tls://example.com", &config));
+  EXPECT_FALSE(ParseUpstreams(" , ", &config));
+}
+
+TEST(LocalResolver, ForwardsOverTlsOnPooledResumedConnections) {
+  TestCertificates certificates;
+  SSL_CTX* server_tls = certificates.NewServerContext();
+  StubUpstream upstream(300);
+  upstream.EnableTls(server_tls);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.tls_upstreams.push_back({upstream.address(), "dns.test"});
+  config.tls_ca_file = certificates.ca_file();
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  {
+    // Every name goes over the one connection.
+    LocalResolver resolver(config);
+    std::string error;
+    ASSERT_TRUE(resolver.Start(&error)) << error;
+    for (uint16_t id = 1; id <= 4; id++) {
+      std::string name = "tls" + std::to_string(id) + ".example";
+      size_t length = MakeQuery(name.c_str(), id, 1, query);
+      ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                  response, sizeof(response));
+      ASSERT_GT(received, 0);
+      EXPECT_EQ(GetMessageId(response), id);
+      EXPECT_EQ(GetRcode(response), kRcodeNoError);
+    }
+    ResolverStats stats = resolver.Stats();
+    EXPECT_EQ(stats.upstream_tcp_connections, 1u);
+    EXPECT_EQ(stats.upstream_tcp_queries, 4u);
+    EXPECT_EQ(stats.tls_handshakes, 1u);
+  }
+  EXPECT_EQ(upstream.tcp_connections(), 1u);
+  EXPECT_EQ(upstream.tcp_queries(), 4u);
+
+  // Closing the connection once it goes quiet forces a handshake per
+  // query; all but the first resume the session.
+  config.upstream_tcp_idle_timeout_ms = 0;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+  for (uint16_t id = 1; id <= 3; id++) {
+    std::string name = "resumed" + std::to_string(id) + ".example";
+    size_t length = MakeQuery(name.c_str(), id, 1, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+  }
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.tls_handshakes, 3u);
+  EXPECT_EQ(stats.tls_resumed_handshakes, 2u);
+  resolver.Stop();
+  SSL_CTX_free(server_tls);
+}
+
+TEST(LocalResolver, RetriesTlsQueryWhenUpstreamClosesConnection) {
+  TestCertificates certificates;
+  SSL_CTX* server_tls = certificates.NewServerContext();
+  StubUpstream upstream(300);
+  upstream.EnableTls(server_tls);
+  upstream.set_dropped_connections(1);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.tls_upstreams.push_back({upstream.address(), "dns.test"});
+  config.tls_ca_file = certificates.ca_file();
+  // Long enough that only the retry on a fresh connection can answer in
+  // time.
+  config.upstream_timeout_ms = 5000;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("dropped.example", 9, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response), 1000);
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetMessageId(response), 9);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(upstream.tcp_connections(), 2u);
+  EXPECT_EQ(upstream.tcp_queries(), 2u);
+  resolver.Stop();
+  SSL_CTX_free(server_tls);
+}
+
+TEST(LocalResolver, RejectsTlsUpstreamWithWrongName) {
+  TestCertificates certificates;
+  SSL_CTX* server_tls = certificates.NewServerContext();
+  StubUpstream upstream(300);
+  upstream.EnableTls(server_tls);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.tls_upstreams.push_back({upstream.address(), "other.test"});
+  config.tls_ca_file = certificates.ca_file();
+  config.upstream_timeout_ms = 200;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("spoofed.example", 5, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetRcode(response), kRcodeServFail);
+  EXPECT_EQ(upstream.tcp_queries(), 0u);
+  EXPECT_EQ(resolver.Stats().tls_handshakes, 0u);
+  resolver.Stop();
+  SSL_CTX_free(server_tls);
+}
+
+TEST(LocalResolver, RecordsQueryEventsWhileEnabled) {
+  StubUpstream upstream(300);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.query_event_capacity = 16;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("ignored.example", 1, 1, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  resolver.SetQueryEventsEnabled(true);
+  for (uint16_t id = 2; id <= 3; id++) {
+    length = MakeQuery("logged.example", id, 1, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+  }
+
+  QueryEventBatch batch;
+  ASSERT_EQ(resolver.DrainQueryEvents(&batch, 10), 2u);
+  const std::vector<uint8_t>& bytes = batch.bytes();
+  size_t first = QueryEventBatch::kHeaderSize;
+  size_t second = first + 13 + strlen("logged.example");
+  EXPECT_EQ(bytes[first + 11], static_cast<uint8_t>(QuerySource::kUpstream));
+  EXPECT_EQ(bytes[second + 11], static_cast<uint8_t>(QuerySource::kCache));
+  EXPECT_EQ(std::string(bytes.begin() + second + 13, bytes.end()),
+            "logged.example");
+}
+
+TEST(LocalResolver, ShardsShareAnswersAndMergeQueryEvents) {
+  StubUpstream upstream(300);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.threads = 4;
+  config.query_event_capacity = 64;
+  LocalResolver resolver(config);
+  resolver.SetQueryEventsEnabled(true);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+  EXPECT_EQ(resolver.threads(), 4u);
+
+  // Every exchange uses a new client port, so the kernel spreads them over
+  // the threads; only the first may go upstream.
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 32; id++) {
+    size_t length = MakeQuery("sharded.example", id, 1, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+    EXPECT_EQ(GetMessageId(response), id);
+  }
+
+  EXPECT_EQ(upstream.queries(), 1u);
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.queries, 32u);
+  EXPECT_EQ(stats.cache_misses, 1u);
+  EXPECT_GT(stats.shared_cache_hits, 0u);
+
+  // A thread records its event just after sending the answer.
+  QueryEventBatch batch;
+  size_t drained = 0;
+  for (int attempt = 0; attempt < 100 && drained < 32; attempt++) {
+    drained += resolver.DrainQueryEvents(&batch, 64);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_EQ(drained, 32u);
+  const std::vector<uint8_t>& bytes = batch.bytes();
+  EXPECT_EQ(bytes[QueryEventBatch::kHeaderSize + 11],
+            static_cast<uint8_t>(QuerySource::kUpstream));
+  uint32_t previous_offset = 0;
+  size_t at = QueryEventBatch::kHeaderSize;
+  for (int i = 0; i < 32; i++) {
+    uint32_t offset = bytes[at] | bytes[at + 1] << 8 | bytes[at + 2] << 16 |
+                      static_cast<uint32_t>(bytes[at + 3]) << 24;
+    EXPECT_GE(offset, previous_offset);
+    previous_offset = offset;
+    at += 13 + bytes[at + 12];
+  }
+}
+
+TEST(LocalResolver, RefreshesHotEntriesAhead) {
+  StubUpstream upstream(300);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  // Every entry is inside the refresh window, so the second hit refreshes.
+  config.prefetch_fraction = 1.0;
+  config.prefetch_min_hits = 2;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 3; id++) {
+    size_t length = MakeQuery("hot.example", id, 1, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+  }
+  for (int i = 0; i < 100 && upstream.queries() < 2; i++) {
+    usleep(10000);
+  }
+  EXPECT_EQ(upstream.queries(), 2u);
+  // Give the resolver thread time to store the refreshed answer.
+  usleep(50000);
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.prefetches_issued, 1u);
+  EXPECT_EQ(stats.prefetch_hits, 0u);
+
+  // The next client is served from the refreshed entry.
+  size_t length = MakeQuery("hot.example", 4, 1, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  stats = resolver.Stats();
+  EXPECT_EQ(stats.prefetch_hits, 1u);
+  EXPECT_EQ(stats.prefetches_wasted, 0u);
+  EXPECT_EQ(stats.cache_misses, 1u);
+}
+
+TEST(LocalResolver, CachesNegativeAnswersForSoaMinimum) {
+  StubUpstream upstream(60);
+  upstream.set_nxdomain(true);
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 2; id++) {
+    size_t length = MakeQuery("missing.example", id, 1, query);
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    EXPECT_EQ(GetRcode(response), kRcodeNxDomain);
+    uint32_t ttl = 0;
+    ASSERT_TRUE(FindNegativeTtl(response, received, &ttl));
+    EXPECT_LE(ttl, 60u);
+  }
+
+  EXPECT_EQ(upstream.queries(), 1u);
+  EXPECT_EQ(resolver.Stats().negative_cache_hits, 1u);
+}
+
+TEST(LocalResolver, ServesStaleWhenUpstreamsFail) {
+  StubUpstream upstream(1);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.upstream_timeout_ms = 100;
+  config.client_response_timeout_ms = 50;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("flaky.example", 1, 1, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+
+  // Let the one-second TTL run out, then take the upstream away.
+  usleep(1100000);
+  upstream.set_silent(true);
+  length = MakeQuery("flaky.example", 2, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response), 500);
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetMessageId(response), 2);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  uint32_t ttl = 0;
+  ASSERT_TRUE(FindMinimumTtl(response, received, &ttl));
+  EXPECT_EQ(ttl, 30u);
+  EXPECT_EQ(resolver.Stats().stale_answers_served, 1u);
+}
+
+TEST(LocalResolver, DoesNotServeStaleBeyondMaximumAge) {
+  StubUpstream upstream(1);
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.upstream_timeout_ms = 50;
+  config.client_response_timeout_ms = 20;
+  config.max_stale_seconds = 0;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("flaky.example", 1, 1, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+
+  usleep(1100000);
+  upstream.set_silent(true);
+  length = MakeQuery("flaky.example", 2, 1, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeServFail);
+  EXPECT_EQ(resolver.Stats().stale_answers_served, 0u);
+}
+
+TEST(LocalResolver, AnswersBlockedNamesWithNxDomain) {
+  StubUpstream upstream;
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  resolver.SetBlocklist(BlockOne("||ads.example^"));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("pixel.ads.example", 5, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetMessageId(response), 5);
+  EXPECT_EQ(GetRcode(response), kRcodeNxDomain);
+  EXPECT_EQ(upstream.queries(), 0u);
+
+  // Unblocking takes effect for the next query.
+  resolver.SetBlocklist(BlocklistView());
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(upstream.queries(), 1u);
+  EXPECT_EQ(resolver.Stats().blocked_queries, 1u);
+}
+
+TEST(LocalResolver, AnswersBlockedNamesWithNullAddress) {
+  StubUpstream upstream;
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.blocking_mode = BlockingMode::kNullAddress;
+  LocalResolver resolver(config);
+  resolver.SetBlocklist(BlockOne("0.0.0.0 ads.example"));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t qtype : {kTypeA, kTypeAaaa, kTypeNs}) {
+    size_t length = MakeQuery("ads.example", qtype, qtype, query);
+    ssize_t received = Exchange(resolver.bound_address(), query, length,
+                                response, sizeof(response));
+    ASSERT_GT(received, 0);
+    EXPECT_EQ(GetRcode(response), kRcodeNoError);
+    DnsMessageReader reader(response, received);
+    DnsRecordView record;
+    if (qtype == kTypeNs) {
+      EXPECT_FALSE(reader.NextRecord(&record));
+      continue;
+    }
+    ASSERT_TRUE(reader.NextRecord(&record));
+    EXPECT_EQ(record.type, qtype);
+    EXPECT_EQ(record.rdata_length, qtype == kTypeA ? 4 : 16);
+    for (size_t i = 0; i < record.rdata_length; i++) {
+      EXPECT_EQ(record.rdata[i], 0);
+    }
+  }
+  EXPECT_EQ(upstream.queries(), 0u);
+  EXPECT_EQ(resolver.Stats().blocked_queries, 3u);
+}
+
+TEST(LocalResolver, MovesOnAtOnceWhenAnUpstreamSendIsRefused) {
+  StubUpstream upstream;
+  // Without SO_BROADCAST the kernel refuses to send to the broadcast
+  // address, so no timeout should be waited out.
+  SocketAddress broadcast;
+  SocketAddress::Parse("255.255.255.255", 53, &broadcast);
+  ResolverConfig config = LoopbackConfig(broadcast);
+  config.upstreams.push_back(upstream.address());
+  config.adaptive_upstreams = false;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("example.com", 1, kTypeA, query);
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(config.upstream_timeout_ms / 2));
+  EXPECT_EQ(upstream.queries(), 1u);
+}
+
+TEST(LocalResolver, TurnsAwayClientsOverTheirRateLimit) {
+  StubUpstream upstream;
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.rate_limit_qps = 0.1;
+  config.rate_limit_burst = 3;
+  config.rate_limit_action = RateLimitAction::kTruncated;
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  for (uint16_t id = 1; id <= 3; id++) {
+    std::string name = "host" + std::to_string(id) + ".example";
+    size_t length = MakeQuery(name.c_str(), id, kTypeA, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+    EXPECT_FALSE(IsTruncated(response));
+  }
+  EXPECT_EQ(upstream.queries(), 3u);
+
+  // The bucket is empty: a truncated answer over UDP, REFUSED over TCP, and
+  // nothing sent upstream.
+  size_t length = MakeQuery("host4.example", 4, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetMessageId(response), 4);
+  EXPECT_TRUE(IsTruncated(response));
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  int fd = ConnectTcp(resolver.bound_address());
+  SendTcp(fd, query, length);
+  ASSERT_GT(ReceiveTcp(fd, response, sizeof(response)), 0);
+  EXPECT_EQ(GetRcode(response), kRcodeRefused);
+  close(fd);
+  EXPECT_EQ(upstream.queries(), 3u);
+  ResolverStats stats = resolver.Stats();
+  EXPECT_EQ(stats.queries, 5u);
+  EXPECT_EQ(stats.rate_limited_queries, 2u);
+}
+
+TEST(LocalResolver, AppliesBlocklistDeltaWhileRunning) {
+  StubUpstream upstream;
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  BlocklistView base = BlockOne("ads.example");
+  resolver.SetBlocklist(base);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  resolver.SetBlocklist(BlocklistView(
+      base.base(), BlocklistDelta::Parse("-ads.example\n+tracker.example\n")));
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("tracker.example", 1, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeNxDomain);
+  length = MakeQuery("ads.example", 2, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(upstream.queries(), 1u);
+}
+
+TEST(LocalResolver, AnswersFromHostOverrides) {
+  StubUpstream upstream;
+  LocalResolver resolver(LoopbackConfig(upstream.address()));
+  resolver.SetBlocklist(BlockOne("||corp.example^"));
+  resolver.SetHostOverrides(
+      Override("10.1.2.3 git.corp.example\n"
+               "fd00::5 git.corp.example\n"
+               "code.corp.example CNAME git.corp.example\n"
+               "wiki.corp.example CNAME docs.elsewhere.example\n"));
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  // The alias is followed to the pinned address; overrides come before the
+  // blocklist.
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("Code.Corp.Example", 7, kTypeA, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetMessageId(response), 7);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  DnsMessageReader reader(response, received);
+  DnsRecordView record;
+  ASSERT_TRUE(reader.NextRecord(&record));
+  EXPECT_EQ(record.type, kTypeCname);
+  EXPECT_EQ(record.name.ToString(), "code.corp.example");
+  ASSERT_TRUE(reader.NextRecord(&record));
+  EXPECT_EQ(record.type, kTypeA);
+  EXPECT_EQ(record.name.ToString(), "git.corp.example");
+  const uint8_t kAddress[4] = {10, 1, 2, 3};
+  ASSERT_EQ(record.rdata_length, 4);
+  EXPECT_EQ(memcmp(record.rdata, kAddress, 4), 0);
+  EXPECT_FALSE(reader.NextRecord(&record));
+
+  // An alias to a name that is not overridden is answered with just the
+  // CNAME, and an address type the name has no records of with none.
+  length = MakeQuery("wiki.corp.example", 8, kTypeAaaa, query);
+  received = Exchange(resolver.bound_address(), query, length, response,
+                      sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(ReadU16(response + 6), 1);
+  resolver.SetHostOverrides(Override("10.1.2.3 git.corp.example\n"));
+  length = MakeQuery("git.corp.example", 9, kTypeAaaa, query);
+  received = Exchange(resolver.bound_address(), query, length, response,
+                      sizeof(response));
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(ReadU16(response + 6), 0);
+  EXPECT_EQ(resolver.Stats().host_override_queries, 3u);
+
+  // Without overrides the blocklist applies again.
+  resolver.SetHostOverrides(nullptr);
+  length = MakeQuery("git.corp.example", 10, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(GetRcode(response), kRcodeNxDomain);
+  EXPECT_EQ(upstream.queries(), 0u);
+}
+
+TEST(LocalResolver, RoutesSuffixesToTheirOwnUpstreams) {
+  StubUpstream public_upstream;
+  StubUpstream vpn_upstream;
+  ResolverConfig config = LoopbackConfig(public_upstream.address());
+  config.routes.push_back({"corp.example", {vpn_upstream.address()}});
+  LocalResolver resolver(config);
+  std::string error;
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  size_t length = MakeQuery("git.corp.example", 1, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  length = MakeQuery("www.example", 2, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(vpn_upstream.queries(), 1u);
+  EXPECT_EQ(public_upstream.queries(), 1u);
+
+  // Routes can change while running.
+  ASSERT_TRUE(resolver.SetRoutes({}, &error)) << error;
+  length = MakeQuery("wiki.corp.example", 3, kTypeA, query);
+  ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                     sizeof(response)),
+            0);
+  EXPECT_EQ(vpn_upstream.queries(), 1u);
+  EXPECT_EQ(public_upstream.queries(), 2u);
+
+  EXPECT_FALSE(resolver.SetRoutes({{"bad..suffix", {vpn_upstream.address()}}},
+                                  &error));
+  EXPECT_FALSE(resolver.SetRoutes({{"corp.example", {}}}, &error));
+}
+
+TEST(LocalResolver, AnswersFromPreviousRunAfterRestart) {
+  std::string path = testing::TempDir() + "local_resolver_warm_start.bin";
+  unlink(path.c_str());
+  StubUpstream upstream;
+  ResolverConfig config = LoopbackConfig(upstream.address());
+  config.cache_file = path;
+
+  uint8_t query[512];
+  uint8_t response[kMaxUdpMessageSize];
+  {
+    LocalResolver resolver(config);
+    std::string error;
+    ASSERT_TRUE(resolver.Start(&error)) << error;
+    size_t length = MakeQuery("warm.example", 1, 1, query);
+    ASSERT_GT(Exchange(resolver.bound_address(), query, length, response,
+                       sizeof(response)),
+              0);
+    resolver.Stop();
+  }
+  ASSERT_EQ(upstream.queries(), 1u);
+
+  std::string error;
+  std::unique_ptr<PersistentCache> warm_cache =
+      PersistentCache::Open(path, &error);
+  ASSERT_NE(warm_cache, nullptr) << error;
+  LocalResolver resolver(config);
+  resolver.set_warm_cache(std::move(warm_cache));
+  ASSERT_TRUE(resolver.Start(&error)) << error;
+  upstream.set_silent(true);
+  size_t length = MakeQuery("warm.example", 2, 1, query);
+  ssize_t received = Exchange(resolver.bound_address(), query, length,
+                              response, sizeof(response), 500);
+  ASSERT_GT(received, 0);
+  EXPECT_EQ(GetMessageId(response), 2);
+  EXPECT_EQ(GetRcode(response), kRcodeNoError);
+  EXPECT_EQ(upstream.queries(), 1u);
+  EXPECT_EQ(resolver.Stats().warm_cache_hits, 1u);
+  resolver.Stop();
+  unlink(path.c_str());
+}
+
+}  // namespace test
+}  // namespace dns_manager
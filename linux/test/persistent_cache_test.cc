@@ -0,0 +1,154 @@
+#include "persistent_cache.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+std::string KeyFor(size_t index) {
+  return std::string("\0\1\0\1", 4) + "host" + std::to_string(index) +
+         ".example";
+}
+
+std::vector<uint8_t> ResponseFor(size_t index) {
+  std::vector<uint8_t> response(40, static_cast<uint8_t>(index));
+  response[0] = static_cast<uint8_t>(index >> 8);
+  return response;
+}
+
+// Writes |count| records stored at |stored| with TTL |ttl| to |path|.
+void WriteCache(const std::string& path, size_t count, int64_t stored,
+                uint32_t ttl) {
+  PersistentCacheWriter writer;
+  for (size_t i = 0; i < count; i++) {
+    std::vector<uint8_t> response = ResponseFor(i);
+    writer.Add(KeyFor(i), response.data(), response.size(), stored, ttl);
+  }
+  std::string error;
+  ASSERT_TRUE(PersistentCacheWriter::Commit(path, writer.Build(), &error))
+      << error;
+}
+
+class PersistentCacheTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "persistent_cache_test.bin";
+    now_ = time(nullptr);
+  }
+  void TearDown() override { unlink(path_.c_str()); }
+
+  // Overwrites one byte of the file at |offset|.
+  void Corrupt(long offset) {
+    FILE* file = fopen(path_.c_str(), "r+b");
+    ASSERT_NE(file, nullptr);
+    fseek(file, offset, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(byte ^ 0xff, file);
+    fclose(file);
+  }
+
+  std::string path_;
+  int64_t now_ = 0;
+};
+
+}  // namespace
+
+TEST_F(PersistentCacheTest, RoundTripsRecords) {
+  WriteCache(path_, 1000, now_, 300);
+  std::string error;
+  std::unique_ptr<PersistentCache> cache = PersistentCache::Open(path_, &error);
+  ASSERT_NE(cache, nullptr) << error;
+  EXPECT_GT(cache->segment_count(), 1u);
+
+  for (size_t i = 0; i < 1000; i++) {
+    PersistentCache::Record record;
+    ASSERT_TRUE(cache->Find(KeyFor(i), now_, 0, &record)) << i;
+    std::vector<uint8_t> expected = ResponseFor(i);
+    ASSERT_EQ(record.length, expected.size());
+    EXPECT_EQ(memcmp(record.response, expected.data(), expected.size()), 0);
+    EXPECT_EQ(record.stored_wall_seconds, now_);
+    EXPECT_EQ(record.ttl, 300u);
+  }
+  PersistentCache::Record record;
+  EXPECT_FALSE(cache->Find(KeyFor(1000), now_, 0, &record));
+
+  size_t visited = 0;
+  cache->ForEach(now_, 0,
+                 [&](const std::string&, const PersistentCache::Record&) {
+                   visited++;
+                 });
+  EXPECT_EQ(visited, 1000u);
+}
+
+TEST_F(PersistentCacheTest, ChecksTtlAgainstWallClockOnLookup) {
+  WriteCache(path_, 10, now_ - 100, 60);
+  std::string error;
+  std::unique_ptr<PersistentCache> cache = PersistentCache::Open(path_, &error);
+  ASSERT_NE(cache, nullptr) << error;
+
+  PersistentCache::Record record;
+  EXPECT_FALSE(cache->Find(KeyFor(3), now_, 0, &record));
+  // Expired 40 seconds ago, so still usable when serving stale.
+  EXPECT_TRUE(cache->Find(KeyFor(3), now_, 60, &record));
+  EXPECT_FALSE(cache->Find(KeyFor(3), now_, 30, &record));
+}
+
+TEST_F(PersistentCacheTest, CorruptSegmentOnlyLosesItsOwnRecords) {
+  WriteCache(path_, 1000, now_, 300);
+  // Flip a byte near the end of the file, inside the last segment's records.
+  long size = 0;
+  {
+    FILE* file = fopen(path_.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+  }
+  Corrupt(size - 20);
+
+  std::string error;
+  std::unique_ptr<PersistentCache> cache = PersistentCache::Open(path_, &error);
+  ASSERT_NE(cache, nullptr) << error;
+  size_t found = 0;
+  for (size_t i = 0; i < 1000; i++) {
+    PersistentCache::Record record;
+    if (cache->Find(KeyFor(i), now_, 0, &record)) {
+      found++;
+    }
+  }
+  EXPECT_EQ(cache->corrupt_segments(), 1u);
+  EXPECT_LT(found, 1000u);
+  EXPECT_GT(found, 900u);
+}
+
+TEST_F(PersistentCacheTest, RejectsBadHeaders) {
+  std::string error;
+  EXPECT_EQ(PersistentCache::Open(path_, &error), nullptr);
+
+  WriteCache(path_, 10, now_, 300);
+  // The version field follows the eight-byte magic.
+  Corrupt(8);
+  EXPECT_EQ(PersistentCache::Open(path_, &error), nullptr);
+  EXPECT_NE(error.find("version"), std::string::npos) << error;
+
+  WriteCache(path_, 10, now_, 300);
+  // The creation time is only covered by the header checksum.
+  Corrupt(16);
+  EXPECT_EQ(PersistentCache::Open(path_, &error), nullptr);
+  EXPECT_NE(error.find("checksum"), std::string::npos) << error;
+
+  ASSERT_EQ(truncate(path_.c_str(), 10), 0);
+  EXPECT_EQ(PersistentCache::Open(path_, &error), nullptr);
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,97 @@
+#include "query_events.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+uint32_t U32At(const std::vector<uint8_t>& bytes, size_t at) {
+  return bytes[at] | bytes[at + 1] << 8 | bytes[at + 2] << 16 |
+         static_cast<uint32_t>(bytes[at + 3]) << 24;
+}
+
+void Push(QueryEventRing* ring, const char* name, int64_t time_us) {
+  QueryEvent* event = ring->Reserve();
+  ASSERT_NE(event, nullptr);
+  event->time_us = time_us;
+  event->latency_us = 250;
+  event->qtype = 28;
+  event->rcode = 3;
+  event->source = QuerySource::kUpstream;
+  event->name_length = static_cast<uint8_t>(strlen(name));
+  memcpy(event->name, name, event->name_length);
+  ring->Commit();
+}
+
+void CountReady(void* calls) { (*static_cast<int*>(calls))++; }
+
+}  // namespace
+
+TEST(QueryEventBatch, EncodesDocumentedLayout) {
+  QueryEventRing ring(4);
+  Push(&ring, "example.com", 1700000000000000);
+  Push(&ring, "a.example", 1700000000001500);
+  QueryEventBatch batch;
+  ASSERT_EQ(ring.Drain(&batch, 10), 2u);
+
+  const std::vector<uint8_t>& bytes = batch.bytes();
+  ASSERT_EQ(bytes.size(), QueryEventBatch::kHeaderSize + 2 * 13 + 11 + 9);
+  EXPECT_EQ(bytes[0], QueryEventBatch::kVersion);
+  EXPECT_EQ(U32At(bytes, 4), 2u);
+  EXPECT_EQ(U32At(bytes, 8), 0u);
+  uint64_t base = U32At(bytes, 12) | uint64_t{U32At(bytes, 16)} << 32;
+  EXPECT_EQ(base, 1700000000000000u);
+
+  size_t second = QueryEventBatch::kHeaderSize + 13 + 11;
+  EXPECT_EQ(U32At(bytes, QueryEventBatch::kHeaderSize), 0u);
+  EXPECT_EQ(U32At(bytes, second), 1500u);
+  EXPECT_EQ(U32At(bytes, second + 4), 250u);
+  EXPECT_EQ(bytes[second + 8] | bytes[second + 9] << 8, 28);
+  EXPECT_EQ(bytes[second + 10], 3);
+  EXPECT_EQ(bytes[second + 11], static_cast<uint8_t>(QuerySource::kUpstream));
+  EXPECT_EQ(bytes[second + 12], 9);
+  EXPECT_EQ(std::string(bytes.begin() + second + 13, bytes.end()),
+            "a.example");
+}
+
+TEST(QueryEventRing, DropsAndCountsWhenFull) {
+  QueryEventRing ring(2);
+  Push(&ring, "one", 1);
+  Push(&ring, "two", 2);
+  EXPECT_EQ(ring.Reserve(), nullptr);
+  EXPECT_EQ(ring.Reserve(), nullptr);
+
+  QueryEventBatch batch;
+  EXPECT_EQ(ring.Drain(&batch, 1), 1u);
+  EXPECT_EQ(U32At(batch.bytes(), 8), 2u);
+  // Room again after draining; the drop count restarts.
+  Push(&ring, "three", 3);
+  batch.Clear();
+  EXPECT_EQ(ring.Drain(&batch, 10), 2u);
+  EXPECT_EQ(U32At(batch.bytes(), 4), 2u);
+  EXPECT_EQ(U32At(batch.bytes(), 8), 0u);
+}
+
+TEST(QueryEventRing, CallsReadyOnceAtThreshold) {
+  QueryEventRing ring(16);
+  int calls = 0;
+  ring.set_ready_callback(CountReady, &calls, 3);
+  for (int i = 0; i < 5; i++) {
+    Push(&ring, "name", i);
+  }
+  EXPECT_EQ(calls, 1);
+  QueryEventBatch batch;
+  ring.Drain(&batch, 16);
+  for (int i = 0; i < 3; i++) {
+    Push(&ring, "name", i);
+  }
+  EXPECT_EQ(calls, 2);
+}
+
+}  // namespace test
+}  // namespace dns_manager
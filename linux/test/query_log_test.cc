@@ -0,0 +1,197 @@
+#include "query_log.h"
+
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+constexpr int64_t kHourUs = QueryLog::kPartitionSeconds * 1000000;
+// 2026-01-01 00:00:00 UTC.
+constexpr int64_t kStartUs = 1767225600LL * 1000000;
+
+QueryEvent EventAt(int64_t time_us, size_t i) {
+  QueryEvent event;
+  event.time_us = time_us;
+  event.latency_us = static_cast<uint32_t>(i % 5000);
+  event.qtype = i % 3 == 0 ? 28 : 1;
+  event.rcode = i % 11 == 0 ? 3 : 0;
+  event.source = static_cast<QuerySource>(i % 7);
+  std::string name = "host" + std::to_string(i % 300) + ".example.com";
+  event.name_length = static_cast<uint8_t>(name.size());
+  memcpy(event.name, name.data(), name.size());
+  return event;
+}
+
+std::string NameOf(const QueryEvent& event) {
+  return std::string(event.name, event.name_length);
+}
+
+void ExpectSameEvent(const QueryEvent& actual, const QueryEvent& expected) {
+  EXPECT_EQ(actual.time_us, expected.time_us);
+  EXPECT_EQ(actual.latency_us, expected.latency_us);
+  EXPECT_EQ(actual.qtype, expected.qtype);
+  EXPECT_EQ(actual.rcode, expected.rcode);
+  EXPECT_EQ(actual.source, expected.source);
+  EXPECT_EQ(NameOf(actual), NameOf(expected));
+}
+
+class QueryLogTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = testing::TempDir() + "query_log_test";
+    RemoveDirectory();
+  }
+  void TearDown() override { RemoveDirectory(); }
+
+  void RemoveDirectory() {
+    DIR* dir = opendir(directory_.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+    while (dirent* entry = readdir(dir)) {
+      if (entry->d_name[0] != '.') {
+        unlink((directory_ + "/" + entry->d_name).c_str());
+      }
+    }
+    closedir(dir);
+    rmdir(directory_.c_str());
+  }
+
+  std::unique_ptr<QueryLog> OpenLog(uint64_t max_bytes = 1 << 30) {
+    std::string error;
+    std::unique_ptr<QueryLog> log =
+        QueryLog::Open(directory_, max_bytes, &error);
+    EXPECT_NE(log, nullptr) << error;
+    return log;
+  }
+
+  std::string directory_;
+};
+
+}  // namespace
+
+TEST_F(QueryLogTest, ScansTimeRangesAcrossHours) {
+  std::unique_ptr<QueryLog> log = OpenLog();
+  ASSERT_NE(log, nullptr);
+  // One event every 100 ms for three hours.
+  std::vector<QueryEvent> appended;
+  for (size_t i = 0; i < 3 * 36000; i++) {
+    appended.push_back(
+        EventAt(kStartUs + static_cast<int64_t>(i) * 100000, i));
+    log->Append(appended.back());
+  }
+  EXPECT_GT(log->buffered(), 0u);
+  ASSERT_TRUE(log->Flush());
+  EXPECT_EQ(log->events(), appended.size());
+  // Against 13 bytes plus the name in a QueryEventBatch, even though at
+  // this rate each minute's block repeats the 300 names.
+  EXPECT_LT(log->bytes(), appended.size() * 20);
+
+  // 10:02 to 10:05, so to speak: three minutes in the second hour.
+  int64_t from = kStartUs + kHourUs + 2 * 60 * 1000000LL;
+  int64_t to = from + 3 * 60 * 1000000LL;
+  std::vector<QueryEvent> found;
+  QueryLog::ScanStats stats;
+  ASSERT_EQ(log->Scan(from, to, 100000, &found, &stats), 1800u);
+  size_t first = static_cast<size_t>((from - kStartUs) / 100000);
+  for (size_t i = 0; i < found.size(); i++) {
+    ExpectSameEvent(found[i], appended[first + i]);
+  }
+  // Only the blocks overlapping the range were read.
+  EXPECT_LE(stats.blocks_read, 3u);
+  EXPECT_GT(stats.blocks_skipped, 100u);
+  EXPECT_EQ(stats.corrupt_blocks, 0u);
+
+  // Limited, and across an hour boundary.
+  found.clear();
+  EXPECT_EQ(log->Scan(kStartUs + kHourUs - 1000000, kStartUs + 2 * kHourUs,
+                      25, &found),
+            25u);
+  EXPECT_EQ(found.front().time_us, kStartUs + kHourUs - 1000000);
+  found.clear();
+  EXPECT_EQ(log->Scan(kStartUs - kHourUs, kStartUs, 100, &found), 0u);
+}
+
+TEST_F(QueryLogTest, ScansBufferedEventsAndPackedBatches) {
+  std::unique_ptr<QueryLog> log = OpenLog();
+  ASSERT_NE(log, nullptr);
+  QueryEventBatch batch;
+  for (size_t i = 0; i < 10; i++) {
+    batch.Add(EventAt(kStartUs + static_cast<int64_t>(i) * 1000, i));
+  }
+  const std::vector<uint8_t>& bytes = batch.bytes();
+  EXPECT_EQ(log->Append(bytes.data(), bytes.size()), 10u);
+  EXPECT_EQ(log->Append(bytes.data(), 5), 0u);
+  EXPECT_EQ(log->buffered(), 10u);
+  EXPECT_EQ(log->events(), 0u);
+
+  std::vector<QueryEvent> found;
+  ASSERT_EQ(log->Scan(kStartUs + 2000, kStartUs + 5000, 100, &found), 3u);
+  ExpectSameEvent(found[0], EventAt(kStartUs + 2000, 2));
+  ExpectSameEvent(found[2], EventAt(kStartUs + 4000, 4));
+}
+
+TEST_F(QueryLogTest, ReopensAfterATornWrite) {
+  {
+    std::unique_ptr<QueryLog> log = OpenLog();
+    ASSERT_NE(log, nullptr);
+    for (size_t i = 0; i < 5000; i++) {
+      log->Append(EventAt(kStartUs + static_cast<int64_t>(i) * 1000, i));
+    }
+  }
+  // Half a block header, as if the process died mid-write.
+  std::string path =
+      directory_ + "/" + std::to_string(kStartUs / 1000000) + ".qlog";
+  FILE* file = fopen(path.c_str(), "ab");
+  ASSERT_NE(file, nullptr);
+  fwrite("DMQB\x10\x00\x00", 1, 7, file);
+  fclose(file);
+
+  std::unique_ptr<QueryLog> log = OpenLog();
+  ASSERT_NE(log, nullptr);
+  EXPECT_EQ(log->events(), 5000u);
+  log->Append(EventAt(kStartUs + 5000 * 1000, 5000));
+  ASSERT_TRUE(log->Flush());
+  std::vector<QueryEvent> found;
+  QueryLog::ScanStats stats;
+  EXPECT_EQ(log->Scan(kStartUs, kStartUs + kHourUs, 10000, &found, &stats),
+            5001u);
+  EXPECT_EQ(stats.corrupt_blocks, 0u);
+  ExpectSameEvent(found.back(), EventAt(kStartUs + 5000 * 1000, 5000));
+}
+
+TEST_F(QueryLogTest, DropsTheOldestHoursOverBudget) {
+  std::unique_ptr<QueryLog> log = OpenLog(200000);
+  ASSERT_NE(log, nullptr);
+  // Unique names, so each hour takes about 100 KB.
+  for (int64_t hour = 0; hour < 4; hour++) {
+    for (size_t i = 0; i < 4000; i++) {
+      QueryEvent event =
+          EventAt(kStartUs + hour * kHourUs + static_cast<int64_t>(i), i);
+      std::string name = "h" + std::to_string(hour) + "-" +
+                         std::to_string(i) + ".example.com";
+      event.name_length = static_cast<uint8_t>(name.size());
+      memcpy(event.name, name.data(), name.size());
+      log->Append(event);
+    }
+  }
+  ASSERT_TRUE(log->Flush());
+  EXPECT_LE(log->bytes(), 200000u);
+  std::vector<QueryEvent> found;
+  EXPECT_EQ(log->Scan(kStartUs, kStartUs + 2 * kHourUs, 10000, &found), 0u);
+  EXPECT_EQ(log->Scan(kStartUs + 3 * kHourUs, kStartUs + 4 * kHourUs, 10000,
+                      &found),
+            4000u);
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,86 @@
+#include "rate_limiter.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+using Clock = RateLimiter::Clock;
+using std::chrono::milliseconds;
+
+SocketAddress Address(const char* text, uint16_t port = 53) {
+  SocketAddress address;
+  EXPECT_TRUE(SocketAddress::Parse(text, port, &address)) << text;
+  return address;
+}
+
+size_t Allowed(RateLimiter* limiter, const SocketAddress& client,
+               Clock::time_point now, size_t queries) {
+  size_t allowed = 0;
+  for (size_t i = 0; i < queries; i++) {
+    allowed += limiter->Allow(client, now);
+  }
+  return allowed;
+}
+
+}  // namespace
+
+TEST(RateLimiterTest, AllowsABurstThenTheRate) {
+  RateLimiter limiter(100, 20, 64);
+  SocketAddress client = Address("192.0.2.1");
+  Clock::time_point now = Clock::now();
+  EXPECT_EQ(Allowed(&limiter, client, now, 50), 20u);
+  // Another port is the same client; another address is not.
+  EXPECT_FALSE(limiter.Allow(Address("192.0.2.1", 4000), now));
+  EXPECT_EQ(Allowed(&limiter, Address("192.0.2.2"), now, 50), 20u);
+  EXPECT_EQ(Allowed(&limiter, Address("2001:db8::1"), now, 50), 20u);
+
+  // A token every 10 ms.
+  EXPECT_EQ(Allowed(&limiter, client, now + milliseconds(55), 10), 5u);
+  EXPECT_EQ(Allowed(&limiter, client, now + milliseconds(60), 10), 1u);
+  // Refused queries do not count: a second later the bucket is full again.
+  EXPECT_EQ(Allowed(&limiter, client, now + milliseconds(1060), 50), 20u);
+}
+
+TEST(RateLimiterTest, EvictsTheStalestClientOfASet) {
+  // One set, so every client competes for the same four ways.
+  RateLimiter limiter(10, 5, 1);
+  ASSERT_EQ(limiter.capacity(), RateLimiter::kWays);
+  Clock::time_point now = Clock::now();
+  SocketAddress flooder = Address("192.0.2.100");
+  EXPECT_EQ(Allowed(&limiter, flooder, now, 10), 5u);
+  // Quiet clients come and go, each with one query on a full bucket. The
+  // flooder, whose bucket is furthest from full, is never the one evicted.
+  for (int i = 0; i < 20; i++) {
+    std::string text = "198.51.100." + std::to_string(i);
+    EXPECT_TRUE(limiter.Allow(Address(text.c_str()), now)) << text;
+    EXPECT_FALSE(limiter.Allow(flooder, now)) << text;
+  }
+}
+
+TEST(RateLimiterTest, SharesBucketsAcrossThreads) {
+  RateLimiter limiter(1, 1000, 1024);
+  SocketAddress client = Address("192.0.2.1");
+  Clock::time_point now = Clock::now();
+  std::atomic<size_t> allowed{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      allowed += Allowed(&limiter, client, now, 1000);
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(allowed.load(), 1000u);
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,131 @@
+#include "route_monitor.h"
+
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+// Runs |body| on a thread of its own in a fresh network namespace, where the
+// test can add links and routes without touching the host. Threads and
+// processes |body| starts inherit the namespace. Returns false if the
+// namespace or the ip tool is not available (the test needs
+// CAP_NET_ADMIN).
+bool RunInNetworkNamespace(const std::function<void()>& body) {
+  bool entered = false;
+  std::thread thread([&]() {
+    if (unshare(CLONE_NEWNET) != 0 ||
+        system("ip link set lo up >/dev/null 2>&1") != 0) {
+      return;
+    }
+    entered = true;
+    body();
+  });
+  thread.join();
+  return entered;
+}
+
+void Ip(const std::string& arguments) {
+  std::string command = "ip " + arguments + " >/dev/null 2>&1";
+  ASSERT_EQ(system(command.c_str()), 0) << command;
+}
+
+// Adds a veth pair |name|0/|name|1 with 10.0.|subnet|.1/24 on the first.
+void AddVeth(const std::string& name, int subnet) {
+  Ip("link add " + name + "0 type veth peer name " + name + "1");
+  Ip("link set " + name + "0 up");
+  Ip("link set " + name + "1 up");
+  Ip("addr add 10.0." + std::to_string(subnet) + ".1/24 dev " + name + "0");
+}
+
+// Waits up to a second for the monitor to report |expected|.
+std::string WaitFor(const RouteMonitor& monitor, const std::string& expected) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  std::string current = monitor.DefaultInterface();
+  while (current != expected && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    current = monitor.DefaultInterface();
+  }
+  return current;
+}
+
+}  // namespace
+
+TEST(RouteMonitor, FollowsTheLowestMetricDefaultRoute) {
+  bool ran = RunInNetworkNamespace([]() {
+    AddVeth("wired", 1);
+    AddVeth("wifi", 2);
+    Ip("route add default via 10.0.1.2 dev wired0 metric 100");
+
+    RouteMonitor monitor;
+    std::string error;
+    ASSERT_TRUE(monitor.Start(&error)) << error;
+    EXPECT_EQ(monitor.DefaultInterface(), "wired0");
+
+    // A better route elsewhere takes over, and losing it falls back.
+    Ip("route add default via 10.0.2.2 dev wifi0 metric 50");
+    EXPECT_EQ(WaitFor(monitor, "wifi0"), "wifi0");
+    Ip("route del default via 10.0.2.2 dev wifi0 metric 50");
+    EXPECT_EQ(WaitFor(monitor, "wired0"), "wired0");
+
+    Ip("route del default via 10.0.1.2 dev wired0 metric 100");
+    EXPECT_EQ(WaitFor(monitor, ""), "");
+  });
+  if (!ran) {
+    GTEST_SKIP() << "needs CAP_NET_ADMIN and the ip tool";
+  }
+}
+
+TEST(RouteMonitor, IgnoresRoutesOnLinksThatAreDown) {
+  bool ran = RunInNetworkNamespace([]() {
+    AddVeth("wired", 1);
+    AddVeth("vpn", 2);
+    Ip("route add default via 10.0.1.2 dev wired0 metric 100");
+    Ip("route add default via 10.0.2.2 dev vpn0 metric 10");
+
+    RouteMonitor monitor;
+    std::string error;
+    ASSERT_TRUE(monitor.Start(&error)) << error;
+    EXPECT_EQ(monitor.DefaultInterface(), "vpn0");
+
+    // The kernel flushes the IPv4 routes of a link taken down without
+    // reporting them one by one.
+    Ip("link set vpn0 down");
+    EXPECT_EQ(WaitFor(monitor, "wired0"), "wired0");
+    // Losing the carrier keeps the route but makes it unusable.
+    Ip("link set wired1 down");
+    EXPECT_EQ(WaitFor(monitor, ""), "");
+  });
+  if (!ran) {
+    GTEST_SKIP() << "needs CAP_NET_ADMIN and the ip tool";
+  }
+}
+
+TEST(RouteMonitor, ConsidersIpv6DefaultRoutes) {
+  bool ran = RunInNetworkNamespace([]() {
+    AddVeth("wired", 1);
+    AddVeth("tunnel", 2);
+    Ip("route add default via 10.0.1.2 dev wired0 metric 100");
+    Ip("-6 addr add fd00::1/64 dev tunnel0 nodad");
+    Ip("-6 route add default via fd00::2 dev tunnel0 metric 20");
+
+    RouteMonitor monitor;
+    std::string error;
+    ASSERT_TRUE(monitor.Start(&error)) << error;
+    EXPECT_EQ(monitor.DefaultInterface(), "tunnel0");
+  });
+  if (!ran) {
+    GTEST_SKIP() << "needs CAP_NET_ADMIN and the ip tool";
+  }
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,241 @@
+#include "shared_network_state.h"
+
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+// A segment of its own for each test, removed afterwards.
+class SharedNetworkStateTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    name_ = "/dns_manager-test-" + std::to_string(getpid()) + "-" +
+            testing::UnitTest::GetInstance()->current_test_info()->name();
+    SharedNetworkState::Remove(name_);
+  }
+
+  void TearDown() override { SharedNetworkState::Remove(name_); }
+
+  std::unique_ptr<SharedNetworkState> Open() {
+    std::string error;
+    std::unique_ptr<SharedNetworkState> state =
+        SharedNetworkState::Open(name_, &error);
+    EXPECT_NE(state, nullptr) << error;
+    return state;
+  }
+
+  std::string name_;
+};
+
+// A snapshot whose every field follows from |generation|, so that a reader
+// can tell a torn copy from a whole one.
+NetworkSnapshot SnapshotFor(uint64_t generation) {
+  NetworkSnapshot snapshot;
+  snapshot.state = 70;
+  snapshot.connectivity = 4;
+  snapshot.generation = generation;
+  if (generation % 3 == 0) {
+    snapshot.global_dns = {"9.9.9.9", "2620:fe::fe"};
+  }
+  NetworkDevice device;
+  device.interface = "eth" + std::to_string(generation);
+  device.type = 1;
+  device.state = 100;
+  device.connection_uuid = "uuid-" + std::to_string(generation);
+  snapshot.devices.push_back(device);
+  NetworkConnection connection;
+  connection.id = "Wired " + std::to_string(generation);
+  connection.uuid = device.connection_uuid;
+  connection.type = "802-3-ethernet";
+  connection.devices.push_back(device.interface);
+  connection.state = 2;
+  connection.is_default = true;
+  connection.has_settings = generation % 2 == 0;
+  connection.ipv4_ignore_auto_dns = true;
+  for (uint64_t i = 0; i < generation % 8; i++) {
+    connection.ipv4_dns.push_back("10.0.0." + std::to_string(i));
+  }
+  connection.ipv6_dns.push_back("fd00::" + std::to_string(generation % 100));
+  snapshot.connections.push_back(connection);
+  return snapshot;
+}
+
+bool Matches(const NetworkSnapshot& snapshot,
+             const std::string& default_interface) {
+  NetworkSnapshot expected = SnapshotFor(snapshot.generation);
+  if (snapshot.devices.size() != 1 || snapshot.connections.size() != 1 ||
+      default_interface != expected.devices[0].interface) {
+    return false;
+  }
+  const NetworkDevice& device = snapshot.devices[0];
+  const NetworkConnection& connection = snapshot.connections[0];
+  const NetworkConnection& want = expected.connections[0];
+  return snapshot.state == expected.state &&
+         snapshot.connectivity == expected.connectivity &&
+         snapshot.global_dns == expected.global_dns &&
+         device.interface == expected.devices[0].interface &&
+         device.connection_uuid == expected.devices[0].connection_uuid &&
+         connection.id == want.id && connection.uuid == want.uuid &&
+         connection.devices == want.devices &&
+         connection.is_default == want.is_default &&
+         connection.has_settings == want.has_settings &&
+         connection.ipv4_ignore_auto_dns == want.ipv4_ignore_auto_dns &&
+         connection.ipv6_ignore_auto_dns == want.ipv6_ignore_auto_dns &&
+         connection.ipv4_dns == want.ipv4_dns &&
+         connection.ipv6_dns == want.ipv6_dns;
+}
+
+}  // namespace
+
+TEST_F(SharedNetworkStateTest, ReadsWhatTheOwnerPublished) {
+  std::unique_ptr<SharedNetworkState> owner = Open();
+  std::unique_ptr<SharedNetworkState> reader = Open();
+  ASSERT_TRUE(owner->TryBecomeOwner());
+  // Only one instance owns the segment, even within one process.
+  EXPECT_FALSE(reader->TryBecomeOwner());
+  EXPECT_FALSE(reader->Publish(nullptr, ""));
+
+  reader->Read([](const NetworkSnapshot* snapshot, const std::string&) {
+    EXPECT_EQ(snapshot, nullptr);
+  });
+
+  NetworkSnapshot published = SnapshotFor(6);
+  ASSERT_TRUE(owner->Publish(&published, "eth6"));
+  const NetworkSnapshot* first = nullptr;
+  reader->Read([&](const NetworkSnapshot* snapshot,
+                   const std::string& default_interface) {
+    ASSERT_NE(snapshot, nullptr);
+    EXPECT_EQ(snapshot->generation, 6u);
+    EXPECT_TRUE(Matches(*snapshot, default_interface));
+    EXPECT_EQ(snapshot->PrimaryConnection(default_interface)->uuid, "uuid-6");
+    first = snapshot;
+  });
+  // An unchanged state is not decoded again.
+  reader->Read([&](const NetworkSnapshot* snapshot, const std::string&) {
+    EXPECT_EQ(snapshot, first);
+  });
+
+  ASSERT_TRUE(owner->Publish(nullptr, ""));
+  reader->Read([](const NetworkSnapshot* snapshot, const std::string&) {
+    EXPECT_EQ(snapshot, nullptr);
+  });
+}
+
+TEST_F(SharedNetworkStateTest, SharesNothingThatDoesNotFit) {
+  std::unique_ptr<SharedNetworkState> owner = Open();
+  std::unique_ptr<SharedNetworkState> reader = Open();
+  ASSERT_TRUE(owner->TryBecomeOwner());
+  NetworkSnapshot published = SnapshotFor(1);
+  ASSERT_TRUE(owner->Publish(&published, "eth1"));
+
+  NetworkSnapshot huge = SnapshotFor(2);
+  huge.connections[0].ipv4_dns.assign(
+      SharedNetworkState::kSegmentSize / 8, "192.168.100.100");
+  EXPECT_FALSE(owner->Publish(&huge, "eth2"));
+  // Readers fall back to their own lookups rather than keep a stale state.
+  reader->Read([](const NetworkSnapshot* snapshot, const std::string&) {
+    EXPECT_EQ(snapshot, nullptr);
+  });
+}
+
+TEST_F(SharedNetworkStateTest, ElectsOneOwnerAmongProcesses) {
+  const int kProcesses = 4;
+  std::vector<pid_t> children;
+  int results[2];
+  ASSERT_EQ(pipe(results), 0);
+  for (int i = 0; i < kProcesses; i++) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      std::string error;
+      std::unique_ptr<SharedNetworkState> state =
+          SharedNetworkState::Open(name_, &error);
+      char owner = state != nullptr && state->TryBecomeOwner() ? 1 : 0;
+      if (write(results[1], &owner, 1) != 1) {
+        _exit(1);
+      }
+      // Holds on to the segment until killed.
+      pause();
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+  int owners = 0;
+  for (int i = 0; i < kProcesses; i++) {
+    char owner = 0;
+    ASSERT_EQ(read(results[0], &owner, 1), 1);
+    owners += owner;
+  }
+  EXPECT_EQ(owners, 1);
+
+  std::unique_ptr<SharedNetworkState> state = Open();
+  EXPECT_FALSE(state->TryBecomeOwner());
+  // However the owner exits, another instance can take over.
+  for (pid_t pid : children) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+  }
+  EXPECT_TRUE(state->TryBecomeOwner());
+  close(results[0]);
+  close(results[1]);
+}
+
+TEST_F(SharedNetworkStateTest, ReadersInOtherProcessesSeeWholeSnapshots) {
+  std::unique_ptr<SharedNetworkState> owner = Open();
+  ASSERT_TRUE(owner->TryBecomeOwner());
+  const uint64_t kGenerations = 20000;
+  NetworkSnapshot first = SnapshotFor(1);
+  ASSERT_TRUE(owner->Publish(&first, "eth1"));
+
+  const int kReaders = 3;
+  std::vector<pid_t> readers;
+  for (int i = 0; i < kReaders; i++) {
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0) {
+      std::string error;
+      std::unique_ptr<SharedNetworkState> state =
+          SharedNetworkState::Open(name_, &error);
+      if (state == nullptr) {
+        _exit(2);
+      }
+      uint64_t last = 0;
+      int status = 0;
+      while (last < kGenerations && status == 0) {
+        state->Read([&](const NetworkSnapshot* snapshot,
+                        const std::string& default_interface) {
+          if (snapshot == nullptr || snapshot->generation < last ||
+              !Matches(*snapshot, default_interface)) {
+            status = 1;
+          } else {
+            last = snapshot->generation;
+          }
+        });
+      }
+      _exit(status);
+    }
+    readers.push_back(pid);
+  }
+  for (uint64_t generation = 2; generation <= kGenerations; generation++) {
+    NetworkSnapshot snapshot = SnapshotFor(generation);
+    ASSERT_TRUE(owner->Publish(&snapshot, snapshot.devices[0].interface));
+  }
+  for (pid_t pid : readers) {
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+}
+
+}  // namespace test
+}  // namespace dns_manager
@@ -0,0 +1,263 @@
+#ifndef DNS_MANAGER_TEST_STUB_UPSTREAM_H_
+#define DNS_MANAGER_TEST_STUB_UPSTREAM_H_
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "dns_message.h"
+#include "dns_stream.h"
+#include "socket_address.h"
+
+namespace dns_manager {
+namespace test {
+
+// A loopback UDP and TCP server that answers every query with A records
+// (192.0.2.1 and up, TTL |ttl|), or with NXDOMAIN and an SOA record whose
+// MINIMUM is |ttl|. UDP answers too large for the query's buffer are sent
+// truncated; queries pipelined on a TCP connection are answered in reverse
+// order of each read. With EnableTls() the TCP port speaks DNS-over-TLS
+// instead. Used as the upstream in resolver tests and benchmarks.
+class StubUpstream {
+ public:
+  explicit StubUpstream(uint32_t ttl = 300) : ttl_(ttl) {
+    SocketAddress::Parse("127.0.0.1", 0, &address_);
+    fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    bind(fd_, address_.sockaddr_ptr(), address_.length);
+    address_.length = sizeof(address_.storage);
+    getsockname(fd_, address_.sockaddr_ptr(), &address_.length);
+    tcp_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(tcp_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    bind(tcp_fd_, address_.sockaddr_ptr(), address_.length);
+    listen(tcp_fd_, SOMAXCONN);
+    thread_ = std::thread(&StubUpstream::Run, this);
+  }
+
+  ~StubUpstream() {
+    running_ = false;
+    thread_.join();
+    close(fd_);
+    close(tcp_fd_);
+  }
+
+  const SocketAddress& address() const { return address_; }
+  size_t queries() const { return queries_.load(); }
+  // Queries that arrived over TCP, and the connections they came on.
+  size_t tcp_queries() const { return tcp_queries_.load(); }
+  size_t tcp_connections() const { return tcp_connections_.load(); }
+  // Makes connections accepted from now on TLS, presenting the certificate
+  // of |ctx|, which must outlive the stub.
+  void EnableTls(SSL_CTX* ctx) { tls_ = ctx; }
+  // A records per answer; enough of them need TCP.
+  void set_answer_count(size_t count) { answer_count_ = count; }
+  // While set, queries are read but never answered.
+  void set_silent(bool silent) { silent_ = silent; }
+  // While set, queries are answered with NXDOMAIN.
+  void set_nxdomain(bool nxdomain) { nxdomain_ = nxdomain; }
+  // Waits this long before each answer, like a distant upstream.
+  void set_delay_ms(int delay_ms) { delay_ms_ = delay_ms; }
+  // While set, UDP answers carry another name than the query's, like a
+  // forged answer that only guessed the ID.
+  void set_wrong_question(bool wrong) { wrong_question_ = wrong; }
+  // Closes the next |count| TCP connections as soon as a query has been read
+  // on them, without answering it.
+  void set_dropped_connections(size_t count) { dropped_connections_ = count; }
+  // The different ports UDP queries have come from.
+  size_t source_ports() const {
+    std::lock_guard<std::mutex> lock(ports_mutex_);
+    return ports_.size();
+  }
+
+ private:
+  void Run() {
+    std::vector<uint8_t> buffer(kMaxTcpMessageSize);
+    std::vector<std::unique_ptr<DnsStream>> streams;
+    std::vector<pollfd> fds;
+    while (running_) {
+      fds.assign({{fd_, POLLIN, 0}, {tcp_fd_, POLLIN, 0}});
+      for (const auto& stream : streams) {
+        fds.push_back({stream->fd(),
+                       static_cast<short>(POLLIN | (stream->wants_write()
+                                                        ? POLLOUT
+                                                        : 0)),
+                       0});
+      }
+      if (poll(fds.data(), fds.size(), 20) <= 0) {
+        continue;
+      }
+      if (fds[0].revents & POLLIN) {
+        AnswerUdp(buffer.data());
+      }
+      for (size_t i = 2; i < fds.size(); i++) {
+        DnsStream* stream = streams[i - 2].get();
+        bool open = !(fds[i].revents & POLLOUT) || stream->Flush();
+        if (open && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+          open = AnswerTcp(stream, buffer.data());
+        }
+        if (!open) {
+          streams[i - 2].reset();
+        }
+      }
+      streams.erase(
+          std::remove(streams.begin(), streams.end(), nullptr),
+          streams.end());
+      if (fds[1].revents & POLLIN) {
+        int fd = accept4(tcp_fd_, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd >= 0) {
+          tcp_connections_++;
+          SSL* ssl = nullptr;
+          if (SSL_CTX* tls = tls_.load()) {
+            ssl = SSL_new(tls);
+            SSL_set_fd(ssl, fd);
+            SSL_set_accept_state(ssl);
+          }
+          streams.emplace_back(new DnsStream(fd, ssl));
+        }
+      }
+    }
+  }
+
+  void AnswerUdp(uint8_t* buffer) {
+    SocketAddress client;
+    client.length = sizeof(client.storage);
+    ssize_t received = recvfrom(fd_, buffer, kMaxUdpMessageSize, 0,
+                                client.sockaddr_ptr(), &client.length);
+    if (received < static_cast<ssize_t>(kDnsHeaderSize)) {
+      return;
+    }
+    queries_++;
+    {
+      std::lock_guard<std::mutex> lock(ports_mutex_);
+      ports_.insert(client.port());
+    }
+    if (silent_) {
+      return;
+    }
+    size_t length = static_cast<size_t>(received);
+    size_t max_size = MaxUdpResponseSize(buffer, length);
+    length = Answer(buffer, length);
+    if (wrong_question_ && length > kDnsHeaderSize + 1) {
+      // The first letter of the first label.
+      buffer[kDnsHeaderSize + 1] ^= 1;
+    }
+    uint8_t truncated[kMaxUdpMessageSize];
+    if (length > max_size) {
+      length = BuildTruncatedResponse(buffer, length, truncated,
+                                      sizeof(truncated));
+      buffer = truncated;
+    }
+    sendto(fd_, buffer, length, 0, client.sockaddr_ptr(), client.length);
+  }
+
+  // Returns false once the connection is closed.
+  bool AnswerTcp(DnsStream* stream, uint8_t* buffer) {
+    std::vector<std::vector<uint8_t>> queries;
+    bool open = stream->Read([&](const uint8_t* query, size_t length) {
+      if (length >= kDnsHeaderSize) {
+        queries.emplace_back(query, query + length);
+      }
+    });
+    queries_ += queries.size();
+    tcp_queries_ += queries.size();
+    if (!queries.empty() && dropped_connections_ > 0) {
+      dropped_connections_--;
+      return false;
+    }
+    if (silent_) {
+      return open;
+    }
+    for (auto it = queries.rbegin(); it != queries.rend(); ++it) {
+      memcpy(buffer, it->data(), it->size());
+      size_t length = Answer(buffer, it->size());
+      if (!stream->Send(buffer, length)) {
+        return false;
+      }
+    }
+    return open;
+  }
+
+  // Turns the query in |buffer| into the answer and returns its length.
+  size_t Answer(uint8_t* buffer, size_t length) {
+    if (delay_ms_ > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
+    }
+    buffer[2] |= 0x80;
+    buffer[3] = 0x80;
+    if (nxdomain_) {
+      // SOA with root MNAME and RNAME, then SERIAL..MINIMUM.
+      static const uint8_t kSoaHeader[] = {0xc0, 0x0c, 0x00, 0x06,
+                                           0x00, 0x01};
+      buffer[3] |= kRcodeNxDomain;
+      WriteU16(buffer + 8, 1);
+      memcpy(buffer + length, kSoaHeader, sizeof(kSoaHeader));
+      length += sizeof(kSoaHeader);
+      WriteU32(buffer + length, 3600);
+      WriteU16(buffer + length + 4, 22);
+      memset(buffer + length + 6, 0, 22);
+      WriteU32(buffer + length + 6 + 18, ttl_);
+      return length + 28;
+    }
+    static const uint8_t kAnswerHeader[] = {0xc0, 0x0c, 0x00, 0x01,
+                                            0x00, 0x01};
+    size_t count = answer_count_;
+    WriteU16(buffer + 6, static_cast<uint16_t>(count));
+    for (size_t i = 0; i < count; i++) {
+      memcpy(buffer + length, kAnswerHeader, sizeof(kAnswerHeader));
+      length += sizeof(kAnswerHeader);
+      WriteU32(buffer + length, ttl_);
+      WriteU16(buffer + length + 4, 4);
+      const uint8_t address[] = {192, 0, static_cast<uint8_t>(2 + i / 254),
+                                 static_cast<uint8_t>(1 + i % 254)};
+      memcpy(buffer + length + 6, address, sizeof(address));
+      length += 10;
+    }
+    return length;
+  }
+
+  const uint32_t ttl_;
+  SocketAddress address_;
+  int fd_ = -1;
+  int tcp_fd_ = -1;
+  std::atomic<bool> running_{true};
+  std::atomic<bool> silent_{false};
+  std::atomic<bool> nxdomain_{false};
+  std::atomic<int> delay_ms_{0};
+  std::atomic<bool> wrong_question_{false};
+  std::atomic<size_t> dropped_connections_{0};
+  mutable std::mutex ports_mutex_;
+  std::set<uint16_t> ports_;
+  std::atomic<size_t> queries_{0};
+  std::atomic<size_t> tcp_queries_{0};
+  std::atomic<size_t> tcp_connections_{0};
+  std::atomic<size_t> answer_count_{1};
+  std::atomic<SSL_CTX*> tls_{nullptr};
+  std::thread thread_;
+};
+
+// Writes a recursive IN query for |name| with the given |id| and |qtype|
+// into |out|, which must hold 512 bytes, and returns its length.
+inline size_t MakeQuery(const char* name, uint16_t id, uint16_t qtype,
+                        uint8_t* out) {
+  DnsQuestion question;
+  question.name = name;
+  question.qtype = qtype;
+  question.qclass = 1;
+  return BuildQuery(question, id, out, 512);
+}
+
+}  // namespace test
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_TEST_STUB_UPSTREAM_H_
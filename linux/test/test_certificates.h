@@ -0,0 +1,114 @@
+#ifndef DNS_MANAGER_TEST_TEST_CERTIFICATES_H_
+#define DNS_MANAGER_TEST_TEST_CERTIFICATES_H_
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+namespace dns_manager {
+namespace test {
+
+// A throwaway CA, written to a PEM file for clients to trust, and a server
+// certificate it signed for |server_name| and 127.0.0.1. Used to run TLS
+// upstreams in tests and benchmarks.
+class TestCertificates {
+ public:
+  explicit TestCertificates(const std::string& server_name = "dns.test") {
+    ca_key_ = EVP_EC_gen("P-256");
+    ca_ = MakeCertificate(ca_key_, "dns_manager test CA", nullptr, ca_key_,
+                          1, "critical,CA:TRUE", "");
+    server_key_ = EVP_EC_gen("P-256");
+    server_ = MakeCertificate(server_key_, server_name.c_str(), ca_, ca_key_,
+                              2, "CA:FALSE",
+                              "DNS:" + server_name + ",IP:127.0.0.1");
+    char path[] = "/tmp/dns_manager_test_ca_XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file = fdopen(fd, "w");
+    PEM_write_X509(file, ca_);
+    fclose(file);
+    ca_file_ = path;
+  }
+
+  ~TestCertificates() {
+    unlink(ca_file_.c_str());
+    X509_free(server_);
+    EVP_PKEY_free(server_key_);
+    X509_free(ca_);
+    EVP_PKEY_free(ca_key_);
+  }
+
+  TestCertificates(const TestCertificates&) = delete;
+  TestCertificates& operator=(const TestCertificates&) = delete;
+
+  const std::string& ca_file() const { return ca_file_; }
+
+  // A server context presenting the certificate. The caller frees it.
+  SSL_CTX* NewServerContext() const {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_use_certificate(ctx, server_);
+    SSL_CTX_use_PrivateKey(ctx, server_key_);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                              SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+  }
+
+ private:
+  static X509* MakeCertificate(EVP_PKEY* key, const char* common_name,
+                               X509* issuer, EVP_PKEY* issuer_key,
+                               long serial, const std::string& constraints,
+                               const std::string& alt_names) {
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 86400);
+    X509_set_pubkey(cert, key);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(
+        name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>(common_name), -1, -1, 0);
+    X509_set_issuer_name(cert, issuer != nullptr
+                                   ? X509_get_subject_name(issuer)
+                                   : name);
+    X509V3_CTX context;
+    X509V3_set_ctx_nodb(&context);
+    X509V3_set_ctx(&context, issuer != nullptr ? issuer : cert, cert,
+                   nullptr, nullptr, 0);
+    AddExtension(cert, &context, NID_basic_constraints, constraints);
+    AddExtension(cert, &context, NID_subject_key_identifier, "hash");
+    if (issuer == nullptr) {
+      AddExtension(cert, &context, NID_key_usage,
+                   "critical,keyCertSign,cRLSign");
+    } else {
+      AddExtension(cert, &context, NID_authority_key_identifier, "keyid");
+      AddExtension(cert, &context, NID_subject_alt_name, alt_names);
+    }
+    X509_sign(cert, issuer_key, EVP_sha256());
+    return cert;
+  }
+
+  static void AddExtension(X509* cert, X509V3_CTX* context, int nid,
+                           const std::string& value) {
+    X509_EXTENSION* extension =
+        X509V3_EXT_conf_nid(nullptr, context, nid, value.c_str());
+    X509_add_ext(cert, extension, -1);
+    X509_EXTENSION_free(extension);
+  }
+
+  EVP_PKEY* ca_key_;
+  X509* ca_;
+  EVP_PKEY* server_key_;
+  X509* server_;
+  std::string ca_file_;
+};
+
+}  // namespace test
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_TEST_TEST_CERTIFICATES_H_
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "top_domains.h"
+
+namespace dns_manager {
+namespace test {
+
+TEST(TopDomainsSketch, FindsHeavyHitters) {
+  TopDomainsSketch sketch(16, 0);
+  for (int i = 0; i < 10000; i++) {
+    sketch.Add("popular.example", 15, 0);
+    if (i % 2 == 0) {
+      sketch.Add("second.example", 14, 0);
+    }
+    std::string noise = "noise" + std::to_string(i) + ".example";
+    sketch.Add(noise.data(), noise.size(), 0);
+  }
+
+  std::vector<DomainCount> top = sketch.Top(2, 0);
+  ASSERT_EQ(top.size(), 2u);
+  EXPECT_EQ(top[0].name, "popular.example");
+  EXPECT_EQ(top[1].name, "second.example");
+  // Space-Saving never under-counts.
+  EXPECT_GE(top[0].count, 10000);
+  EXPECT_LE(top[0].count - top[0].error, 10000);
+}
+
+TEST(TopDomainsSketch, MemoryIsIndependentOfStreamLength) {
+  TopDomainsSketch sketch(64, 60);
+  size_t initial = sketch.memory_bytes();
+  for (int i = 0; i < 100000; i++) {
+    std::string name = "host" + std::to_string(i) + ".example";
+    sketch.Add(name.data(), name.size(), i / 1000.0);
+  }
+  EXPECT_EQ(sketch.size(), 64u);
+  EXPECT_EQ(sketch.memory_bytes(), initial);
+}
+
+TEST(TopDomainsSketch, OldQueriesDecay) {
+  TopDomainsSketch sketch(8, 10);
+  for (int i = 0; i < 100; i++) {
+    sketch.Add("old.example", 11, 0);
+  }
+  for (int i = 0; i < 10; i++) {
+    sketch.Add("new.example", 11, 100);
+  }
+
+  // Ten half-lives later the 100 old queries are worth about 0.1.
+  std::vector<DomainCount> top = sketch.Top(2, 100);
+  ASSERT_EQ(top.size(), 2u);
+  EXPECT_EQ(top[0].name, "new.example");
+  EXPECT_NEAR(top[0].count, 10, 1e-9);
+  EXPECT_NEAR(top[1].count, 100.0 / 1024, 1e-9);
+}
+
+TEST(TopDomainsSketch, SurvivesRenormalisation) {
+  TopDomainsSketch sketch(4, 1);
+  // 2000 half-lives would overflow a double without renormalising.
+  for (int second = 0; second < 2000; second++) {
+    sketch.Add("steady.example", 14, second);
+  }
+  std::vector<DomainCount> top = sketch.Top(1, 1999);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].name, "steady.example");
+  // A geometric series with ratio 1/2 converges to 2.
+  EXPECT_NEAR(top[0].count, 2, 1e-6);
+}
+
+}  // namespace test
+}  // namespace dns_manager
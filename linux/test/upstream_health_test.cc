@@ -0,0 +1,136 @@
+#include "upstream_health.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace dns_manager {
+namespace test {
+
+namespace {
+
+using Clock = UpstreamHealth::Clock;
+using std::chrono::milliseconds;
+
+std::vector<SocketAddress> Servers(std::vector<const char*> texts) {
+  std::vector<SocketAddress> servers;
+  for (const char* text : texts) {
+    SocketAddress address;
+    EXPECT_TRUE(SocketAddress::Parse(text, 53, &address)) << text;
+    servers.push_back(address);
+  }
+  return servers;
+}
+
+}  // namespace
+
+TEST(UpstreamHealthTest, DerivesTimeoutFromRoundTrips) {
+  UpstreamHealth health(100, 10, 1000);
+  std::vector<SocketAddress> servers = Servers({"192.0.2.1"});
+  Clock::time_point now = Clock::now();
+  int timeout_ms = 0;
+  ASSERT_EQ(health.Choose(servers, 0, now, &timeout_ms), 0u);
+  EXPECT_EQ(timeout_ms, 100);
+  EXPECT_EQ(health.Choose(servers, 1, now, &timeout_ms), 1u);
+
+  // The first sample sets the deviation to half of it, later ones move the
+  // estimates by 1/8 and 1/4 of the difference.
+  health.RecordAnswer(servers[0], milliseconds(20));
+  std::vector<UpstreamScore> scores = health.Scores(now);
+  ASSERT_EQ(scores.size(), 1u);
+  EXPECT_DOUBLE_EQ(scores[0].srtt_ms, 20);
+  EXPECT_DOUBLE_EQ(scores[0].rttvar_ms, 10);
+  EXPECT_DOUBLE_EQ(scores[0].timeout_ms, 60);
+  health.RecordAnswer(servers[0], milliseconds(40));
+  scores = health.Scores(now);
+  EXPECT_DOUBLE_EQ(scores[0].srtt_ms, 22.5);
+  EXPECT_DOUBLE_EQ(scores[0].rttvar_ms, 12.5);
+  EXPECT_DOUBLE_EQ(scores[0].timeout_ms, 72.5);
+  ASSERT_EQ(health.Choose(servers, 0, now, &timeout_ms), 0u);
+  EXPECT_EQ(timeout_ms, 73);
+
+  // Clamped to the minimum.
+  for (int i = 0; i < 50; i++) {
+    health.RecordAnswer(servers[0], milliseconds(1));
+  }
+  scores = health.Scores(now);
+  EXPECT_EQ(scores[0].answers, 52u);
+  EXPECT_DOUBLE_EQ(scores[0].timeout_ms, 10);
+}
+
+TEST(UpstreamHealthTest, PrefersTheFastestServer) {
+  UpstreamHealth health(100, 10, 1000);
+  std::vector<SocketAddress> servers =
+      Servers({"192.0.2.1", "192.0.2.2", "[2001:db8::1]:5353"});
+  Clock::time_point now = Clock::now();
+  int timeout_ms = 0;
+  health.RecordAnswer(servers[0], milliseconds(50));
+  health.RecordAnswer(servers[1], milliseconds(2));
+  // Never heard from, so measured first.
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 2u);
+  health.RecordAnswer(servers[2], milliseconds(5));
+  // Both below the minimum timeout, still ranked by speed.
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 1u);
+  EXPECT_EQ(timeout_ms, 10);
+  EXPECT_EQ(health.Choose(servers, 2, now, &timeout_ms), 2u);
+  EXPECT_EQ(health.Choose(servers, 6, now, &timeout_ms), 0u);
+  EXPECT_EQ(timeout_ms, 150);
+
+  // Without adaptation: list order, the initial timeout.
+  UpstreamHealth fixed(100, 10, 1000, false);
+  fixed.RecordAnswer(servers[1], milliseconds(2));
+  EXPECT_EQ(fixed.Choose(servers, 0, now, &timeout_ms), 0u);
+  EXPECT_EQ(timeout_ms, 100);
+  EXPECT_EQ(fixed.Choose(servers, 1, now, &timeout_ms), 1u);
+  EXPECT_EQ(timeout_ms, 100);
+}
+
+TEST(UpstreamHealthTest, HoldsDownAndProbesServersThatTimeOut) {
+  UpstreamHealth health(100, 10, 1000);
+  std::vector<SocketAddress> servers = Servers({"192.0.2.1", "192.0.2.2"});
+  Clock::time_point now = Clock::now();
+  int timeout_ms = 0;
+  ASSERT_EQ(health.Choose(servers, 0, now, &timeout_ms), 0u);
+  health.RecordTimeout(servers[0], now);
+  std::vector<UpstreamScore> scores = health.Scores(now);
+  EXPECT_FALSE(scores[0].available);
+  EXPECT_EQ(scores[0].consecutive_timeouts, 1u);
+  EXPECT_DOUBLE_EQ(scores[0].timeout_ms, 200);
+
+  // Skipped while held down, unless nothing else is left.
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 1u);
+  EXPECT_EQ(health.Choose(servers, 2, now, &timeout_ms), 0u);
+  EXPECT_EQ(timeout_ms, 200);
+  // Queries already in flight when it was held down do not back off
+  // further.
+  health.RecordTimeout(servers[0], now + milliseconds(50));
+  scores = health.Scores(now);
+  EXPECT_EQ(scores[0].timeouts, 2u);
+  EXPECT_EQ(scores[0].consecutive_timeouts, 1u);
+
+  // Once the hold-down ends one query probes it, even ahead of a server
+  // that answers.
+  health.RecordAnswer(servers[1], milliseconds(5));
+  now += milliseconds(1000);
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 0u);
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 1u);
+  // The probe times out too: twice the hold-down and timeout.
+  now += milliseconds(200);
+  health.RecordTimeout(servers[0], now);
+  scores = health.Scores(now);
+  EXPECT_EQ(scores[0].consecutive_timeouts, 2u);
+  EXPECT_DOUBLE_EQ(scores[0].timeout_ms, 400);
+  EXPECT_FALSE(health.Scores(now + milliseconds(1999))[0].available);
+  EXPECT_TRUE(health.Scores(now + milliseconds(2000))[0].available);
+
+  // An answer restores it.
+  health.RecordAnswer(servers[0], milliseconds(3));
+  scores = health.Scores(now);
+  EXPECT_TRUE(scores[0].available);
+  EXPECT_EQ(scores[0].consecutive_timeouts, 0u);
+  EXPECT_EQ(health.Choose(servers, 0, now, &timeout_ms), 0u);
+}
+
+}  // namespace test
+}  // namespace dns_manager
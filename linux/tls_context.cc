@@ -0,0 +1,131 @@
+#include "tls_context.h"
+
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+namespace dns_manager {
+
+namespace {
+
+void FreeSessionKey(void*, void* key, CRYPTO_EX_DATA*, int, long, void*) {
+  delete static_cast<std::string*>(key);
+}
+
+// Where each connection keeps the key its sessions are stored under.
+int SessionKeyIndex() {
+  static const int index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, FreeSessionKey);
+  return index;
+}
+
+std::string OpenSslError() {
+  char buffer[256];
+  ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+  return buffer;
+}
+
+}  // namespace
+
+TlsContext::TlsContext(SSL_CTX* ctx) : ctx_(ctx) {}
+
+TlsContext::~TlsContext() {
+  for (const auto& entry : sessions_) {
+    SSL_SESSION_free(entry.second);
+  }
+  SSL_CTX_free(ctx_);
+}
+
+std::unique_ptr<TlsContext> TlsContext::Create(const std::string& ca_file,
+                                               std::string* error) {
+  SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+  if (ctx == nullptr) {
+    *error = "SSL_CTX_new: " + OpenSslError();
+    return nullptr;
+  }
+  // RFC 8310 asks for TLS 1.2 or later.
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  bool loaded = ca_file.empty()
+                    ? SSL_CTX_set_default_verify_paths(ctx) == 1
+                    : SSL_CTX_load_verify_locations(ctx, ca_file.c_str(),
+                                                    nullptr) == 1;
+  if (!loaded) {
+    *error = "Loading CA certificates: " + OpenSslError();
+    SSL_CTX_free(ctx);
+    return nullptr;
+  }
+  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+  // Sessions are kept per server by StoreSession() rather than in
+  // OpenSSL's cache, which only servers consult.
+  SSL_CTX_set_session_cache_mode(
+      ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx, &TlsContext::StoreSession);
+  // DnsStream appends to its write buffer between retries of a write.
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+  std::unique_ptr<TlsContext> context(new TlsContext(ctx));
+  SSL_CTX_set_app_data(ctx, context.get());
+  return context;
+}
+
+SSL* TlsContext::NewConnection(int fd, const SocketAddress& address,
+                               const std::string& server_name) {
+  SSL* ssl = SSL_new(ctx_);
+  if (ssl == nullptr) {
+    return nullptr;
+  }
+  X509_VERIFY_PARAM* param = SSL_get0_param(ssl);
+  bool configured =
+      SSL_set_fd(ssl, fd) == 1 &&
+      (server_name.empty()
+           ? X509_VERIFY_PARAM_set1_ip_asc(param,
+                                           address.HostString().c_str()) == 1
+           : SSL_set_tlsext_host_name(ssl, server_name.c_str()) == 1 &&
+                 SSL_set1_host(ssl, server_name.c_str()) == 1);
+  if (!configured) {
+    SSL_free(ssl);
+    return nullptr;
+  }
+  std::string* key = new std::string(SessionKey(address, server_name));
+  SSL_set_ex_data(ssl, SessionKeyIndex(), key);
+  {
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    auto it = sessions_.find(*key);
+    if (it != sessions_.end()) {
+      SSL_set_session(ssl, it->second);
+    }
+  }
+  SSL_set_connect_state(ssl);
+  return ssl;
+}
+
+void TlsContext::RecordHandshake(SSL* ssl) {
+  handshakes_++;
+  if (SSL_session_reused(ssl)) {
+    resumed_handshakes_++;
+  }
+}
+
+int TlsContext::StoreSession(SSL* ssl, SSL_SESSION* session) {
+  auto* context =
+      static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+  auto* key =
+      static_cast<std::string*>(SSL_get_ex_data(ssl, SessionKeyIndex()));
+  if (context == nullptr || key == nullptr) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> lock(context->sessions_mutex_);
+  SSL_SESSION*& stored = context->sessions_[*key];
+  if (stored != nullptr) {
+    SSL_SESSION_free(stored);
+  }
+  // Returning 1 keeps the reference OpenSSL passed in.
+  stored = session;
+  return 1;
+}
+
+std::string TlsContext::SessionKey(const SocketAddress& address,
+                                   const std::string& server_name) {
+  return address.ToString() + "#" + server_name;
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,66 @@
+#ifndef DNS_MANAGER_TLS_CONTEXT_H_
+#define DNS_MANAGER_TLS_CONTEXT_H_
+
+#include <openssl/ssl.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "socket_address.h"
+
+namespace dns_manager {
+
+// Client-side TLS settings shared by every DNS-over-TLS connection of a
+// resolver: the trust store, and the last session each server handed out,
+// so that a new connection resumes it instead of running a full handshake.
+// Thread-safe.
+class TlsContext {
+ public:
+  ~TlsContext();
+
+  TlsContext(const TlsContext&) = delete;
+  TlsContext& operator=(const TlsContext&) = delete;
+
+  // Verifies servers against the CA certificates in the PEM file |ca_file|,
+  // or against the system's trust store if it is empty. Returns nullptr and
+  // sets |error| on failure.
+  static std::unique_ptr<TlsContext> Create(const std::string& ca_file,
+                                            std::string* error);
+
+  // A client connection on the connected socket |fd| to |address|, checking
+  // that the certificate is for |server_name| (sent as SNI), or for the
+  // address itself if the name is empty. Resumes the server's last session
+  // when there is one. The caller owns the result.
+  SSL* NewConnection(int fd, const SocketAddress& address,
+                     const std::string& server_name);
+
+  // Called by DnsStream when a handshake completes.
+  void RecordHandshake(SSL* ssl);
+
+  // Handshakes completed, and how many of them resumed a session.
+  uint64_t handshakes() const { return handshakes_.load(); }
+  uint64_t resumed_handshakes() const { return resumed_handshakes_.load(); }
+
+ private:
+  explicit TlsContext(SSL_CTX* ctx);
+
+  static int StoreSession(SSL* ssl, SSL_SESSION* session);
+  static std::string SessionKey(const SocketAddress& address,
+                                const std::string& server_name);
+
+  SSL_CTX* const ctx_;
+  std::atomic<uint64_t> handshakes_{0};
+  std::atomic<uint64_t> resumed_handshakes_{0};
+
+  std::mutex sessions_mutex_;
+  // Owns one reference to each session.
+  std::unordered_map<std::string, SSL_SESSION*> sessions_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_TLS_CONTEXT_H_
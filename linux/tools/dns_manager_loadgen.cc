@@ -0,0 +1,706 @@
+// Load generator for DNS resolvers, in the spirit of dnsperf.
+//
+// Replays a list of query names against a resolver over UDP or TCP from
+// several sender threads, each with its own sockets, and reports achieved
+// queries per second, lost queries and a latency histogram with
+// percentiles, as text or as JSON for comparing runs.
+//
+// Three ways to drive the load:
+//   -Q <qps>     open loop at a target rate, spread evenly over the threads;
+//   (default)    closed loop: each socket keeps -w queries in flight and
+//                sends the next one as soon as an answer arrives;
+//   --flood      open loop as fast as the sockets take queries, answers or
+//                not; what the resolver cannot keep up with shows as loss.
+//
+// With --local the tool starts a LocalResolver on 127.0.0.1, forwarding to
+// an in-process stub upstream, and loads that, so a run needs no network.
+//
+// Usage: dns_manager_loadgen [-s server[:port]] [-d query_file] [-m udp|tcp]
+//            [-l seconds] [-T threads] [-c sockets_per_thread]
+//            [-w in_flight_per_socket] [-Q qps] [--flood] [-t timeout_ms]
+//            [--json] [--local]
+//
+// The query file holds one query per line: a name, optionally followed by a
+// type (A, AAAA, MX, ...; A by default), as dnsperf reads it. Lines starting
+// with '#' are skipped. Without a file, host0.example.com to
+// host9999.example.com are asked for.
+
+#include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dns_message.h"
+#include "dns_stream.h"
+#include "local_resolver.h"
+#include "socket_address.h"
+#include "test/stub_upstream.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Latency buckets grow by this factor from 1 us, which keeps every
+// percentile within 5% of the true value up to well past any timeout.
+constexpr double kBucketGrowth = 1.05;
+constexpr size_t kBuckets = 400;
+// Sockets are polled at least this often so that timeouts are noticed.
+constexpr int kPollIntervalMs = 10;
+
+struct Options {
+  dns_manager::SocketAddress server;
+  std::string query_file;
+  bool tcp = false;
+  double seconds = 10;
+  size_t threads = 1;
+  size_t sockets = 4;
+  size_t window = 16;
+  double qps = 0;
+  bool flood = false;
+  int timeout_ms = 2000;
+  bool json = false;
+  bool local = false;
+};
+
+struct Query {
+  std::vector<uint8_t> wire;
+};
+
+// Latencies in buckets of geometrically growing width.
+class Histogram {
+ public:
+  Histogram() : counts_(kBuckets, 0) {}
+
+  void Add(double micros) {
+    size_t bucket = 0;
+    if (micros > 1) {
+      bucket = static_cast<size_t>(std::log(micros) / std::log(kBucketGrowth));
+    }
+    counts_[std::min(bucket, kBuckets - 1)]++;
+    total_++;
+    sum_ += micros;
+    max_ = std::max(max_, micros);
+  }
+
+  void Merge(const Histogram& other) {
+    for (size_t i = 0; i < kBuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+    sum_ += other.sum_;
+    max_ = std::max(max_, other.max_);
+  }
+
+  // Upper bound of the bucket holding the |fraction| quantile.
+  double Percentile(double fraction) const {
+    uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * total_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= rank && seen > 0) {
+        return std::min(UpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  static double UpperBound(size_t bucket) {
+    return std::pow(kBucketGrowth, bucket + 1);
+  }
+
+  uint64_t count(size_t bucket) const { return counts_[bucket]; }
+  uint64_t total() const { return total_; }
+  double mean() const { return total_ > 0 ? sum_ / total_ : 0; }
+  double max() const { return max_; }
+
+ private:
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  double sum_ = 0;
+  double max_ = 0;
+};
+
+struct Results {
+  uint64_t sent = 0;
+  uint64_t answered = 0;
+  uint64_t lost = 0;
+  // Answers by RCODE; the last slot counts anything above 15.
+  uint64_t rcodes[17] = {};
+  Histogram latency;
+
+  void Merge(const Results& other) {
+    sent += other.sent;
+    answered += other.answered;
+    lost += other.lost;
+    for (size_t i = 0; i < 17; i++) {
+      rcodes[i] += other.rcodes[i];
+    }
+    latency.Merge(other.latency);
+  }
+};
+
+uint16_t TypeCode(const std::string& type) {
+  static const struct {
+    const char* name;
+    uint16_t code;
+  } kTypes[] = {{"A", 1},     {"NS", 2},     {"CNAME", 5}, {"SOA", 6},
+                {"PTR", 12},  {"MX", 15},    {"TXT", 16},  {"AAAA", 28},
+                {"SRV", 33},  {"DS", 43},    {"DNSKEY", 48},
+                {"SVCB", 64}, {"HTTPS", 65}, {"ANY", 255}};
+  for (const auto& known : kTypes) {
+    if (strcasecmp(type.c_str(), known.name) == 0) {
+      return known.code;
+    }
+  }
+  if (strncasecmp(type.c_str(), "TYPE", 4) == 0) {
+    return static_cast<uint16_t>(atoi(type.c_str() + 4));
+  }
+  return 0;
+}
+
+bool AddQuery(const std::string& name, uint16_t qtype,
+              std::vector<Query>* queries) {
+  dns_manager::DnsQuestion question;
+  question.name = name;
+  question.qtype = qtype;
+  question.qclass = 1;
+  Query query;
+  query.wire.resize(512);
+  size_t length = dns_manager::BuildQuery(question, 0, query.wire.data(),
+                                          query.wire.size());
+  if (length == 0) {
+    return false;
+  }
+  query.wire.resize(length);
+  queries->push_back(std::move(query));
+  return true;
+}
+
+bool LoadQueries(const std::string& path, std::vector<Query>* queries) {
+  if (path.empty()) {
+    for (int i = 0; i < 10000; i++) {
+      AddQuery("host" + std::to_string(i) + ".example.com", 1, queries);
+    }
+    return true;
+  }
+  std::ifstream file(path);
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return false;
+  }
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(file, line)) {
+    line_number++;
+    std::istringstream fields(line);
+    std::string name;
+    std::string type = "A";
+    if (!(fields >> name) || name[0] == '#') {
+      continue;
+    }
+    fields >> type;
+    uint16_t qtype = TypeCode(type);
+    if (qtype == 0 || !AddQuery(name, qtype, queries)) {
+      fprintf(stderr, "%s:%zu: cannot parse '%s'\n", path.c_str(),
+              line_number, line.c_str());
+      return false;
+    }
+  }
+  if (queries->empty()) {
+    fprintf(stderr, "%s holds no queries\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// One socket's queries in flight. IDs are handed out in order, so the
+// oldest query in flight is always at the front of |order|.
+class Connection {
+ public:
+  Connection(const Options& options, Results* results)
+      : options_(options), results_(results), sent_at_(65536) {
+    if (options.tcp) {
+      stream_ = dns_manager::DnsStream::Connect(options.server);
+      fd_ = stream_ ? stream_->fd() : -1;
+    } else {
+      fd_ = socket(options.server.family(),
+                   SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (fd_ >= 0 && connect(fd_, options.server.sockaddr_ptr(),
+                              options.server.length) != 0) {
+        close(fd_);
+        fd_ = -1;
+      }
+    }
+  }
+
+  ~Connection() {
+    if (!stream_ && fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool ok() const { return fd_ >= 0; }
+  int fd() const { return fd_; }
+  size_t in_flight() const { return order_.size(); }
+  bool wants_write() const { return stream_ && stream_->wants_write(); }
+
+  // Returns false if the socket did not take the query.
+  bool Send(const Query& query, Clock::time_point now) {
+    // An ID still in flight from 65536 queries ago has long timed out.
+    if (order_.size() >= 65535) {
+      return false;
+    }
+    uint16_t id = next_id_;
+    scratch_.assign(query.wire.begin(), query.wire.end());
+    dns_manager::SetMessageId(scratch_.data(), id);
+    bool sent = stream_ ? stream_->Send(scratch_.data(), scratch_.size())
+                        : send(fd_, scratch_.data(), scratch_.size(), 0) ==
+                              static_cast<ssize_t>(scratch_.size());
+    if (!sent) {
+      return false;
+    }
+    next_id_++;
+    sent_at_[id] = now;
+    order_.push_back(id);
+    results_->sent++;
+    return true;
+  }
+
+  // Reads every answer waiting; returns false if the TCP connection broke.
+  bool Receive(Clock::time_point now) {
+    if (stream_) {
+      return stream_->Read([&](const uint8_t* message, size_t length) {
+        Answer(message, length, now);
+      });
+    }
+    uint8_t buffer[dns_manager::kMaxUdpMessageSize];
+    while (true) {
+      ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+      if (received < 0) {
+        return true;
+      }
+      Answer(buffer, static_cast<size_t>(received), now);
+    }
+  }
+
+  bool Flush() { return !stream_ || stream_->Flush(); }
+
+  // Counts queries older than the timeout as lost.
+  void Expire(Clock::time_point now) {
+    Clock::time_point limit =
+        now - std::chrono::milliseconds(options_.timeout_ms);
+    while (!order_.empty()) {
+      uint16_t id = order_.front();
+      if (sent_at_[id] == Clock::time_point()) {
+        order_.pop_front();
+      } else if (sent_at_[id] <= limit) {
+        sent_at_[id] = Clock::time_point();
+        order_.pop_front();
+        results_->lost++;
+      } else {
+        break;
+      }
+    }
+  }
+
+ private:
+  void Answer(const uint8_t* message, size_t length, Clock::time_point now) {
+    if (length < dns_manager::kDnsHeaderSize) {
+      return;
+    }
+    uint16_t id = dns_manager::GetMessageId(message);
+    if (sent_at_[id] == Clock::time_point()) {
+      // Late, after it was counted as lost, or not ours.
+      return;
+    }
+    results_->latency.Add(
+        std::chrono::duration<double, std::micro>(now - sent_at_[id])
+            .count());
+    sent_at_[id] = Clock::time_point();
+    results_->answered++;
+    results_->rcodes[std::min<size_t>(dns_manager::GetRcode(message), 16)]++;
+    while (!order_.empty() && sent_at_[order_.front()] == Clock::time_point()) {
+      order_.pop_front();
+    }
+  }
+
+  const Options& options_;
+  Results* results_;
+  int fd_ = -1;
+  std::unique_ptr<dns_manager::DnsStream> stream_;
+  uint16_t next_id_ = 0;
+  // Send time by ID; the epoch marks IDs not in flight.
+  std::vector<Clock::time_point> sent_at_;
+  std::deque<uint16_t> order_;
+  std::vector<uint8_t> scratch_;
+};
+
+// A sender thread: drives its connections until |deadline|, then waits up
+// to the timeout for the answers still in flight.
+void RunSender(const Options& options, const std::vector<Query>& queries,
+               size_t first_query, Clock::time_point deadline,
+               Results* results) {
+  std::vector<std::unique_ptr<Connection>> connections;
+  for (size_t i = 0; i < options.sockets; i++) {
+    connections.emplace_back(new Connection(options, results));
+    if (!connections.back()->ok()) {
+      fprintf(stderr, "cannot open a socket to %s\n",
+              options.server.ToString().c_str());
+      return;
+    }
+  }
+  size_t next_query = first_query;
+  size_t next_connection = 0;
+  auto send_one = [&](Connection* connection, Clock::time_point now) {
+    if (connection->Send(queries[next_query % queries.size()], now)) {
+      next_query++;
+      return true;
+    }
+    return false;
+  };
+
+  Clock::time_point start = Clock::now();
+  double rate = options.qps / options.threads;
+  std::vector<pollfd> fds(connections.size());
+  Clock::time_point drain_until =
+      deadline + std::chrono::milliseconds(options.timeout_ms);
+  while (true) {
+    Clock::time_point now = Clock::now();
+    bool sending = now < deadline;
+    size_t in_flight = 0;
+    for (const auto& connection : connections) {
+      in_flight += connection->in_flight();
+    }
+    if (!sending && (in_flight == 0 || now >= drain_until)) {
+      break;
+    }
+
+    int timeout_ms = kPollIntervalMs;
+    if (sending && rate > 0) {
+      // Paced: catch up with the schedule, round-robin over the sockets.
+      double elapsed = std::chrono::duration<double>(now - start).count();
+      uint64_t due = static_cast<uint64_t>(elapsed * rate) + 1;
+      while (results->sent < due) {
+        if (!send_one(connections[next_connection].get(), now)) {
+          break;
+        }
+        next_connection = (next_connection + 1) % connections.size();
+      }
+      double next_send = (results->sent) / rate - elapsed;
+      timeout_ms = std::min(timeout_ms,
+                            std::max(0, static_cast<int>(next_send * 1000)));
+    } else if (sending && options.flood) {
+      for (const auto& connection : connections) {
+        for (size_t i = 0; i < options.window; i++) {
+          if (!send_one(connection.get(), now)) {
+            break;
+          }
+        }
+      }
+      timeout_ms = 0;
+    } else if (sending) {
+      for (const auto& connection : connections) {
+        while (connection->in_flight() < options.window &&
+               send_one(connection.get(), now)) {
+        }
+      }
+    }
+
+    for (size_t i = 0; i < connections.size(); i++) {
+      fds[i] = {connections[i]->fd(),
+                static_cast<short>(POLLIN | (connections[i]->wants_write()
+                                                 ? POLLOUT
+                                                 : 0)),
+                0};
+    }
+    poll(fds.data(), fds.size(), timeout_ms);
+    now = Clock::now();
+    for (size_t i = 0; i < connections.size(); i++) {
+      Connection* connection = connections[i].get();
+      bool open = true;
+      if (fds[i].revents & POLLOUT) {
+        open = connection->Flush();
+      }
+      if (open && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        open = connection->Receive(now);
+      }
+      if (!open) {
+        fprintf(stderr, "connection to %s closed\n",
+                options.server.ToString().c_str());
+        return;
+      }
+      connection->Expire(now);
+    }
+  }
+  // Whatever is still unanswered after the drain counts as lost.
+  for (const auto& connection : connections) {
+    connection->Expire(Clock::time_point::max());
+  }
+}
+
+void PrintText(const Options& options, const Results& results,
+               double elapsed) {
+  printf("Server:            %s over %s\n",
+         options.server.ToString().c_str(), options.tcp ? "TCP" : "UDP");
+  printf("Mode:              ");
+  if (options.qps > 0) {
+    printf("open loop at %.0f qps\n", options.qps);
+  } else if (options.flood) {
+    printf("flood, %zu per socket per round\n", options.window);
+  } else {
+    printf("closed loop, %zu in flight per socket\n", options.window);
+  }
+  printf("Senders:           %zu threads x %zu sockets\n", options.threads,
+         options.sockets);
+  printf("Duration:          %.2f s\n", elapsed);
+  printf("Queries sent:      %llu\n",
+         static_cast<unsigned long long>(results.sent));
+  printf("Queries answered:  %llu (%.2f%%)\n",
+         static_cast<unsigned long long>(results.answered),
+         results.sent > 0 ? 100.0 * results.answered / results.sent : 0.0);
+  printf("Queries lost:      %llu (%.2f%%)\n",
+         static_cast<unsigned long long>(results.lost),
+         results.sent > 0 ? 100.0 * results.lost / results.sent : 0.0);
+  printf("Achieved QPS:      %.0f\n", results.answered / elapsed);
+  printf("Response codes:   ");
+  for (size_t i = 0; i < 17; i++) {
+    if (results.rcodes[i] > 0) {
+      printf(" %s%zu=%llu", i == 16 ? ">" : "", i == 16 ? 15 : i,
+             static_cast<unsigned long long>(results.rcodes[i]));
+    }
+  }
+  printf("\n");
+  const Histogram& latency = results.latency;
+  printf("Latency (us):      mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, "
+         "p99.9 %.1f, max %.1f\n",
+         latency.mean(), latency.Percentile(0.5), latency.Percentile(0.9),
+         latency.Percentile(0.99), latency.Percentile(0.999), latency.max());
+
+  // Powers of two are easier to read than the fine buckets.
+  printf("Histogram:\n");
+  uint64_t range_count = 0;
+  double range_start = 0;
+  double range_end = 2;
+  for (size_t i = 0; i < kBuckets; i++) {
+    double upper = Histogram::UpperBound(i);
+    if (upper > range_end) {
+      if (range_count > 0) {
+        printf("  %8.0f - %8.0f us  %10llu  %6.2f%%\n", range_start,
+               range_end, static_cast<unsigned long long>(range_count),
+               100.0 * range_count / latency.total());
+      }
+      range_start = range_end;
+      while (range_end < upper) {
+        range_end *= 2;
+      }
+      range_count = 0;
+    }
+    range_count += latency.count(i);
+  }
+  if (range_count > 0) {
+    printf("  %8.0f +           us  %10llu  %6.2f%%\n", range_start,
+           static_cast<unsigned long long>(range_count),
+           100.0 * range_count / latency.total());
+  }
+}
+
+void PrintJson(const Options& options, const Results& results,
+               double elapsed) {
+  const Histogram& latency = results.latency;
+  printf("{\n");
+  printf("  \"server\": \"%s\",\n", options.server.ToString().c_str());
+  printf("  \"transport\": \"%s\",\n", options.tcp ? "tcp" : "udp");
+  printf("  \"mode\": \"%s\",\n",
+         options.qps > 0 ? "rate" : options.flood ? "flood" : "closed");
+  printf("  \"target_qps\": %.0f,\n", options.qps);
+  printf("  \"threads\": %zu,\n", options.threads);
+  printf("  \"sockets_per_thread\": %zu,\n", options.sockets);
+  printf("  \"window\": %zu,\n", options.window);
+  printf("  \"duration_seconds\": %.3f,\n", elapsed);
+  printf("  \"sent\": %llu,\n", static_cast<unsigned long long>(results.sent));
+  printf("  \"answered\": %llu,\n",
+         static_cast<unsigned long long>(results.answered));
+  printf("  \"lost\": %llu,\n", static_cast<unsigned long long>(results.lost));
+  printf("  \"qps\": %.1f,\n", results.answered / elapsed);
+  printf("  \"rcodes\": {");
+  const char* separator = "";
+  for (size_t i = 0; i < 17; i++) {
+    if (results.rcodes[i] > 0) {
+      printf("%s\"%s%zu\": %llu", separator, i == 16 ? ">" : "",
+             i == 16 ? 15 : i,
+             static_cast<unsigned long long>(results.rcodes[i]));
+      separator = ", ";
+    }
+  }
+  printf("},\n");
+  printf("  \"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+         "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f},\n",
+         latency.mean(), latency.Percentile(0.5), latency.Percentile(0.9),
+         latency.Percentile(0.99), latency.Percentile(0.999), latency.max());
+  // Non-empty buckets as [upper bound in us, count].
+  printf("  \"histogram\": [");
+  separator = "";
+  for (size_t i = 0; i < kBuckets; i++) {
+    if (latency.count(i) > 0) {
+      printf("%s[%.1f, %llu]", separator, Histogram::UpperBound(i),
+             static_cast<unsigned long long>(latency.count(i)));
+      separator = ", ";
+    }
+  }
+  printf("]\n");
+  printf("}\n");
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-s server[:port]] [-d query_file] [-m udp|tcp]\n"
+          "           [-l seconds] [-T threads] [-c sockets_per_thread]\n"
+          "           [-w in_flight_per_socket] [-Q qps] [--flood]\n"
+          "           [-t timeout_ms] [--json] [--local]\n",
+          program);
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  static const option kLongOptions[] = {
+      {"flood", no_argument, nullptr, 'F'},
+      {"json", no_argument, nullptr, 'J'},
+      {"local", no_argument, nullptr, 'L'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}};
+  std::string server = "127.0.0.1";
+  int option;
+  while ((option = getopt_long(argc, argv, "s:d:m:l:T:c:w:Q:t:h",
+                               kLongOptions, nullptr)) != -1) {
+    switch (option) {
+      case 's':
+        server = optarg;
+        break;
+      case 'd':
+        options->query_file = optarg;
+        break;
+      case 'm':
+        if (strcmp(optarg, "tcp") != 0 && strcmp(optarg, "udp") != 0) {
+          fprintf(stderr, "-m takes udp or tcp\n");
+          return false;
+        }
+        options->tcp = strcmp(optarg, "tcp") == 0;
+        break;
+      case 'l':
+        options->seconds = atof(optarg);
+        break;
+      case 'T':
+        options->threads = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'c':
+        options->sockets = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'w':
+        options->window = static_cast<size_t>(atoi(optarg));
+        break;
+      case 'Q':
+        options->qps = atof(optarg);
+        break;
+      case 't':
+        options->timeout_ms = atoi(optarg);
+        break;
+      case 'F':
+        options->flood = true;
+        break;
+      case 'J':
+        options->json = true;
+        break;
+      case 'L':
+        options->local = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  if (optind != argc || options->seconds <= 0 || options->threads == 0 ||
+      options->sockets == 0 || options->window == 0 ||
+      options->timeout_ms <= 0 || options->qps < 0) {
+    return false;
+  }
+  if (!options->local &&
+      !dns_manager::SocketAddress::Parse(server, 53, &options->server)) {
+    fprintf(stderr, "invalid server address %s\n", server.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage(argv[0]);
+    return 2;
+  }
+  std::vector<Query> queries;
+  if (!LoadQueries(options.query_file, &queries)) {
+    return 1;
+  }
+
+  std::unique_ptr<dns_manager::test::StubUpstream> upstream;
+  std::unique_ptr<dns_manager::LocalResolver> resolver;
+  if (options.local) {
+    upstream.reset(new dns_manager::test::StubUpstream(3600));
+    dns_manager::ResolverConfig config;
+    config.listen_port = 0;
+    config.upstreams.push_back(upstream->address());
+    resolver.reset(new dns_manager::LocalResolver(config));
+    std::string error;
+    if (!resolver->Start(&error)) {
+      fprintf(stderr, "cannot start the local resolver: %s\n",
+              error.c_str());
+      return 1;
+    }
+    options.server = resolver->bound_address();
+  }
+
+  std::vector<Results> results(options.threads);
+  std::vector<std::thread> senders;
+  Clock::time_point start = Clock::now();
+  Clock::time_point deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(options.seconds));
+  for (size_t i = 0; i < options.threads; i++) {
+    senders.emplace_back(RunSender, std::cref(options), std::cref(queries),
+                         i * queries.size() / options.threads, deadline,
+                         &results[i]);
+  }
+  for (std::thread& sender : senders) {
+    sender.join();
+  }
+  // Rates are over the sending period; the drain only collects stragglers.
+  double elapsed = std::chrono::duration<double>(
+                       std::min(Clock::now(), deadline) - start)
+                       .count();
+
+  Results total;
+  for (const Results& result : results) {
+    total.Merge(result);
+  }
+  if (options.json) {
+    PrintJson(options, total, elapsed);
+  } else {
+    PrintText(options, total, elapsed);
+  }
+  return total.sent > 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+#include "top_domains.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "hash.h"
+
+namespace dns_manager {
+
+namespace {
+
+// Renormalise once weights exceed 2^kMaxExponent so doubles never overflow.
+constexpr double kMaxExponent = 512;
+
+size_t IndexSizeFor(size_t capacity) {
+  size_t size = 16;
+  while (size < capacity * 2) {
+    size <<= 1;
+  }
+  return size;
+}
+
+}  // namespace
+
+TopDomainsSketch::TopDomainsSketch(size_t capacity, double half_life_seconds)
+    : capacity_(std::max<size_t>(capacity, 1)),
+      half_life_seconds_(half_life_seconds > 0 ? half_life_seconds : 0),
+      counters_(capacity_),
+      heap_(capacity_),
+      heap_position_(capacity_),
+      index_(IndexSizeFor(capacity_), kEmptySlot),
+      index_mask_(IndexSizeFor(capacity_) - 1) {}
+
+size_t TopDomainsSketch::memory_bytes() const {
+  return sizeof(*this) + counters_.capacity() * sizeof(Counter) +
+         heap_.capacity() * sizeof(uint32_t) +
+         heap_position_.capacity() * sizeof(uint32_t) +
+         index_.capacity() * sizeof(uint32_t);
+}
+
+void TopDomainsSketch::Add(const char* name, size_t length,
+                           double now_seconds) {
+  if (length > kMaxDnsNameLength) {
+    return;
+  }
+  double weight = WeightAt(now_seconds);
+  uint64_t hash = HashBytes(name, length);
+
+  uint32_t slot = FindSlot(hash, name, length);
+  if (index_[slot] != kEmptySlot) {
+    uint32_t counter = index_[slot];
+    counters_[counter].weight += weight;
+    SiftDown(heap_position_[counter]);
+    return;
+  }
+
+  uint32_t counter;
+  double base = 0;
+  bool appended = size_ < capacity_;
+  if (appended) {
+    counter = static_cast<uint32_t>(size_);
+    heap_[size_] = counter;
+    heap_position_[counter] = static_cast<uint32_t>(size_);
+    size_++;
+  } else {
+    // Replace the minimum counter; the newcomer inherits its weight as the
+    // over-estimation error.
+    counter = heap_[0];
+    base = counters_[counter].weight;
+    EraseIndex(counter);
+  }
+
+  Counter& entry = counters_[counter];
+  entry.weight = base + weight;
+  entry.error = base;
+  entry.hash = hash;
+  entry.length = static_cast<uint8_t>(length);
+  memcpy(entry.name, name, length);
+  InsertIndex(counter);
+  if (appended) {
+    SiftUp(heap_position_[counter]);
+  } else {
+    SiftDown(heap_position_[counter]);
+  }
+}
+
+std::vector<DomainCount> TopDomainsSketch::Top(size_t count,
+                                               double now_seconds) const {
+  std::vector<uint32_t> order(heap_.begin(), heap_.begin() + size_);
+  count = std::min(count, order.size());
+  std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                    [this](uint32_t a, uint32_t b) {
+                      return counters_[a].weight > counters_[b].weight;
+                    });
+
+  double factor = DecayFactor(now_seconds);
+  std::vector<DomainCount> result;
+  result.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    const Counter& entry = counters_[order[i]];
+    DomainCount domain;
+    domain.name.assign(entry.name, entry.length);
+    domain.count = entry.weight * factor;
+    domain.error = entry.error * factor;
+    result.push_back(std::move(domain));
+  }
+  return result;
+}
+
+double TopDomainsSketch::WeightAt(double now_seconds) {
+  if (half_life_seconds_ == 0) {
+    return 1;
+  }
+  now_seconds = std::floor(now_seconds);
+  if (!has_landmark_) {
+    landmark_seconds_ = now_seconds;
+    has_landmark_ = true;
+  }
+  double exponent = (now_seconds - landmark_seconds_) / half_life_seconds_;
+  if (exponent > kMaxExponent) {
+    Renormalise(now_seconds);
+    exponent = 0;
+  }
+  return std::exp2(std::max(exponent, 0.0));
+}
+
+double TopDomainsSketch::DecayFactor(double now_seconds) const {
+  if (half_life_seconds_ == 0 || !has_landmark_) {
+    return 1;
+  }
+  double exponent =
+      (std::floor(now_seconds) - landmark_seconds_) / half_life_seconds_;
+  return std::exp2(-std::max(exponent, 0.0));
+}
+
+void TopDomainsSketch::Renormalise(double now_seconds) {
+  // Scaling every weight by the same factor keeps the heap order intact.
+  double factor = DecayFactor(now_seconds);
+  for (size_t i = 0; i < size_; i++) {
+    counters_[i].weight *= factor;
+    counters_[i].error *= factor;
+  }
+  landmark_seconds_ = std::floor(now_seconds);
+}
+
+uint32_t TopDomainsSketch::FindSlot(uint64_t hash, const char* name,
+                                    size_t length) const {
+  size_t slot = hash & index_mask_;
+  while (index_[slot] != kEmptySlot) {
+    const Counter& entry = counters_[index_[slot]];
+    if (entry.hash == hash && entry.length == length &&
+        memcmp(entry.name, name, length) == 0) {
+      break;
+    }
+    slot = (slot + 1) & index_mask_;
+  }
+  return static_cast<uint32_t>(slot);
+}
+
+void TopDomainsSketch::InsertIndex(uint32_t counter) {
+  size_t slot = counters_[counter].hash & index_mask_;
+  while (index_[slot] != kEmptySlot) {
+    slot = (slot + 1) & index_mask_;
+  }
+  index_[slot] = counter;
+}
+
+void TopDomainsSketch::EraseIndex(uint32_t counter) {
+  size_t slot = counters_[counter].hash & index_mask_;
+  while (index_[slot] != counter) {
+    slot = (slot + 1) & index_mask_;
+  }
+  // Backward-shift deletion keeps probe sequences intact without tombstones.
+  size_t hole = slot;
+  size_t next = (hole + 1) & index_mask_;
+  while (index_[next] != kEmptySlot) {
+    size_t home = counters_[index_[next]].hash & index_mask_;
+    if (((next - home) & index_mask_) >= ((next - hole) & index_mask_)) {
+      index_[hole] = index_[next];
+      hole = next;
+    }
+    next = (next + 1) & index_mask_;
+  }
+  index_[hole] = kEmptySlot;
+}
+
+void TopDomainsSketch::SiftDown(size_t position) {
+  while (true) {
+    size_t smallest = position;
+    size_t left = position * 2 + 1;
+    size_t right = left + 1;
+    if (left < size_ &&
+        counters_[heap_[left]].weight < counters_[heap_[smallest]].weight) {
+      smallest = left;
+    }
+    if (right < size_ &&
+        counters_[heap_[right]].weight < counters_[heap_[smallest]].weight) {
+      smallest = right;
+    }
+    if (smallest == position) {
+      return;
+    }
+    SwapHeap(position, smallest);
+    position = smallest;
+  }
+}
+
+void TopDomainsSketch::SiftUp(size_t position) {
+  while (position > 0) {
+    size_t parent = (position - 1) / 2;
+    if (counters_[heap_[parent]].weight <= counters_[heap_[position]].weight) {
+      return;
+    }
+    SwapHeap(position, parent);
+    position = parent;
+  }
+}
+
+void TopDomainsSketch::SwapHeap(size_t a, size_t b) {
+  std::swap(heap_[a], heap_[b]);
+  heap_position_[heap_[a]] = static_cast<uint32_t>(a);
+  heap_position_[heap_[b]] = static_cast<uint32_t>(b);
+}
+
+}  // namespace dns_manager
@@ -0,0 +1,95 @@
+#ifndef DNS_MANAGER_TOP_DOMAINS_H_
+#define DNS_MANAGER_TOP_DOMAINS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dns_message.h"
+
+namespace dns_manager {
+
+struct DomainCount {
+  std::string name;
+  // Decayed query count. Space-Saving never under-counts, so the true count
+  // lies in [count - error, count].
+  double count = 0;
+  double error = 0;
+};
+
+// Heavy-hitters sketch over queried names using the Space-Saving algorithm
+// (Metwally et al.) with exponential time decay.
+//
+// All storage is allocated in the constructor: |capacity| counters, a
+// min-heap over them and an open-addressing index, so memory is fixed no
+// matter how many queries or distinct names are seen. Add() is O(1) expected
+// for the index probe plus O(log capacity) for the heap update.
+//
+// Decay uses forward decay: an event at time t is weighted by
+// 2^((t - landmark) / half_life), which keeps the relative order of counters
+// without touching every counter each second. Timestamps are truncated to
+// whole seconds, and weights are renormalised once they grow large.
+//
+// Not thread-safe; callers serialise access.
+class TopDomainsSketch {
+ public:
+  TopDomainsSketch(size_t capacity, double half_life_seconds);
+
+  TopDomainsSketch(const TopDomainsSketch&) = delete;
+  TopDomainsSketch& operator=(const TopDomainsSketch&) = delete;
+
+  // Records one query for |name| (at most kMaxDnsNameLength bytes) at
+  // |now_seconds| on any monotonic clock.
+  void Add(const char* name, size_t length, double now_seconds);
+
+  // Returns up to |count| names ordered by decayed count, as of |now_seconds|.
+  std::vector<DomainCount> Top(size_t count, double now_seconds) const;
+
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return size_; }
+  // Bytes held by the sketch; constant for a given capacity.
+  size_t memory_bytes() const;
+
+ private:
+  struct Counter {
+    double weight;
+    double error;
+    uint64_t hash;
+    uint8_t length;
+    char name[kMaxDnsNameLength];
+  };
+
+  static constexpr uint32_t kEmptySlot = UINT32_MAX;
+
+  double WeightAt(double now_seconds);
+  double DecayFactor(double now_seconds) const;
+  void Renormalise(double now_seconds);
+
+  uint32_t FindSlot(uint64_t hash, const char* name, size_t length) const;
+  void InsertIndex(uint32_t counter);
+  void EraseIndex(uint32_t counter);
+
+  void SiftDown(size_t heap_position);
+  void SiftUp(size_t heap_position);
+  void SwapHeap(size_t a, size_t b);
+
+  const size_t capacity_;
+  const double half_life_seconds_;
+  size_t size_ = 0;
+  double landmark_seconds_ = 0;
+  bool has_landmark_ = false;
+
+  std::vector<Counter> counters_;
+  // Min-heap of counter indices ordered by weight; heap_position_ is the
+  // inverse mapping.
+  std::vector<uint32_t> heap_;
+  std::vector<uint32_t> heap_position_;
+  // Linear-probing index from name hash to counter; size is a power of two.
+  std::vector<uint32_t> index_;
+  size_t index_mask_ = 0;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_TOP_DOMAINS_H_
@@ -0,0 +1,144 @@
+#include "upstream_health.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace dns_manager {
+
+UpstreamHealth::UpstreamHealth(int initial_timeout_ms, int min_timeout_ms,
+                               int max_timeout_ms, bool adaptive)
+    : initial_timeout_us_(initial_timeout_ms * 1000.0),
+      min_timeout_us_(min_timeout_ms * 1000.0),
+      max_timeout_us_(std::max(max_timeout_ms, min_timeout_ms) * 1000.0),
+      adaptive_(adaptive) {}
+
+size_t UpstreamHealth::IndexOf(const SocketAddress& address) {
+  for (size_t i = 0; i < servers_.size(); i++) {
+    if (servers_[i].address == address) {
+      return i;
+    }
+  }
+  Server server;
+  server.address = address;
+  server.timeout_us = initial_timeout_us_;
+  servers_.push_back(server);
+  return servers_.size() - 1;
+}
+
+size_t UpstreamHealth::Choose(const std::vector<SocketAddress>& upstreams,
+                              uint64_t tried, Clock::time_point now,
+                              int* timeout_ms) {
+  size_t limit = std::min(upstreams.size(), kMaxTried);
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t best = upstreams.size();
+  size_t best_server = 0;
+  // Lower is better: a probe due first, then available servers by score,
+  // then held-down ones by when their hold-down ends.
+  int best_rank = 0;
+  double best_score = 0;
+  for (size_t i = 0; i < limit; i++) {
+    if ((tried >> i) & 1) {
+      continue;
+    }
+    size_t index = IndexOf(upstreams[i]);
+    const Server& server = servers_[index];
+    int rank;
+    double score;
+    if (!adaptive_) {
+      rank = 1;
+      score = 0;
+    } else if (HeldDown(server, now)) {
+      rank = 2;
+      score = std::chrono::duration<double>(server.retry_at - now).count();
+    } else if (server.consecutive_timeouts > 0) {
+      rank = 0;
+      score = 0;
+    } else {
+      // Unclamped, so that servers below the minimum timeout still rank by
+      // speed.
+      rank = 1;
+      score = server.srtt_us < 0 ? 0 : server.srtt_us + 4 * server.rttvar_us;
+    }
+    if (best == upstreams.size() || rank < best_rank ||
+        (rank == best_rank && score < best_score)) {
+      best = i;
+      best_server = index;
+      best_rank = rank;
+      best_score = score;
+    }
+  }
+  if (best == upstreams.size()) {
+    return best;
+  }
+  Server& server = servers_[best_server];
+  double timeout_us = adaptive_ ? server.timeout_us : initial_timeout_us_;
+  *timeout_ms = static_cast<int>(std::ceil(timeout_us / 1000));
+  if (adaptive_ && best_rank == 0) {
+    // One probe at a time: hold the server down again until the probe is
+    // answered or times out.
+    server.retry_at =
+        now + std::chrono::microseconds(static_cast<int64_t>(timeout_us));
+  }
+  return best;
+}
+
+void UpstreamHealth::RecordAnswer(const SocketAddress& upstream,
+                                  Clock::duration rtt) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Server& server = servers_[IndexOf(upstream)];
+  server.answers++;
+  server.consecutive_timeouts = 0;
+  double r = std::chrono::duration<double, std::micro>(rtt).count();
+  if (server.srtt_us < 0) {
+    server.srtt_us = r;
+    server.rttvar_us = r / 2;
+  } else {
+    server.rttvar_us =
+        0.75 * server.rttvar_us + 0.25 * std::fabs(server.srtt_us - r);
+    server.srtt_us = 0.875 * server.srtt_us + 0.125 * r;
+  }
+  server.timeout_us = std::min(
+      std::max(server.srtt_us + 4 * server.rttvar_us, min_timeout_us_),
+      max_timeout_us_);
+}
+
+void UpstreamHealth::RecordTimeout(const SocketAddress& upstream,
+                                   Clock::time_point now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Server& server = servers_[IndexOf(upstream)];
+  server.timeouts++;
+  // Queries sent before the server was held down time out in a burst; only
+  // the first of them, or a probe, backs off further.
+  if (HeldDown(server, now)) {
+    return;
+  }
+  server.consecutive_timeouts++;
+  server.timeout_us = std::min(server.timeout_us * 2, max_timeout_us_);
+  int shift = static_cast<int>(std::min<uint32_t>(
+      server.consecutive_timeouts - 1, 16));
+  int hold_down_ms = std::min(kMinHoldDownMs << shift, kMaxHoldDownMs);
+  server.retry_at = now + std::chrono::milliseconds(hold_down_ms);
+}
+
+std::vector<UpstreamScore> UpstreamHealth::Scores(
+    Clock::time_point now) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<UpstreamScore> scores;
+  scores.reserve(servers_.size());
+  for (const Server& server : servers_) {
+    UpstreamScore score;
+    score.address = server.address;
+    score.srtt_ms = std::max(server.srtt_us, 0.0) / 1000;
+    score.rttvar_ms = server.rttvar_us / 1000;
+    score.timeout_ms =
+        (adaptive_ ? server.timeout_us : initial_timeout_us_) / 1000;
+    score.answers = server.answers;
+    score.timeouts = server.timeouts;
+    score.consecutive_timeouts = server.consecutive_timeouts;
+    score.available = !HeldDown(server, now);
+    scores.push_back(score);
+  }
+  return scores;
+}
+
+}  // namespace dns_manager
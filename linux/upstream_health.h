@@ -0,0 +1,110 @@
+#ifndef DNS_MANAGER_UPSTREAM_HEALTH_H_
+#define DNS_MANAGER_UPSTREAM_HEALTH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "socket_address.h"
+
+namespace dns_manager {
+
+// What UpstreamHealth knows about one server.
+struct UpstreamScore {
+  SocketAddress address;
+  // Smoothed round-trip time and its mean deviation, 0 before the first
+  // answer.
+  double srtt_ms = 0;
+  double rttvar_ms = 0;
+  // How long the next query waits for it before moving on.
+  double timeout_ms = 0;
+  uint64_t answers = 0;
+  uint64_t timeouts = 0;
+  // Timeouts since it last answered.
+  uint32_t consecutive_timeouts = 0;
+  // False while it is held down after timing out; it is only tried when no
+  // other server is left, or once the hold-down ends.
+  bool available = true;
+};
+
+// Per-server round-trip estimates that decide which upstream a query goes to
+// first and how long to wait for it.
+//
+// Each server's timeout is computed the way TCP computes its retransmission
+// timeout (RFC 6298): a smoothed RTT plus four mean deviations, clamped to
+// [min_timeout, max_timeout]. A query goes to each server at most once, so
+// every answer is an unambiguous sample. A timeout doubles the server's
+// timeout and holds it down for a period that also doubles with every
+// further timeout; when the period ends one query probes it, and an answer
+// restores it. Queries go to the available server with the lowest estimate,
+// ties in list order, so a dead or slow first server costs one timeout
+// instead of one per query. Servers never heard from count as fastest, so
+// each gets measured once.
+// Shared by the resolver threads. Thread-safe.
+class UpstreamHealth {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Only the first kMaxTried servers of a list are tried for one query.
+  static constexpr size_t kMaxTried = 64;
+
+  // |initial_timeout_ms| applies to servers with no answer yet. With
+  // |adaptive| false servers are tried in list order, each with the initial
+  // timeout, as a baseline to compare against.
+  UpstreamHealth(int initial_timeout_ms, int min_timeout_ms,
+                 int max_timeout_ms, bool adaptive = true);
+
+  UpstreamHealth(const UpstreamHealth&) = delete;
+  UpstreamHealth& operator=(const UpstreamHealth&) = delete;
+
+  // Picks the server in |upstreams| to try next, skipping those whose bit is
+  // set in |tried|, and sets |timeout_ms| to how long to wait for it.
+  // Returns upstreams.size() if every server was tried.
+  size_t Choose(const std::vector<SocketAddress>& upstreams, uint64_t tried,
+                Clock::time_point now, int* timeout_ms);
+
+  // An answer from |upstream| |rtt| after the query was sent to it.
+  void RecordAnswer(const SocketAddress& upstream, Clock::duration rtt);
+  // |upstream| did not answer in time.
+  void RecordTimeout(const SocketAddress& upstream, Clock::time_point now);
+
+  // Every server chosen so far, in the order first seen.
+  std::vector<UpstreamScore> Scores(Clock::time_point now) const;
+
+ private:
+  // Hold-down after the first timeout, and its ceiling.
+  static constexpr int kMinHoldDownMs = 1000;
+  static constexpr int kMaxHoldDownMs = 60000;
+
+  struct Server {
+    SocketAddress address;
+    // In microseconds; srtt_us < 0 until the first sample.
+    double srtt_us = -1;
+    double rttvar_us = 0;
+    double timeout_us = 0;
+    uint64_t answers = 0;
+    uint64_t timeouts = 0;
+    uint32_t consecutive_timeouts = 0;
+    // While held down, when the next probe may go out.
+    Clock::time_point retry_at;
+  };
+
+  // Index of |address| in |servers_|, added if new.
+  size_t IndexOf(const SocketAddress& address);
+  bool HeldDown(const Server& server, Clock::time_point now) const {
+    return server.consecutive_timeouts > 0 && server.retry_at > now;
+  }
+
+  const double initial_timeout_us_;
+  const double min_timeout_us_;
+  const double max_timeout_us_;
+  const bool adaptive_;
+  mutable std::mutex mutex_;
+  // Few enough that a linear scan beats hashing addresses.
+  std::vector<Server> servers_;
+};
+
+}  // namespace dns_manager
+
+#endif  // DNS_MANAGER_UPSTREAM_HEALTH_H_
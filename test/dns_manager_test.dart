@@ -1,3 +1,5 @@
+import 'dart:typed_data';
+
 import 'package:flutter_test/flutter_test.dart';
 import 'package:dns_manager/dns_manager.dart';
 import 'package:dns_manager/dns_manager_platform_interface.dart';
@@ -11,10 +13,123 @@ class MockDnsManagerPlatform
   Future<String?> getDNS() => Future.value('42');
 
   @override
-  Future<String?> setDNS(String dns) => Future.value('42');
+  Future<String?> setDNS(String dns,
+          {LocalResolverOptions? localResolver, bool global = false}) =>
+      Future.value('42');
 
   @override
   Future<String?> resetDNS() => Future.value('42');
+
+  @override
+  Future<NetworkState> getNetworkState() => Future.value(const NetworkState(
+        state: 'connected',
+        connectivity: 'full',
+        globalDns: [],
+        devices: [],
+        connections: [],
+        generation: 1,
+        ownsSharedState: true,
+        commandsRun: 0,
+      ));
+
+  @override
+  Future<String?> definePreset(String name, String dns,
+          {bool global = false}) =>
+      Future.value('Preset defined: $name ($dns)');
+
+  @override
+  Future<PresetApplyResult> applyPreset(String name) =>
+      Future.value(PresetApplyResult(
+        preset: name,
+        result: 'Preset applied - Network reconnecting...',
+        changed: true,
+        backendCalls: 1,
+        lookup: const Duration(microseconds: 20),
+        compare: const Duration(microseconds: 5),
+        apply: const Duration(milliseconds: 40),
+        total: const Duration(microseconds: 40025),
+      ));
+
+  @override
+  Future<List<DnsPreset>> listPresets() => Future.value(const [
+        DnsPreset(name: 'public', servers: ['1.1.1.1'], global: false),
+      ]);
+
+  @override
+  Future<List<TopDomain>> getTopDomains({int count = 20}) =>
+      Future.value([const TopDomain(name: 'example.com', count: 42, error: 0)]);
+
+  @override
+  Future<ResolverStats> getResolverStats() => Future.value(const ResolverStats(
+        queries: 42,
+        cacheHits: 40,
+        cacheMisses: 2,
+        prefetchesIssued: 1,
+        prefetchHits: 1,
+        prefetchesWasted: 0,
+        negativeCacheHits: 0,
+        staleAnswersServed: 0,
+        warmCacheHits: 0,
+        sharedCacheHits: 0,
+        blockedQueries: 0,
+        hostOverrideQueries: 0,
+        tcpQueries: 0,
+        upstreamTcpQueries: 0,
+        upstreamTcpConnections: 0,
+        tlsHandshakes: 0,
+        tlsResumedHandshakes: 0,
+        rateLimitedQueries: 0,
+      ));
+
+  @override
+  Future<List<UpstreamHealth>> getUpstreamHealth() => Future.value(const [
+        UpstreamHealth(
+          address: '1.1.1.1:53',
+          srttMs: 12.5,
+          rttVarMs: 3,
+          timeoutMs: 100,
+          answers: 42,
+          timeouts: 1,
+          consecutiveTimeouts: 0,
+          available: true,
+        ),
+      ]);
+
+  @override
+  Stream<QueryEventBatch> queryEvents(
+          {Duration interval = const Duration(milliseconds: 100)}) =>
+      const Stream.empty();
+
+  @override
+  Future<List<QueryEvent>> queryLog(
+          {required DateTime from, required DateTime to, int limit = 10000}) =>
+      Future.value([
+        QueryEvent(
+          time: from,
+          name: 'example.com',
+          type: 1,
+          rcode: 0,
+          latency: const Duration(microseconds: 800),
+          source: QuerySource.cache,
+        ),
+      ]);
+
+  @override
+  Future<String?> loadBlocklist(List<String> sources) =>
+      Future.value('Blocklist loaded: ${sources.length} rules');
+
+  @override
+  Future<String?> applyBlocklistDelta(String path) =>
+      Future.value('Blocklist updated: 0 rules');
+
+  @override
+  Future<String?> setDnsRoutes(Map<String, String> routes) =>
+      Future.value('DNS routes set: ${routes.length}');
+
+  @override
+  Future<String?> setHostOverrides(
+          {Map<String, List<String>> hosts = const {}, String? file}) =>
+      Future.value('Host overrides set: ${hosts.length} names');
 }
 
 void main() {
@@ -31,4 +146,90 @@ void main() {
 
     expect(await dnsManagerPlugin.getDNS(), '42');
   });
+
+  test('QueryEventBatch.decode', () {
+    final bytes = ByteData(20 + 13 + 11);
+    bytes.setUint8(0, 1);
+    bytes.setUint32(4, 1, Endian.little);
+    bytes.setUint32(8, 2, Endian.little);
+    bytes.setInt64(12, 1700000000000000, Endian.little);
+    bytes.setUint32(20, 500, Endian.little);
+    bytes.setUint32(24, 1200, Endian.little);
+    bytes.setUint16(28, 28, Endian.little);
+    bytes.setUint8(30, 3);
+    bytes.setUint8(31, QuerySource.blocked.index);
+    bytes.setUint8(32, 11);
+    final name = bytes.buffer.asUint8List(33);
+    name.setAll(0, 'example.com'.codeUnits);
+
+    final batch = QueryEventBatch.decode(bytes.buffer.asUint8List());
+    expect(batch.dropped, 2);
+    final event = batch.events.single;
+    expect(event.name, 'example.com');
+    expect(event.type, 28);
+    expect(event.rcode, 3);
+    expect(event.source, QuerySource.blocked);
+    expect(event.latency, const Duration(microseconds: 1200));
+    expect(event.time.microsecondsSinceEpoch, 1700000000000500);
+  });
+
+  test('getTopDomains', () async {
+    DnsManager dnsManagerPlugin = DnsManager();
+    MockDnsManagerPlatform fakePlatform = MockDnsManagerPlatform();
+    DnsManagerPlatform.instance = fakePlatform;
+
+    final top = await dnsManagerPlugin.getTopDomains();
+    expect(top.single.name, 'example.com');
+    expect(top.single.count, 42);
+  });
+
+  test('applyPreset', () async {
+    DnsManager dnsManagerPlugin = DnsManager();
+    MockDnsManagerPlatform fakePlatform = MockDnsManagerPlatform();
+    DnsManagerPlatform.instance = fakePlatform;
+
+    final presets = await dnsManagerPlugin.listPresets();
+    expect(presets.single.name, 'public');
+    final applied = await dnsManagerPlugin.applyPreset('public');
+    expect(applied.preset, 'public');
+    expect(applied.backendCalls, 1);
+  });
+
+  test('PresetApplyResult.fromMap', () {
+    final result = PresetApplyResult.fromMap({
+      'preset': 'corporate',
+      'result': 'DNS unchanged - preset already applied',
+      'changed': false,
+      'backendCalls': 0,
+      'lookupUs': 12,
+      'compareUs': 3,
+      'applyUs': 0,
+      'totalUs': 15,
+    });
+    expect(result.changed, isFalse);
+    expect(result.lookup, const Duration(microseconds: 12));
+    expect(result.total, const Duration(microseconds: 15));
+  });
+
+  test('getUpstreamHealth', () async {
+    DnsManager dnsManagerPlugin = DnsManager();
+    MockDnsManagerPlatform fakePlatform = MockDnsManagerPlatform();
+    DnsManagerPlatform.instance = fakePlatform;
+
+    final servers = await dnsManagerPlugin.getUpstreamHealth();
+    expect(servers.single.address, '1.1.1.1:53');
+    expect(servers.single.available, isTrue);
+  });
+
+  test('queryLog', () async {
+    DnsManager dnsManagerPlugin = DnsManager();
+    MockDnsManagerPlatform fakePlatform = MockDnsManagerPlatform();
+    DnsManagerPlatform.instance = fakePlatform;
+
+    final from = DateTime.utc(2026, 1, 1, 10, 2);
+    final events = await dnsManagerPlugin.queryLog(
+        from: from, to: from.add(const Duration(minutes: 3)));
+    expect(events.single.name, 'example.com');
+    expect(events.single.time, from);
+  });
 }